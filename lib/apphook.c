@@ -34,6 +34,7 @@
 #include "timeutils.h"
 #include "logsource.h"
 #include "logwriter.h"
+#include "logproto.h"
 #include "afinter.h"
 #include "templates.h"
 
@@ -147,6 +148,7 @@ app_startup(void)
   stats_init();
   tzset();
   log_msg_global_init();
+  log_proto_global_init();
   log_tags_init();
   log_source_global_init();
   log_template_global_init();
@@ -177,6 +179,7 @@ app_shutdown(void)
   log_template_global_deinit();
   log_tags_deinit();
   log_msg_global_deinit();
+  log_proto_global_deinit();
 
   stats_destroy();
   dns_cache_destroy();
@@ -169,6 +169,13 @@ extern struct _LogDriver *last_driver;
 %token KW_PROTO_TEMPLATE              10079
 %token KW_MARK_MODE                   10080
 
+/* threaded destination options */
+%token KW_BATCH_LINES                 10081
+%token KW_BATCH_TIMEOUT               10082
+%token KW_WORKERS                     10083
+%token KW_WORKER_PARTITION_KEY        10084
+%token KW_RETRIES                     10085
+
 %token KW_CHAIN_HOSTNAMES             10090
 %token KW_NORMALIZE_HOSTNAMES         10091
 %token KW_KEEP_HOSTNAME               10092
@@ -317,6 +324,7 @@ extern struct _LogDriver *last_driver;
 #include "block-ref-parser.h"
 #include "plugin.h"
 #include "logwriter.h"
+#include "logthrdestdrv.h"
 #include "messages.h"
 
 #include "syslog-names.h"
@@ -964,6 +972,17 @@ dest_driver_option
           }
         ;
 
+threaded_dest_driver_option
+        /* NOTE: plugins need to set "last_driver" in order to incorporate this rule in their grammar */
+
+	: KW_WORKERS '(' LL_NUMBER ')'		{ log_threaded_dest_driver_set_workers(last_driver, $3); }
+	| KW_WORKER_PARTITION_KEY '(' string ')'	{ log_threaded_dest_driver_set_worker_partition_key(last_driver, $3); free($3); }
+	| KW_BATCH_LINES '(' LL_NUMBER ')'	{ log_threaded_dest_driver_set_batch_lines(last_driver, $3); }
+	| KW_BATCH_TIMEOUT '(' LL_NUMBER ')'	{ log_threaded_dest_driver_set_batch_timeout(last_driver, $3); }
+	| KW_RETRIES '(' LL_NUMBER ')'		{ log_threaded_dest_driver_set_retries(last_driver, $3); }
+	| dest_driver_option
+	;
+
 dest_writer_options
 	: dest_writer_option dest_writer_options
 	|
@@ -171,9 +171,24 @@ typedef struct _FilterCmp
   FilterExprNode super;
   LogTemplate *left, *right;
   GString *left_buf, *right_buf;
+  /* non-zero if the corresponding side is a single value reference, in
+   * which case numeric comparisons try to use its binary form */
+  NVHandle left_handle, right_handle;
   gint cmp_op;
 } FilterCmp;
 
+static gint64
+fop_cmp_eval_numeric_operand(LogTemplate *template, NVHandle handle, GString *buf, LogMessage **msgs, gint num_msg)
+{
+  gint64 value;
+
+  if (handle && log_msg_get_value_numeric(msgs[num_msg - 1], handle, &value))
+    return value;
+
+  log_template_format_with_context(template, msgs, num_msg, NULL, LTZ_LOCAL, 0, NULL, buf);
+  return strtoll(buf->str, NULL, 10);
+}
+
 gboolean
 fop_cmp_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
 {
@@ -181,24 +196,23 @@ fop_cmp_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
   gboolean result = FALSE;
   gint cmp;
 
-  log_template_format_with_context(self->left, msgs, num_msg, NULL, LTZ_LOCAL, 0, NULL, self->left_buf);
-  log_template_format_with_context(self->right, msgs, num_msg, NULL, LTZ_LOCAL, 0, NULL, self->right_buf);
-
   if (self->cmp_op & FCMP_NUM)
     {
-      gint l, r;
+      gint64 l, r;
 
-      l = atoi(self->left_buf->str);
-      r = atoi(self->right_buf->str);
+      l = fop_cmp_eval_numeric_operand(self->left, self->left_handle, self->left_buf, msgs, num_msg);
+      r = fop_cmp_eval_numeric_operand(self->right, self->right_handle, self->right_buf, msgs, num_msg);
       if (l == r)
         cmp = 0;
-      else if (l > r)
+      else if (l < r)
         cmp = -1;
       else
         cmp = 1;
     }
   else
     {
+      log_template_format_with_context(self->left, msgs, num_msg, NULL, LTZ_LOCAL, 0, NULL, self->left_buf);
+      log_template_format_with_context(self->right, msgs, num_msg, NULL, LTZ_LOCAL, 0, NULL, self->right_buf);
       cmp = strcmp(self->left_buf->str, self->right_buf->str);
     }
 
@@ -208,11 +222,11 @@ fop_cmp_eval(FilterExprNode *s, LogMessage **msgs, gint num_msg)
     }
   else if (cmp < 0)
     {
-      result = self->cmp_op & FCMP_LT || self->cmp_op == 0;
+      result = self->cmp_op & FCMP_LT || (self->cmp_op & ~FCMP_NUM) == 0;
     }
   else
     {
-      result = self->cmp_op & FCMP_GT || self->cmp_op == 0;
+      result = self->cmp_op & FCMP_GT || (self->cmp_op & ~FCMP_NUM) == 0;
     }
   return result ^ s->comp;
 }
@@ -242,42 +256,47 @@ fop_cmp_new(LogTemplate *left, LogTemplate *right, gint op)
   self->right_buf = g_string_sized_new(32);
   self->super.type = "CMP";
 
+  if (!log_template_is_trivial_value(left, &self->left_handle))
+    self->left_handle = 0;
+  if (!log_template_is_trivial_value(right, &self->right_handle))
+    self->right_handle = 0;
+
+  /* NOTE: the numeric variants fall through to add the comparison flags */
   switch (op)
     {
     case KW_NUM_LT:
       self->cmp_op = FCMP_NUM;
     case KW_LT:
-      self->cmp_op = FCMP_LT;
+      self->cmp_op |= FCMP_LT;
       break;
 
     case KW_NUM_LE:
       self->cmp_op = FCMP_NUM;
     case KW_LE:
-      self->cmp_op = FCMP_LT | FCMP_EQ;
+      self->cmp_op |= FCMP_LT | FCMP_EQ;
       break;
 
     case KW_NUM_EQ:
       self->cmp_op = FCMP_NUM;
     case KW_EQ:
-      self->cmp_op = FCMP_EQ;
+      self->cmp_op |= FCMP_EQ;
       break;
 
     case KW_NUM_NE:
       self->cmp_op = FCMP_NUM;
     case KW_NE:
-      self->cmp_op = 0;
       break;
 
     case KW_NUM_GE:
       self->cmp_op = FCMP_NUM;
     case KW_GE:
-      self->cmp_op = FCMP_GT | FCMP_EQ;
+      self->cmp_op |= FCMP_GT | FCMP_EQ;
       break;
 
     case KW_NUM_GT:
       self->cmp_op = FCMP_NUM;
     case KW_GT:
-      self->cmp_op = FCMP_GT;
+      self->cmp_op |= FCMP_GT;
       break;
     }
   return &self->super;
@@ -101,6 +101,11 @@ g_sockaddr_new(struct sockaddr *sa, int salen)
 char *
 g_sockaddr_format(GSockAddr *a, gchar *text, gulong n, gint format)
 {
+  if (a->formatted && format == GSA_ADDRESS_ONLY)
+    {
+      g_strlcpy(text, a->formatted, n);
+      return text;
+    }
   return a->sa_funcs->sa_format(a, text, n, format);
 }
 
@@ -144,6 +149,7 @@ g_sockaddr_unref(GSockAddr *a)
     {
       if (g_atomic_counter_dec_and_test(&a->refcnt))
         {
+          g_free(a->formatted);
           if (!a->sa_funcs->freefn)
             g_slice_free1(g_sockaddr_len(a), a);
           else
@@ -152,6 +158,103 @@ g_sockaddr_unref(GSockAddr *a)
     }
 }
 
+/* interning */
+
+struct _GSockAddrInternTable
+{
+  GHashTable *addrs;
+  gint max_size;
+};
+
+/* the raw sockaddr of an interned address, also used for lookups */
+typedef struct _GSockAddrInternKey
+{
+  int salen;
+  struct sockaddr *sa;
+} GSockAddrInternKey;
+
+static guint
+g_sockaddr_intern_key_hash(gconstpointer k)
+{
+  const GSockAddrInternKey *key = (const GSockAddrInternKey *) k;
+  const guchar *p = (const guchar *) key->sa;
+  guint h = 5381;
+  gint i;
+
+  for (i = 0; i < key->salen; i++)
+    h = (h << 5) + h + p[i];
+  return h;
+}
+
+static gboolean
+g_sockaddr_intern_key_equal(gconstpointer a, gconstpointer b)
+{
+  const GSockAddrInternKey *key_a = (const GSockAddrInternKey *) a;
+  const GSockAddrInternKey *key_b = (const GSockAddrInternKey *) b;
+
+  return key_a->salen == key_b->salen && memcmp(key_a->sa, key_b->sa, key_a->salen) == 0;
+}
+
+GSockAddrInternTable *
+g_sockaddr_intern_table_new(gint max_size)
+{
+  GSockAddrInternTable *self = g_new0(GSockAddrInternTable, 1);
+
+  self->addrs = g_hash_table_new_full(g_sockaddr_intern_key_hash, g_sockaddr_intern_key_equal,
+                                      g_free, (GDestroyNotify) g_sockaddr_unref);
+  self->max_size = max_size;
+  return self;
+}
+
+void
+g_sockaddr_intern_table_free(GSockAddrInternTable *self)
+{
+  g_hash_table_destroy(self->addrs);
+  g_free(self);
+}
+
+/**
+ * g_sockaddr_intern:
+ * @self: intern table
+ * @sa: libc sockaddr * pointer to look up
+ * @salen: size of sa
+ *
+ * Returns a reference to the shared GSockAddr instance equal to @sa,
+ * creating it if this is the first time @sa is seen. The instance caches
+ * its GSA_ADDRESS_ONLY format. When the table reaches its maximum size
+ * (e.g. senders using a new source port for every message), it is
+ * emptied, addresses still referenced by messages remain valid.
+ *
+ * Returns: a GSockAddr instance or NULL if failure
+ **/
+GSockAddr *
+g_sockaddr_intern(GSockAddrInternTable *self, struct sockaddr *sa, int salen)
+{
+  GSockAddrInternKey lookup_key = { salen, sa };
+  GSockAddrInternKey *key;
+  GSockAddr *addr;
+
+  addr = g_hash_table_lookup(self->addrs, &lookup_key);
+  if (addr)
+    return g_sockaddr_ref(addr);
+
+  addr = g_sockaddr_new(sa, salen);
+  if (!addr || addr->salen != salen)
+    return addr;
+
+  addr->formatted = g_malloc(MAX_SOCKADDR_STRING);
+  addr->sa_funcs->sa_format(addr, addr->formatted, MAX_SOCKADDR_STRING, GSA_ADDRESS_ONLY);
+
+  if (g_hash_table_size(self->addrs) >= self->max_size)
+    g_hash_table_remove_all(self->addrs);
+
+  key = g_new(GSockAddrInternKey, 1);
+  key->salen = salen;
+  key->sa = g_sockaddr_get_sa(addr);
+  g_hash_table_insert(self->addrs, key, g_sockaddr_ref(addr));
+  return addr;
+}
+
 /* AF_INET socket address */
 /*+
 
@@ -164,6 +267,7 @@ typedef struct _GSockAddrInet
   GAtomicCounter refcnt;
   guint32 flags;
   GSockAddrFuncs *sa_funcs;
+  gchar *formatted;
   int salen;
   struct sockaddr_in sin;
 } GSockAddrInet;
@@ -287,6 +391,7 @@ typedef struct _GSockAddrInetRange
   GAtomicCounter refcnt;
   guint32 flags;
   GSockAddrFuncs *sa_funcs;
+  gchar *formatted;
   int salen;
   struct sockaddr_in sin;
   gpointer options;
@@ -377,6 +482,7 @@ typedef struct _GSockAddrInet6
   GAtomicCounter refcnt;
   guint32 flags;
   GSockAddrFuncs *sa_funcs;
+  gchar *formatted;
   int salen;
   struct sockaddr_in6 sin6;
 } GSockAddrInet6;
@@ -495,6 +601,7 @@ typedef struct _GSockAddrUnix
   GAtomicCounter refcnt;
   guint32 flags;
   GSockAddrFuncs *sa_funcs;
+  gchar *formatted;
   int salen;
   struct sockaddr_un saun;
 } GSockAddrUnix;
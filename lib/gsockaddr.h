@@ -50,6 +50,9 @@ typedef struct _GSockAddr
   GAtomicCounter refcnt;
   guint32 flags;
   GSockAddrFuncs *sa_funcs;
+  /* GSA_ADDRESS_ONLY format of addresses returned by g_sockaddr_intern(),
+   * NULL otherwise */
+  gchar *formatted;
   int salen;
   struct sockaddr sa;
 } GSockAddr;
@@ -70,6 +73,19 @@ gchar *g_sockaddr_format(GSockAddr *a, gchar *text, gulong n, gint format);
 GSockAddr *g_sockaddr_ref(GSockAddr *a);
 void g_sockaddr_unref(GSockAddr *a);
 
+/*
+ * Interning: datagram sources see the same few thousand senders over and
+ * over, GSockAddrInternTable returns a shared instance for each of them
+ * instead of allocating (and later formatting) a new one for every
+ * packet. A table is not thread safe, it is meant to be used by a single
+ * reader, the returned addresses can be used anywhere.
+ */
+typedef struct _GSockAddrInternTable GSockAddrInternTable;
+
+GSockAddrInternTable *g_sockaddr_intern_table_new(gint max_size);
+void g_sockaddr_intern_table_free(GSockAddrInternTable *self);
+GSockAddr *g_sockaddr_intern(GSockAddrInternTable *self, struct sockaddr *sa, int salen);
+
 gboolean g_sockaddr_inet_check(GSockAddr *a);
 GSockAddr *g_sockaddr_inet_new(gchar *ip, guint16 port);
 GSockAddr *g_sockaddr_inet_new2(struct sockaddr_in *sin);
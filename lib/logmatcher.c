@@ -26,6 +26,7 @@
 #include "messages.h"
 #include "cfg.h"
 #include "misc.h"
+#include "tls-support.h"
 
 #include <string.h>
 #if ENABLE_PCRE
@@ -273,18 +274,89 @@ typedef struct _LogMatcherString
   LogMatcher super;
   gchar *pattern;
   gint pattern_len;
+  /* Boyer-Moore-Horspool bad character shifts for substring matching, in
+   * case of icase matching the pattern and the table are case-folded */
+  gint shift_table[256];
 } LogMatcherString;
 
+static void
+log_matcher_string_compile_shift_table(LogMatcherString *self)
+{
+  gint i;
+
+  for (i = 0; i < 256; i++)
+    self->shift_table[i] = self->pattern_len;
+  for (i = 0; i < self->pattern_len - 1; i++)
+    self->shift_table[(guchar) self->pattern[i]] = self->pattern_len - 1 - i;
+}
+
 static gboolean
 log_matcher_string_compile(LogMatcher *s, const gchar *pattern)
 {
   LogMatcherString *self = (LogMatcherString *) s; 
   
-  self->pattern = g_strdup(pattern);
+  if (self->super.flags & LMF_ICASE)
+    self->pattern = g_ascii_strdown(pattern, -1);
+  else
+    self->pattern = g_strdup(pattern);
   self->pattern_len = strlen(self->pattern);
+  if (self->super.flags & LMF_SUBSTRING)
+    log_matcher_string_compile_shift_table(self);
+  return TRUE;
+}
+
+static inline gboolean
+log_matcher_string_equal_icase(const gchar *value, const gchar *folded_pattern, gsize len)
+{
+  gsize i;
+
+  for (i = 0; i < len; i++)
+    {
+      if (g_ascii_tolower(value[i]) != folded_pattern[i])
+        return FALSE;
+    }
   return TRUE;
 }
 
+/* Boyer-Moore-Horspool search over a possibly non-zero terminated value,
+ * the value is never copied, not even in the case-insensitive case */
+static const gchar *
+log_matcher_string_find_substring(LogMatcherString *self, const gchar *value, gsize value_len)
+{
+  const gchar *pattern = self->pattern;
+  gsize last = self->pattern_len - 1;
+  gsize pos = 0;
+
+  if (self->pattern_len == 0)
+    return value;
+
+  if (self->super.flags & LMF_ICASE)
+    {
+      while (pos + last < value_len)
+        {
+          guchar c = g_ascii_tolower(value[pos + last]);
+
+          if (c == (guchar) pattern[last] &&
+              log_matcher_string_equal_icase(&value[pos], pattern, last))
+            return &value[pos];
+          pos += self->shift_table[c];
+        }
+    }
+  else
+    {
+      while (pos + last < value_len)
+        {
+          guchar c = value[pos + last];
+
+          if (c == (guchar) pattern[last] &&
+              memcmp(&value[pos], pattern, last) == 0)
+            return &value[pos];
+          pos += self->shift_table[c];
+        }
+    }
+  return NULL;
+}
+
 static const gchar *
 log_matcher_string_match_string(LogMatcherString *self, const gchar *value, gsize value_len)
 {
@@ -309,20 +381,7 @@ log_matcher_string_match_string(LogMatcherString *self, const gchar *value, gsiz
     }
   else if (self->super.flags & LMF_SUBSTRING)
     {
-      if (self->super.flags & LMF_ICASE)
-        {
-          gchar *buf;
-          gchar *res;
-
-          APPEND_ZERO(buf, value, value_len);
-          res = strcasestr(buf, self->pattern);
-          if (res)
-            result = value + (res - buf);
-        }
-      else
-        {
-          result = g_strstr_len(value, value_len, self->pattern);
-        }
+      result = log_matcher_string_find_substring(self, value, value_len);
     }
 
   if (match && !result)
@@ -335,6 +394,8 @@ log_matcher_string_match(LogMatcher *s, LogMessage *msg, gint value_handle, cons
 {
   LogMatcherString *self = (LogMatcherString *) s; 
   
+  if (value_len < 0)
+    value_len = strlen(value);
   return log_matcher_string_match_string(self, value, value_len) != NULL;
 }
 
@@ -500,14 +561,62 @@ log_matcher_glob_new(void)
 
 /* libpcre support */
 
+#ifdef PCRE_STUDY_JIT_COMPILE
+#define LOG_MATCHER_PCRE_JIT 1
+#define LOG_MATCHER_PCRE_JIT_STACK_MIN   (32 * 1024)
+#define LOG_MATCHER_PCRE_JIT_STACK_MAX  (512 * 1024)
+#endif
+
+/* per-thread state of the PCRE matchers: the ovector is reused between
+ * matches instead of being set up on every call, and JIT compiled patterns
+ * share a single JIT stack per thread, as pcre JIT stacks can't be used by
+ * multiple threads concurrently. */
+TLS_BLOCK_START
+{
+  gint pcre_matches[3 * (RE_MAX_MATCHES + 1)];
+#if LOG_MATCHER_PCRE_JIT
+  pcre_jit_stack *jit_stack;
+#endif
+}
+TLS_BLOCK_END;
+
+#define local_pcre_matches    __tls_deref(pcre_matches)
+#define local_jit_stack       __tls_deref(jit_stack)
+
 typedef struct _LogMatcherPcreRe
 {
   LogMatcher super;
   pcre *pattern;
   pcre_extra *extra;
   gint match_options;
+  /* number of capturing subpatterns, capped at RE_MAX_MATCHES */
+  gint num_matches;
 } LogMatcherPcreRe;
 
+#if LOG_MATCHER_PCRE_JIT
+static pcre_jit_stack *
+log_matcher_pcre_re_get_jit_stack(void *user_data)
+{
+  if (!local_jit_stack)
+    local_jit_stack = pcre_jit_stack_alloc(LOG_MATCHER_PCRE_JIT_STACK_MIN, LOG_MATCHER_PCRE_JIT_STACK_MAX);
+  return local_jit_stack;
+}
+#endif
+
+/* frees the per-thread resources allocated by the PCRE matchers, should be
+ * called when a thread that may have evaluated PCRE matchers exits */
+void
+log_matcher_pcre_thread_free(void)
+{
+#if LOG_MATCHER_PCRE_JIT
+  if (local_jit_stack)
+    {
+      pcre_jit_stack_free(local_jit_stack);
+      local_jit_stack = NULL;
+    }
+#endif
+}
+
 static gboolean
 log_matcher_pcre_re_compile(LogMatcher *s, const gchar *re)
 {
@@ -517,6 +626,8 @@ log_matcher_pcre_re_compile(LogMatcher *s, const gchar *re)
   const gchar *errptr;
   gint erroffset;
   gint flags = 0;
+  gint study_flags = 0;
+  gint jit = 0;
  
   if (self->super.flags & LMF_ICASE)
     flags |= PCRE_CASELESS;
@@ -547,6 +658,15 @@ log_matcher_pcre_re_compile(LogMatcher *s, const gchar *re)
            return FALSE;
         }
     }
+#if LOG_MATCHER_PCRE_JIT
+  {
+    gint support = 0;
+
+    pcre_config(PCRE_CONFIG_JIT, &support);
+    if (support)
+      study_flags |= PCRE_STUDY_JIT_COMPILE;
+  }
+#endif
  
   /* complile the regexp */ 
   self->pattern = pcre_compile2(re_comp, flags, &rc, &errptr, &erroffset, NULL);
@@ -563,7 +683,7 @@ log_matcher_pcre_re_compile(LogMatcher *s, const gchar *re)
     }
     
   /* optimize regexp */
-  self->extra = pcre_study(self->pattern, 0, &errptr);
+  self->extra = pcre_study(self->pattern, study_flags, &errptr);
   if (errptr != NULL)
     {
       msg_error("Error while optimizing regular expression",
@@ -573,6 +693,20 @@ log_matcher_pcre_re_compile(LogMatcher *s, const gchar *re)
       return FALSE;
     }
 
+#if LOG_MATCHER_PCRE_JIT
+  if (self->extra && pcre_fullinfo(self->pattern, self->extra, PCRE_INFO_JIT, &jit) == 0 && jit)
+    pcre_assign_jit_stack(self->extra, log_matcher_pcre_re_get_jit_stack, NULL);
+#endif
+  msg_debug("Compiled PCRE regular expression",
+            evt_tag_str("regular_expression", re),
+            evt_tag_str("jit", jit ? "yes" : "no"),
+            NULL);
+
+  if (pcre_fullinfo(self->pattern, self->extra, PCRE_INFO_CAPTURECOUNT, &self->num_matches) < 0)
+    g_assert_not_reached();
+  if (self->num_matches > RE_MAX_MATCHES)
+    self->num_matches = RE_MAX_MATCHES;
+
   return TRUE;
 }
 
@@ -629,22 +763,13 @@ static gboolean
 log_matcher_pcre_re_match(LogMatcher *s, LogMessage *msg, gint value_handle, const gchar *value, gssize value_len)
 {
   LogMatcherPcreRe *self = (LogMatcherPcreRe *) s; 
-  gint *matches;
-  gsize matches_size;
-  gint num_matches;
+  gint *matches = local_pcre_matches;
+  gsize matches_size = 3 * (self->num_matches + 1);
   gint rc;
 
   if (value_len == -1)
     value_len = strlen(value);
 
-  if (pcre_fullinfo(self->pattern, self->extra, PCRE_INFO_CAPTURECOUNT, &num_matches) < 0)
-    g_assert_not_reached();
-  if (num_matches > RE_MAX_MATCHES)
-    num_matches = RE_MAX_MATCHES;
-
-  matches_size = 3 * (num_matches + 1);
-  matches = g_alloca(matches_size * sizeof(gint));
-
   rc = pcre_exec(self->pattern, self->extra,
                  value, value_len, 0, self->match_options, matches, matches_size);
   if (rc < 0)
@@ -683,22 +808,14 @@ log_matcher_pcre_re_replace(LogMatcher *s, LogMessage *msg, gint value_handle, c
 {
   LogMatcherPcreRe *self = (LogMatcherPcreRe *) s; 
   GString *new_value = NULL;
-  gint *matches;
-  gsize matches_size;
-  gint num_matches;
+  gint *matches = local_pcre_matches;
+  gsize matches_size = 3 * (self->num_matches + 1);
   gint rc;
   gint start_offset, last_offset;
+  gint match_start, match_end;
   gint options;
   gboolean last_match_was_empty;
 
-  if (pcre_fullinfo(self->pattern, self->extra, PCRE_INFO_CAPTURECOUNT, &num_matches) < 0)
-    g_assert_not_reached();
-  if (num_matches > RE_MAX_MATCHES)
-    num_matches = RE_MAX_MATCHES;
-
-  matches_size = 3 * (num_matches + 1);
-  matches = g_alloca(matches_size * sizeof(gint));
-
   /* we need zero initialized offsets for the last match as the
    * algorithm tries uses that as the base position */
 
@@ -785,15 +902,21 @@ log_matcher_pcre_re_replace(LogMatcher *s, LogMessage *msg, gint value_handle, c
           log_matcher_pcre_re_feed_backrefs(s, msg, value_handle, matches, rc, value);
           log_matcher_pcre_re_feed_named_substrings(s, msg, matches, value);
 
+          /* the match vector is per-thread, save the offsets we need
+           * before expanding the replacement, which may run other
+           * matchers */
+          match_start = matches[0];
+          match_end = matches[1];
+
           if (!new_value)
             new_value = g_string_sized_new(value_len); 
           /* append non-matching portion */
-          g_string_append_len(new_value, &value[last_offset], matches[0] - last_offset);
+          g_string_append_len(new_value, &value[last_offset], match_start - last_offset);
           /* replacement */
           log_template_append_format(replacement, msg, NULL, LTZ_LOCAL, 0, NULL, new_value);
 
-          last_match_was_empty = (matches[0] == matches[1]);
-          start_offset = last_offset = matches[1];
+          last_match_was_empty = (match_start == match_end);
+          start_offset = last_offset = match_end;
         }
     }
   while (self->super.flags & LMF_GLOBAL && start_offset < value_len);
@@ -813,7 +936,11 @@ static void
 log_matcher_pcre_re_free(LogMatcher *s)
 {
   LogMatcherPcreRe *self = (LogMatcherPcreRe *) s;
+#if LOG_MATCHER_PCRE_JIT
+  pcre_free_study(self->extra);
+#else
   pcre_free(self->extra);
+#endif
   pcre_free(self->pattern);
 }
 
@@ -829,6 +956,14 @@ log_matcher_pcre_re_new(void)
   self->super.free_fn = log_matcher_pcre_re_free;
   return &self->super;
 }
+
+#else
+
+void
+log_matcher_pcre_thread_free(void)
+{
+}
+
 #endif
 
 LogMatcher *
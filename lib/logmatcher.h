@@ -105,6 +105,8 @@ LogMatcher *log_matcher_pcre_re_new(void);
 LogMatcher *log_matcher_string_new(void);
 LogMatcher *log_matcher_glob_new(void);
 
+void log_matcher_pcre_thread_free(void);
+
 LogMatcher *log_matcher_new(const gchar *type);
 LogMatcher *log_matcher_ref(LogMatcher *s);
 void log_matcher_unref(LogMatcher *s);
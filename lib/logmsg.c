@@ -34,6 +34,10 @@
 #include "tls-support.h"
 
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <stddef.h>
 #include <time.h>
 #include <unistd.h>
 #include <string.h>
@@ -165,6 +169,18 @@ log_msg_unset_flag(LogMessage *self, gint32 flag)
   self->flags &= ~flag;
 }
 
+/* called whenever the message is changed, as memoized template output
+ * would become stale */
+static inline void
+log_msg_reset_format_cache(LogMessage *self)
+{
+  if (self->format_cache)
+    {
+      log_template_format_cache_free(self->format_cache);
+      self->format_cache = NULL;
+    }
+}
+
 /* the index matches the value id */
 const gchar *builtin_value_names[] =
 {
@@ -478,8 +494,9 @@ log_msg_free_queue_node(LogMessageQueueNode *node)
     g_slice_free(LogMessageQueueNode, node);
 }
 
-void
-log_msg_set_value(LogMessage *self, NVHandle handle, const gchar *value, gssize value_len)
+/* @numeric is optional, it is the binary form of @value if the caller parsed it as an integer */
+static void
+log_msg_set_value_full(LogMessage *self, NVHandle handle, const gchar *value, gssize value_len, const gint64 *numeric)
 {
   const gchar *name;
   gssize name_len;
@@ -490,6 +507,7 @@ log_msg_set_value(LogMessage *self, NVHandle handle, const gchar *value, gssize
   if (handle == LM_V_NONE)
     return;
 
+  log_msg_reset_format_cache(self);
   name = log_msg_get_value_name(handle, &name_len);
 
   if (value_len < 0)
@@ -504,7 +522,9 @@ log_msg_set_value(LogMessage *self, NVHandle handle, const gchar *value, gssize
   /* we need a loop here as a single realloc may not be enough. Might help
    * if we pass how much bytes we need though. */
 
-  while (!nv_table_add_value(self->payload, handle, name, name_len, value, value_len, &new_entry))
+  while (!(numeric
+           ? nv_table_add_value_with_numeric(self->payload, handle, name, name_len, value, value_len, *numeric, &new_entry)
+           : nv_table_add_value(self->payload, handle, name, name_len, value, value_len, &new_entry)))
     {
       /* error allocating string in payload, reallocate */
       if (!nv_table_realloc(self->payload, &self->payload))
@@ -526,7 +546,20 @@ log_msg_set_value(LogMessage *self, NVHandle handle, const gchar *value, gssize
 }
 
 void
-log_msg_set_value_indirect(LogMessage *self, NVHandle handle, NVHandle ref_handle, guint8 type, guint16 ofs, guint16 len)
+log_msg_set_value(LogMessage *self, NVHandle handle, const gchar *value, gssize value_len)
+{
+  log_msg_set_value_full(self, handle, value, value_len, NULL);
+}
+
+/* stores @value along with its binary form, see log_msg_get_value_numeric() */
+void
+log_msg_set_value_with_numeric(LogMessage *self, NVHandle handle, const gchar *value, gssize value_len, gint64 numeric)
+{
+  log_msg_set_value_full(self, handle, value, value_len, &numeric);
+}
+
+static void
+log_msg_set_value_indirect_full(LogMessage *self, NVHandle handle, NVHandle ref_handle, guint8 type, guint16 ofs, guint16 len, const gint64 *numeric)
 {
   const gchar *name;
   gssize name_len;
@@ -539,6 +572,7 @@ log_msg_set_value_indirect(LogMessage *self, NVHandle handle, NVHandle ref_handl
 
   g_assert(handle >= LM_V_MAX);
 
+  log_msg_reset_format_cache(self);
   name = log_msg_get_value_name(handle, &name_len);
 
   if (!log_msg_chk_flag(self, LF_STATE_OWN_PAYLOAD))
@@ -547,7 +581,9 @@ log_msg_set_value_indirect(LogMessage *self, NVHandle handle, NVHandle ref_handl
       log_msg_set_flag(self, LF_STATE_OWN_PAYLOAD);
     }
 
-  while (!nv_table_add_value_indirect(self->payload, handle, name, name_len, ref_handle, type, ofs, len, &new_entry))
+  while (!(numeric
+           ? nv_table_add_value_indirect_with_numeric(self->payload, handle, name, name_len, ref_handle, type, ofs, len, *numeric, &new_entry)
+           : nv_table_add_value_indirect(self->payload, handle, name, name_len, ref_handle, type, ofs, len, &new_entry)))
     {
       /* error allocating string in payload, reallocate */
       if (!nv_table_realloc(self->payload, &self->payload))
@@ -566,7 +602,17 @@ log_msg_set_value_indirect(LogMessage *self, NVHandle handle, NVHandle ref_handl
     log_msg_update_sdata(self, handle, name, name_len);
 }
 
+void
+log_msg_set_value_indirect(LogMessage *self, NVHandle handle, NVHandle ref_handle, guint8 type, guint16 ofs, guint16 len)
+{
+  log_msg_set_value_indirect_full(self, handle, ref_handle, type, ofs, len, NULL);
+}
 
+void
+log_msg_set_value_indirect_with_numeric(LogMessage *self, NVHandle handle, NVHandle ref_handle, guint8 type, guint16 ofs, guint16 len, gint64 numeric)
+{
+  log_msg_set_value_indirect_full(self, handle, ref_handle, type, ofs, len, &numeric);
+}
 
 void
 log_msg_set_match(LogMessage *self, gint index, const gchar *value, gssize value_len)
@@ -676,6 +722,7 @@ log_msg_set_tag_by_id_onoff(LogMessage *self, LogTagId id, gboolean on)
   gboolean inline_tags;
 
   g_assert(!log_msg_is_write_protected(self));
+  log_msg_reset_format_cache(self);
   if (!log_msg_chk_flag(self, LF_STATE_OWN_TAGS) && self->num_tags)
     {
       self->tags = g_memdup(self->tags, sizeof(self->tags[0]) * self->num_tags);
@@ -962,20 +1009,25 @@ log_msg_print_tags(LogMessage *self, GString *result)
  * log_msg_init:
  * @self: LogMessage instance
  * @saddr: sender address 
+ * @recvd: time the message was received, NULL means now
  *
  * This function initializes a LogMessage instance without allocating it
  * first. It is used internally by the log_msg_new function.
  **/
 static void
-log_msg_init(LogMessage *self, GSockAddr *saddr)
+log_msg_init(LogMessage *self, GSockAddr *saddr, const GTimeVal *recvd)
 {
   GTimeVal tv;
 
   /* ref is set to 1, ack is set to 0 */
   self->ack_and_ref = LOGMSG_REFCACHE_REF_TO_VALUE(1);
-  cached_g_current_time(&tv);
-  self->timestamps[LM_TS_RECVD].tv_sec = tv.tv_sec;
-  self->timestamps[LM_TS_RECVD].tv_usec = tv.tv_usec;
+  if (!recvd)
+    {
+      cached_g_current_time(&tv);
+      recvd = &tv;
+    }
+  self->timestamps[LM_TS_RECVD].tv_sec = recvd->tv_sec;
+  self->timestamps[LM_TS_RECVD].tv_usec = recvd->tv_usec;
   self->timestamps[LM_TS_RECVD].zone_offset = get_local_timezone_ofs(self->timestamps[LM_TS_RECVD].tv_sec);
   self->timestamps[LM_TS_STAMP].tv_sec = -1;
   self->timestamps[LM_TS_STAMP].zone_offset = -1;
@@ -990,6 +1042,7 @@ log_msg_init(LogMessage *self, GSockAddr *saddr)
 void
 log_msg_clear(LogMessage *self)
 {
+  log_msg_reset_format_cache(self);
   if (log_msg_chk_flag(self, LF_STATE_OWN_PAYLOAD))
     nv_table_clear(self->payload);
   else
@@ -1050,22 +1103,26 @@ log_msg_alloc(gsize payload_size)
 }
 
 /**
- * log_msg_new:
+ * log_msg_new_received:
  * @msg: message to parse
  * @length: length of @msg
  * @saddr: sender address
+ * @recvd: time the message was received, NULL means now
  * @flags: parse flags (LP_*)
  *
  * This function allocates, parses and returns a new LogMessage instance.
+ * Sources that know when the message arrived (e.g. from the kernel) pass
+ * that in @recvd, which also saves a clock read.
  **/
 LogMessage *
-log_msg_new(const gchar *msg, gint length,
-            GSockAddr *saddr,
-            MsgFormatOptions *parse_options)
+log_msg_new_received(const gchar *msg, gint length,
+                     GSockAddr *saddr,
+                     const GTimeVal *recvd,
+                     MsgFormatOptions *parse_options)
 {
   LogMessage *self = log_msg_alloc(length == 0 ? 256 : length * 2);
 
-  log_msg_init(self, saddr);
+  log_msg_init(self, saddr, recvd);
 
   if (G_LIKELY(parse_options->format_handler))
     {
@@ -1078,12 +1135,20 @@ log_msg_new(const gchar *msg, gint length,
   return self;
 }
 
+LogMessage *
+log_msg_new(const gchar *msg, gint length,
+            GSockAddr *saddr,
+            MsgFormatOptions *parse_options)
+{
+  return log_msg_new_received(msg, length, saddr, NULL, parse_options);
+}
+
 LogMessage *
 log_msg_new_empty(void)
 {
   LogMessage *self = log_msg_alloc(256);
   
-  log_msg_init(self, NULL);
+  log_msg_init(self, NULL, NULL);
   return self;
 }
 
@@ -1128,6 +1193,7 @@ log_msg_clone_cow(LogMessage *msg, const LogPathOptions *path_options)
   self->ack_and_ref = LOGMSG_REFCACHE_REF_TO_VALUE(1) + LOGMSG_REFCACHE_ACK_TO_VALUE(0);
   self->cur_node = 0;
   self->protect_cnt = 0;
+  self->format_cache = NULL;
 
   log_msg_add_ack(self, path_options);
   if (!path_options->ack_needed)
@@ -1213,6 +1279,7 @@ log_msg_free(LogMessage *self)
   if (self->original)
     log_msg_unref(self->original);
 
+  log_template_format_cache_free(self->format_cache);
   g_free(self);
 }
 
@@ -1232,6 +1299,232 @@ log_msg_drop(LogMessage *msg, const LogPathOptions *path_options)
 }
 
 
+/*
+ * Serialization of messages, used to forward them to another syslog-ng
+ * instance with all their name-value pairs and tags. The format is
+ * versioned, integers are stored in network byte order.
+ */
+
+#define LOGMSG_SERIALIZE_VERSION 1
+
+static gboolean
+log_msg_write_value(NVHandle handle, const gchar *name, const gchar *value, gssize value_len, gpointer user_data)
+{
+  SerializeArchive *sa = (SerializeArchive *) user_data;
+
+  /* matches are only meaningful to the rule that produced them */
+  if (nv_registry_get_handle_flags(logmsg_registry, handle) & LM_VF_MATCH)
+    return FALSE;
+
+  return !(serialize_write_cstring(sa, name, -1) &&
+           serialize_write_cstring(sa, value, value_len));
+}
+
+static gboolean
+log_msg_write_tag(LogMessage *self, LogTagId tag_id, const gchar *name, gpointer user_data)
+{
+  SerializeArchive *sa = (SerializeArchive *) user_data;
+
+  return serialize_write_cstring(sa, name, -1);
+}
+
+gboolean
+log_msg_write(LogMessage *self, SerializeArchive *sa)
+{
+  struct sockaddr *addr = NULL;
+  gint i;
+
+  serialize_write_uint8(sa, LOGMSG_SERIALIZE_VERSION);
+  serialize_write_uint32(sa, self->flags & ~LF_STATE_MASK);
+  serialize_write_uint16(sa, self->pri);
+  for (i = 0; i < LM_TS_MAX; i++)
+    {
+      serialize_write_uint64(sa, (guint64) self->timestamps[i].tv_sec);
+      serialize_write_uint32(sa, self->timestamps[i].tv_usec);
+      serialize_write_uint32(sa, (guint32) self->timestamps[i].zone_offset);
+    }
+
+  if (self->saddr)
+    addr = g_sockaddr_get_sa(self->saddr);
+  if (addr && self->saddr->salen <= G_MAXUINT16)
+    {
+      serialize_write_uint16(sa, self->saddr->salen);
+      serialize_write_blob(sa, addr, self->saddr->salen);
+    }
+  else
+    {
+      serialize_write_uint16(sa, 0);
+    }
+
+  /* name-value pairs and tags, both lists are terminated by an empty name */
+  nv_table_foreach(self->payload, logmsg_registry, log_msg_write_value, sa);
+  serialize_write_cstring(sa, "", 0);
+  log_msg_tags_foreach(self, log_msg_write_tag, sa);
+  return serialize_write_cstring(sa, "", 0);
+}
+
+/* g_sockaddr_new() aborts on families it doesn't know and copies a whole
+ * struct sockaddr_* of the family, the length is also sent on by
+ * log_msg_write(), so it has to match the family exactly */
+static gboolean
+log_msg_is_sockaddr_valid(struct sockaddr *addr, guint16 salen)
+{
+  struct sockaddr_un *saun;
+
+  switch (addr->sa_family)
+    {
+    case AF_INET:
+      return salen == sizeof(struct sockaddr_in);
+#if ENABLE_IPV6
+    case AF_INET6:
+      return salen == sizeof(struct sockaddr_in6);
+#endif
+    case AF_UNIX:
+      if (salen <= offsetof(struct sockaddr_un, sun_path) || salen > sizeof(struct sockaddr_un))
+        return FALSE;
+      saun = (struct sockaddr_un *) addr;
+      return memchr(saun->sun_path, 0, salen - offsetof(struct sockaddr_un, sun_path)) != NULL;
+    default:
+      return FALSE;
+    }
+}
+
+/* discards @len bytes, a chunk at a time, without buffering all of them */
+static gboolean
+log_msg_skip_blob(SerializeArchive *sa, guint16 len)
+{
+  gchar buf[128];
+
+  while (len > 0)
+    {
+      guint16 chunk = MIN(len, sizeof(buf));
+
+      if (!serialize_read_blob(sa, buf, chunk))
+        return FALSE;
+      len -= chunk;
+    }
+  return TRUE;
+}
+
+/* names seen for the first time are registered for good, a peer may only
+ * add *new_names_left of them, the values and tags of further ones are
+ * dropped */
+static gboolean
+log_msg_read_use_new_name(const gchar *name, gint *new_names_left)
+{
+  if (!new_names_left)
+    return TRUE;
+  if (*new_names_left > 0)
+    {
+      (*new_names_left)--;
+      return TRUE;
+    }
+  if (*new_names_left == 0)
+    {
+      msg_warning("Too many new names in serialized messages from peer, dropping values and tags with unknown names",
+                  evt_tag_str("name", name),
+                  NULL);
+      *new_names_left = -1;
+    }
+  return FALSE;
+}
+
+/*
+ * log_msg_read:
+ * @new_names_left: the number of value and tag names that may still be
+ *                  registered on behalf of the peer, NULL means unlimited
+ */
+gboolean
+log_msg_read(LogMessage *self, SerializeArchive *sa, gint *new_names_left)
+{
+  guint8 version;
+  guint32 flags, usec, zone_offset;
+  guint64 sec;
+  guint16 pri, salen;
+  GString *name, *value;
+  NVHandle handle;
+  LogTagId tag_id;
+  gboolean success = FALSE;
+  gint i;
+
+  if (!serialize_read_uint8(sa, &version) || version != LOGMSG_SERIALIZE_VERSION)
+    return FALSE;
+
+  if (!serialize_read_uint32(sa, &flags) || !serialize_read_uint16(sa, &pri))
+    return FALSE;
+  self->flags = (self->flags & ~LF_SERIALIZED_MASK) | (flags & LF_SERIALIZED_MASK);
+  self->pri = pri;
+
+  for (i = 0; i < LM_TS_MAX; i++)
+    {
+      if (!serialize_read_uint64(sa, &sec) ||
+          !serialize_read_uint32(sa, &usec) ||
+          !serialize_read_uint32(sa, &zone_offset))
+        return FALSE;
+      self->timestamps[i].tv_sec = (time_t) sec;
+      self->timestamps[i].tv_usec = usec;
+      self->timestamps[i].zone_offset = (gint32) zone_offset;
+    }
+
+  if (!serialize_read_uint16(sa, &salen))
+    return FALSE;
+  if (salen > sizeof(struct sockaddr_storage))
+    {
+      if (!log_msg_skip_blob(sa, salen))
+        return FALSE;
+    }
+  else if (salen > 0)
+    {
+      struct sockaddr_storage ss;
+
+      memset(&ss, 0, sizeof(ss));
+      if (!serialize_read_blob(sa, (gchar *) &ss, salen))
+        return FALSE;
+
+      if (log_msg_is_sockaddr_valid((struct sockaddr *) &ss, salen))
+        {
+          if (log_msg_chk_flag(self, LF_STATE_OWN_SADDR))
+            g_sockaddr_unref(self->saddr);
+          self->saddr = g_sockaddr_new((struct sockaddr *) &ss, salen);
+          self->flags |= LF_STATE_OWN_SADDR;
+        }
+    }
+
+  name = g_string_sized_new(32);
+  value = g_string_sized_new(256);
+  while (TRUE)
+    {
+      if (!serialize_read_string(sa, name))
+        goto exit;
+      if (name->len == 0)
+        break;
+      if (!serialize_read_string(sa, value) || !log_msg_is_value_name_valid(name->str))
+        goto exit;
+      handle = nv_registry_get_handle(logmsg_registry, name->str);
+      if (!handle && log_msg_read_use_new_name(name->str, new_names_left))
+        handle = log_msg_get_value_handle(name->str);
+      if (handle)
+        log_msg_set_value(self, handle, value->str, value->len);
+    }
+  while (TRUE)
+    {
+      if (!serialize_read_string(sa, name))
+        goto exit;
+      if (name->len == 0)
+        break;
+      if (log_tags_lookup_by_name(name->str, &tag_id))
+        log_msg_set_tag_by_id(self, tag_id);
+      else if (log_msg_read_use_new_name(name->str, new_names_left))
+        log_msg_set_tag_by_name(self, name->str);
+    }
+  success = TRUE;
+
+ exit:
+  g_string_free(name, TRUE);
+  g_string_free(value, TRUE);
+  return success;
+}
+
 /***************************************************************************************
  * In order to read & understand this code, reading the comment on the top
  * of this file about ref/ack handling is strongly recommended.
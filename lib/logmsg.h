@@ -109,6 +109,10 @@ enum
    * message header intact in a value named LEGACY_MSGHDR.
    */
   LF_LEGACY_MSGHDR    = 0x00020000,
+
+  /* flags accepted from a serialized message, the rest describe how the
+   * message was received on this host, not what the peer claims */
+  LF_SERIALIZED_MASK   = LF_UTF8 | LF_MARK | LF_CHAINED_HOSTNAME | LF_LEGACY_MSGHDR,
 };
 
 typedef struct _LogMessageQueueNode
@@ -144,6 +148,11 @@ struct _LogMessage
   gpointer ack_userdata;
   LogMessage *original;
 
+  /* formatted template output shared between destinations, owned by
+   * this message and dropped whenever it changes, see
+   * log_template_format_cached() */
+  LogTemplateFormatCache *format_cache;
+
   /* message parts */ 
   
   /* the contents of the members below is directly copied into another
@@ -192,7 +201,7 @@ LogMessage *log_msg_clone_cow(LogMessage *msg, const LogPathOptions *path_option
 LogMessage *log_msg_make_writable(LogMessage **pmsg, const LogPathOptions *path_options);
 
 gboolean log_msg_write(LogMessage *self, SerializeArchive *sa);
-gboolean log_msg_read(LogMessage *self, SerializeArchive *sa);
+gboolean log_msg_read(LogMessage *self, SerializeArchive *sa, gint *new_names_left);
 
 /* generic values that encapsulate log message fields, dynamic values and structured data */
 NVHandle log_msg_get_value_handle(const gchar *value_name);
@@ -217,10 +226,26 @@ log_msg_get_value(LogMessage *self, NVHandle handle, gssize *value_len)
     return log_msg_get_macro_value(self, flags >> 8, value_len);
 }
 
+/* returns TRUE and the binary form of the value in @value if the value
+ * was stored as a number (see log_msg_set_value_with_numeric()).
+ * Returns FALSE if the string form has to be parsed instead. */
+static inline gboolean
+log_msg_get_value_numeric(LogMessage *self, NVHandle handle, gint64 *value)
+{
+  guint16 flags;
+
+  flags = nv_registry_get_handle_flags(logmsg_registry, handle);
+  if ((flags & LM_VF_MACRO) != 0)
+    return FALSE;
+  return __nv_table_get_numeric(self->payload, handle, LM_V_MAX, value);
+}
+
 typedef gboolean (*LogMessageTagsForeachFunc)(LogMessage *self, LogTagId tag_id, const gchar *name, gpointer user_data);
 
 void log_msg_set_value(LogMessage *self, NVHandle handle, const gchar *new_value, gssize length);
 void log_msg_set_value_indirect(LogMessage *self, NVHandle handle, NVHandle ref_handle, guint8 type, guint16 ofs, guint16 len);
+void log_msg_set_value_with_numeric(LogMessage *self, NVHandle handle, const gchar *value, gssize value_len, gint64 numeric);
+void log_msg_set_value_indirect_with_numeric(LogMessage *self, NVHandle handle, NVHandle ref_handle, guint8 type, guint16 ofs, guint16 len, gint64 numeric);
 void log_msg_set_match(LogMessage *self, gint index, const gchar *value, gssize value_len);
 void log_msg_set_match_indirect(LogMessage *self, gint index, NVHandle ref_handle, guint8 type, guint16 ofs, guint16 len);
 void log_msg_clear_matches(LogMessage *self);
@@ -246,6 +271,10 @@ void log_msg_clear(LogMessage *self);
 LogMessage *log_msg_new(const gchar *msg, gint length,
                         GSockAddr *saddr,
                         MsgFormatOptions *parse_options);
+LogMessage *log_msg_new_received(const gchar *msg, gint length,
+                                 GSockAddr *saddr,
+                                 const GTimeVal *recvd,
+                                 MsgFormatOptions *parse_options);
 LogMessage *log_msg_new_mark(void);
 LogMessage *log_msg_new_internal(gint prio, const gchar *msg);
 LogMessage *log_msg_new_empty(void);
@@ -123,9 +123,18 @@ void
 log_column_parser_set_columns(LogColumnParser *s, GList *columns)
 {
   LogColumnParser *self = (LogColumnParser *) s;
+  GList *l;
+  gint i;
   
   string_list_free(self->columns);
   self->columns = columns;
+
+  /* resolve the names once, instead of going through the registry lock
+   * for every column of every message */
+  g_free(self->column_handles);
+  self->column_handles = g_new(NVHandle, g_list_length(columns));
+  for (l = columns, i = 0; l; l = l->next, i++)
+    self->column_handles[i] = log_msg_get_value_handle((gchar *) l->data);
 }
 
 void
@@ -134,6 +143,7 @@ log_column_parser_free_method(LogPipe *s)
   LogColumnParser *self = (LogColumnParser *) s;
   
   string_list_free(self->columns);
+  g_free(self->column_handles);
   log_parser_free_method(s);
 }
 
@@ -55,6 +55,8 @@ struct _LogColumnParser
 {
   LogParser super;
   GList *columns;
+  /* the NVHandles of @columns, in the same order */
+  NVHandle *column_handles;
 };
 
 void log_column_parser_set_columns(LogColumnParser *s, GList *fields);
@@ -26,6 +26,7 @@
 #include "logproto.h"
 #include "messages.h"
 #include "persist-state.h"
+#include "stats.h"
 #include "compat.h"
 
 #include <ctype.h>
@@ -33,6 +34,7 @@
 #include <sys/stat.h>
 #include <stdlib.h>
 #include <sys/uio.h>
+#include <sys/socket.h>
 #include <limits.h>
 
 gboolean
@@ -57,11 +59,180 @@ log_proto_set_encoding(LogProto *self, const gchar *encoding)
   return TRUE;
 }
 
+/*
+ * Receive buffer pool
+ *
+ * Server side protocols only need their receive buffer while there's
+ * data in flight. Those serving connections return their buffer to this
+ * pool once all input is processed and take one again when the next
+ * chunk arrives, so the memory used by mostly idle connections doesn't
+ * grow with the number of connections. Buffers are kept per size, and at
+ * most LOG_PROTO_BUFFER_POOL_MAX bytes are kept for reuse.
+ *
+ * The global receive_buffers counters cover all connections; the memory
+ * used by the connections of a single source is reported by the
+ * LogProtoBufferStats set by log_proto_set_buffer_stats().
+ */
+
+#define LOG_PROTO_BUFFER_POOL_MAX (16 * 1024 * 1024)
+
+static GStaticMutex buffer_pool_lock = G_STATIC_MUTEX_INIT;
+/* size -> GTrashStack of free buffers */
+static GHashTable *buffer_pool;
+static gsize buffer_pool_size;
+static StatsCounterItem *buffers_in_use;
+static StatsCounterItem *buffers_pooled;
+
+LogProtoBufferStats *
+log_proto_buffer_stats_new(void)
+{
+  LogProtoBufferStats *self = g_new0(LogProtoBufferStats, 1);
+
+  g_atomic_counter_set(&self->ref_cnt, 1);
+  return self;
+}
+
+LogProtoBufferStats *
+log_proto_buffer_stats_ref(LogProtoBufferStats *self)
+{
+  if (self)
+    g_atomic_counter_inc(&self->ref_cnt);
+  return self;
+}
+
+void
+log_proto_buffer_stats_unref(LogProtoBufferStats *self)
+{
+  if (self && g_atomic_counter_dec_and_test(&self->ref_cnt))
+    g_free(self);
+}
+
+void
+log_proto_buffer_stats_register(LogProtoBufferStats *self, gint level, gint source, const gchar *id)
+{
+  stats_lock();
+  stats_register_counter(level, source, id, "receive_buffers", SC_TYPE_MEMORY, &self->in_use);
+  stats_counter_add(self->in_use, g_atomic_counter_get(&self->in_use_bytes));
+  stats_unlock();
+}
+
+void
+log_proto_buffer_stats_unregister(LogProtoBufferStats *self, gint source, const gchar *id)
+{
+  stats_lock();
+  /* the counter itself survives, don't leave our share in it */
+  stats_counter_add(self->in_use, -g_atomic_counter_get(&self->in_use_bytes));
+  stats_unregister_counter(source, id, "receive_buffers", SC_TYPE_MEMORY, &self->in_use);
+  stats_unlock();
+}
+
+static void
+log_proto_buffer_stats_account(LogProtoBufferStats *self, gint size)
+{
+  if (!self)
+    return;
+  g_atomic_counter_exchange_and_add(&self->in_use_bytes, size);
+  stats_counter_add(self->in_use, size);
+}
+
+static guchar *
+log_proto_buffer_pool_get(LogProtoBufferStats *buffer_stats, gsize size)
+{
+  GTrashStack *free_buffers;
+  guchar *buffer = NULL;
+
+  g_static_mutex_lock(&buffer_pool_lock);
+  free_buffers = g_hash_table_lookup(buffer_pool, GSIZE_TO_POINTER(size));
+  if (free_buffers)
+    {
+      buffer = g_trash_stack_pop(&free_buffers);
+      g_hash_table_insert(buffer_pool, GSIZE_TO_POINTER(size), free_buffers);
+      buffer_pool_size -= size;
+      stats_counter_add(buffers_pooled, -((gint) size));
+    }
+  g_static_mutex_unlock(&buffer_pool_lock);
+
+  if (!buffer)
+    buffer = g_malloc(size);
+  stats_counter_add(buffers_in_use, size);
+  log_proto_buffer_stats_account(buffer_stats, size);
+  return buffer;
+}
+
+static void
+log_proto_buffer_pool_put(LogProtoBufferStats *buffer_stats, guchar *buffer, gsize size)
+{
+  GTrashStack *free_buffers;
+
+  stats_counter_add(buffers_in_use, -((gint) size));
+  log_proto_buffer_stats_account(buffer_stats, -((gint) size));
+  g_static_mutex_lock(&buffer_pool_lock);
+  if (size >= sizeof(GTrashStack) && buffer_pool_size + size <= LOG_PROTO_BUFFER_POOL_MAX)
+    {
+      free_buffers = g_hash_table_lookup(buffer_pool, GSIZE_TO_POINTER(size));
+      g_trash_stack_push(&free_buffers, buffer);
+      g_hash_table_insert(buffer_pool, GSIZE_TO_POINTER(size), free_buffers);
+      buffer_pool_size += size;
+      stats_counter_add(buffers_pooled, size);
+      buffer = NULL;
+    }
+  g_static_mutex_unlock(&buffer_pool_lock);
+  g_free(buffer);
+}
+
+static guchar *
+log_proto_buffer_pool_resize(LogProtoBufferStats *buffer_stats, guchar *buffer, gsize old_size, gsize new_size)
+{
+  stats_counter_add(buffers_in_use, (gint) new_size - (gint) old_size);
+  log_proto_buffer_stats_account(buffer_stats, (gint) new_size - (gint) old_size);
+  return g_realloc(buffer, new_size);
+}
+
+static void
+log_proto_buffer_pool_free_stack(gpointer key, gpointer value, gpointer user_data)
+{
+  GTrashStack *free_buffers = (GTrashStack *) value;
+
+  while (free_buffers)
+    g_free(g_trash_stack_pop(&free_buffers));
+}
+
+void
+log_proto_global_init(void)
+{
+  buffer_pool = g_hash_table_new(g_direct_hash, g_direct_equal);
+  stats_lock();
+  stats_register_counter(0, SCS_GLOBAL, "receive_buffers", "in_use", SC_TYPE_MEMORY, &buffers_in_use);
+  stats_register_counter(0, SCS_GLOBAL, "receive_buffers", "pooled", SC_TYPE_MEMORY, &buffers_pooled);
+  stats_unlock();
+}
+
+void
+log_proto_global_deinit(void)
+{
+  stats_lock();
+  stats_unregister_counter(SCS_GLOBAL, "receive_buffers", "in_use", SC_TYPE_MEMORY, &buffers_in_use);
+  stats_unregister_counter(SCS_GLOBAL, "receive_buffers", "pooled", SC_TYPE_MEMORY, &buffers_pooled);
+  stats_unlock();
+  g_hash_table_foreach(buffer_pool, log_proto_buffer_pool_free_stack, NULL);
+  g_hash_table_destroy(buffer_pool);
+  buffer_pool = NULL;
+  buffer_pool_size = 0;
+}
+
+void
+log_proto_set_buffer_stats(LogProto *s, LogProtoBufferStats *buffer_stats)
+{
+  log_proto_buffer_stats_unref(s->buffer_stats);
+  s->buffer_stats = log_proto_buffer_stats_ref(buffer_stats);
+}
+
 void
 log_proto_free(LogProto *s)
 {
   if (s->free_fn)
     s->free_fn(s);
+  log_proto_buffer_stats_unref(s->buffer_stats);
   if (s->convert != (GIConv) -1)
     g_iconv_close(s->convert);
   if (s->encoding)
@@ -78,6 +249,8 @@ typedef struct _LogProtoTextClient
   guchar *partial;
   GDestroyNotify partial_free;
   gsize partial_len, partial_pos;
+  /* the transport has buffered data that it couldn't push out yet */
+  gboolean transport_pending;
 } LogProtoTextClient;
 
 static gboolean
@@ -91,7 +264,7 @@ log_proto_text_client_prepare(LogProto *s, gint *fd, GIOCondition *cond)
   /* if there's no pending I/O in the transport layer, then we want to do a write */
   if (*cond == 0)
     *cond = G_IO_OUT;
-  return self->partial != NULL;
+  return self->partial != NULL || self->transport_pending;
 }
 
 static LogProtoStatus
@@ -140,6 +313,38 @@ log_proto_text_client_flush(LogProto *s)
   return LPS_SUCCESS;
 }
 
+/*
+ * Flush method exposed as log_proto_flush(): apart from our own partial
+ * buffer, this also flushes the transport, which is only done here, so
+ * that transports buffering internally are flushed once per batch of
+ * messages written by LogWriter, instead of once for every message.
+ */
+static LogProtoStatus
+log_proto_text_client_flush_output(LogProto *s)
+{
+  LogProtoTextClient *self = (LogProtoTextClient *) s;
+  LogProtoStatus rc;
+
+  rc = log_proto_text_client_flush(s);
+  if (rc != LPS_SUCCESS || self->partial)
+    return rc;
+
+  self->transport_pending = FALSE;
+  if (log_transport_flush(self->super.transport) < 0)
+    {
+      if (errno != EAGAIN && errno != EINTR)
+        {
+          msg_error("I/O error occurred while flushing",
+                    evt_tag_int("fd", self->super.transport->fd),
+                    evt_tag_errno(EVT_TAG_OSERROR, errno),
+                    NULL);
+          return LPS_ERROR;
+        }
+      self->transport_pending = TRUE;
+    }
+  return LPS_SUCCESS;
+}
+
 static LogProtoStatus
 log_proto_text_client_submit_write(LogProto *s, guchar *msg, gsize msg_len, GDestroyNotify msg_free, gint next_state)
 {
@@ -210,7 +415,7 @@ log_proto_text_client_new(LogTransport *transport)
   LogProtoTextClient *self = g_new0(LogProtoTextClient, 1);
 
   self->super.prepare = log_proto_text_client_prepare;
-  self->super.flush = log_proto_text_client_flush;
+  self->super.flush = log_proto_text_client_flush_output;
   self->super.post = log_proto_text_client_post;
   self->super.transport = transport;
   self->super.convert = (GIConv) -1;
@@ -431,6 +636,196 @@ log_proto_file_writer_new(LogTransport *transport, gint flush_lines, gboolean fs
   return &self->super;
 }
 
+typedef struct _LogProtoDGramClient
+{
+  LogProto super;
+  gint buf_size;
+  gint buf_count;
+  gint sent;
+  struct iovec *buffer;
+#if HAVE_SENDMMSG
+  struct mmsghdr *msgs;
+#endif
+} LogProtoDGramClient;
+
+/* sends the buffered datagrams starting at @start, returns the number of datagrams sent */
+static gint
+log_proto_dgram_client_send(LogProtoDGramClient *self, gint start)
+{
+  gint rc;
+
+  do
+    {
+#if HAVE_SENDMMSG
+      rc = sendmmsg(self->super.transport->fd, &self->msgs[start], self->buf_count - start, 0);
+#else
+      rc = send(self->super.transport->fd, self->buffer[start].iov_base, self->buffer[start].iov_len, 0);
+      if (rc >= 0)
+        rc = 1;
+#endif
+    }
+  while (rc < 0 && errno == EINTR);
+  return rc;
+}
+
+/*
+ * log_proto_dgram_client_flush:
+ *
+ * Sends out as many buffered datagrams as the socket accepts, the rest
+ * remains buffered until the next flush.
+ */
+static LogProtoStatus
+log_proto_dgram_client_flush(LogProto *s)
+{
+  LogProtoDGramClient *self = (LogProtoDGramClient *) s;
+  LogProtoStatus status = LPS_SUCCESS;
+  gint sent = 0, rc, i;
+
+  while (sent < self->buf_count)
+    {
+      rc = log_proto_dgram_client_send(self, sent);
+      if (rc > 0)
+        {
+          sent += rc;
+        }
+      else if (rc < 0 && errno == ENOBUFS)
+        {
+          /* NOTE: just like log_transport_plain_write() we drop the
+           * datagram the kernel had no buffer for and go on with the
+           * next one, see the comment there for the reasons. */
+          sent++;
+        }
+      else
+        {
+          if (rc < 0 && errno != EAGAIN)
+            {
+              msg_error("I/O error occurred while writing",
+                        evt_tag_int("fd", self->super.transport->fd),
+                        evt_tag_errno(EVT_TAG_OSERROR, errno),
+                        NULL);
+              status = LPS_ERROR;
+            }
+          break;
+        }
+    }
+
+  for (i = 0; i < sent; i++)
+    g_free(self->buffer[i].iov_base);
+  self->buf_count -= sent;
+  memmove(self->buffer, &self->buffer[sent], self->buf_count * sizeof(self->buffer[0]));
+  self->sent += sent;
+  return status;
+}
+
+/*
+ * log_proto_dgram_client_post:
+ *
+ * Adds a message to the output buffer, the buffer is sent once it is full
+ * (on the next post), or when LogWriter asks for a flush. An error is
+ * only returned if @msg was not consumed, the caller should resend it in
+ * that case.
+ */
+static LogProtoStatus
+log_proto_dgram_client_post(LogProto *s, guchar *msg, gsize msg_len, gboolean *consumed)
+{
+  LogProtoDGramClient *self = (LogProtoDGramClient *) s;
+  LogProtoStatus rc;
+
+  *consumed = FALSE;
+  if (self->buf_count >= self->buf_size)
+    {
+      rc = log_proto_dgram_client_flush(s);
+      if (rc != LPS_SUCCESS || self->buf_count >= self->buf_size)
+        {
+          /* don't consume a new message if flush failed, or even after the flush we don't have any free slots */
+          return rc;
+        }
+    }
+
+  self->buffer[self->buf_count].iov_base = (void *) msg;
+  self->buffer[self->buf_count].iov_len = msg_len;
+  ++self->buf_count;
+  *consumed = TRUE;
+  return LPS_SUCCESS;
+}
+
+static gint
+log_proto_dgram_client_take_sent(LogProto *s)
+{
+  LogProtoDGramClient *self = (LogProtoDGramClient *) s;
+  gint sent = self->sent;
+
+  self->sent = 0;
+  return sent;
+}
+
+static gboolean
+log_proto_dgram_client_prepare(LogProto *s, gint *fd, GIOCondition *cond)
+{
+  LogProtoDGramClient *self = (LogProtoDGramClient *) s;
+
+  *fd = self->super.transport->fd;
+  *cond = self->super.transport->cond;
+
+  /* if there's no pending I/O in the transport layer, then we want to do a write */
+  if (*cond == 0)
+    *cond = G_IO_OUT;
+  return self->buf_count > 0;
+}
+
+static void
+log_proto_dgram_client_free(LogProto *s)
+{
+  LogProtoDGramClient *self = (LogProtoDGramClient *) s;
+  gint i;
+
+  for (i = 0; i < self->buf_count; i++)
+    g_free(self->buffer[i].iov_base);
+  g_free(self->buffer);
+#if HAVE_SENDMMSG
+  g_free(self->msgs);
+#endif
+}
+
+LogProto *
+log_proto_dgram_client_new(LogTransport *transport, gint max_batch)
+{
+  LogProtoDGramClient *self = g_new0(LogProtoDGramClient, 1);
+
+  if (max_batch <= 0)
+    max_batch = 1;
+#ifdef UIO_MAXIOV
+  if (max_batch > UIO_MAXIOV)
+    /* sendmmsg() doesn't send more than this many datagrams in one go */
+    max_batch = UIO_MAXIOV;
+#endif
+
+  self->buf_size = max_batch;
+  self->buffer = g_new0(struct iovec, max_batch);
+#if HAVE_SENDMMSG
+  {
+    gint i;
+
+    /* every message header refers to the iovec with the same index, the
+     * buffered datagrams are always kept at the start of the buffer */
+    self->msgs = g_new0(struct mmsghdr, max_batch);
+    for (i = 0; i < max_batch; i++)
+      {
+        self->msgs[i].msg_hdr.msg_iov = &self->buffer[i];
+        self->msgs[i].msg_hdr.msg_iovlen = 1;
+      }
+  }
+#endif
+  self->super.prepare = log_proto_dgram_client_prepare;
+  self->super.post = log_proto_dgram_client_post;
+  self->super.flush = log_proto_dgram_client_flush;
+  self->super.take_sent = log_proto_dgram_client_take_sent;
+  self->super.free_fn = log_proto_dgram_client_free;
+  self->super.transport = transport;
+  self->super.convert = (GIConv) -1;
+  return &self->super;
+}
+
 
 
 typedef struct _LogProtoBufferedServerState
@@ -625,11 +1020,16 @@ log_proto_buffered_server_convert_from_raw(LogProtoBufferedServer *self, const g
 
               if (state->buffer_size < self->max_buffer_size)
                 {
+                  gsize old_size = state->buffer_size;
+
                   state->buffer_size *= 2;
                   if (state->buffer_size > self->max_buffer_size)
                     state->buffer_size = self->max_buffer_size;
 
-                  self->buffer = g_realloc(self->buffer, state->buffer_size);
+                  if (self->super.flags & LPBS_RELEASE_IDLE_BUFFER)
+                    self->buffer = log_proto_buffer_pool_resize(self->super.buffer_stats, self->buffer, old_size, state->buffer_size);
+                  else
+                    self->buffer = g_realloc(self->buffer, state->buffer_size);
 
                   /* recalculate the out pointer, and add what we have now */
                   ret = -1;
@@ -1058,7 +1458,8 @@ log_proto_buffered_server_prepare(LogProto *s, gint *fd, GIOCondition *cond)
   if (*cond == 0)
     *cond = G_IO_IN;
 
-  return FALSE;
+  /* the transport has data buffered, the fd won't tell us about it */
+  return log_transport_pending(self->super.transport);
 }
 
 
@@ -1104,6 +1505,24 @@ log_proto_buffered_server_fetch_from_buf(LogProtoBufferedServer *self, const guc
   return success;
 }
 
+/*
+ * Called when the transport has no more data to offer: if everything in
+ * the buffer has been processed, it is returned to the pool until the
+ * next chunk arrives.
+ */
+static void
+log_proto_buffered_server_release_idle_buffer(LogProtoBufferedServer *self, LogProtoBufferedServerState *state)
+{
+  if ((self->super.flags & LPBS_RELEASE_IDLE_BUFFER) == 0 || !self->buffer)
+    return;
+
+  if (state->pending_buffer_end != 0 || state->buffer_pos != 0 || state->buffer_cached_eol != 0)
+    return;
+
+  log_proto_buffer_pool_put(self->super.buffer_stats, self->buffer, state->buffer_size);
+  self->buffer = NULL;
+}
+
 /**
  * Returns: TRUE to indicate success, FALSE otherwise. The returned
  * msg can be NULL even if no failure occurred.
@@ -1119,7 +1538,10 @@ log_proto_buffered_server_fetch(LogProto *s, const guchar **msg, gsize *msg_len,
 
   if (G_UNLIKELY(!self->buffer))
     {
-      self->buffer = g_malloc(self->init_buffer_size);
+      if (self->super.flags & LPBS_RELEASE_IDLE_BUFFER)
+        self->buffer = log_proto_buffer_pool_get(self->super.buffer_stats, self->init_buffer_size);
+      else
+        self->buffer = g_malloc(self->init_buffer_size);
       state->buffer_size = self->init_buffer_size;
     }
 
@@ -1173,6 +1595,7 @@ log_proto_buffered_server_fetch(LogProto *s, const guchar **msg, gsize *msg_len,
           if (errno == EAGAIN)
             {
               /* ok we don't have any more data to read, return to main poll loop */
+              log_proto_buffered_server_release_idle_buffer(self, state);
               break;
             }
           else
@@ -1308,7 +1731,15 @@ log_proto_buffered_server_free(LogProto *s)
 
   g_sockaddr_unref(self->prev_saddr);
 
-  g_free(self->buffer);
+  if (self->buffer && (self->super.flags & LPBS_RELEASE_IDLE_BUFFER))
+    {
+      LogProtoBufferedServerState *state = log_proto_buffered_server_get_state(self);
+
+      log_proto_buffer_pool_put(self->super.buffer_stats, self->buffer, state->buffer_size);
+      log_proto_buffered_server_put_state(self);
+    }
+  else
+    g_free(self->buffer);
   if (self->state1)
     {
       g_free(self->state1);
@@ -1824,7 +2255,7 @@ log_proto_framed_client_new(LogTransport *transport)
   LogProtoFramedClient *self = g_new0(LogProtoFramedClient, 1);
 
   self->super.super.prepare = log_proto_text_client_prepare;
-  self->super.super.flush = log_proto_text_client_flush;
+  self->super.super.flush = log_proto_text_client_flush_output;
   self->super.super.post = log_proto_framed_client_post;
   self->super.super.transport = transport;
   self->super.super.convert = (GIConv) -1;
@@ -1873,7 +2304,8 @@ log_proto_framed_server_prepare(LogProto *s, gint *fd, GIOCondition *cond)
   if (*cond == 0)
     *cond = G_IO_IN;
 
-  return FALSE;
+  /* the transport has data buffered, the fd won't tell us about it */
+  return log_transport_pending(self->super.transport);
 }
 
 static LogProtoStatus
@@ -1884,6 +2316,9 @@ log_proto_framed_server_fetch_data(LogProtoFramedServer *self, gboolean *may_rea
   if (self->buffer_pos == self->buffer_end)
     self->buffer_pos = self->buffer_end = 0;
 
+  if (!self->buffer)
+    self->buffer = log_proto_buffer_pool_get(self->super.buffer_stats, self->buffer_size);
+
   if (self->buffer_size == self->buffer_end)
     {
       /* no more space in the buffer, we can't fetch further data. Move the
@@ -1914,6 +2349,12 @@ log_proto_framed_server_fetch_data(LogProtoFramedServer *self, gboolean *may_rea
         {
           /* we need more data to parse this message but the data is not available yet */
           self->half_message_in_buffer = TRUE;
+          if (self->buffer_end == 0)
+            {
+              /* nothing in flight, don't hold a buffer while idle */
+              log_proto_buffer_pool_put(self->super.buffer_stats, self->buffer, self->buffer_size);
+              self->buffer = NULL;
+            }
         }
     }
   else if (rc == 0)
@@ -2008,12 +2449,13 @@ log_proto_framed_server_fetch(LogProto *s, const guchar **msg, gsize *msg_len, G
             {
               /* a larger buffer would have prevented moving of data, grow
                * the buffer up to max_buffer_size */
+              guint32 old_size = self->buffer_size;
 
               self->buffer_size = 16 * (self->frame_len + LPFS_FRAME_BUFFER);
 
               if (self->buffer_size > self->max_buffer_size)
                 self->buffer_size = self->max_buffer_size;
-              self->buffer = g_realloc(self->buffer, self->buffer_size);
+              self->buffer = log_proto_buffer_pool_resize(self->super.buffer_stats, self->buffer, old_size, self->buffer_size);
               msg_debug("Resizing input buffer",
                         evt_tag_int("new_size", self->buffer_size),
                         NULL);
@@ -2080,7 +2522,9 @@ static void
 log_proto_framed_server_free(LogProto *s)
 {
   LogProtoFramedServer *self = (LogProtoFramedServer *) s;
-  g_free(self->buffer);
+
+  if (self->buffer)
+    log_proto_buffer_pool_put(self->super.buffer_stats, self->buffer, self->buffer_size);
 }
 
 LogProto *
@@ -2097,7 +2541,598 @@ log_proto_framed_server_new(LogTransport *transport, gint max_msg_size)
   self->max_msg_size = max_msg_size;
   self->max_buffer_size = max_msg_size * 6;
   self->buffer_size = LPFS_FRAME_BUFFER;
-  self->buffer = g_malloc(self->buffer_size);
   self->half_message_in_buffer = FALSE;
   return &self->super;
 }
+
+/*
+ * Relay protocol
+ *
+ * Used between syslog-ng instances, the client sends messages serialized
+ * by log_msg_write() in batches, the server acknowledges each batch once
+ * all of its messages are queued. Batches that are not acknowledged are
+ * resent over the next connection, see log_proto_take_sent().
+ *
+ * Every batch starts with a header of four 32 bit big endian integers:
+ * LPR_BATCH_MAGIC, the batch id, the number of messages and the length of
+ * the payload. In the payload each message is prefixed by its length as
+ * a 32 bit big endian integer. Acknowledgements are sent back as two 32
+ * bit integers: LPR_ACK_MAGIC and the id of the last batch that was
+ * queued, which acknowledges earlier batches too.
+ */
+
+#define LPR_BATCH_MAGIC   0x534e4742
+#define LPR_ACK_MAGIC     0x534e4741
+#define LPR_HEADER_SIZE   16
+#define LPR_ACK_SIZE      8
+/* the client closes a batch when its payload reaches this size */
+#define LPR_BATCH_SIZE    (1024 * 1024)
+/* the largest batch accepted by the server */
+#define LPR_MAX_BATCH_SIZE (16 * 1024 * 1024)
+
+static inline void
+log_proto_relay_put_uint32(guchar *buf, guint32 value)
+{
+  value = GUINT32_TO_BE(value);
+  memcpy(buf, &value, sizeof(value));
+}
+
+static inline guint32
+log_proto_relay_get_uint32(const guchar *buf)
+{
+  guint32 value;
+
+  memcpy(&value, buf, sizeof(value));
+  return GUINT32_FROM_BE(value);
+}
+
+typedef struct _LogProtoRelayBatch
+{
+  guint32 id;
+  gint msg_count;
+} LogProtoRelayBatch;
+
+typedef struct _LogProtoRelayClient
+{
+  LogProto super;
+  gint batch_lines;
+  guint32 next_batch_id;
+
+  /* the batch being assembled, starting with room for its header */
+  GString *batch;
+  gint batch_count;
+
+  /* batches that are complete but not written out yet */
+  GString *output;
+  gsize output_pos;
+  gboolean transport_pending;
+
+  /* ring buffer of the batches that were not acknowledged yet */
+  LogProtoRelayBatch *window;
+  gint window_size, window_start, window_len;
+
+  guchar ack_buf[LPR_ACK_SIZE];
+  gsize ack_len;
+  gint acked;
+} LogProtoRelayClient;
+
+/* returns FALSE if the batch can't be closed as the window is full */
+static gboolean
+log_proto_relay_client_close_batch(LogProtoRelayClient *self)
+{
+  LogProtoRelayBatch *batch;
+  GString *tmp;
+
+  if (self->batch_count == 0)
+    return TRUE;
+  if (self->window_len >= self->window_size)
+    return FALSE;
+
+  log_proto_relay_put_uint32((guchar *) self->batch->str, LPR_BATCH_MAGIC);
+  log_proto_relay_put_uint32((guchar *) self->batch->str + 4, self->next_batch_id);
+  log_proto_relay_put_uint32((guchar *) self->batch->str + 8, self->batch_count);
+  log_proto_relay_put_uint32((guchar *) self->batch->str + 12, self->batch->len - LPR_HEADER_SIZE);
+
+  if (self->output_pos == self->output->len)
+    {
+      /* nothing waiting to be written, no need to copy */
+      tmp = self->output;
+      self->output = self->batch;
+      self->batch = tmp;
+      self->output_pos = 0;
+    }
+  else
+    {
+      g_string_append_len(self->output, self->batch->str, self->batch->len);
+    }
+  g_string_set_size(self->batch, LPR_HEADER_SIZE);
+
+  batch = &self->window[(self->window_start + self->window_len) % self->window_size];
+  batch->id = self->next_batch_id++;
+  batch->msg_count = self->batch_count;
+  self->window_len++;
+  self->batch_count = 0;
+  return TRUE;
+}
+
+static LogProtoStatus
+log_proto_relay_client_write_output(LogProtoRelayClient *self)
+{
+  gssize rc;
+
+  if (self->output_pos == self->output->len && !self->transport_pending)
+    return LPS_SUCCESS;
+
+  while (self->output_pos < self->output->len)
+    {
+      rc = log_transport_write(self->super.transport, self->output->str + self->output_pos, self->output->len - self->output_pos);
+      if (rc < 0)
+        {
+          if (errno != EAGAIN && errno != EINTR)
+            {
+              msg_error("I/O error occurred while writing",
+                        evt_tag_int("fd", self->super.transport->fd),
+                        evt_tag_errno(EVT_TAG_OSERROR, errno),
+                        NULL);
+              return LPS_ERROR;
+            }
+          return LPS_SUCCESS;
+        }
+      self->output_pos += rc;
+    }
+  g_string_truncate(self->output, 0);
+  self->output_pos = 0;
+
+  self->transport_pending = FALSE;
+  if (log_transport_flush(self->super.transport) < 0)
+    {
+      if (errno != EAGAIN && errno != EINTR)
+        {
+          msg_error("I/O error occurred while flushing",
+                    evt_tag_int("fd", self->super.transport->fd),
+                    evt_tag_errno(EVT_TAG_OSERROR, errno),
+                    NULL);
+          return LPS_ERROR;
+        }
+      self->transport_pending = TRUE;
+    }
+  return LPS_SUCCESS;
+}
+
+/* returns FALSE if @ack_id doesn't refer to an outstanding batch */
+static gboolean
+log_proto_relay_client_ack_batches(LogProtoRelayClient *self, guint32 ack_id)
+{
+  LogProtoRelayBatch *batch;
+  gint i;
+
+  for (i = 0; i < self->window_len; i++)
+    {
+      if (self->window[(self->window_start + i) % self->window_size].id == ack_id)
+        break;
+    }
+  if (i == self->window_len)
+    return FALSE;
+
+  for (; i >= 0; i--)
+    {
+      batch = &self->window[self->window_start];
+      self->acked += batch->msg_count;
+      self->window_start = (self->window_start + 1) % self->window_size;
+      self->window_len--;
+    }
+  return TRUE;
+}
+
+static LogProtoStatus
+log_proto_relay_client_read_acks(LogProtoRelayClient *self)
+{
+  gssize rc;
+
+  /* the server only sends acknowledgements, and only for batches we sent */
+  while (self->window_len > 0)
+    {
+      rc = log_transport_read(self->super.transport, self->ack_buf + self->ack_len, LPR_ACK_SIZE - self->ack_len, NULL);
+      if (rc < 0)
+        {
+          if (errno != EAGAIN && errno != EINTR)
+            {
+              msg_error("I/O error occurred while reading acknowledgements",
+                        evt_tag_int("fd", self->super.transport->fd),
+                        evt_tag_errno(EVT_TAG_OSERROR, errno),
+                        NULL);
+              return LPS_ERROR;
+            }
+          break;
+        }
+      else if (rc == 0)
+        {
+          msg_error("EOF occurred while waiting for acknowledgements",
+                    evt_tag_int("fd", self->super.transport->fd),
+                    evt_tag_int("unacked_batches", self->window_len),
+                    NULL);
+          return LPS_ERROR;
+        }
+
+      self->ack_len += rc;
+      if (self->ack_len < LPR_ACK_SIZE)
+        continue;
+
+      self->ack_len = 0;
+      if (log_proto_relay_get_uint32(self->ack_buf) != LPR_ACK_MAGIC ||
+          !log_proto_relay_client_ack_batches(self, log_proto_relay_get_uint32(self->ack_buf + 4)))
+        {
+          msg_error("Invalid acknowledgement received from relay peer",
+                    evt_tag_int("fd", self->super.transport->fd),
+                    evt_tag_printf("ack", "%08x:%u", log_proto_relay_get_uint32(self->ack_buf), log_proto_relay_get_uint32(self->ack_buf + 4)),
+                    NULL);
+          return LPS_ERROR;
+        }
+    }
+  return LPS_SUCCESS;
+}
+
+static LogProtoStatus
+log_proto_relay_client_flush(LogProto *s)
+{
+  LogProtoRelayClient *self = (LogProtoRelayClient *) s;
+  LogProtoStatus rc;
+
+  /* acknowledgements may free up the window for the current batch */
+  rc = log_proto_relay_client_read_acks(self);
+  if (rc != LPS_SUCCESS)
+    return rc;
+  log_proto_relay_client_close_batch(self);
+  rc = log_proto_relay_client_write_output(self);
+  if (rc != LPS_SUCCESS)
+    return rc;
+  return log_proto_relay_client_read_acks(self);
+}
+
+/*
+ * log_proto_relay_client_post:
+ *
+ * Adds a serialized message to the current batch, which is closed and
+ * sent when it has batch_lines messages or when LogWriter flushes us.
+ * A batch can only be closed while less than window_size batches are
+ * waiting for an acknowledgement, messages are not consumed while the
+ * current batch is full and can't be closed.
+ */
+static LogProtoStatus
+log_proto_relay_client_post(LogProto *s, guchar *msg, gsize msg_len, gboolean *consumed)
+{
+  LogProtoRelayClient *self = (LogProtoRelayClient *) s;
+  guchar len_buf[4];
+  LogProtoStatus rc;
+
+  *consumed = FALSE;
+  rc = log_proto_relay_client_write_output(self);
+  if (rc != LPS_SUCCESS)
+    return rc;
+
+  /* check for acknowledgements once per batch, not for every message */
+  if (self->batch_count == 0 || self->batch_count >= self->batch_lines ||
+      self->batch->len + sizeof(len_buf) + msg_len > LPR_HEADER_SIZE + LPR_BATCH_SIZE)
+    {
+      rc = log_proto_relay_client_read_acks(self);
+      if (rc != LPS_SUCCESS)
+        return rc;
+      if (!log_proto_relay_client_close_batch(self))
+        return LPS_SUCCESS;
+    }
+
+  if (msg_len > LPR_MAX_BATCH_SIZE - sizeof(len_buf))
+    {
+      /* the server would refuse it, send an empty message instead so
+       * that it is still acknowledged in order */
+      msg_error("Message too large for the relay protocol, dropping",
+                evt_tag_int("length", msg_len),
+                evt_tag_int("max_length", LPR_MAX_BATCH_SIZE - sizeof(len_buf)),
+                NULL);
+      msg_len = 0;
+    }
+
+  log_proto_relay_put_uint32(len_buf, msg_len);
+  g_string_append_len(self->batch, (gchar *) len_buf, sizeof(len_buf));
+  g_string_append_len(self->batch, (gchar *) msg, msg_len);
+  g_free(msg);
+  *consumed = TRUE;
+
+  self->batch_count++;
+  if (self->batch_count >= self->batch_lines)
+    log_proto_relay_client_close_batch(self);
+  return log_proto_relay_client_write_output(self);
+}
+
+static gint
+log_proto_relay_client_take_sent(LogProto *s)
+{
+  LogProtoRelayClient *self = (LogProtoRelayClient *) s;
+  gint acked = self->acked;
+
+  self->acked = 0;
+  return acked;
+}
+
+static gboolean
+log_proto_relay_client_prepare(LogProto *s, gint *fd, GIOCondition *cond)
+{
+  LogProtoRelayClient *self = (LogProtoRelayClient *) s;
+
+  *fd = self->super.transport->fd;
+  *cond = 0;
+
+  if (self->output_pos < self->output->len || self->transport_pending ||
+      (self->batch_count > 0 && self->window_len < self->window_size))
+    *cond = self->super.transport->cond ? : G_IO_OUT;
+
+  /* NOTE: while batches are outstanding, we are woken up by their
+   * acknowledgements, new messages in the queue are sent afterwards */
+  if (self->window_len > 0)
+    *cond |= G_IO_IN;
+
+  if (*cond)
+    return TRUE;
+
+  /* if there's no pending I/O in the transport layer, then we want to do a write */
+  *cond = self->super.transport->cond ? : G_IO_OUT;
+  return FALSE;
+}
+
+static void
+log_proto_relay_client_free(LogProto *s)
+{
+  LogProtoRelayClient *self = (LogProtoRelayClient *) s;
+
+  g_string_free(self->batch, TRUE);
+  g_string_free(self->output, TRUE);
+  g_free(self->window);
+}
+
+LogProto *
+log_proto_relay_client_new(LogTransport *transport, gint batch_lines, gint window_size)
+{
+  LogProtoRelayClient *self = g_new0(LogProtoRelayClient, 1);
+
+  self->batch_lines = MAX(batch_lines, 1);
+  self->window_size = MAX(window_size, 1);
+  self->window = g_new0(LogProtoRelayBatch, self->window_size);
+  self->batch = g_string_sized_new(4096);
+  g_string_set_size(self->batch, LPR_HEADER_SIZE);
+  self->output = g_string_sized_new(4096);
+
+  self->super.prepare = log_proto_relay_client_prepare;
+  self->super.post = log_proto_relay_client_post;
+  self->super.flush = log_proto_relay_client_flush;
+  self->super.take_sent = log_proto_relay_client_take_sent;
+  self->super.free_fn = log_proto_relay_client_free;
+  self->super.transport = transport;
+  self->super.convert = (GIConv) -1;
+  return &self->super;
+}
+
+typedef struct _LogProtoRelayServer
+{
+  LogProto super;
+
+  guchar header[LPR_HEADER_SIZE];
+  gsize header_len;
+  guint32 batch_id, batch_count;
+
+  /* the payload of the current batch, only allocated while one is in flight */
+  guchar *payload;
+  guint32 payload_len, payload_end, payload_pos;
+  guint32 fetched, queued;
+
+  GString *acks;
+  gsize acks_pos;
+  gboolean transport_pending;
+} LogProtoRelayServer;
+
+static LogProtoStatus
+log_proto_relay_server_write_acks(LogProtoRelayServer *self)
+{
+  gssize rc;
+
+  while (self->acks_pos < self->acks->len)
+    {
+      rc = log_transport_write(self->super.transport, self->acks->str + self->acks_pos, self->acks->len - self->acks_pos);
+      if (rc < 0)
+        {
+          if (errno != EAGAIN && errno != EINTR)
+            {
+              msg_error("I/O error occurred while sending acknowledgements",
+                        evt_tag_int("fd", self->super.transport->fd),
+                        evt_tag_errno(EVT_TAG_OSERROR, errno),
+                        NULL);
+              return LPS_ERROR;
+            }
+          return LPS_SUCCESS;
+        }
+      self->acks_pos += rc;
+    }
+  g_string_truncate(self->acks, 0);
+  self->acks_pos = 0;
+
+  self->transport_pending = FALSE;
+  if (log_transport_flush(self->super.transport) < 0)
+    {
+      if (errno != EAGAIN && errno != EINTR)
+        return LPS_ERROR;
+      self->transport_pending = TRUE;
+    }
+  return LPS_SUCCESS;
+}
+
+static gboolean
+log_proto_relay_server_prepare(LogProto *s, gint *fd, GIOCondition *cond)
+{
+  LogProtoRelayServer *self = (LogProtoRelayServer *) s;
+
+  *fd = self->super.transport->fd;
+  *cond = self->super.transport->cond;
+
+  /* the current batch has messages we can return without reading */
+  if (self->payload && self->payload_end == self->payload_len && self->fetched < self->batch_count)
+    return TRUE;
+
+  /* if there's no pending I/O in the transport layer, then we want to do a read */
+  if (*cond == 0)
+    *cond = G_IO_IN;
+  if (self->acks_pos < self->acks->len || self->transport_pending)
+    *cond |= G_IO_OUT;
+
+  /* the transport has data buffered, the fd won't tell us about it */
+  return log_transport_pending(self->super.transport);
+}
+
+static gboolean
+log_proto_relay_server_start_batch(LogProtoRelayServer *self)
+{
+  guint32 magic = log_proto_relay_get_uint32(self->header);
+
+  self->batch_id = log_proto_relay_get_uint32(self->header + 4);
+  self->batch_count = log_proto_relay_get_uint32(self->header + 8);
+  self->payload_len = log_proto_relay_get_uint32(self->header + 12);
+  if (magic != LPR_BATCH_MAGIC || self->payload_len > LPR_MAX_BATCH_SIZE ||
+      self->batch_count == 0 || self->batch_count > self->payload_len / 4)
+    {
+      msg_error("Invalid batch header received from relay peer",
+                evt_tag_int("fd", self->super.transport->fd),
+                evt_tag_printf("header", "%08x:%u:%u:%u", magic, self->batch_id, self->batch_count, self->payload_len),
+                NULL);
+      return FALSE;
+    }
+  self->payload = g_malloc(self->payload_len);
+  self->payload_end = self->payload_pos = 0;
+  self->fetched = self->queued = 0;
+  return TRUE;
+}
+
+static LogProtoStatus
+log_proto_relay_server_fetch(LogProto *s, const guchar **msg, gsize *msg_len, GSockAddr **sa, gboolean *may_read)
+{
+  LogProtoRelayServer *self = (LogProtoRelayServer *) s;
+  LogProtoStatus status;
+  guint32 len;
+  gssize rc;
+
+  if (sa)
+    *sa = NULL;
+
+  status = log_proto_relay_server_write_acks(self);
+  if (status != LPS_SUCCESS)
+    return status;
+
+  while (TRUE)
+    {
+      if (self->payload && self->payload_end == self->payload_len)
+        {
+          if (self->fetched < self->batch_count)
+            {
+              if (self->payload_len - self->payload_pos < 4 ||
+                  (len = log_proto_relay_get_uint32(self->payload + self->payload_pos)) > self->payload_len - self->payload_pos - 4)
+                {
+                  msg_error("Invalid message length in relay batch",
+                            evt_tag_int("fd", self->super.transport->fd),
+                            evt_tag_int("batch_id", self->batch_id),
+                            NULL);
+                  return LPS_ERROR;
+                }
+              *msg = self->payload + self->payload_pos + 4;
+              *msg_len = len;
+              self->payload_pos += 4 + len;
+              self->fetched++;
+              return LPS_SUCCESS;
+            }
+
+          /* all messages were queued and acknowledged, don't hold the
+           * payload until the next batch arrives */
+          g_free(self->payload);
+          self->payload = NULL;
+          self->header_len = 0;
+        }
+
+      if (!(*may_read))
+        return LPS_SUCCESS;
+
+      if (!self->payload)
+        rc = log_transport_read(self->super.transport, self->header + self->header_len, LPR_HEADER_SIZE - self->header_len, NULL);
+      else
+        rc = log_transport_read(self->super.transport, self->payload + self->payload_end, self->payload_len - self->payload_end, NULL);
+
+      if (rc < 0)
+        {
+          if (errno != EAGAIN && errno != EINTR)
+            {
+              msg_error("Error reading relay batch",
+                        evt_tag_int("fd", self->super.transport->fd),
+                        evt_tag_errno("error", errno),
+                        NULL);
+              return LPS_ERROR;
+            }
+          return LPS_SUCCESS;
+        }
+      else if (rc == 0)
+        {
+          msg_verbose("EOF occurred while reading",
+                      evt_tag_int(EVT_TAG_FD, self->super.transport->fd),
+                      NULL);
+          return LPS_EOF;
+        }
+
+      if (!self->payload)
+        {
+          self->header_len += rc;
+          if (self->header_len == LPR_HEADER_SIZE && !log_proto_relay_server_start_batch(self))
+            return LPS_ERROR;
+        }
+      else
+        {
+          self->payload_end += rc;
+        }
+    }
+}
+
+/* acknowledge the batch once all of its messages are queued */
+static void
+log_proto_relay_server_queued(LogProto *s)
+{
+  LogProtoRelayServer *self = (LogProtoRelayServer *) s;
+  guchar ack[LPR_ACK_SIZE];
+
+  self->queued++;
+  if (self->queued != self->batch_count)
+    return;
+
+  log_proto_relay_put_uint32(ack, LPR_ACK_MAGIC);
+  log_proto_relay_put_uint32(ack + 4, self->batch_id);
+  g_string_append_len(self->acks, (gchar *) ack, sizeof(ack));
+
+  /* errors are reported by the next fetch() */
+  log_proto_relay_server_write_acks(self);
+}
+
+static void
+log_proto_relay_server_free(LogProto *s)
+{
+  LogProtoRelayServer *self = (LogProtoRelayServer *) s;
+
+  g_free(self->payload);
+  g_string_free(self->acks, TRUE);
+}
+
+LogProto *
+log_proto_relay_server_new(LogTransport *transport)
+{
+  LogProtoRelayServer *self = g_new0(LogProtoRelayServer, 1);
+
+  self->acks = g_string_sized_new(LPR_ACK_SIZE);
+  self->super.prepare = log_proto_relay_server_prepare;
+  self->super.fetch = log_proto_relay_server_fetch;
+  self->super.queued = log_proto_relay_server_queued;
+  self->super.free_fn = log_proto_relay_server_free;
+  self->super.transport = transport;
+  self->super.convert = (GIConv) -1;
+  return &self->super;
+}
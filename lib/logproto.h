@@ -28,6 +28,8 @@
 #include "logtransport.h"
 #include "serialize.h"
 #include "persist-state.h"
+#include "stats.h"
+#include "atomic.h"
 
 typedef struct _LogProto LogProto;
 typedef struct _LogProtoTextServer LogProtoTextServer;
@@ -40,11 +42,32 @@ typedef enum
   LPS_EOF,
 } LogProtoStatus;
 
+/*
+ * Receive buffer memory used by a group of connections (e.g. the ones of a
+ * source driver), reported by the receive_buffers counter of the group.
+ * Protocols keep a reference, so it can outlive the registration of the
+ * counter: connections kept alive across a reload stop reporting.
+ */
+typedef struct _LogProtoBufferStats
+{
+  GAtomicCounter ref_cnt;
+  GAtomicCounter in_use_bytes;
+  StatsCounterItem *in_use;
+} LogProtoBufferStats;
+
+LogProtoBufferStats *log_proto_buffer_stats_new(void);
+LogProtoBufferStats *log_proto_buffer_stats_ref(LogProtoBufferStats *self);
+void log_proto_buffer_stats_unref(LogProtoBufferStats *self);
+void log_proto_buffer_stats_register(LogProtoBufferStats *self, gint level, gint source, const gchar *id);
+void log_proto_buffer_stats_unregister(LogProtoBufferStats *self, gint source, const gchar *id);
+
 struct _LogProto
 {
   LogTransport *transport;
   GIConv convert;
   gchar *encoding;
+  /* receive buffers taken from the shared pool are also accounted here */
+  LogProtoBufferStats *buffer_stats;
   LogProtoStatus status;
   guint16 flags;
   /* FIXME: rename to something else */
@@ -54,7 +77,11 @@ struct _LogProto
   LogProtoStatus (*fetch)(LogProto *s, const guchar **msg, gsize *msg_len, GSockAddr **sa, gboolean *may_read);
   void (*queued)(LogProto *s);
   LogProtoStatus (*post)(LogProto *s, guchar *msg, gsize msg_len, gboolean *consumed);
+  /* optional, for protocols that need the address of the original sender too */
+  LogProtoStatus (*post_from)(LogProto *s, GSockAddr *saddr, guchar *msg, gsize msg_len, gboolean *consumed);
   LogProtoStatus (*flush)(LogProto *s);
+  /* returns the number of consumed messages that were actually sent since the last call */
+  gint (*take_sent)(LogProto *s);
   void (*free_fn)(LogProto *s);
 };
 
@@ -95,6 +122,35 @@ log_proto_post(LogProto *s, guchar *msg, gsize msg_len, gboolean *consumed)
   return s->post(s, msg, msg_len, consumed);
 }
 
+/* @saddr is the address the message was received from, it may be NULL */
+static inline LogProtoStatus
+log_proto_post_from(LogProto *s, GSockAddr *saddr, guchar *msg, gsize msg_len, gboolean *consumed)
+{
+  if (s->post_from)
+    return s->post_from(s, saddr, msg, msg_len, consumed);
+  return s->post(s, msg, msg_len, consumed);
+}
+
+/*
+ * Protocols that implement take_sent() keep the messages they consumed in
+ * post() buffered, the caller must not ack them until this function
+ * reports them as sent. Messages are always sent in the order they were
+ * posted.
+ */
+static inline gboolean
+log_proto_has_delayed_ack(LogProto *s)
+{
+  return s->take_sent != NULL;
+}
+
+static inline gint
+log_proto_take_sent(LogProto *s)
+{
+  if (s->take_sent)
+    return s->take_sent(s);
+  return 0;
+}
+
 static inline LogProtoStatus
 log_proto_fetch(LogProto *s, const guchar **msg, gsize *msg_len, GSockAddr **sa, gboolean *may_read)
 {
@@ -117,14 +173,31 @@ log_proto_get_fd(LogProto *s)
   return s->transport->fd;
 }
 
+/* the kernel receive timestamp of the message returned by the last
+ * fetch(), only available for datagram transports */
+static inline gboolean
+log_proto_get_recvd(LogProto *s, GTimeVal *recvd)
+{
+  /* FIXME: Layering violation, see log_proto_get_fd() */
+  if (s->transport->recvd.tv_sec == 0)
+    return FALSE;
+  *recvd = s->transport->recvd;
+  return TRUE;
+}
+
 static inline void
 log_proto_reset_error(LogProto *s)
 {
   s->status = LPS_SUCCESS;
 }
 
+void log_proto_global_init(void);
+void log_proto_global_deinit(void);
+
 gint log_proto_get_char_size_for_fixed_encoding(const gchar *encoding);
 gboolean log_proto_set_encoding(LogProto *s, const gchar *encoding);
+/* has to be called before the first fetch(), while no buffer is held */
+void log_proto_set_buffer_stats(LogProto *s, LogProtoBufferStats *buffer_stats);
 void log_proto_free(LogProto *s);
 
 /* flags for log proto plain server */
@@ -141,6 +214,9 @@ void log_proto_free(LogProto *s);
 
 /* don't treat NL and NUL characters as message terminators, they should be left alone */
 #define LPRS_BINARY         0x0010
+/* return the buffer to the shared pool whenever all input is processed,
+ * so that idle connections don't hold one */
+#define LPBS_RELEASE_IDLE_BUFFER 0x0020
 
 /*
  * LogProtoRecordServer
@@ -172,10 +248,25 @@ LogProto *log_proto_file_writer_new(LogTransport *transport, gint flush_lines, g
  */
 LogProto *log_proto_text_client_new(LogTransport *transport);
 
+/*
+ * LogProtoDGramClient
+ *
+ * This class sends each message as a separate datagram, collecting at
+ * most max_batch of them and sending them using a single sendmmsg() call.
+ */
+LogProto *log_proto_dgram_client_new(LogTransport *transport, gint max_batch);
+
 /* framed */
 LogProto *log_proto_framed_client_new(LogTransport *transport);
 
 void log_proto_framed_server_set_buffer_sizes(LogProto *s, guint32 buffer_size, guint32 max_buffer_size);
 LogProto *log_proto_framed_server_new(LogTransport *transport, gint max_msg_size);
 
+/*
+ * relay: batches of serialized messages, acknowledged by the server once
+ * queued, used between syslog-ng instances
+ */
+LogProto *log_proto_relay_client_new(LogTransport *transport, gint batch_lines, gint window_size);
+LogProto *log_proto_relay_server_new(LogTransport *transport);
+
 #endif
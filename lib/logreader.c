@@ -46,6 +46,10 @@
 #include <iv.h>
 #include <iv_work.h>
 
+/* the number of value and tag names a serialized peer may add to the
+ * global registries, which never shrink */
+#define LOG_READER_MAX_SERIALIZED_NAMES 1024
+
 /**
  * FIXME: LogReader has grown big enough that it is difficult to
  * maintain it. The root of the problem is a design issue, instead of
@@ -102,6 +106,7 @@ struct _LogReader
   GCond *pending_proto_cond;
   GStaticMutex pending_proto_lock;
   LogProto *pending_proto;
+  gint serialized_names_left;
 };
 
 static gboolean log_reader_fetch_log(LogReader *self);
@@ -531,10 +536,36 @@ log_reader_handle_line(LogReader *self, const guchar *line, gint length, GSockAd
   msg_debug("Incoming log entry", 
             evt_tag_printf("line", "%.*s", length, line),
             NULL);
-  /* use the current time to get the time zone offset */
-  m = log_msg_new((gchar *) line, length,
-                  saddr,
-                  &self->options->parse_options);
+  if (self->options->flags & LR_SERIALIZED)
+    {
+      SerializeArchive *sa;
+      gboolean success;
+
+      /* sent by log_msg_write() of another syslog-ng, no parsing needed */
+      m = log_msg_new_empty();
+      sa = serialize_buffer_archive_new((gchar *) line, length);
+      success = log_msg_read(m, sa, &self->serialized_names_left);
+      serialize_archive_free(sa);
+      if (!success)
+        {
+          msg_error("Error deserializing message, dropping",
+                    evt_tag_int("length", length),
+                    NULL);
+          log_msg_unref(m);
+          return log_source_free_to_send(&self->super);
+        }
+    }
+  else
+    {
+      GTimeVal recvd;
+
+      /* prefer the time the kernel received the datagram over the
+       * current time, the latter depends on how busy we are */
+      m = log_msg_new_received((gchar *) line, length,
+                               saddr,
+                               log_proto_get_recvd(self->proto, &recvd) ? &recvd : NULL,
+                               &self->options->parse_options);
+    }
 
   log_msg_refcache_start_producer(m);
   if (!m->saddr && self->peer_addr)
@@ -805,6 +836,7 @@ log_reader_new(LogProto *proto)
   self->proto = proto;
   self->immediate_check = FALSE;
   self->pollable_state = -1;
+  self->serialized_names_left = LOG_READER_MAX_SERIALIZED_NAMES;
   log_reader_init_watches(self);
   g_static_mutex_init(&self->pending_proto_lock);
   self->pending_proto_cond = g_cond_new();
@@ -169,15 +169,23 @@ log_source_mangle_hostname(LogSource *self, LogMessage *msg)
     }
 }
 
-gboolean
-log_source_init(LogPipe *s)
+static void
+log_source_register_stats(LogSource *self)
 {
-  LogSource *self = (LogSource *) s;
-
   stats_lock();
   stats_register_counter(self->stats_level, self->stats_source | SCS_SOURCE, self->stats_id, self->stats_instance, SC_TYPE_PROCESSED, &self->recvd_messages);
   stats_register_counter(self->stats_level, self->stats_source | SCS_SOURCE, self->stats_id, self->stats_instance, SC_TYPE_STAMP, &self->last_message_seen);
   stats_unlock();
+  self->stats_registered = TRUE;
+}
+
+gboolean
+log_source_init(LogPipe *s)
+{
+  LogSource *self = (LogSource *) s;
+
+  if (!self->options->defer_stats)
+    log_source_register_stats(self);
   return TRUE;
 }
 
@@ -186,10 +194,14 @@ log_source_deinit(LogPipe *s)
 {
   LogSource *self = (LogSource *) s;
   
+  if (!self->stats_registered)
+    return TRUE;
+
   stats_lock();
   stats_unregister_counter(self->stats_source | SCS_SOURCE, self->stats_id, self->stats_instance, SC_TYPE_PROCESSED, &self->recvd_messages);
   stats_unregister_counter(self->stats_source | SCS_SOURCE, self->stats_id, self->stats_instance, SC_TYPE_STAMP, &self->last_message_seen);
   stats_unlock();
+  self->stats_registered = FALSE;
   return TRUE;
 }
 
@@ -285,6 +297,8 @@ log_source_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options
 
   g_assert(old_window_size > 0);
 
+  if (G_UNLIKELY(!self->stats_registered))
+    log_source_register_stats(self);
   stats_counter_inc(self->recvd_messages);
   stats_counter_set(self->last_message_seen, msg->timestamps[LM_TS_RECVD].tv_sec);
   log_pipe_forward_msg(s, msg, &local_options);
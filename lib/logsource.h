@@ -46,6 +46,9 @@ typedef struct _LogSourceOptions
   gint host_override_len;
   LogTagId source_group_tag;
   GArray *tags;
+  /* register the stats counters of the source only when the first
+   * message arrives, used for short-lived per-connection sources */
+  gboolean defer_stats;
 } LogSourceOptions;
 
 typedef struct _LogSource LogSource;
@@ -70,6 +73,7 @@ struct _LogSource
   GAtomicCounter window_size;
   StatsCounterItem *last_message_seen;
   StatsCounterItem *recvd_messages;
+  gboolean stats_registered;
   guint32 last_ack_count;
   guint32 ack_count;
   glong window_full_sleep_nsec;
@@ -25,7 +25,7 @@
 #include "logstamp.h"
 #include "messages.h"
 #include "timeutils.h"
-#include "str-format.h"
+#include "tls-support.h"
 
 static void
 log_stamp_append_frac_digits(LogStamp *stamp, GString *target, gint frac_digits)
@@ -48,86 +48,96 @@ log_stamp_append_frac_digits(LogStamp *stamp, GString *target, gint frac_digits)
     }
 }
 
-/** 
- * log_stamp_format:
- * @stamp: Timestamp to format
- * @target: Target storage for formatted timestamp
- * @ts_format: Specifies basic timestamp format (TS_FMT_BSD, TS_FMT_ISO)
- * @zone_offset: Specifies custom zone offset if @tz_convert == TZ_CNV_CUSTOM
- *
- * Emits the formatted version of @stamp into @target as specified by
- * @ts_format and @tz_convert. 
- **/
-void
-log_stamp_append_format(LogStamp *stamp, GString *target, gint ts_format, glong zone_offset, gint frac_digits)
+/* the rendered form of the last timestamp formatted by the current
+ * thread, one for each ts_format. As most messages arrive within the
+ * same second, only the fraction of a second needs to be appended. */
+typedef struct _LogStampFormatCache
+{
+  time_t tv_sec;
+  glong zone_offset;
+  gint prefix_len;
+  gchar prefix[32];
+  gint suffix_len;
+  gchar suffix[16];
+} LogStampFormatCache;
+
+TLS_BLOCK_START
+{
+  LogStampFormatCache stamp_format_cache[TS_FMT_UNIX + 1];
+}
+TLS_BLOCK_END;
+
+#define stamp_format_cache __tls_deref(stamp_format_cache)
+
+static void
+log_stamp_format_cache_fill(LogStampFormatCache *cache, LogStamp *stamp, gint ts_format, glong target_zone_offset)
 {
-  glong target_zone_offset = 0;
   struct tm *tm, tm_storage;
-  char buf[8];
   time_t t;
-  
-  if (zone_offset != -1)
-    target_zone_offset = zone_offset;
-  else
-    target_zone_offset = stamp->zone_offset;
 
   t = stamp->tv_sec + target_zone_offset;
   cached_gmtime(&t, &tm_storage);
   tm = &tm_storage;
+
+  cache->suffix_len = 0;
   switch (ts_format)
     {
     case TS_FMT_BSD:
-      g_string_append(target, month_names_abbrev[tm->tm_mon]);
-      g_string_append_c(target, ' ');
-      format_uint32_padded(target, 2, ' ', 10, tm->tm_mday);
-      g_string_append_c(target, ' ');
-      format_uint32_padded(target, 2, '0', 10, tm->tm_hour);
-      g_string_append_c(target, ':');
-      format_uint32_padded(target, 2, '0', 10, tm->tm_min);
-      g_string_append_c(target, ':');
-      format_uint32_padded(target, 2, '0', 10, tm->tm_sec);
-      log_stamp_append_frac_digits(stamp, target, frac_digits);
+      cache->prefix_len = g_snprintf(cache->prefix, sizeof(cache->prefix), "%s %2d %02d:%02d:%02d",
+                                     month_names_abbrev[tm->tm_mon], tm->tm_mday,
+                                     tm->tm_hour, tm->tm_min, tm->tm_sec);
       break;
     case TS_FMT_ISO:
-      format_uint32_padded(target, 0, 0, 10, tm->tm_year + 1900);
-      g_string_append_c(target, '-');
-      format_uint32_padded(target, 2, '0', 10, tm->tm_mon + 1);
-      g_string_append_c(target, '-');
-      format_uint32_padded(target, 2, '0', 10, tm->tm_mday);
-      g_string_append_c(target, 'T');
-      format_uint32_padded(target, 2, '0', 10, tm->tm_hour);
-      g_string_append_c(target, ':');
-      format_uint32_padded(target, 2, '0', 10, tm->tm_min);
-      g_string_append_c(target, ':');
-      format_uint32_padded(target, 2, '0', 10, tm->tm_sec);
-
-      log_stamp_append_frac_digits(stamp, target, frac_digits);
-      format_zone_info(buf, sizeof(buf), target_zone_offset);
-      g_string_append(target, buf);
+      cache->prefix_len = g_snprintf(cache->prefix, sizeof(cache->prefix), "%d-%02d-%02dT%02d:%02d:%02d",
+                                     tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday,
+                                     tm->tm_hour, tm->tm_min, tm->tm_sec);
+      cache->suffix_len = format_zone_info(cache->suffix, sizeof(cache->suffix), target_zone_offset);
       break;
     case TS_FMT_FULL:
-      format_uint32_padded(target, 0, 0, 10, tm->tm_year + 1900);
-      g_string_append_c(target, ' ');
-      g_string_append(target, month_names_abbrev[tm->tm_mon]);
-      g_string_append_c(target, ' ');
-      format_uint32_padded(target, 2, ' ', 10, tm->tm_mday);
-      g_string_append_c(target, ' ');
-      format_uint32_padded(target, 2, '0', 10, tm->tm_hour);
-      g_string_append_c(target, ':');
-      format_uint32_padded(target, 2, '0', 10, tm->tm_min);
-      g_string_append_c(target, ':');
-      format_uint32_padded(target, 2, '0', 10, tm->tm_sec);
-
-      log_stamp_append_frac_digits(stamp, target, frac_digits);
+      cache->prefix_len = g_snprintf(cache->prefix, sizeof(cache->prefix), "%d %s %2d %02d:%02d:%02d",
+                                     tm->tm_year + 1900, month_names_abbrev[tm->tm_mon], tm->tm_mday,
+                                     tm->tm_hour, tm->tm_min, tm->tm_sec);
       break;
     case TS_FMT_UNIX:
-      format_uint32_padded(target, 0, 0, 10, (int) stamp->tv_sec);
-      log_stamp_append_frac_digits(stamp, target, frac_digits);
+      cache->prefix_len = g_snprintf(cache->prefix, sizeof(cache->prefix), "%u", (guint32) stamp->tv_sec);
       break;
     default:
       g_assert_not_reached();
       break;
     }
+  cache->tv_sec = stamp->tv_sec;
+  cache->zone_offset = target_zone_offset;
+}
+
+/** 
+ * log_stamp_format:
+ * @stamp: Timestamp to format
+ * @target: Target storage for formatted timestamp
+ * @ts_format: Specifies basic timestamp format (TS_FMT_BSD, TS_FMT_ISO)
+ * @zone_offset: Specifies custom zone offset if @tz_convert == TZ_CNV_CUSTOM
+ *
+ * Emits the formatted version of @stamp into @target as specified by
+ * @ts_format and @tz_convert. 
+ **/
+void
+log_stamp_append_format(LogStamp *stamp, GString *target, gint ts_format, glong zone_offset, gint frac_digits)
+{
+  LogStampFormatCache *cache;
+  glong target_zone_offset = 0;
+
+  if (zone_offset != -1)
+    target_zone_offset = zone_offset;
+  else
+    target_zone_offset = stamp->zone_offset;
+
+  g_assert(ts_format >= TS_FMT_BSD && ts_format <= TS_FMT_UNIX);
+  cache = &stamp_format_cache[ts_format];
+  if (cache->prefix_len == 0 || cache->tv_sec != stamp->tv_sec || cache->zone_offset != target_zone_offset)
+    log_stamp_format_cache_fill(cache, stamp, ts_format, target_zone_offset);
+
+  g_string_append_len(target, cache->prefix, cache->prefix_len);
+  log_stamp_append_frac_digits(stamp, target, frac_digits);
+  g_string_append_len(target, cache->suffix, cache->suffix_len);
 }
 
 void
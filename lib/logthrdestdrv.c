@@ -0,0 +1,559 @@
+/*
+ * Copyright (c) 2002-2012 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2012 Balázs Scheidler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "logthrdestdrv.h"
+#include "logqueue.h"
+#include "messages.h"
+#include "misc.h"
+#include "scratch-buffers.h"
+
+#define LTD_DEFAULT_RETRIES 3
+
+void
+log_threaded_dest_driver_set_workers(LogDriver *s, gint workers)
+{
+  LogThrDestDriver *self = (LogThrDestDriver *) s;
+
+  self->num_workers = workers;
+}
+
+void
+log_threaded_dest_driver_set_worker_partition_key(LogDriver *s, const gchar *key)
+{
+  LogThrDestDriver *self = (LogThrDestDriver *) s;
+
+  log_template_unref(self->worker_partition_key);
+  self->worker_partition_key = log_template_new(configuration, NULL);
+  log_template_compile(self->worker_partition_key, key, NULL);
+}
+
+void
+log_threaded_dest_driver_set_batch_lines(LogDriver *s, gint batch_lines)
+{
+  LogThrDestDriver *self = (LogThrDestDriver *) s;
+
+  self->batch_lines = batch_lines;
+}
+
+void
+log_threaded_dest_driver_set_batch_timeout(LogDriver *s, gint batch_timeout)
+{
+  LogThrDestDriver *self = (LogThrDestDriver *) s;
+
+  self->batch_timeout = batch_timeout;
+}
+
+void
+log_threaded_dest_driver_set_retries(LogDriver *s, gint num_retries)
+{
+  LogThrDestDriver *self = (LogThrDestDriver *) s;
+
+  if (num_retries < 1)
+    self->num_retries = 1;
+  else
+    self->num_retries = num_retries;
+}
+
+/*
+ * Worker thread
+ */
+
+/* NOTE: must be called with self->lock held */
+static void
+log_threaded_dest_worker_suspend(LogThrDestWorker *self)
+{
+  self->suspended = TRUE;
+  g_get_current_time(&self->suspend_target);
+  g_time_val_add(&self->suspend_target, self->owner->time_reopen * 1000 * 1000); /* the timeout expects microseconds */
+}
+
+static gboolean
+log_threaded_dest_worker_connect(LogThrDestWorker *self)
+{
+  LogThrDestDriver *owner = self->owner;
+
+  if (!self->connected)
+    self->connected = !owner->worker.connect || owner->worker.connect(self);
+  return self->connected;
+}
+
+static void
+log_threaded_dest_worker_disconnect(LogThrDestWorker *self)
+{
+  LogThrDestDriver *owner = self->owner;
+
+  if (self->connected && owner->worker.disconnect)
+    owner->worker.disconnect(self);
+  self->connected = FALSE;
+}
+
+/**
+ * log_threaded_dest_worker_fill_batch:
+ *
+ * Pop messages to self->batch, keeping them on the backlog until the
+ * batch is acked. Once the queue runs empty, the batch is closed unless
+ * batch_timeout() asks to wait for more messages.
+ *
+ * Returns: the number of messages in the batch
+ **/
+static gint
+log_threaded_dest_worker_fill_batch(LogThrDestWorker *self)
+{
+  LogThrDestDriver *owner = self->owner;
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  GTimeVal flush_target;
+  gint batch_size;
+  gint n = 0;
+
+  /* while hunting for the message that failed a batch, send one at a time */
+  batch_size = self->retry_one_by_one > 0 ? 1 : owner->batch_lines;
+
+  g_mutex_lock(self->lock);
+  while (n < batch_size)
+    {
+      /* FIXME: this is a workaround because of the non-proper locking semantics
+       * of the LogQueue.  It might happen that the _queue() method sees 0
+       * elements in the queue, while the thread is still busy processing the
+       * previous message.  In that case arming the parallel push callback is
+       * not needed and will cause assertions to fail.  This is ugly and should
+       * be fixed by properly defining the "blocking" semantics of the LogQueue
+       * object w/o having to rely on user-code messing with parallel push
+       * callbacks. */
+      log_queue_reset_parallel_push(self->queue);
+      if (log_queue_pop_head(self->queue, &self->batch[n], &path_options, TRUE, FALSE))
+        {
+          if (n == 0 && owner->batch_timeout > 0)
+            {
+              g_get_current_time(&flush_target);
+              g_time_val_add(&flush_target, owner->batch_timeout * 1000);
+            }
+          n++;
+          continue;
+        }
+
+      if (n == 0 || owner->batch_timeout <= 0 || self->terminate)
+        break;
+
+      /* the queue ran empty, the _queue() method arms the parallel push
+       * callback, which wakes us up as new messages arrive */
+      if (!g_cond_timed_wait(self->wakeup_cond, self->lock, &flush_target))
+        break;
+    }
+  g_mutex_unlock(self->lock);
+  return n;
+}
+
+/**
+ * log_threaded_dest_worker_flush_batch:
+ *
+ * Deliver the current batch, then ack what was delivered and rewind the
+ * rest of the backlog, so that it is sent again.
+ **/
+static void
+log_threaded_dest_worker_flush_batch(LogThrDestWorker *self, gint batch_len)
+{
+  LogThrDestDriver *owner = self->owner;
+  LogThrDestResult result;
+  gboolean suspend = FALSE;
+  gint delivered = 0;
+  gint dropped = 0;
+  gint i;
+
+  result = owner->worker.insert(self, self->batch, batch_len, &delivered);
+  if (result == LTD_SUCCESS)
+    delivered = batch_len;
+  delivered = CLAMP(delivered, 0, batch_len);
+
+  /* the backlog holds its own references */
+  for (i = 0; i < batch_len; i++)
+    log_msg_unref(self->batch[i]);
+
+  if (self->retry_one_by_one > 0)
+    self->retry_one_by_one = MAX(self->retry_one_by_one - delivered, 0);
+
+  switch (result)
+    {
+    case LTD_SUCCESS:
+      self->failed_attempts = 0;
+      break;
+
+    case LTD_ERROR:
+      if (batch_len - delivered > 1)
+        {
+          /* a single bad message fails the whole batch, retry the rest
+           * one-by-one, so that only the offending message is dropped */
+          msg_notice("Error delivering a batch of messages, retrying them one-by-one",
+                     evt_tag_str("driver", owner->super.super.id),
+                     evt_tag_int("worker", self->index),
+                     evt_tag_int("batch_size", batch_len - delivered),
+                     NULL);
+          self->retry_one_by_one = batch_len - delivered;
+        }
+      else if (++self->failed_attempts >= owner->num_retries)
+        {
+          msg_error("Multiple failures while delivering this message, message dropped",
+                    evt_tag_str("driver", owner->super.super.id),
+                    evt_tag_int("worker", self->index),
+                    evt_tag_int("attempts", owner->num_retries),
+                    NULL);
+          stats_counter_inc(owner->dropped_messages);
+          self->failed_attempts = 0;
+          if (self->retry_one_by_one > 0)
+            self->retry_one_by_one--;
+          dropped = 1;
+        }
+      else
+        {
+          suspend = TRUE;
+        }
+      break;
+
+    case LTD_NOT_CONNECTED:
+      /* the driver has already logged the error */
+      log_threaded_dest_worker_disconnect(self);
+      suspend = TRUE;
+      break;
+    }
+
+  g_mutex_lock(self->lock);
+  /* FIXME: see the same reset in log_threaded_dest_worker_fill_batch() */
+  log_queue_reset_parallel_push(self->queue);
+  log_queue_ack_backlog(self->queue, delivered + dropped);
+  log_queue_rewind_backlog(self->queue);
+  if (suspend)
+    log_threaded_dest_worker_suspend(self);
+  g_mutex_unlock(self->lock);
+
+  for (i = 0; i < delivered + dropped; i++)
+    step_sequence_number(&self->seq_num);
+
+  if (delivered > 0)
+    {
+      GTimeVal now;
+
+      /* cached_g_current_time() is not thread safe */
+      g_get_current_time(&now);
+      stats_counter_add(owner->processed_messages, delivered);
+      stats_counter_set(owner->last_delivery, now.tv_sec);
+    }
+}
+
+static gpointer
+log_threaded_dest_worker_thread(gpointer arg)
+{
+  LogThrDestWorker *self = (LogThrDestWorker *) arg;
+  LogThrDestDriver *owner = self->owner;
+
+  msg_debug("Worker thread started",
+            evt_tag_str("driver", owner->super.super.id),
+            evt_tag_int("worker", self->index),
+            NULL);
+
+  if (owner->worker.thread_init)
+    owner->worker.thread_init(self);
+
+  while (!self->terminate)
+    {
+      gint batch_len;
+
+      g_mutex_lock(self->lock);
+      if (self->suspended)
+        {
+          /* we got suspended, probably because of a connection error,
+           * during this time we only get wakeups if we need to be
+           * terminated. */
+          if (!self->terminate)
+            g_cond_timed_wait(self->wakeup_cond, self->lock, &self->suspend_target);
+          self->suspended = FALSE;
+        }
+      else if (log_queue_get_length(self->queue) == 0)
+        {
+          /* nothing to deliver, wait until the parallel push callback
+           * wakes us up */
+          if (!self->terminate)
+            g_cond_wait(self->wakeup_cond, self->lock);
+        }
+      g_mutex_unlock(self->lock);
+
+      /* we loop back to check if the thread was requested to terminate */
+      if (self->terminate)
+        break;
+
+      if (!log_threaded_dest_worker_connect(self))
+        {
+          g_mutex_lock(self->lock);
+          log_threaded_dest_worker_suspend(self);
+          g_mutex_unlock(self->lock);
+          continue;
+        }
+
+      /* a batch that was popped before termination was requested is
+       * still delivered, or rewound to the queue if that fails */
+      batch_len = log_threaded_dest_worker_fill_batch(self);
+      if (batch_len > 0)
+        log_threaded_dest_worker_flush_batch(self, batch_len);
+    }
+
+  log_threaded_dest_worker_disconnect(self);
+
+  if (owner->worker.thread_deinit)
+    owner->worker.thread_deinit(self);
+
+  msg_debug("Worker thread finished",
+            evt_tag_str("driver", owner->super.super.id),
+            evt_tag_int("worker", self->index),
+            NULL);
+  return NULL;
+}
+
+/*
+ * Main thread
+ */
+
+static void
+log_threaded_dest_worker_start(LogThrDestWorker *self)
+{
+  self->batch = g_new0(LogMessage *, self->owner->batch_lines);
+  self->terminate = FALSE;
+  self->suspended = FALSE;
+  self->retry_one_by_one = 0;
+  self->thread = create_worker_thread(log_threaded_dest_worker_thread, self, TRUE, NULL);
+}
+
+static void
+log_threaded_dest_worker_stop(LogThrDestWorker *self)
+{
+  g_mutex_lock(self->lock);
+  self->terminate = TRUE;
+  g_cond_signal(self->wakeup_cond);
+  g_mutex_unlock(self->lock);
+  g_thread_join(self->thread);
+  self->thread = NULL;
+
+  g_free(self->batch);
+  self->batch = NULL;
+}
+
+static void
+log_threaded_dest_driver_init_workers(LogThrDestDriver *self)
+{
+  gint i;
+
+  if (self->workers)
+    return;
+
+  self->workers = g_new0(LogThrDestWorker *, self->num_workers);
+  for (i = 0; i < self->num_workers; i++)
+    {
+      LogThrDestWorker *worker = g_malloc0(self->worker_size);
+
+      worker->owner = self;
+      worker->index = i;
+      worker->lock = g_mutex_new();
+      worker->wakeup_cond = g_cond_new();
+      init_sequence_number(&worker->seq_num);
+      self->workers[i] = worker;
+    }
+}
+
+gboolean
+log_threaded_dest_driver_init_method(LogPipe *s)
+{
+  LogThrDestDriver *self = (LogThrDestDriver *) s;
+  GlobalConfig *cfg = log_pipe_get_config(s);
+  gint i;
+
+  if (self->num_workers < 1)
+    {
+      msg_error("The number of workers must be at least 1",
+                evt_tag_int("workers", self->num_workers),
+                NULL);
+      return FALSE;
+    }
+
+  if (!log_dest_driver_init_method(s))
+    return FALSE;
+
+  if (self->time_reopen == -1)
+    self->time_reopen = cfg->time_reopen;
+  if (self->batch_lines < 1)
+    self->batch_lines = 1;
+  if (self->batch_timeout < 0)
+    self->batch_timeout = 0;
+
+  stats_lock();
+  stats_register_counter(0, self->stats_source | SCS_DESTINATION, self->super.super.id, self->format_stats_instance(self), SC_TYPE_STORED, &self->stored_messages);
+  stats_register_counter(0, self->stats_source | SCS_DESTINATION, self->super.super.id, self->format_stats_instance(self), SC_TYPE_DROPPED, &self->dropped_messages);
+  stats_register_counter(0, self->stats_source | SCS_DESTINATION, self->super.super.id, self->format_stats_instance(self), SC_TYPE_PROCESSED, &self->processed_messages);
+  stats_register_counter(1, self->stats_source | SCS_DESTINATION, self->super.super.id, self->format_stats_instance(self), SC_TYPE_STAMP, &self->last_delivery);
+  stats_unlock();
+
+  log_threaded_dest_driver_init_workers(self);
+  for (i = 0; i < self->num_workers; i++)
+    {
+      LogThrDestWorker *worker = self->workers[i];
+
+      worker->queue = log_dest_driver_acquire_queue(&self->super, (gchar *) self->format_persist_name(self, i));
+      log_queue_set_counters(worker->queue, self->stored_messages, self->dropped_messages);
+      log_threaded_dest_worker_start(worker);
+    }
+
+  msg_verbose("Threaded destination started",
+              evt_tag_str("driver", self->super.super.id),
+              evt_tag_int("workers", self->num_workers),
+              evt_tag_int("batch_lines", self->batch_lines),
+              evt_tag_int("batch_timeout", self->batch_timeout),
+              NULL);
+  return TRUE;
+}
+
+gboolean
+log_threaded_dest_driver_deinit_method(LogPipe *s)
+{
+  LogThrDestDriver *self = (LogThrDestDriver *) s;
+  gboolean success;
+  gint i;
+
+  for (i = 0; i < self->num_workers; i++)
+    {
+      log_threaded_dest_worker_stop(self->workers[i]);
+      log_queue_set_counters(self->workers[i]->queue, NULL, NULL);
+    }
+
+  stats_lock();
+  stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->super.super.id, self->format_stats_instance(self), SC_TYPE_STORED, &self->stored_messages);
+  stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->super.super.id, self->format_stats_instance(self), SC_TYPE_DROPPED, &self->dropped_messages);
+  stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->super.super.id, self->format_stats_instance(self), SC_TYPE_PROCESSED, &self->processed_messages);
+  stats_unregister_counter(self->stats_source | SCS_DESTINATION, self->super.super.id, self->format_stats_instance(self), SC_TYPE_STAMP, &self->last_delivery);
+  stats_unlock();
+
+  /* this saves the queues into the persistent config, our own
+   * references are dropped only afterwards */
+  success = log_dest_driver_deinit_method(s);
+  for (i = 0; i < self->num_workers; i++)
+    {
+      log_queue_unref(self->workers[i]->queue);
+      self->workers[i]->queue = NULL;
+    }
+  return success;
+}
+
+static void
+log_threaded_dest_worker_queue_notify(gpointer user_data)
+{
+  LogThrDestWorker *self = (LogThrDestWorker *) user_data;
+
+  g_mutex_lock(self->lock);
+  g_cond_signal(self->wakeup_cond);
+  log_queue_reset_parallel_push(self->queue);
+  g_mutex_unlock(self->lock);
+}
+
+/*
+ * Messages with the same worker_partition_key() always go to the same
+ * worker, which keeps their order. Without a key, messages are
+ * distributed round-robin.
+ */
+static LogThrDestWorker *
+log_threaded_dest_driver_choose_worker(LogThrDestDriver *self, LogMessage *msg)
+{
+  guint index;
+
+  if (self->num_workers == 1)
+    return self->workers[0];
+
+  if (self->worker_partition_key)
+    {
+      ScratchBuffer *sb = scratch_buffer_acquire();
+
+      log_template_format(self->worker_partition_key, msg, NULL, LTZ_LOCAL, 0, NULL, sb_string(sb));
+      index = g_str_hash(sb_string(sb)->str);
+      scratch_buffer_release(sb);
+    }
+  else
+    {
+      index = (guint) g_atomic_counter_exchange_and_add(&self->next_worker, 1);
+    }
+  return self->workers[index % self->num_workers];
+}
+
+void
+log_threaded_dest_driver_queue_method(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
+{
+  LogThrDestDriver *self = (LogThrDestDriver *) s;
+  LogThrDestWorker *worker;
+  LogPathOptions local_options;
+
+  if (!path_options->flow_control_requested)
+    path_options = log_msg_break_ack(msg, path_options, &local_options);
+
+  worker = log_threaded_dest_driver_choose_worker(self, msg);
+
+  g_mutex_lock(worker->lock);
+  if (log_queue_get_length(worker->queue) == 0 && !worker->suspended)
+    log_queue_set_parallel_push(worker->queue, 1, log_threaded_dest_worker_queue_notify, worker, NULL);
+  g_mutex_unlock(worker->lock);
+
+  log_msg_add_ack(msg, path_options);
+  log_queue_push_tail(worker->queue, log_msg_ref(msg), path_options);
+  log_dest_driver_queue_method(s, msg, path_options, user_data);
+}
+
+void
+log_threaded_dest_driver_free(LogPipe *s)
+{
+  LogThrDestDriver *self = (LogThrDestDriver *) s;
+  gint i;
+
+  for (i = 0; self->workers && i < self->num_workers; i++)
+    {
+      LogThrDestWorker *worker = self->workers[i];
+
+      if (worker->queue)
+        log_queue_unref(worker->queue);
+      g_mutex_free(worker->lock);
+      g_cond_free(worker->wakeup_cond);
+      g_free(worker);
+    }
+  g_free(self->workers);
+  log_template_unref(self->worker_partition_key);
+  log_dest_driver_free(s);
+}
+
+void
+log_threaded_dest_driver_init_instance(LogThrDestDriver *self)
+{
+  log_dest_driver_init_instance(&self->super);
+  self->super.super.super.init = log_threaded_dest_driver_init_method;
+  self->super.super.super.deinit = log_threaded_dest_driver_deinit_method;
+  self->super.super.super.queue = log_threaded_dest_driver_queue_method;
+  self->super.super.super.free_fn = log_threaded_dest_driver_free;
+
+  self->num_workers = 1;
+  self->batch_lines = -1;
+  self->batch_timeout = -1;
+  self->num_retries = LTD_DEFAULT_RETRIES;
+  self->time_reopen = -1;
+  self->worker_size = sizeof(LogThrDestWorker);
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2002-2012 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2012 Balázs Scheidler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#ifndef LOGTHRDESTDRV_H_INCLUDED
+#define LOGTHRDESTDRV_H_INCLUDED
+
+#include "syslog-ng.h"
+#include "driver.h"
+#include "templates.h"
+#include "stats.h"
+#include "atomic.h"
+
+/*
+ * Threaded destination drivers
+ * ============================
+ *
+ * Some destinations (SQL, MongoDB, SMTP) can only be reached through
+ * blocking client libraries, so they can't be driven from the main loop.
+ * LogThrDestDriver runs them in dedicated worker threads instead, and
+ * takes care of everything that is not specific to the destination:
+ *
+ *   - distributing incoming messages among workers() workers, each with
+ *     its own thread and LogQueue (a LogQueue has a single consumer),
+ *     optionally keeping messages with the same worker_partition_key() on
+ *     the same worker,
+ *
+ *   - waking up the worker thread using parallel push notifications,
+ *
+ *   - popping messages in batches of at most batch_lines() messages,
+ *     waiting at most batch_timeout() milliseconds for a batch to fill
+ *     up once the queue runs empty,
+ *
+ *   - acking the delivered part of a batch and rewinding the rest to
+ *     the queue, retrying a failed batch one message at a time so that
+ *     a single bad message is dropped after retries() attempts, and
+ *     suspending the worker for time_reopen() seconds when the
+ *     destination is not reachable,
+ *
+ *   - stored/dropped/processed counters and a timestamp of the last
+ *     delivery, registered with the same layout for every driver.
+ *
+ * Drivers derive from LogThrDestDriver and fill in the "worker" methods,
+ * which are always called from the worker thread. Drivers that need
+ * per-connection state derive from LogThrDestWorker as well and set
+ * worker_size accordingly.
+ */
+
+typedef enum
+{
+  /* all messages of the batch were delivered */
+  LTD_SUCCESS,
+  /* the messages starting with the one at the delivered index failed */
+  LTD_ERROR,
+  /* like LTD_ERROR, but the connection is lost: reconnect after time_reopen() */
+  LTD_NOT_CONNECTED,
+} LogThrDestResult;
+
+typedef struct _LogThrDestDriver LogThrDestDriver;
+typedef struct _LogThrDestWorker LogThrDestWorker;
+
+struct _LogThrDestWorker
+{
+  LogThrDestDriver *owner;
+  gint index;
+
+  /* shared between the main and the worker thread, protected by lock */
+  GThread *thread;
+  GMutex *lock;
+  GCond *wakeup_cond;
+  gboolean terminate;
+  gboolean suspended;
+  GTimeVal suspend_target;
+  LogQueue *queue;
+
+  /* used exclusively by the worker thread */
+  gboolean connected;
+  gint32 seq_num;
+  gint failed_attempts;
+  gint retry_one_by_one;
+  LogMessage **batch;
+};
+
+struct _LogThrDestDriver
+{
+  LogDestDriver super;
+
+  gint num_workers;
+  LogTemplate *worker_partition_key;
+  gint batch_lines;
+  gint batch_timeout;
+  gint num_retries;
+  gint time_reopen;
+
+  gint stats_source;
+  StatsCounterItem *stored_messages;
+  StatsCounterItem *dropped_messages;
+  StatsCounterItem *processed_messages;
+  StatsCounterItem *last_delivery;
+
+  gsize worker_size;
+  LogThrDestWorker **workers;
+  GAtomicCounter next_worker;
+
+  struct
+  {
+    void (*thread_init)(LogThrDestWorker *s);
+    void (*thread_deinit)(LogThrDestWorker *s);
+    gboolean (*connect)(LogThrDestWorker *s);
+    void (*disconnect)(LogThrDestWorker *s);
+    /* sets *delivered to the number of messages at the start of @msgs
+     * that were delivered, in case something else than LTD_SUCCESS is
+     * returned */
+    LogThrDestResult (*insert)(LogThrDestWorker *s, LogMessage **msgs, gint msgs_len, gint *delivered);
+  } worker;
+
+  const gchar *(*format_stats_instance)(LogThrDestDriver *s);
+  const gchar *(*format_persist_name)(LogThrDestDriver *s, gint worker_index);
+};
+
+void log_threaded_dest_driver_set_workers(LogDriver *s, gint workers);
+void log_threaded_dest_driver_set_worker_partition_key(LogDriver *s, const gchar *key);
+void log_threaded_dest_driver_set_batch_lines(LogDriver *s, gint batch_lines);
+void log_threaded_dest_driver_set_batch_timeout(LogDriver *s, gint batch_timeout);
+void log_threaded_dest_driver_set_retries(LogDriver *s, gint num_retries);
+
+gboolean log_threaded_dest_driver_init_method(LogPipe *s);
+gboolean log_threaded_dest_driver_deinit_method(LogPipe *s);
+void log_threaded_dest_driver_queue_method(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data);
+
+void log_threaded_dest_driver_init_instance(LogThrDestDriver *self);
+void log_threaded_dest_driver_free(LogPipe *s);
+
+#endif
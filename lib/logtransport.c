@@ -28,6 +28,9 @@
 
 #include <errno.h>
 #include <ctype.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 void
 log_transport_free_method(LogTransport *s)
@@ -56,8 +59,13 @@ typedef struct _LogTransportPlain LogTransportPlain;
 struct _LogTransportPlain
 {
   LogTransport super;
+  /* sender addresses of LTF_RECV transports */
+  GSockAddrInternTable *peer_addrs;
 };
 
+/* the number of distinct senders remembered by a datagram transport */
+#define LOG_TRANSPORT_MAX_PEER_ADDRS 8192
+
 static gssize
 log_transport_plain_read_method(LogTransport *s, gpointer buf, gsize buflen, GSockAddr **sa)
 {
@@ -99,16 +107,52 @@ log_transport_plain_read_method(LogTransport *s, gpointer buf, gsize buflen, GSo
         struct sockaddr __sa;
       } sas;
       
-      socklen_t salen = sizeof(sas);
+      struct iovec iov;
+      struct msghdr msg;
+#ifdef SCM_TIMESTAMPNS
+      struct cmsghdr *cmsg;
+      union
+      {
+        struct cmsghdr __align;
+        gchar buf[CMSG_SPACE(sizeof(struct timespec))];
+      } control;
+#endif
+
+      iov.iov_base = buf;
+      iov.iov_len = buflen;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_name = &sas;
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
 
       do
         {
-          rc = recvfrom(self->super.fd, buf, buflen, 0, 
-                        (struct sockaddr *) &sas, &salen);
+          msg.msg_namelen = sizeof(sas);
+#ifdef SCM_TIMESTAMPNS
+          msg.msg_control = &control;
+          msg.msg_controllen = sizeof(control);
+#endif
+          rc = recvmsg(self->super.fd, &msg, 0);
         }
       while (rc == -1 && errno == EINTR);
-      if (rc != -1 && salen && sa)
-        (*sa) = g_sockaddr_new((struct sockaddr *) &sas, salen);
+      if (rc != -1 && msg.msg_namelen && sa)
+        (*sa) = g_sockaddr_intern(self->peer_addrs, (struct sockaddr *) &sas, msg.msg_namelen);
+
+      self->super.recvd.tv_sec = 0;
+#ifdef SCM_TIMESTAMPNS
+      for (cmsg = rc != -1 ? CMSG_FIRSTHDR(&msg) : NULL; cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+          if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+            {
+              struct timespec ts;
+
+              memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+              self->super.recvd.tv_sec = ts.tv_sec;
+              self->super.recvd.tv_usec = ts.tv_nsec / 1000;
+              break;
+            }
+        }
+#endif
     }
   return rc;
 }
@@ -184,6 +228,16 @@ log_transport_plain_write_method(LogTransport *s, const gpointer buf, gsize bufl
 }
 
 
+static void
+log_transport_plain_free_method(LogTransport *s)
+{
+  LogTransportPlain *self = (LogTransportPlain *) s;
+
+  if (self->peer_addrs)
+    g_sockaddr_intern_table_free(self->peer_addrs);
+  log_transport_free_method(s);
+}
+
 LogTransport *
 log_transport_plain_new(gint fd, guint flags)
 {
@@ -194,7 +248,9 @@ log_transport_plain_new(gint fd, guint flags)
   self->super.flags = flags;
   self->super.read = log_transport_plain_read_method;
   self->super.write = log_transport_plain_write_method;
-  self->super.free_fn = log_transport_free_method;
+  self->super.free_fn = log_transport_plain_free_method;
+  if (flags & LTF_RECV)
+    self->peer_addrs = g_sockaddr_intern_table_new(LOG_TRANSPORT_MAX_PEER_ADDRS);
   return &self->super;
 }
 
@@ -34,7 +34,8 @@
 /* reseek to the end-of-file before writing */
 #define LTF_APPEND    0x0004
 
-/* use recv() instead of read() */
+/* use recvmsg() instead of read(), reports the sender address and the
+ * receive timestamp if the socket has SO_TIMESTAMPNS enabled */
 #define LTF_RECV      0x0008
 
 /* issue a shutdown() when LogTransport is destructed, only works if LTF_DONTCLOSE is unset */
@@ -54,8 +55,17 @@ struct _LogTransport
   GIOCondition cond;
   guint flags;
   gint timeout;
+  /* kernel receive timestamp of the datagram returned by the last read(),
+   * tv_sec is 0 if the transport doesn't provide one */
+  GTimeVal recvd;
   gssize (*read)(LogTransport *self, gpointer buf, gsize count, GSockAddr **sa);
   gssize (*write)(LogTransport *self, const gpointer buf, gsize count);
+  /* optional, push out data buffered by the transport itself (e.g.
+   * compression), returns -1/EAGAIN if it could only partially be done */
+  gssize (*flush)(LogTransport *self);
+  /* optional, TRUE if read() can return data without the fd becoming
+   * readable (e.g. decompressed data that didn't fit the last read) */
+  gboolean (*pending)(LogTransport *self);
   void (*free_fn)(LogTransport *self);
 };
 
@@ -71,6 +81,20 @@ log_transport_read(LogTransport *self, gpointer buf, gsize count, GSockAddr **sa
   return self->read(self, buf, count, sa);
 }
 
+static inline gssize
+log_transport_flush(LogTransport *self)
+{
+  if (!self->flush)
+    return 0;
+  return self->flush(self);
+}
+
+static inline gboolean
+log_transport_pending(LogTransport *self)
+{
+  return self->pending && self->pending(self);
+}
+
 LogTransport *log_transport_plain_new(gint fd, guint flags);
 void log_transport_free(LogTransport *s);
 void log_transport_free_method(LogTransport *s);
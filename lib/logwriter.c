@@ -84,6 +84,8 @@ struct _LogWriter
   gboolean work_result;
   gint pollable_state;
   LogProto *proto, *pending_proto;
+  /* messages consumed by a buffering LogProto, but not yet sent */
+  struct iv_list_head unacked;
   gboolean watches_running:1, suspended:1, working:1, flush_waiting_for_timeout:1;
   gboolean pending_proto_present;
   GCond *pending_proto_cond;
@@ -119,6 +121,7 @@ static void log_writer_start_watches(LogWriter *self);
 static void log_writer_stop_watches(LogWriter *self);
 static void log_writer_update_watches(LogWriter *self);
 static void log_writer_suspend(LogWriter *self);
+static void log_writer_free_proto(LogWriter *self);
 
 static void
 log_writer_work_perform(gpointer s)
@@ -146,7 +149,7 @@ log_writer_work_finished(gpointer s)
 
       g_static_mutex_lock(&self->pending_proto_lock);
       if (self->proto)
-        log_proto_free(self->proto);
+        log_writer_free_proto(self);
 
       self->proto = self->pending_proto;
       self->pending_proto = NULL;
@@ -778,6 +781,17 @@ log_writer_format_log(LogWriter *self, LogMessage *lm, GString *result)
 
   g_string_truncate(result, 0);
 
+  if (self->flags & LW_SERIALIZED)
+    {
+      SerializeArchive *sa;
+
+      /* the whole message is forwarded, templates don't apply */
+      sa = serialize_string_archive_new(result);
+      log_msg_write(lm, sa);
+      serialize_archive_free(sa);
+      return;
+    }
+
   if ((self->flags & LW_SYSLOG_PROTOCOL) || (self->options->options & LWO_SYSLOG_PROTOCOL))
     {
       gint len;
@@ -821,11 +835,11 @@ log_writer_format_log(LogWriter *self, LogMessage *lm, GString *result)
           g_string_append_c(result, ' ');
           if (lm->flags & LF_UTF8)
             g_string_append_len(result, "\xEF\xBB\xBF", 3);
-          log_template_append_format(self->options->template, lm, 
-                                     &self->options->template_options,
-                                     LTZ_SEND,
-                                     seq_num, NULL,
-                                     result);
+          log_template_append_format_cached(self->options->template, lm,
+                                            &self->options->template_options,
+                                            LTZ_SEND,
+                                            seq_num, NULL,
+                                            result);
         }
       else
         {
@@ -863,11 +877,11 @@ log_writer_format_log(LogWriter *self, LogMessage *lm, GString *result)
       
       if (template)
         {
-          log_template_format(template, lm, 
-                              &self->options->template_options,
-                              LTZ_SEND,
-                              seq_num, NULL,
-                              result);
+          log_template_format_cached(template, lm,
+                                     &self->options->template_options,
+                                     LTZ_SEND,
+                                     seq_num, NULL,
+                                     result);
 
         }
       else 
@@ -940,6 +954,69 @@ log_writer_format_log(LogWriter *self, LogMessage *lm, GString *result)
     }
 }
 
+/* keep @lm around until the LogProto reports that it was sent */
+static void
+log_writer_keep_unacked(LogWriter *self, LogMessage *lm, const LogPathOptions *path_options)
+{
+  LogMessageQueueNode *node;
+
+  node = log_msg_alloc_queue_node(lm, path_options);
+  iv_list_add_tail(&node->list, &self->unacked);
+}
+
+/* ack the first @sent messages kept by log_writer_keep_unacked() */
+static void
+log_writer_ack_sent(LogWriter *self, gint sent)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessageQueueNode *node;
+  LogMessage *lm;
+
+  while (sent > 0)
+    {
+      g_assert(!iv_list_empty(&self->unacked));
+
+      node = iv_list_entry(self->unacked.next, LogMessageQueueNode, list);
+      lm = node->msg;
+      path_options.ack_needed = node->ack_needed;
+      iv_list_del(&node->list);
+      log_msg_free_queue_node(node);
+
+      log_msg_ack(lm, &path_options);
+      log_msg_unref(lm);
+      sent--;
+    }
+}
+
+/*
+ * Frees the current LogProto instance. Messages it consumed but couldn't
+ * send are put back to the head of our queue, so they are resent using
+ * the next LogProto instance. Must be called with the watches stopped.
+ */
+static void
+log_writer_free_proto(LogWriter *self)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  LogMessageQueueNode *node;
+  LogMessage *lm;
+
+  log_writer_ack_sent(self, log_proto_take_sent(self->proto));
+  log_proto_free(self->proto);
+  self->proto = NULL;
+
+  /* walk backwards, as push_head() reverses the order */
+  while (!iv_list_empty(&self->unacked))
+    {
+      node = iv_list_entry(self->unacked.prev, LogMessageQueueNode, list);
+      lm = node->msg;
+      path_options.ack_needed = node->ack_needed;
+      iv_list_del(&node->list);
+      log_msg_free_queue_node(node);
+
+      log_queue_push_head(self->queue, lm, &path_options);
+    }
+}
+
 static void
 log_writer_broken(LogWriter *self, gint notify_code)
 {
@@ -987,6 +1064,7 @@ log_writer_flush(LogWriter *self, LogWriterFlushMode flush_mode)
       LogMessage *lm;
       LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
       gboolean consumed = FALSE;
+      gboolean ack_when_sent = FALSE;
       
       if (!log_queue_pop_head(self->queue, &lm, &path_options, FALSE, ignore_throttle))
         {
@@ -1003,7 +1081,7 @@ log_writer_flush(LogWriter *self, LogWriterFlushMode flush_mode)
         {
           LogProtoStatus status;
 
-          status = log_proto_post(proto, (guchar *) self->line_buffer->str, self->line_buffer->len, &consumed);
+          status = log_proto_post_from(proto, lm->saddr, (guchar *) self->line_buffer->str, self->line_buffer->len, &consumed);
           if (status == LPS_ERROR)
             {
               if ((self->options->options & LWO_IGNORE_ERRORS) == 0)
@@ -1019,6 +1097,10 @@ log_writer_flush(LogWriter *self, LogWriterFlushMode flush_mode)
                   consumed = TRUE;
                 }
             }
+          else if (consumed)
+            {
+              ack_when_sent = log_proto_has_delayed_ack(proto);
+            }
           if (consumed)
             {
               self->line_buffer->str = g_malloc(self->line_buffer->allocated_len);
@@ -1030,8 +1112,12 @@ log_writer_flush(LogWriter *self, LogWriterFlushMode flush_mode)
         {
           if (lm->flags & LF_LOCAL)
             step_sequence_number(&self->seq_num);
-          log_msg_ack(lm, &path_options);
+          if (ack_when_sent)
+            log_writer_keep_unacked(self, lm, &path_options);
+          else
+            log_msg_ack(lm, &path_options);
           log_msg_unref(lm);
+          log_writer_ack_sent(self, log_proto_take_sent(proto));
         }
       else
         {
@@ -1051,6 +1137,7 @@ log_writer_flush(LogWriter *self, LogWriterFlushMode flush_mode)
     {
       if (log_proto_flush(proto) == LPS_ERROR)
         return FALSE;
+      log_writer_ack_sent(self, log_proto_take_sent(proto));
     }
 
   return TRUE;
@@ -1167,7 +1254,7 @@ log_writer_free(LogPipe *s)
   LogWriter *self = (LogWriter *) s;
 
   if (self->proto)
-    log_proto_free(self->proto);
+    log_writer_free_proto(self);
 
   if (self->line_buffer)
     g_string_free(self->line_buffer, TRUE);
@@ -1223,7 +1310,7 @@ log_writer_reopen_deferred(gpointer s)
   log_writer_stop_watches(self);
 
   if (self->proto)
-    log_proto_free(self->proto);
+    log_writer_free_proto(self);
 
   self->proto = proto;
 
@@ -1307,6 +1394,7 @@ log_writer_new(guint32 flags)
   self->flags = flags;
   self->line_buffer = g_string_sized_new(128);
   self->pollable_state = -1;
+  INIT_IV_LIST_HEAD(&self->unacked);
   init_sequence_number(&self->seq_num);
 
   log_writer_init_watches(self);
@@ -1395,12 +1483,15 @@ log_writer_options_set_mark_mode(LogWriterOptions *options, gchar *mark_mode)
 void
 log_writer_options_init(LogWriterOptions *options, GlobalConfig *cfg, guint32 option_flags)
 {
-  LogTemplate *template;
+  LogTemplate *template, *template_user;
   gchar *time_zone[2];
   TimeZoneInfo *time_zone_info[2];
   gint i;
 
   template = log_template_ref(options->template);
+  /* keep our registration as a user of the template across the reinit */
+  template_user = options->template_user;
+  options->template_user = NULL;
 
   for (i = 0; i < LTZ_MAX; i++)
     {
@@ -1422,6 +1513,22 @@ log_writer_options_init(LogWriterOptions *options, GlobalConfig *cfg, guint32 op
     }
   log_template_options_init(&options->template_options, cfg);
   options->options |= option_flags;
+
+  /* options are initialized again whenever their driver is, but they
+   * only count as one user of their template, registered when it is
+   * first attached */
+  if (template_user != options->template)
+    {
+      if (template_user)
+        {
+          log_template_remove_user(template_user);
+          log_template_unref(template_user);
+        }
+      template_user = log_template_ref(options->template);
+      if (template_user)
+        log_template_add_user(template_user);
+    }
+  options->template_user = template_user;
     
   if (options->flush_lines == -1)
     options->flush_lines = cfg->flush_lines;
@@ -1457,6 +1564,12 @@ void
 log_writer_options_destroy(LogWriterOptions *options)
 {
   log_template_options_destroy(&options->template_options);
+  if (options->template_user)
+    {
+      log_template_remove_user(options->template_user);
+      log_template_unref(options->template_user);
+      options->template_user = NULL;
+    }
   log_template_unref(options->template);
   log_template_unref(options->file_template);
   log_template_unref(options->proto_template);
@@ -37,6 +37,7 @@
 #define LW_FORMAT_PROTO      0x0004
 #define LW_SYSLOG_PROTOCOL   0x0008
 #define LW_SOFT_FLOW_CONTROL 0x0010
+#define LW_SERIALIZED        0x0020
 
 /* writer options (set by the user) */
 #define LWO_SYSLOG_PROTOCOL   0x0001
@@ -61,6 +62,9 @@ typedef struct _LogWriterOptions
   LogTemplate *template;
   LogTemplate *file_template;
   LogTemplate *proto_template;
+  /* the template we're registered as a user of, @template once
+   * log_writer_options_init() was called */
+  LogTemplate *template_user;
   
   gboolean fsync;
   LogTemplateOptions template_options;
@@ -33,6 +33,7 @@
 #include "dnscache.h"
 #include "tls-support.h"
 #include "scratch-buffers.h"
+#include "logmatcher.h"
 
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -323,6 +324,7 @@ main_loop_io_worker_thread_stop(void *cookie)
   g_static_mutex_unlock(&main_loop_io_workers_idmap_lock);
   dns_cache_destroy();
   scratch_buffers_free();
+  log_matcher_pcre_thread_free();
 
   if (call_info.cond)
     g_cond_free(call_info.cond);
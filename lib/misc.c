@@ -228,11 +228,16 @@ resolve_sockaddr(gchar *result, gsize *result_len, GSockAddr *saddr, gboolean us
                 } 
             }
             
-          if (!hname) 
+          if (!hname && !usedns && saddr->formatted)
+            {
+              /* interned address, see g_sockaddr_intern() */
+              hname = saddr->formatted;
+            }
+          else if (!hname) 
             {
               inet_ntop(saddr->sa.sa_family, addr, buf, sizeof(buf));
               hname = buf;
-              if (use_dns_cache)
+              if (use_dns_cache && usedns)
                 dns_cache_store(FALSE, saddr->sa.sa_family, addr, hname, FALSE);
             }
           else 
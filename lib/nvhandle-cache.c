@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2012 BalaBit IT Ltd, Budapest, Hungary
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+
+#include "nvhandle-cache.h"
+#include "logmsg.h"
+
+#include <string.h>
+
+/* must be a power of two */
+#define NV_HANDLE_CACHE_SIZE   512
+#define NV_HANDLE_CACHE_PROBES 8
+
+typedef struct _NVHandleCacheEntry
+{
+  guint hash;
+  NVHandle handle;
+  gsize name_len;
+  gchar name[0];
+} NVHandleCacheEntry;
+
+struct _NVHandleCache
+{
+  gchar *prefix;
+  gsize prefix_len;
+  /* slots are set once and never change afterwards, so readers need no locking */
+  NVHandleCacheEntry *entries[NV_HANDLE_CACHE_SIZE];
+};
+
+static guint
+nv_handle_cache_hash(const gchar *name, gsize name_len)
+{
+  guint hash = 5381;
+  gsize i;
+
+  for (i = 0; i < name_len; i++)
+    hash = (hash << 5) + hash + (guchar) name[i];
+  return hash;
+}
+
+static NVHandle
+nv_handle_cache_resolve(NVHandleCache *self, const gchar *name, gsize name_len)
+{
+  gchar buf[256];
+  gchar *full_name;
+  NVHandle handle;
+
+  if (self->prefix_len + name_len < sizeof(buf))
+    full_name = buf;
+  else
+    full_name = g_malloc(self->prefix_len + name_len + 1);
+
+  memcpy(full_name, self->prefix, self->prefix_len);
+  memcpy(full_name + self->prefix_len, name, name_len);
+  full_name[self->prefix_len + name_len] = 0;
+
+  handle = log_msg_get_value_handle(full_name);
+  if (full_name != buf)
+    g_free(full_name);
+  return handle;
+}
+
+NVHandle
+nv_handle_cache_lookup(NVHandleCache *self, const gchar *name, gssize name_len)
+{
+  NVHandleCacheEntry *entry, *new_entry = NULL;
+  NVHandle handle;
+  guint hash;
+  gint i;
+
+  if (name_len < 0)
+    name_len = strlen(name);
+  hash = nv_handle_cache_hash(name, name_len);
+
+  for (i = 0; i < NV_HANDLE_CACHE_PROBES; i++)
+    {
+      NVHandleCacheEntry **slot = &self->entries[(hash + i) & (NV_HANDLE_CACHE_SIZE - 1)];
+
+      entry = g_atomic_pointer_get(slot);
+      if (!entry)
+        {
+          if (!new_entry)
+            {
+              new_entry = g_malloc(sizeof(NVHandleCacheEntry) + name_len);
+              new_entry->hash = hash;
+              new_entry->handle = nv_handle_cache_resolve(self, name, name_len);
+              new_entry->name_len = name_len;
+              memcpy(new_entry->name, name, name_len);
+            }
+          if (g_atomic_pointer_compare_and_exchange((gpointer *) slot, NULL, new_entry))
+            return new_entry->handle;
+
+          /* another thread has filled this slot in the meanwhile */
+          entry = g_atomic_pointer_get(slot);
+        }
+      if (entry->hash == hash && entry->name_len == name_len && memcmp(entry->name, name, name_len) == 0)
+        {
+          g_free(new_entry);
+          return entry->handle;
+        }
+    }
+
+  /* no free slot around this hash, don't cache this name */
+  if (new_entry)
+    {
+      handle = new_entry->handle;
+      g_free(new_entry);
+      return handle;
+    }
+  return nv_handle_cache_resolve(self, name, name_len);
+}
+
+NVHandleCache *
+nv_handle_cache_new(const gchar *prefix)
+{
+  NVHandleCache *self = g_new0(NVHandleCache, 1);
+
+  self->prefix = g_strdup(prefix ? prefix : "");
+  self->prefix_len = strlen(self->prefix);
+  return self;
+}
+
+void
+nv_handle_cache_free(NVHandleCache *self)
+{
+  gint i;
+
+  for (i = 0; i < NV_HANDLE_CACHE_SIZE; i++)
+    g_free(self->entries[i]);
+  g_free(self->prefix);
+  g_free(self);
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2012 BalaBit IT Ltd, Budapest, Hungary
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+
+#ifndef NVHANDLE_CACHE_H_INCLUDED
+#define NVHANDLE_CACHE_H_INCLUDED
+
+#include "nvtable.h"
+
+/*
+ * A small, lock-free, per-consumer map from value names to NVHandles,
+ * so that parsers creating values with names only known at runtime do
+ * not have to go through the global registry (and its lock) for every
+ * value of every message.
+ *
+ * The names are looked up as @prefix + name, the prefix is fixed when
+ * the cache is created.
+ */
+typedef struct _NVHandleCache NVHandleCache;
+
+NVHandle nv_handle_cache_lookup(NVHandleCache *self, const gchar *name, gssize name_len);
+NVHandleCache *nv_handle_cache_new(const gchar *prefix);
+void nv_handle_cache_free(NVHandleCache *self);
+
+#endif
@@ -36,7 +36,9 @@ nv_registry_get_handle(NVRegistry *self, const gchar *name)
 {
   gpointer p;
 
+  g_static_mutex_lock(&nv_registry_lock);
   p = g_hash_table_lookup(self->name_map, name);
+  g_static_mutex_unlock(&nv_registry_lock);
   if (p)
     return GPOINTER_TO_UINT(p);
   return 0;
@@ -201,9 +203,24 @@ nv_table_alloc_value(NVTable *self, gsize alloc_size)
   entry->alloc_len = alloc_size;
   entry->indirect = FALSE;
   entry->referenced = FALSE;
+  entry->numeric = FALSE;
   return entry;
 }
 
+static inline void
+nv_table_set_entry_numeric(NVEntry *entry, const gint64 *numeric)
+{
+  if (numeric)
+    {
+      memcpy(((gchar *) entry) + entry->alloc_len - NV_ENTRY_NUMERIC_SIZE, numeric, NV_ENTRY_NUMERIC_SIZE);
+      entry->numeric = TRUE;
+    }
+  else
+    {
+      entry->numeric = FALSE;
+    }
+}
+
 /* we only support single indirection */
 const gchar *
 nv_table_resolve_indirect(NVTable *self, NVEntry *entry, gssize *length)
@@ -358,6 +375,8 @@ nv_table_set_table_entry(NVTable *self, NVHandle handle, guint32 ofs, NVDynValue
     }
 }
 
+static gboolean nv_table_add_value_full(NVTable *self, NVHandle handle, const gchar *name, gsize name_len, const gchar *value, gsize value_len, const gint64 *numeric, gboolean *new_entry);
+
 static gboolean
 nv_table_make_direct(NVHandle handle, NVEntry *entry, gpointer user_data)
 {
@@ -368,9 +387,12 @@ nv_table_make_direct(NVHandle handle, NVEntry *entry, gpointer user_data)
     {
       const gchar *value;
       gssize value_len;
+      gint64 numeric = 0;
 
+      nv_entry_get_numeric(entry, &numeric);
       value = nv_table_resolve_indirect(self, entry, &value_len);
-      if (!nv_table_add_value(self, handle, entry->vindirect.name, entry->name_len, value, value_len, NULL))
+      if (!nv_table_add_value_full(self, handle, entry->vindirect.name, entry->name_len, value, value_len,
+                                   entry->numeric ? &numeric : NULL, NULL))
         {
           /* nvtable full, but we can't realloc it ourselves,
            * propagate this back as a failure of
@@ -382,12 +404,14 @@ nv_table_make_direct(NVHandle handle, NVEntry *entry, gpointer user_data)
   return FALSE;
 }
 
-gboolean
-nv_table_add_value(NVTable *self, NVHandle handle, const gchar *name, gsize name_len, const gchar *value, gsize value_len, gboolean *new_entry)
+/* @numeric is optional, if specified, the binary form of the value is also stored in the entry */
+static gboolean
+nv_table_add_value_full(NVTable *self, NVHandle handle, const gchar *name, gsize name_len, const gchar *value, gsize value_len, const gint64 *numeric, gboolean *new_entry)
 {
   NVEntry *entry;
   guint32 ofs;
   NVDynValue *dyn_slot;
+  gsize numeric_size = numeric ? NV_ENTRY_NUMERIC_SIZE : 0;
 
   if (value_len > NV_TABLE_MAX_BYTES)
     value_len = NV_TABLE_MAX_BYTES;
@@ -414,7 +438,7 @@ nv_table_add_value(NVTable *self, NVHandle handle, const gchar *name, gsize name
           return FALSE;
         }
     }
-  if (G_UNLIKELY(entry && (((guint) entry->alloc_len)) >= value_len + NV_ENTRY_DIRECT_HDR + name_len + 2))
+  if (G_UNLIKELY(entry && (((guint) entry->alloc_len)) >= value_len + NV_ENTRY_DIRECT_HDR + name_len + 2 + numeric_size))
     {
       gchar *dst;
       /* this value already exists and the new value fits in the old space */
@@ -436,6 +460,7 @@ nv_table_add_value(NVTable *self, NVHandle handle, const gchar *name, gsize name
           memcpy(entry->vdirect.data + name_len + 1, value, value_len);
           entry->vdirect.data[entry->name_len + 1 + value_len] = 0;
         }
+      nv_table_set_entry_numeric(entry, numeric);
       return TRUE;
     }
   else if (!entry && new_entry)
@@ -445,7 +470,7 @@ nv_table_add_value(NVTable *self, NVHandle handle, const gchar *name, gsize name
    * size needed for a dynamic table slot */
   if (!nv_table_reserve_table_entry(self, handle, &dyn_slot))
     return FALSE;
-  entry = nv_table_alloc_value(self, NV_ENTRY_DIRECT_HDR + name_len + value_len + 2);
+  entry = nv_table_alloc_value(self, NV_ENTRY_DIRECT_HDR + name_len + value_len + 2 + numeric_size);
   if (G_UNLIKELY(!entry))
     {
       return FALSE;
@@ -463,17 +488,31 @@ nv_table_add_value(NVTable *self, NVHandle handle, const gchar *name, gsize name
     entry->name_len = 0;
   memcpy(entry->vdirect.data + entry->name_len + 1, value, value_len);
   entry->vdirect.data[entry->name_len + 1 + value_len] = 0;
+  nv_table_set_entry_numeric(entry, numeric);
 
   nv_table_set_table_entry(self, handle, ofs, dyn_slot);
   return TRUE;
 }
 
 gboolean
-nv_table_add_value_indirect(NVTable *self, NVHandle handle, const gchar *name, gsize name_len, NVHandle ref_handle, guint8 type, guint32 rofs, guint32 rlen, gboolean *new_entry)
+nv_table_add_value(NVTable *self, NVHandle handle, const gchar *name, gsize name_len, const gchar *value, gsize value_len, gboolean *new_entry)
+{
+  return nv_table_add_value_full(self, handle, name, name_len, value, value_len, NULL, new_entry);
+}
+
+gboolean
+nv_table_add_value_with_numeric(NVTable *self, NVHandle handle, const gchar *name, gsize name_len, const gchar *value, gsize value_len, gint64 numeric, gboolean *new_entry)
+{
+  return nv_table_add_value_full(self, handle, name, name_len, value, value_len, &numeric, new_entry);
+}
+
+static gboolean
+nv_table_add_value_indirect_full(NVTable *self, NVHandle handle, const gchar *name, gsize name_len, NVHandle ref_handle, guint8 type, guint32 rofs, guint32 rlen, const gint64 *numeric, gboolean *new_entry)
 {
   NVEntry *entry, *ref_entry;
   NVDynValue *dyn_slot;
   guint32 ofs;
+  gsize numeric_size = numeric ? NV_ENTRY_NUMERIC_SIZE : 0;
 
   if (new_entry)
     *new_entry = FALSE;
@@ -497,7 +536,7 @@ nv_table_add_value_indirect(NVTable *self, NVHandle handle, const gchar *name, g
         {
           rlen = MIN(rofs + rlen, ref_length) - rofs;
         }
-      return nv_table_add_value(self, handle, name, name_len, ref_value + rofs, rlen, new_entry);
+      return nv_table_add_value_full(self, handle, name, name_len, ref_value + rofs, rlen, numeric, new_entry);
     }
 
   entry = nv_table_get_entry(self, handle, &dyn_slot);
@@ -517,7 +556,7 @@ nv_table_add_value_indirect(NVTable *self, NVHandle handle, const gchar *name, g
       if (!nv_table_foreach_entry(self, nv_table_make_direct, data))
         return FALSE;
     }
-  if (entry && (((guint) entry->alloc_len) >= NV_ENTRY_INDIRECT_HDR + name_len + 1))
+  if (entry && (((guint) entry->alloc_len) >= NV_ENTRY_INDIRECT_HDR + name_len + 1 + numeric_size))
     {
       /* this value already exists and the new reference  fits in the old space */
       ref_entry->referenced = TRUE;
@@ -539,6 +578,7 @@ nv_table_add_value_indirect(NVTable *self, NVHandle handle, const gchar *name, g
               entry->name_len = 0;
             }
         }
+      nv_table_set_entry_numeric(entry, numeric);
       return TRUE;
     }
   else if (!entry && new_entry)
@@ -546,7 +586,7 @@ nv_table_add_value_indirect(NVTable *self, NVHandle handle, const gchar *name, g
 
   if (!nv_table_reserve_table_entry(self, handle, &dyn_slot))
     return FALSE;
-  entry = nv_table_alloc_value(self, NV_ENTRY_INDIRECT_HDR + name_len + 1);
+  entry = nv_table_alloc_value(self, NV_ENTRY_INDIRECT_HDR + name_len + 1 + numeric_size);
   if (!entry)
     {
       return FALSE;
@@ -566,12 +606,25 @@ nv_table_add_value_indirect(NVTable *self, NVHandle handle, const gchar *name, g
     }
   else
     entry->name_len = 0;
+  nv_table_set_entry_numeric(entry, numeric);
 
   nv_table_set_table_entry(self, handle, ofs, dyn_slot);
 
   return TRUE;
 }
 
+gboolean
+nv_table_add_value_indirect(NVTable *self, NVHandle handle, const gchar *name, gsize name_len, NVHandle ref_handle, guint8 type, guint32 rofs, guint32 rlen, gboolean *new_entry)
+{
+  return nv_table_add_value_indirect_full(self, handle, name, name_len, ref_handle, type, rofs, rlen, NULL, new_entry);
+}
+
+gboolean
+nv_table_add_value_indirect_with_numeric(NVTable *self, NVHandle handle, const gchar *name, gsize name_len, NVHandle ref_handle, guint8 type, guint32 rofs, guint32 rlen, gint64 numeric, gboolean *new_entry)
+{
+  return nv_table_add_value_indirect_full(self, handle, name, name_len, ref_handle, type, rofs, rlen, &numeric, new_entry);
+}
+
 static gboolean
 nv_table_call_foreach(NVHandle handle, NVEntry *entry, gpointer user_data)
 {
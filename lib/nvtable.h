@@ -27,6 +27,8 @@
 
 #include "syslog-ng.h"
 
+#include <string.h>
+
 typedef struct _NVTable NVTable;
 typedef struct _NVRegistry NVRegistry;
 typedef struct _NVDynValue NVDynValue;
@@ -98,11 +100,17 @@ nv_registry_get_handle_name(NVRegistry *self, NVHandle handle, gssize *length)
 
 /*
  * Contains a name-value pair.
+ *
+ * An entry may also carry the binary form of an integer value (if
+ * @numeric is set), which is stored in the last NV_ENTRY_NUMERIC_SIZE bytes
+ * of the allocated space. It is set by whoever parsed the value as a
+ * number, so that consumers don't have to convert the string
+ * representation again.
  */
 struct _NVEntry
 {
   /* negative offset, counting from string table top, e.g. start of the string is at @top + ofs */
-  guint8 indirect:1, referenced:1;
+  guint8 indirect:1, referenced:1, numeric:1;
   guint8 name_len;
   guint32 alloc_len;
   union
@@ -126,6 +134,7 @@ struct _NVEntry
 
 #define NV_ENTRY_DIRECT_HDR ((gsize) (&((NVEntry *) NULL)->vdirect.data))
 #define NV_ENTRY_INDIRECT_HDR (sizeof(NVEntry))
+#define NV_ENTRY_NUMERIC_SIZE (sizeof(gint64))
 
 static inline const gchar *
 nv_entry_get_name(NVEntry *self)
@@ -136,6 +145,17 @@ nv_entry_get_name(NVEntry *self)
     return self->vdirect.data;
 }
 
+static inline gboolean
+nv_entry_get_numeric(NVEntry *self, gint64 *value)
+{
+  if (!self->numeric)
+    return FALSE;
+
+  /* entries are only 4 byte aligned, thus the memcpy() */
+  memcpy(value, ((gchar *) self) + self->alloc_len - NV_ENTRY_NUMERIC_SIZE, NV_ENTRY_NUMERIC_SIZE);
+  return TRUE;
+}
+
 /*
  * Contains a set of ordered name-value pairs.
  *
@@ -210,6 +230,8 @@ struct _NVTable
 
 gboolean nv_table_add_value(NVTable *self, NVHandle handle, const gchar *name, gsize name_len, const gchar *value, gsize value_len, gboolean *new_entry);
 gboolean nv_table_add_value_indirect(NVTable *self, NVHandle handle, const gchar *name, gsize name_len, NVHandle ref_handle, guint8 type, guint32 ofs, guint32 len, gboolean *new_entry);
+gboolean nv_table_add_value_with_numeric(NVTable *self, NVHandle handle, const gchar *name, gsize name_len, const gchar *value, gsize value_len, gint64 numeric, gboolean *new_entry);
+gboolean nv_table_add_value_indirect_with_numeric(NVTable *self, NVHandle handle, const gchar *name, gsize name_len, NVHandle ref_handle, guint8 type, guint32 ofs, guint32 len, gint64 numeric, gboolean *new_entry);
 
 gboolean nv_table_foreach(NVTable *self, NVRegistry *registry, NVTableForeachFunc func, gpointer user_data);
 gboolean nv_table_foreach_entry(NVTable *self, NVTableForeachEntryFunc func, gpointer user_data);
@@ -307,5 +329,25 @@ nv_table_get_value(NVTable *self, NVHandle handle, gssize *length)
   return __nv_table_get_value(self, handle, self->num_static_entries, length);
 }
 
+/* returns FALSE if the value is not present or has no numeric form
+ * attached, in which case the string representation has to be used */
+static inline gboolean
+__nv_table_get_numeric(NVTable *self, NVHandle handle, guint16 num_static_entries, gint64 *value)
+{
+  NVEntry *entry;
+  NVDynValue *dyn_slot;
+
+  entry = __nv_table_get_entry(self, handle, num_static_entries, &dyn_slot);
+  if (G_UNLIKELY(!entry))
+    return FALSE;
+  return nv_entry_get_numeric(entry, value);
+}
+
+static inline gboolean
+nv_table_get_numeric(NVTable *self, NVHandle handle, gint64 *value)
+{
+  return __nv_table_get_numeric(self, handle, self->num_static_entries, value);
+}
+
 
 #endif
@@ -352,6 +352,9 @@ const gchar *tag_names[SC_TYPE_MAX] =
   /* [SC_TYPE_STORED]   = */  "stored",
   /* [SC_TYPE_SUPPRESSED] = */ "suppressed",
   /* [SC_TYPE_STAMP] = */ "stamp",
+  /* [SC_TYPE_LATENCY] = */ "latency",
+  /* [SC_TYPE_MEMORY] = */ "memory",
+  /* [SC_TYPE_RATIO] = */ "ratio",
 };
 
 const gchar *source_names[SCS_MAX] =
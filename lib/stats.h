@@ -37,6 +37,9 @@ typedef enum
   SC_TYPE_STORED,    /* number of messages on disk */
   SC_TYPE_SUPPRESSED,/* number of messages suppressed */
   SC_TYPE_STAMP,     /* timestamp */
+  SC_TYPE_LATENCY,   /* average duration of an operation, in milliseconds */
+  SC_TYPE_MEMORY,    /* number of bytes of memory in use */
+  SC_TYPE_RATIO,     /* ratio of two quantities, multiplied by 100 */
   SC_TYPE_MAX
 } StatsCounterType;
 
@@ -62,6 +62,7 @@
 
 typedef struct _LogPipe LogPipe;
 typedef struct _LogMessage LogMessage;
+typedef struct _LogTemplateFormatCache LogTemplateFormatCache;
 typedef struct _GlobalConfig GlobalConfig;
 
 /* configuration being parsed, used by the bison generated code, NULL whenever parsing is finished. */
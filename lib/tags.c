@@ -97,6 +97,35 @@ log_tags_get_by_name(const gchar *name)
   return id;
 }
 
+/*
+ * log_tags_lookup_by_name
+ *
+ * Lookup the id of an already known tag, unlike log_tags_get_by_name()
+ * it never adds a new one.
+ *
+ * The function returns TRUE and sets @id if the tag is known.
+ *
+ * @name:   the name of the tag
+ * @id:     the tag id is returned here
+ *
+ */
+gboolean
+log_tags_lookup_by_name(const gchar *name, LogTagId *id)
+{
+  guint value;
+
+  g_assert(log_tags_hash != NULL);
+
+  g_static_mutex_lock(&log_tags_lock);
+  value = GPOINTER_TO_UINT(g_hash_table_lookup(log_tags_hash, name));
+  g_static_mutex_unlock(&log_tags_lock);
+
+  if (value == 0)
+    return FALSE;
+  *id = value - 1;
+  return TRUE;
+}
+
 /*
  * log_tag_get_by_id
  *
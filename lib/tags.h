@@ -41,6 +41,7 @@ typedef guint16 LogTagId;
 #endif
 
 LogTagId log_tags_get_by_name(const gchar *name);
+gboolean log_tags_lookup_by_name(const gchar *name, LogTagId *id);
 const gchar *log_tags_get_by_id(LogTagId id);
 
 void log_tags_init(void);
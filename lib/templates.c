@@ -534,9 +534,13 @@ log_macro_expand(GString *result, gint id, gboolean escape, LogTemplateOptions *
         if (zone_ofs == -1)
           zone_ofs = stamp->zone_offset;
 
-        t = stamp->tv_sec + zone_ofs;
-
-        cached_gmtime(&t, &tm_storage);
+        /* complete timestamps are rendered by log_stamp_append_format(),
+         * which caches the broken down time itself */
+        if (id != M_DATE && id != M_STAMP && id != M_ISODATE && id != M_FULLDATE && id != M_UNIXTIME)
+          {
+            t = stamp->tv_sec + zone_ofs;
+            cached_gmtime(&t, &tm_storage);
+          }
         tm  = &tm_storage;
 
         switch (id)
@@ -757,6 +761,7 @@ log_template_set_escape(LogTemplate *self, gboolean enable)
 static void
 log_template_reset_compiled(LogTemplate *self)
 {
+  self->cache_id = 0;
   while (self->compiled_template)
     {
       LogTemplateElem *e;
@@ -885,6 +890,50 @@ parse_msg_ref(gchar **p, gint *msg_ref)
     }
 }
 
+/* the id of the last cacheable template, templates are only compiled
+ * from the main thread */
+static guint32 log_template_last_cache_id;
+
+/* returns TRUE if the output of the template only depends on the message
+ * and the LogTemplateOptions it is formatted with. Template functions are
+ * excluded as they may keep state or depend on the environment. */
+static gboolean
+log_template_is_cacheable(LogTemplate *self)
+{
+  GList *p;
+
+  for (p = self->compiled_template; p; p = g_list_next(p))
+    {
+      LogTemplateElem *e = (LogTemplateElem *) p->data;
+
+      if (e->msg_ref)
+        return FALSE;
+
+      switch (e->type)
+        {
+        case LTE_MACRO:
+          switch (e->macro)
+            {
+            case M_SEQNUM:
+            case M_SDATA:
+            case M_CONTEXT_ID:
+            case M_SYSUPTIME:
+              return FALSE;
+            default:
+              if (e->macro >= M_TIME_FIRST + M_CSTAMP_OFS && e->macro <= M_TIME_LAST + M_CSTAMP_OFS)
+                return FALSE;
+              break;
+            }
+          break;
+        case LTE_VALUE:
+          break;
+        case LTE_FUNC:
+          return FALSE;
+        }
+    }
+  return TRUE;
+}
+
 gboolean
 log_template_compile(LogTemplate *self, const gchar *template, GError **error)
 {
@@ -1132,6 +1181,8 @@ log_template_compile(LogTemplate *self, const gchar *template, GError **error)
       g_string_free(last_text, TRUE);
     }
   self->compiled_template = g_list_reverse(self->compiled_template);
+  if (log_template_is_cacheable(self))
+    self->cache_id = ++log_template_last_cache_id;
   return TRUE;
   
  error:
@@ -1147,6 +1198,28 @@ log_template_compile(LogTemplate *self, const gchar *template, GError **error)
   return FALSE;
 }
 
+/* returns TRUE if the template is a single name-value pair reference
+ * (e.g. "${name}") without any literal text, default value or message
+ * reference, in which case the handle of the referenced value is returned
+ * in @handle. Callers can use this to access the value directly instead of
+ * formatting the template. */
+gboolean
+log_template_is_trivial_value(LogTemplate *self, NVHandle *handle)
+{
+  LogTemplateElem *e;
+
+  if (!self->compiled_template || self->compiled_template->next)
+    return FALSE;
+
+  e = (LogTemplateElem *) self->compiled_template->data;
+  if (e->type != LTE_VALUE || e->text_len > 0 || e->default_value || e->msg_ref)
+    return FALSE;
+
+  if (handle)
+    *handle = e->value_handle;
+  return TRUE;
+}
+
 void
 log_template_append_format_with_context(LogTemplate *self, LogMessage **messages, gint num_messages, LogTemplateOptions *opts, gint tz, gint32 seq_num, const gchar *context_id, GString *result)
 {
@@ -1267,6 +1340,132 @@ log_template_format(LogTemplate *self, LogMessage *lm, LogTemplateOptions *opts,
   log_template_append_format(self, lm, opts, tz, seq_num, context_id, result);
 }
 
+/* output of a cacheable template memoized on the message, entries are
+ * only ever prepended (atomically) while the message is shared, and freed
+ * when the message changes or gets freed */
+struct _LogTemplateFormatCache
+{
+  LogTemplateFormatCache *next;
+  guint32 cache_id;
+  gint tz;
+  gint ts_format;
+  gint frac_digits;
+  gchar *time_zone;
+  gsize len;
+  gchar str[0];
+};
+
+static inline gboolean
+log_template_format_cache_match(LogTemplateFormatCache *entry, LogTemplate *self, LogTemplateOptions *opts, gint tz)
+{
+  return entry->cache_id == self->cache_id &&
+         entry->tz == tz &&
+         entry->ts_format == opts->ts_format &&
+         entry->frac_digits == opts->frac_digits &&
+         g_strcmp0(entry->time_zone, opts->time_zone[tz]) == 0;
+}
+
+static void
+log_template_format_cache_add(LogTemplate *self, LogMessage *lm, LogTemplateOptions *opts, gint tz, const gchar *value, gsize value_len)
+{
+  LogTemplateFormatCache *entry;
+  gsize time_zone_len = opts->time_zone[tz] ? strlen(opts->time_zone[tz]) + 1 : 0;
+  gpointer head;
+
+  entry = g_malloc(sizeof(LogTemplateFormatCache) + value_len + time_zone_len);
+  entry->cache_id = self->cache_id;
+  entry->tz = tz;
+  entry->ts_format = opts->ts_format;
+  entry->frac_digits = opts->frac_digits;
+  entry->len = value_len;
+  memcpy(entry->str, value, value_len);
+  if (time_zone_len)
+    {
+      entry->time_zone = entry->str + value_len;
+      memcpy(entry->time_zone, opts->time_zone[tz], time_zone_len);
+    }
+  else
+    {
+      entry->time_zone = NULL;
+    }
+
+  do
+    {
+      head = g_atomic_pointer_get(&lm->format_cache);
+      entry->next = (LogTemplateFormatCache *) head;
+    }
+  while (!g_atomic_pointer_compare_and_exchange((gpointer *) &lm->format_cache, head, entry));
+}
+
+/*
+ * Same as log_template_append_format(), but if the template is cacheable
+ * and is used by more than one destination, the result is memoized on the
+ * message, so that other destinations formatting the same message with
+ * the same options can reuse it. Two threads formatting the same message
+ * concurrently may both end up formatting it, which is harmless.
+ */
+void
+log_template_append_format_cached(LogTemplate *self, LogMessage *lm, LogTemplateOptions *opts, gint tz, gint32 seq_num, const gchar *context_id, GString *result)
+{
+  LogTemplateFormatCache *entry;
+  gsize len;
+
+  if (!self->cache_id || self->num_users < 2)
+    {
+      log_template_append_format(self, lm, opts, tz, seq_num, context_id, result);
+      return;
+    }
+
+  if (!opts)
+    opts = &self->cfg->template_options;
+
+  for (entry = g_atomic_pointer_get(&lm->format_cache); entry; entry = entry->next)
+    {
+      if (log_template_format_cache_match(entry, self, opts, tz))
+        {
+          g_string_append_len(result, entry->str, entry->len);
+          return;
+        }
+    }
+
+  len = result->len;
+  log_template_append_format(self, lm, opts, tz, seq_num, context_id, result);
+  log_template_format_cache_add(self, lm, opts, tz, result->str + len, result->len - len);
+}
+
+void
+log_template_format_cached(LogTemplate *self, LogMessage *lm, LogTemplateOptions *opts, gint tz, gint32 seq_num, const gchar *context_id, GString *result)
+{
+  g_string_truncate(result, 0);
+  log_template_append_format_cached(self, lm, opts, tz, seq_num, context_id, result);
+}
+
+void
+log_template_format_cache_free(LogTemplateFormatCache *cache)
+{
+  LogTemplateFormatCache *next;
+
+  while (cache)
+    {
+      next = cache->next;
+      g_free(cache);
+      cache = next;
+    }
+}
+
+void
+log_template_add_user(LogTemplate *self)
+{
+  self->num_users++;
+}
+
+void
+log_template_remove_user(LogTemplate *self)
+{
+  g_assert(self->num_users > 0);
+  self->num_users--;
+}
+
 LogTemplate *
 log_template_new(GlobalConfig *cfg, gchar *name)
 {
@@ -246,15 +246,112 @@ tls_session_new(SSL *ssl, TLSContext *ctx)
   return self;
 }
 
+static void tls_session_drop_resumable(TLSSession *self);
+
 void
 tls_session_free(TLSSession *self)
 {
   if (self->verify_data && self->verify_data_destroy)
     self->verify_data_destroy(self->verify_data);
+  /* the connection is closed before its handshake completed */
+  if (!SSL_is_init_finished(self->ssl))
+    tls_session_drop_resumable(self);
   SSL_free(self->ssl);
+  g_free(self->resumption_key);
   g_free(self);
 }
 
+/*
+ * Client side session resumption: the session negotiated by @self is
+ * remembered in the TLSContext under @key (e.g. the address of the
+ * server), and the next session set up for the same key offers it to the
+ * server, so that a reconnect can skip the full handshake. Must be
+ * called before the handshake starts.
+ */
+void
+tls_session_set_resumption_key(TLSSession *self, const gchar *key)
+{
+  TLSContext *ctx = self->ctx;
+  SSL_SESSION *resumable;
+
+  if (!ctx->resumable_sessions)
+    return;
+
+  g_free(self->resumption_key);
+  self->resumption_key = g_strdup(key);
+
+  g_static_mutex_lock(&ctx->resumable_sessions_lock);
+  resumable = g_hash_table_lookup(ctx->resumable_sessions, key);
+  if (resumable)
+    SSL_set_session(self->ssl, resumable);
+  g_static_mutex_unlock(&ctx->resumable_sessions_lock);
+}
+
+/* a session that failed to be resumed is not offered again */
+static void
+tls_session_drop_resumable(TLSSession *self)
+{
+  TLSContext *ctx = self->ctx;
+  SSL_SESSION *offered = SSL_get_session(self->ssl);
+
+  if (!self->resumption_key || !offered)
+    return;
+
+  g_static_mutex_lock(&ctx->resumable_sessions_lock);
+  if (g_hash_table_lookup(ctx->resumable_sessions, self->resumption_key) == offered)
+    g_hash_table_remove(ctx->resumable_sessions, self->resumption_key);
+  g_static_mutex_unlock(&ctx->resumable_sessions_lock);
+}
+
+/* called by libssl whenever the client side negotiated a new session */
+static int
+tls_session_new_session_callback(SSL *ssl, SSL_SESSION *session)
+{
+  TLSSession *self = SSL_get_app_data(ssl);
+  TLSContext *ctx = self->ctx;
+
+  if (!self->resumption_key)
+    return 0;
+
+  g_static_mutex_lock(&ctx->resumable_sessions_lock);
+  g_hash_table_replace(ctx->resumable_sessions, g_strdup(self->resumption_key), session);
+  g_static_mutex_unlock(&ctx->resumable_sessions_lock);
+
+  /* we keep the reference libssl passed to us */
+  return 1;
+}
+
+static void
+tls_context_setup_session_cache(TLSContext *self)
+{
+  /* sessions of a server are only resumed by the same context */
+  static const guchar session_id_context[] = "syslog-ng";
+
+  if (self->session_cache_size <= 0)
+    {
+      SSL_CTX_set_session_cache_mode(self->ssl_ctx, SSL_SESS_CACHE_OFF);
+      SSL_CTX_set_options(self->ssl_ctx, SSL_OP_NO_TICKET);
+      return;
+    }
+
+  SSL_CTX_set_timeout(self->ssl_ctx, self->session_timeout);
+  if (self->mode == TM_CLIENT)
+    {
+      /* libssl doesn't look up client sessions by itself, we keep them per resumption key */
+      SSL_CTX_set_session_cache_mode(self->ssl_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+      SSL_CTX_sess_set_new_cb(self->ssl_ctx, tls_session_new_session_callback);
+      if (!self->resumable_sessions)
+        self->resumable_sessions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) SSL_SESSION_free);
+    }
+  else
+    {
+      /* both the session cache and session tickets (which are enabled by default) */
+      SSL_CTX_set_session_cache_mode(self->ssl_ctx, SSL_SESS_CACHE_SERVER);
+      SSL_CTX_sess_set_cache_size(self->ssl_ctx, self->session_cache_size);
+      SSL_CTX_set_session_id_context(self->ssl_ctx, session_id_context, sizeof(session_id_context) - 1);
+    }
+}
+
 static gboolean
 file_exists(const gchar *fname)
 {
@@ -332,6 +429,7 @@ tls_context_setup_session(TLSContext *self)
 
       SSL_CTX_set_verify(self->ssl_ctx, verify_mode, tls_session_verify_callback);
       SSL_CTX_set_options(self->ssl_ctx, SSL_OP_NO_SSLv2);
+      tls_context_setup_session_cache(self);
       if (self->cipher_suite)
         {
           if (!SSL_CTX_set_cipher_list(self->ssl_ctx, self->cipher_suite))
@@ -364,6 +462,44 @@ tls_context_setup_session(TLSContext *self)
   return NULL;
 }
 
+/*
+ * Advances the handshake of @self on the non-blocking @fd as far as
+ * possible without waiting for the peer. When the peer has to be waited
+ * for, the caller is expected to poll @fd for the returned condition and
+ * call this function again. The LogTransport created for the session
+ * afterwards continues with the established session.
+ */
+TLSHandshakeStatus
+tls_session_handshake(TLSSession *self, gint fd)
+{
+  gint rc, ssl_error;
+
+  SSL_set_fd(self->ssl, fd);
+  while (1)
+    {
+      rc = SSL_do_handshake(self->ssl);
+      if (rc == 1)
+        return TLS_HANDSHAKE_DONE;
+
+      ssl_error = SSL_get_error(self->ssl, rc);
+      if (ssl_error == SSL_ERROR_WANT_READ)
+        return TLS_HANDSHAKE_WANT_READ;
+      else if (ssl_error == SSL_ERROR_WANT_WRITE)
+        return TLS_HANDSHAKE_WANT_WRITE;
+      else if (ssl_error == SSL_ERROR_SYSCALL && rc < 0 && errno == EINTR)
+        continue;
+      break;
+    }
+
+  ssl_error = ERR_get_error();
+  msg_error("SSL error during handshake",
+            evt_tag_int("fd", fd),
+            evt_tag_printf("tls_error", "%s:%s:%s", ERR_lib_error_string(ssl_error), ERR_func_error_string(ssl_error), ERR_reason_error_string(ssl_error)),
+            NULL);
+  ERR_clear_error();
+  return TLS_HANDSHAKE_ERROR;
+}
+
 TLSContext *
 tls_context_new(TLSMode mode)
 {
@@ -371,12 +507,19 @@ tls_context_new(TLSMode mode)
 
   self->mode = mode;
   self->verify_mode = TVM_REQUIRED | TVM_TRUSTED;
+  self->handshake_threads = 4;
+  self->session_cache_size = SSL_SESSION_CACHE_MAX_SIZE_DEFAULT;
+  self->session_timeout = 300;
+  g_static_mutex_init(&self->resumable_sessions_lock);
   return self;
 }
 
 void
 tls_context_free(TLSContext *self)
 {
+  if (self->resumable_sessions)
+    g_hash_table_destroy(self->resumable_sessions);
+  g_static_mutex_free(&self->resumable_sessions_lock);
   SSL_CTX_free(self->ssl_ctx);
   g_list_foreach(self->trusted_fingerpint_list, (GFunc) g_free, NULL);
   g_list_foreach(self->trusted_dn_list, (GFunc) g_free, NULL);
@@ -46,6 +46,14 @@ typedef enum
   TVM_REQUIRED=0x0020,
 } TLSVerifyMode;
 
+typedef enum
+{
+  TLS_HANDSHAKE_DONE,
+  TLS_HANDSHAKE_WANT_READ,
+  TLS_HANDSHAKE_WANT_WRITE,
+  TLS_HANDSHAKE_ERROR,
+} TLSHandshakeStatus;
+
 typedef gint (*TLSSessionVerifyFunc)(gint ok, X509_STORE_CTX *ctx, gpointer user_data);
 typedef struct _TLSContext TLSContext;
 
@@ -56,9 +64,11 @@ typedef struct _TLSSession
   TLSSessionVerifyFunc verify_func;
   gpointer verify_data;
   GDestroyNotify verify_data_destroy;
+  gchar *resumption_key;
 } TLSSession;
 
 void tls_session_set_verify(TLSSession *self, TLSSessionVerifyFunc verify_func, gpointer verify_data, GDestroyNotify verify_destroy);
+void tls_session_set_resumption_key(TLSSession *self, const gchar *key);
 void tls_session_free(TLSSession *self);
 
 struct _TLSContext
@@ -73,10 +83,21 @@ struct _TLSContext
   SSL_CTX *ssl_ctx;
   GList *trusted_fingerpint_list;
   GList *trusted_dn_list;
+  /* the number of threads performing the handshakes of incoming
+   * connections, 0 means the handshake is done by the I/O workers */
+  gint handshake_threads;
+  /* session resumption: the size of the server side session cache (0
+   * disables resumption altogether) and the lifetime of sessions in seconds */
+  gint session_cache_size;
+  gint session_timeout;
+  /* client side, the last session negotiated for each resumption key */
+  GStaticMutex resumable_sessions_lock;
+  GHashTable *resumable_sessions;
 };
 
 
 TLSSession *tls_context_setup_session(TLSContext *self);
+TLSHandshakeStatus tls_session_handshake(TLSSession *self, gint fd);
 void tls_session_set_trusted_fingerprints(TLSContext *self, GList *fingerprints);
 void tls_session_set_trusted_dn(TLSContext *self, GList *dns);
 TLSContext *tls_context_new(TLSMode mode);
@@ -42,9 +42,19 @@ typedef struct
 typedef struct
 {
   gchar *name;
+  /* the name after applying the rekey transformations */
+  gchar *key;
   LogTemplate *template;
 } VPPairConf;
 
+/* a macro or name-value pair that is part of the output, see vp_update_plan() */
+typedef struct
+{
+  gchar *key;
+  gint type;
+  gint id;
+} VPPlanEntry;
+
 struct _ValuePairs
 {
   VPPatternSpec **patterns;
@@ -54,8 +64,30 @@ struct _ValuePairs
   /* guint32 as CfgFlagHandler only supports 32 bit integers */
   guint32 scopes;
   guint32 patterns_size;
+
+  /* the builtin macros & values selected by the scopes and patterns,
+   * with their final keys, in the order they are to be added */
+  GArray *plan;
+
+  /* whether a dynamic name-value pair is included, indexed by NVHandle,
+   * filled lazily as the handles are encountered, see VP_NV_*. Split
+   * into pages that are only allocated once a handle in their range is
+   * seen, NULL if no dynamic pairs are needed at all */
+  guint8 **nv_verdicts;
 };
 
+enum
+{
+  VP_NV_UNKNOWN = 0,
+  VP_NV_INCLUDE,
+  VP_NV_EXCLUDE,
+};
+
+#define VP_NV_VERDICTS_MAX (G_MAXUINT16 + 1)
+#define VP_NV_VERDICTS_PAGE_BITS 8
+#define VP_NV_VERDICTS_PAGE_SIZE (1 << VP_NV_VERDICTS_PAGE_BITS)
+#define VP_NV_VERDICTS_PAGES (VP_NV_VERDICTS_MAX / VP_NV_VERDICTS_PAGE_SIZE)
+
 typedef enum
 {
   VPS_NV_PAIRS        = 0x01,
@@ -128,10 +160,16 @@ static CfgFlagHandler value_pair_scope[] =
   { "everything",         CFH_SET, offsetof(ValuePairs, scopes), VPS_EVERYTHING },
 };
 
+static void vp_update_plan(ValuePairs *vp);
+
 gboolean
 value_pairs_add_scope(ValuePairs *vp, const gchar *scope)
 {
-  return cfg_process_flag(value_pair_scope, vp, scope);
+  gboolean result;
+
+  result = cfg_process_flag(value_pair_scope, vp, scope);
+  vp_update_plan(vp);
+  return result;
 }
 
 void
@@ -149,6 +187,7 @@ value_pairs_add_glob_pattern(ValuePairs *vp, const gchar *pattern,
   p->include = include;
 
   vp->patterns[i] = p;
+  vp_update_plan(vp);
 }
 
 void
@@ -157,10 +196,12 @@ value_pairs_add_pair(ValuePairs *vp, GlobalConfig *cfg, const gchar *key, const
   VPPairConf *p = g_new(VPPairConf, 1);
 
   p->name = g_strdup(key);
+  p->key = NULL;
   p->template = log_template_new(cfg, NULL);
   log_template_compile(p->template, value, NULL);
 
   g_ptr_array_add(vp->vpairs, p);
+  vp_update_plan(vp);
 }
 
 static gchar *
@@ -185,6 +226,173 @@ vp_transform_apply (ValuePairs *vp, gchar *key)
   return ckey;
 }
 
+static gboolean
+vp_is_name_excluded(ValuePairs *vp, const gchar *name)
+{
+  gboolean exclude = FALSE;
+  gint j;
+
+  for (j = 0; j < vp->patterns_size; j++)
+    {
+      if (g_pattern_match_string(vp->patterns[j]->pattern, name))
+        exclude = !vp->patterns[j]->include;
+    }
+  return exclude;
+}
+
+static void
+vp_plan_add_set(ValuePairs *vp, ValuePairSpec *set)
+{
+  gint i;
+
+  for (i = 0; set[i].name; i++)
+    {
+      VPPlanEntry entry;
+
+      if (vp_is_name_excluded(vp, set[i].name))
+        continue;
+
+      entry.key = vp_transform_apply(vp, set[i].name);
+      entry.type = set[i].type;
+      entry.id = set[i].id;
+      g_array_append_val(vp->plan, entry);
+    }
+}
+
+static void
+vp_free_plan(ValuePairs *vp)
+{
+  gint i;
+
+  if (vp->plan)
+    {
+      for (i = 0; i < vp->plan->len; i++)
+        g_free(g_array_index(vp->plan, VPPlanEntry, i).key);
+      g_array_free(vp->plan, TRUE);
+      vp->plan = NULL;
+    }
+  if (vp->nv_verdicts)
+    {
+      for (i = 0; i < VP_NV_VERDICTS_PAGES; i++)
+        g_free(vp->nv_verdicts[i]);
+      g_free(vp->nv_verdicts);
+      vp->nv_verdicts = NULL;
+    }
+}
+
+/*
+ * Macro names, scopes, patterns and rekey transformations are all known
+ * at configuration time, so the list of macros to emit is computed here
+ * once, instead of matching the patterns and transforming the names for
+ * every message. Called whenever the configuration of @vp changes.
+ */
+static void
+vp_update_plan(ValuePairs *vp)
+{
+  gint i;
+
+  vp_free_plan(vp);
+  vp->plan = g_array_new(FALSE, FALSE, sizeof(VPPlanEntry));
+
+  if (vp->scopes & (VPS_RFC3164 + VPS_RFC5424 + VPS_SELECTED_MACROS))
+    vp_plan_add_set(vp, rfc3164);
+
+  if (vp->scopes & VPS_RFC5424)
+    vp_plan_add_set(vp, rfc5424);
+
+  if (vp->scopes & VPS_SELECTED_MACROS)
+    vp_plan_add_set(vp, selected_macros);
+
+  if (vp->scopes & VPS_ALL_MACROS)
+    vp_plan_add_set(vp, all_macros);
+
+  for (i = 0; i < vp->vpairs->len; i++)
+    {
+      VPPairConf *vpc = (VPPairConf *) g_ptr_array_index(vp->vpairs, i);
+
+      g_free(vpc->key);
+      vpc->key = vp_transform_apply(vp, vpc->name);
+    }
+
+  if (vp->scopes & (VPS_NV_PAIRS + VPS_DOT_NV_PAIRS + VPS_SDATA) ||
+      vp->patterns_size > 0)
+    vp->nv_verdicts = g_new0(guint8 *, VP_NV_VERDICTS_PAGES);
+}
+
+/* the page of the verdict map @handle belongs to, allocated on demand */
+static guint8 *
+vp_nv_verdicts_get_page(ValuePairs *vp, NVHandle handle)
+{
+  guint8 **slot = &vp->nv_verdicts[handle >> VP_NV_VERDICTS_PAGE_BITS];
+  guint8 *page;
+
+  page = g_atomic_pointer_get(slot);
+  if (!page)
+    {
+      page = g_new0(guint8, VP_NV_VERDICTS_PAGE_SIZE);
+      if (!g_atomic_pointer_compare_and_exchange((gpointer *) slot, NULL, page))
+        {
+          /* another thread was faster */
+          g_free(page);
+          page = g_atomic_pointer_get(slot);
+        }
+    }
+  return page;
+}
+
+/*
+ * The set of name-value pairs produced for a single message. Names and
+ * values are stored NUL terminated in a single scratch buffer, entries
+ * refer to them by offset, so collecting the results doesn't need
+ * per-pair allocations. Entries are sorted by name once the set is
+ * complete, if the same name is added more than once, the last one wins.
+ */
+typedef struct
+{
+  gsize name_ofs;
+  gsize value_ofs;
+} VPResult;
+
+typedef struct
+{
+  GArray *entries;
+  GString *buf;
+} VPResults;
+
+typedef struct
+{
+  const gchar *buf;
+  GCompareDataFunc compare_func;
+} VPResultsSortCtx;
+
+/* the value has already been appended to the buffer at @value_ofs */
+static void
+vp_results_add_key(VPResults *results, gsize value_ofs, const gchar *key)
+{
+  VPResult entry;
+
+  g_string_append_c(results->buf, 0);
+  entry.value_ofs = value_ofs;
+  entry.name_ofs = results->buf->len;
+  g_string_append(results->buf, key);
+  g_string_append_c(results->buf, 0);
+  g_array_append_val(results->entries, entry);
+}
+
+static gint
+vp_results_compare(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  const VPResult *ra = (const VPResult *) a;
+  const VPResult *rb = (const VPResult *) b;
+  VPResultsSortCtx *ctx = (VPResultsSortCtx *) user_data;
+  gint cmp;
+
+  cmp = ctx->compare_func(ctx->buf + ra->name_ofs, ctx->buf + rb->name_ofs, NULL);
+  if (cmp == 0)
+    cmp = ra->name_ofs < rb->name_ofs ? -1 : 1;
+  return cmp;
+}
+
 /* runs over the name-value pairs requested by the user (e.g. with value_pairs_add_pair) */
 static void
 vp_pairs_foreach(gpointer data, gpointer user_data)
@@ -192,33 +400,25 @@ vp_pairs_foreach(gpointer data, gpointer user_data)
   ValuePairs *vp = ((gpointer *)user_data)[0];
   LogMessage *msg = ((gpointer *)user_data)[2];
   gint32 seq_num = GPOINTER_TO_INT (((gpointer *)user_data)[3]);
-  GTree *scope_set = ((gpointer *)user_data)[5];
-  ScratchBuffer *sb = scratch_buffer_acquire();
+  VPResults *results = ((gpointer *)user_data)[5];
   VPPairConf *vpc = (VPPairConf *)data;
+  gsize value_ofs = results->buf->len;
 
-  log_template_format((LogTemplate *)vpc->template, msg, NULL, LTZ_LOCAL,
-                      seq_num, NULL, sb_string(sb));
+  log_template_append_format((LogTemplate *)vpc->template, msg, NULL, LTZ_LOCAL,
+                             seq_num, NULL, results->buf);
 
-  if (!sb_string(sb)->str[0])
+  if (results->buf->len == value_ofs || !results->buf->str[value_ofs])
     {
-      scratch_buffer_release(sb);
+      g_string_truncate(results->buf, value_ofs);
       return;
     }
 
-  g_tree_insert(scope_set, vp_transform_apply(vp, vpc->name),
-                sb_string(sb)->str);
-  g_string_steal(sb_string(sb));
-  scratch_buffer_release(sb);
+  vp_results_add_key(results, value_ofs, vpc->key);
 }
 
-/* runs over the LogMessage nv-pairs, and inserts them unless excluded */
 static gboolean
-vp_msg_nvpairs_foreach(NVHandle handle, gchar *name,
-                       const gchar *value, gssize value_len,
-                       gpointer user_data)
+vp_is_nvpair_included(ValuePairs *vp, NVHandle handle, const gchar *name)
 {
-  ValuePairs *vp = ((gpointer *)user_data)[0];
-  GTree *scope_set = ((gpointer *)user_data)[5];
   gint j;
   gboolean inc = FALSE;
 
@@ -229,64 +429,93 @@ vp_msg_nvpairs_foreach(NVHandle handle, gchar *name,
     }
 
   /* NOTE: dot-nv-pairs include SDATA too */
-  if (((name[0] == '.' && (vp->scopes & VPS_DOT_NV_PAIRS)) ||
-       (name[0] != '.' && (vp->scopes & VPS_NV_PAIRS)) ||
-       (log_msg_is_handle_sdata(handle) && (vp->scopes & VPS_SDATA))) ||
-      inc)
+  return ((name[0] == '.' && (vp->scopes & VPS_DOT_NV_PAIRS)) ||
+          (name[0] != '.' && (vp->scopes & VPS_NV_PAIRS)) ||
+          (log_msg_is_handle_sdata(handle) && (vp->scopes & VPS_SDATA))) ||
+         inc;
+}
+
+/* runs over the LogMessage nv-pairs, and inserts them unless excluded */
+static gboolean
+vp_msg_nvpairs_foreach(NVHandle handle, gchar *name,
+                       const gchar *value, gssize value_len,
+                       gpointer user_data)
+{
+  ValuePairs *vp = ((gpointer *)user_data)[0];
+  VPResults *results = ((gpointer *)user_data)[5];
+  guint8 *verdicts;
+  guint8 verdict;
+  gsize value_ofs;
+
+  /* the verdict only depends on the name, which is fixed for a given
+   * handle, concurrent threads may compute it at the same time, but
+   * they'll store the same value */
+  verdicts = vp_nv_verdicts_get_page(vp, handle);
+  verdict = verdicts[handle & (VP_NV_VERDICTS_PAGE_SIZE - 1)];
+  if (verdict == VP_NV_UNKNOWN)
+    {
+      verdict = vp_is_nvpair_included(vp, handle, name) ? VP_NV_INCLUDE : VP_NV_EXCLUDE;
+      verdicts[handle & (VP_NV_VERDICTS_PAGE_SIZE - 1)] = verdict;
+    }
+
+  if (verdict == VP_NV_EXCLUDE)
+    return FALSE;
+
+  value_ofs = results->buf->len;
+  g_string_append_len(results->buf, value, value_len);
+  if (vp->transforms)
+    {
+      gchar *key = vp_transform_apply(vp, name);
+
+      vp_results_add_key(results, value_ofs, key);
+      g_free(key);
+    }
+  else
     {
-      /* NOTE: the key is a borrowed reference in the hash, and value is freed */
-      g_tree_insert(scope_set, vp_transform_apply(vp, name), g_strndup(value, value_len));
+      vp_results_add_key(results, value_ofs, name);
     }
 
   return FALSE;
 }
 
-/* runs over a set of ValuePairSpec structs and merges them into the value-pair set */
+/* runs over the precomputed set of macros and builtin values and adds them to the value-pair set */
 static void
-vp_merge_set(ValuePairs *vp, LogMessage *msg, gint32 seq_num, ValuePairSpec *set, GTree *dest)
+vp_merge_plan(ValuePairs *vp, LogMessage *msg, gint32 seq_num, VPResults *results)
 {
   gint i;
-  ScratchBuffer *sb = scratch_buffer_acquire();
 
-  for (i = 0; set[i].name; i++)
+  for (i = 0; i < vp->plan->len; i++)
     {
-      gint j;
-      gboolean exclude = FALSE;
+      VPPlanEntry *entry = &g_array_index(vp->plan, VPPlanEntry, i);
+      gsize value_ofs;
 
-      for (j = 0; j < vp->patterns_size; j++)
-        {
-          if (g_pattern_match_string(vp->patterns[j]->pattern, set[i].name))
-            exclude = !vp->patterns[j]->include;
-        }
-
-      if (exclude)
-	continue;
-
-      switch (set[i].type)
+      value_ofs = results->buf->len;
+      switch (entry->type)
         {
         case VPT_MACRO:
-          log_macro_expand(sb_string(sb), set[i].id, FALSE, NULL, LTZ_LOCAL, seq_num, NULL, msg);
+          log_macro_expand(results->buf, entry->id, FALSE, NULL, LTZ_LOCAL, seq_num, NULL, msg);
           break;
         case VPT_NVPAIR:
           {
             const gchar *nv;
             gssize len;
 
-            nv = log_msg_get_value(msg, (NVHandle) set[i].id, &len);
-            g_string_append_len(sb_string(sb), nv, len);
+            nv = log_msg_get_value(msg, (NVHandle) entry->id, &len);
+            g_string_append_len(results->buf, nv, len);
             break;
           }
         default:
           g_assert_not_reached();
         }
 
-      if (!sb_string(sb)->str[0])
-	continue;
+      if (results->buf->len == value_ofs || !results->buf->str[value_ofs])
+        {
+          g_string_truncate(results->buf, value_ofs);
+          continue;
+        }
 
-      g_tree_insert(dest, vp_transform_apply(vp, set[i].name), sb_string(sb)->str);
-      g_string_steal(sb_string(sb));
+      vp_results_add_key(results, value_ofs, entry->key);
     }
-  scratch_buffer_release(sb);
 }
 
 void
@@ -295,40 +524,51 @@ value_pairs_foreach_sorted (ValuePairs *vp, VPForeachFunc func,
                             LogMessage *msg, gint32 seq_num, gpointer user_data)
 {
   gpointer args[] = { vp, func, msg, GINT_TO_POINTER (seq_num), user_data, NULL };
-  GTree *scope_set;
+  ScratchBuffer *sb = scratch_buffer_acquire();
+  VPResults results;
+  VPResultsSortCtx sort_ctx;
+  gint i;
 
-  scope_set = g_tree_new_full((GCompareDataFunc)compare_func, NULL,
-                              (GDestroyNotify)g_free,
-                              (GDestroyNotify)g_free);
-  args[5] = scope_set;
+  results.buf = sb_string(sb);
+  results.entries = g_array_sized_new(FALSE, FALSE, sizeof(VPResult), 32);
+  args[5] = &results;
 
   /*
    * Build up the base set
    */
-  if (vp->scopes & (VPS_NV_PAIRS + VPS_DOT_NV_PAIRS + VPS_SDATA) ||
-      vp->patterns_size > 0)
+  if (vp->nv_verdicts)
     nv_table_foreach(msg->payload, logmsg_registry,
                      (NVTableForeachFunc) vp_msg_nvpairs_foreach, args);
 
-  if (vp->scopes & (VPS_RFC3164 + VPS_RFC5424 + VPS_SELECTED_MACROS))
-    vp_merge_set(vp, msg, seq_num, rfc3164, scope_set);
-
-  if (vp->scopes & VPS_RFC5424)
-    vp_merge_set(vp, msg, seq_num, rfc5424, scope_set);
-
-  if (vp->scopes & VPS_SELECTED_MACROS)
-    vp_merge_set(vp, msg, seq_num, selected_macros, scope_set);
-
-  if (vp->scopes & VPS_ALL_MACROS)
-    vp_merge_set(vp, msg, seq_num, all_macros, scope_set);
+  vp_merge_plan(vp, msg, seq_num, &results);
 
   /* Merge the explicit key-value pairs too */
   g_ptr_array_foreach(vp->vpairs, (GFunc)vp_pairs_foreach, args);
 
+  /* Sort by name, the buffer doesn't change from here on */
+  sort_ctx.buf = results.buf->str;
+  sort_ctx.compare_func = compare_func;
+  g_qsort_with_data(results.entries->data, results.entries->len, sizeof(VPResult),
+                    vp_results_compare, &sort_ctx);
+
   /* Aaand we run it through the callback! */
-  g_tree_foreach(scope_set, (GTraverseFunc)func, user_data);
+  for (i = 0; i < results.entries->len; i++)
+    {
+      VPResult *entry = &g_array_index(results.entries, VPResult, i);
 
-  g_tree_destroy(scope_set);
+      /* a later entry with the same name overrides this one */
+      if (i + 1 < results.entries->len &&
+          compare_func(results.buf->str + entry->name_ofs,
+                       results.buf->str + g_array_index(results.entries, VPResult, i + 1).name_ofs,
+                       NULL) == 0)
+        continue;
+
+      if (func(results.buf->str + entry->name_ofs, results.buf->str + entry->value_ofs, user_data))
+        break;
+    }
+
+  g_array_free(results.entries, TRUE);
+  scratch_buffer_release(sb);
 }
 
 void
@@ -370,6 +610,7 @@ vp_free_pair(VPPairConf *vpc)
 {
   log_template_unref(vpc->template);
   g_free(vpc->name);
+  g_free(vpc->key);
   g_free(vpc);
 }
 
@@ -411,6 +652,7 @@ value_pairs_new(void)
       value_pair_sets_initialized = TRUE;
     }
 
+  vp_update_plan(vp);
   return vp;
 }
 
@@ -424,6 +666,7 @@ value_pairs_free (ValuePairs *vp)
     vp_free_pair(g_ptr_array_index(vp->vpairs, i));
 
   g_ptr_array_free(vp->vpairs, TRUE);
+  vp_free_plan(vp);
 
   for (i = 0; i < vp->patterns_size; i++)
     {
@@ -447,6 +690,7 @@ void
 value_pairs_add_transforms(ValuePairs *vp, gpointer *vpts)
 {
   vp->transforms = g_list_append(vp->transforms, vpts);
+  vp_update_plan(vp);
 }
 
 static void
@@ -38,6 +38,11 @@ static CfgLexerKeyword afmongodb_keywords[] = {
   { "safe_mode",		KW_SAFE_MODE },
   { "host",                     KW_HOST },
   { "port",                     KW_PORT },
+  { "batch_lines",              KW_BATCH_LINES },
+  { "batch_timeout",            KW_BATCH_TIMEOUT },
+  { "workers",                  KW_WORKERS },
+  { "worker_partition_key",     KW_WORKER_PARTITION_KEY },
+  { "retries",                  KW_RETRIES },
   { NULL }
 };
 
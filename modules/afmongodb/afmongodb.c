@@ -30,7 +30,7 @@
 #include "misc.h"
 #include "stats.h"
 #include "nvtable.h"
-#include "logqueue.h"
+#include "templates.h"
 
 #include "mongo.h"
 
@@ -42,7 +42,7 @@ typedef struct
 
 typedef struct
 {
-  LogDestDriver super;
+  LogThrDestDriver super;
 
   /* Shared between main/writer; only read by the writer, never
      written */
@@ -58,36 +58,26 @@ typedef struct
   gchar *user;
   gchar *password;
 
-  time_t time_reopen;
-
-  StatsCounterItem *dropped_messages;
-  StatsCounterItem *stored_messages;
-
   time_t last_msg_stamp;
 
   ValuePairs *vp;
+} MongoDBDestDriver;
 
-  /* Thread related stuff; shared */
-  GThread *writer_thread;
-  GMutex *queue_mutex;
-  GMutex *suspend_mutex;
-  GCond *writer_thread_wakeup_cond;
-
-  gboolean writer_thread_terminate;
-  gboolean writer_thread_suspended;
-  GTimeVal writer_thread_suspend_target;
-
-  LogQueue *queue;
+/*
+ * Each worker has its own connection, a batch of messages is sent in a
+ * single insert.
+ */
+typedef struct
+{
+  LogThrDestWorker super;
 
   /* Writer-only stuff */
   mongo_sync_connection *conn;
-  gint32 seq_num;
 
   gchar *ns;
 
-  GString *current_value;
-  bson *bson_sel, *bson_upd, *bson_set;
-} MongoDBDestDriver;
+  bson **bulk_docs;
+} MongoDBDestWorker;
 
 /*
  * Configuration
@@ -177,9 +167,10 @@ afmongodb_dd_set_safe_mode(LogDriver *d, gboolean state)
  * Utilities
  */
 
-static gchar *
-afmongodb_dd_format_stats_instance(MongoDBDestDriver *self)
+static const gchar *
+afmongodb_dd_format_stats_instance(LogThrDestDriver *d)
 {
+  MongoDBDestDriver *self = (MongoDBDestDriver *)d;
   static gchar persist_name[1024];
 
   g_snprintf(persist_name, sizeof(persist_name),
@@ -187,50 +178,52 @@ afmongodb_dd_format_stats_instance(MongoDBDestDriver *self)
   return persist_name;
 }
 
-static gchar *
-afmongodb_dd_format_persist_name(MongoDBDestDriver *self)
+static const gchar *
+afmongodb_dd_format_persist_name(LogThrDestDriver *d, gint worker_index)
 {
+  MongoDBDestDriver *self = (MongoDBDestDriver *)d;
   static gchar persist_name[1024];
 
-  g_snprintf(persist_name, sizeof(persist_name),
-	     "afmongodb(%s,%u,%s,%s)", self->host, self->port, self->db, self->coll);
+  /* the first worker keeps the name used before workers() existed, so
+   * that its queue is kept when upgrading */
+  if (worker_index == 0)
+    g_snprintf(persist_name, sizeof(persist_name),
+	       "afmongodb(%s,%u,%s,%s)", self->host, self->port, self->db, self->coll);
+  else
+    g_snprintf(persist_name, sizeof(persist_name),
+	       "afmongodb(%s,%u,%s,%s,%d)", self->host, self->port, self->db, self->coll, worker_index);
   return persist_name;
 }
 
 static void
-afmongodb_dd_suspend(MongoDBDestDriver *self)
+afmongodb_dd_disconnect(LogThrDestWorker *s)
 {
-  self->writer_thread_suspended = TRUE;
-  g_get_current_time(&self->writer_thread_suspend_target);
-  g_time_val_add(&self->writer_thread_suspend_target,
-		 self->time_reopen * 1000000);
-}
+  MongoDBDestWorker *self = (MongoDBDestWorker *)s;
 
-static void
-afmongodb_dd_disconnect(MongoDBDestDriver *self)
-{
   mongo_sync_disconnect(self->conn);
   self->conn = NULL;
 }
 
 static gboolean
-afmongodb_dd_connect(MongoDBDestDriver *self, gboolean reconnect)
+afmongodb_dd_connect(LogThrDestWorker *s)
 {
+  MongoDBDestWorker *self = (MongoDBDestWorker *)s;
+  MongoDBDestDriver *owner = (MongoDBDestDriver *)s->owner;
   GList *l;
 
-  if (reconnect && self->conn)
-    return TRUE;
-
-  self->conn = mongo_sync_connect(self->host, self->port, FALSE);
+  self->conn = mongo_sync_connect(owner->host, owner->port, FALSE);
   if (!self->conn)
     {
-      msg_error ("Error connecting to MongoDB", NULL);
+      msg_error ("Error connecting to MongoDB",
+		 evt_tag_int("worker", s->index),
+		 evt_tag_int("time_reopen", owner->super.time_reopen),
+		 NULL);
       return FALSE;
     }
 
-  mongo_sync_conn_set_safe_mode(self->conn, self->safe_mode);
+  mongo_sync_conn_set_safe_mode(self->conn, owner->safe_mode);
 
-  l = self->servers;
+  l = owner->servers;
   while ((l = g_list_next(l)) != NULL)
     {
       gchar *host = NULL;
@@ -295,170 +288,98 @@ afmongodb_vp_foreach (const gchar *name, const gchar *value,
   return FALSE;
 }
 
-static gboolean
-afmongodb_worker_insert (MongoDBDestDriver *self)
+static void
+afmongodb_worker_format_document (MongoDBDestWorker *self, LogMessage *msg,
+				  gint32 seq_num, bson *doc)
 {
-  gboolean success;
+  MongoDBDestDriver *owner = (MongoDBDestDriver *)self->super.owner;
+  guint32 oid_seq;
   guint8 *oid;
-  LogMessage *msg;
-  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
-
-  afmongodb_dd_connect(self, TRUE);
-
-  g_mutex_lock(self->queue_mutex);
-  log_queue_reset_parallel_push(self->queue);
-  success = log_queue_pop_head(self->queue, &msg, &path_options, FALSE, FALSE);
-  g_mutex_unlock(self->queue_mutex);
-  if (!success)
-    return TRUE;
 
-  msg_set_context(msg);
+  bson_reset (doc);
 
-  bson_reset (self->bson_sel);
-  bson_reset (self->bson_upd);
-  bson_reset (self->bson_set);
-
-  oid = mongo_util_oid_new_with_time (self->last_msg_stamp, self->seq_num);
-  bson_append_oid (self->bson_sel, "_id", oid);
+  /* the OID counter is interleaved among the workers, so that they never
+   * generate the same _id. It is computed unsigned, as it is expected to
+   * wrap around: only its low 24 bits end up in the OID. */
+  oid_seq = (guint32) seq_num * owner->super.num_workers + self->super.index;
+  oid = mongo_util_oid_new_with_time (owner->last_msg_stamp, (gint32) oid_seq);
+  bson_append_oid (doc, "_id", oid);
   g_free (oid);
-  bson_finish (self->bson_sel);
-
-  value_pairs_foreach (self->vp, afmongodb_vp_foreach,
-		       msg, self->seq_num, self->bson_set);
 
-  bson_finish (self->bson_set);
+  value_pairs_foreach (owner->vp, afmongodb_vp_foreach,
+		       msg, seq_num, doc);
+  bson_finish (doc);
+}
 
-  bson_append_document (self->bson_upd, "$set", self->bson_set);
-  bson_finish (self->bson_upd);
+static LogThrDestResult
+afmongodb_worker_insert (LogThrDestWorker *s, LogMessage **msgs, gint msgs_len,
+			 gint *delivered)
+{
+  MongoDBDestWorker *self = (MongoDBDestWorker *)s;
+  MongoDBDestDriver *owner = (MongoDBDestDriver *)s->owner;
+  gint32 seq_num = s->seq_num;
+  gint i;
 
-  if (!mongo_sync_cmd_update (self->conn, self->ns, MONGO_WIRE_FLAG_UPDATE_UPSERT,
-			      self->bson_sel, self->bson_upd))
+  for (i = 0; i < msgs_len; i++)
     {
-      msg_error ("Network error while inserting into MongoDB",
-		 evt_tag_int("time_reopen", self->time_reopen),
-		 NULL);
-      success = FALSE;
+      msg_set_context(msgs[i]);
+      afmongodb_worker_format_document (self, msgs[i], seq_num, self->bulk_docs[i]);
+      msg_set_context(NULL);
+      step_sequence_number(&seq_num);
     }
 
-  msg_set_context(NULL);
-
-  if (success)
-    {
-      stats_counter_inc(self->stored_messages);
-      step_sequence_number(&self->seq_num);
-      log_msg_ack(msg, &path_options);
-      log_msg_unref(msg);
-    }
-  else
+  /* the whole batch is sent in a single insert */
+  if (!mongo_sync_cmd_insert_n (self->conn, self->ns, msgs_len,
+				(const bson **) self->bulk_docs))
     {
-      g_mutex_lock(self->queue_mutex);
-      log_queue_push_head(self->queue, msg, &path_options);
-      g_mutex_unlock(self->queue_mutex);
+      msg_error ("Network error while inserting into MongoDB",
+		 evt_tag_int("time_reopen", owner->super.time_reopen),
+		 evt_tag_int("worker", s->index),
+		 evt_tag_int("documents", msgs_len),
+		 NULL);
+      *delivered = 0;
+      return LTD_NOT_CONNECTED;
     }
-
-  return success;
+  return LTD_SUCCESS;
 }
 
-static gpointer
-afmongodb_worker_thread (gpointer arg)
+static void
+afmongodb_worker_thread_init (LogThrDestWorker *s)
 {
-  MongoDBDestDriver *self = (MongoDBDestDriver *)arg;
-  gboolean success;
-
-  msg_debug ("Worker thread started",
-	     evt_tag_str("driver", self->super.super.id),
-	     NULL);
-
-  success = afmongodb_dd_connect(self, FALSE);
-
-  self->ns = g_strconcat (self->db, ".", self->coll, NULL);
-
-  self->current_value = g_string_sized_new(256);
-
-  self->bson_sel = bson_new_sized(64);
-  self->bson_upd = bson_new_sized(512);
-  self->bson_set = bson_new_sized(512);
-
-  while (!self->writer_thread_terminate)
-    {
-      g_mutex_lock(self->suspend_mutex);
-      if (self->writer_thread_suspended)
-	{
-	  g_cond_timed_wait(self->writer_thread_wakeup_cond,
-			    self->suspend_mutex,
-			    &self->writer_thread_suspend_target);
-	  self->writer_thread_suspended = FALSE;
-	  g_mutex_unlock(self->suspend_mutex);
-	}
-      else
-	{
-	  g_mutex_unlock(self->suspend_mutex);
-
-	  g_mutex_lock(self->queue_mutex);
-	  if (log_queue_get_length(self->queue) == 0)
-	    {
-	      g_cond_wait(self->writer_thread_wakeup_cond, self->queue_mutex);
-	    }
-	  g_mutex_unlock(self->queue_mutex);
-	}
+  MongoDBDestWorker *self = (MongoDBDestWorker *)s;
+  MongoDBDestDriver *owner = (MongoDBDestDriver *)s->owner;
+  gint i;
 
-      if (self->writer_thread_terminate)
-	break;
+  self->ns = g_strconcat (owner->db, ".", owner->coll, NULL);
 
-      if (!afmongodb_worker_insert (self))
-	{
-	  afmongodb_dd_disconnect(self);
-	  afmongodb_dd_suspend(self);
-	}
-    }
+  self->bulk_docs = g_new(bson *, owner->super.batch_lines);
+  for (i = 0; i < owner->super.batch_lines; i++)
+    self->bulk_docs[i] = bson_new_sized(512);
+}
 
-  afmongodb_dd_disconnect(self);
+static void
+afmongodb_worker_thread_deinit (LogThrDestWorker *s)
+{
+  MongoDBDestWorker *self = (MongoDBDestWorker *)s;
+  gint i;
 
   g_free (self->ns);
-  g_string_free (self->current_value, TRUE);
-
-  bson_free (self->bson_sel);
-  bson_free (self->bson_upd);
-  bson_free (self->bson_set);
+  self->ns = NULL;
 
-  msg_debug ("Worker thread finished",
-	     evt_tag_str("driver", self->super.super.id),
-	     NULL);
-
-  return NULL;
+  for (i = 0; i < s->owner->batch_lines; i++)
+    bson_free (self->bulk_docs[i]);
+  g_free (self->bulk_docs);
+  self->bulk_docs = NULL;
 }
 
 /*
  * Main thread
  */
 
-static void
-afmongodb_dd_start_thread (MongoDBDestDriver *self)
-{
-  self->writer_thread = create_worker_thread(afmongodb_worker_thread, self, TRUE, NULL);
-}
-
-static void
-afmongodb_dd_stop_thread (MongoDBDestDriver *self)
-{
-  self->writer_thread_terminate = TRUE;
-  g_mutex_lock(self->queue_mutex);
-  g_cond_signal(self->writer_thread_wakeup_cond);
-  g_mutex_unlock(self->queue_mutex);
-  g_thread_join(self->writer_thread);
-}
-
 static gboolean
 afmongodb_dd_init(LogPipe *s)
 {
   MongoDBDestDriver *self = (MongoDBDestDriver *)s;
-  GlobalConfig *cfg = log_pipe_get_config(s);
-
-  if (!log_dest_driver_init_method(s))
-    return FALSE;
-
-  if (cfg)
-    self->time_reopen = cfg->time_reopen;
 
   if (!self->vp)
     {
@@ -493,43 +414,7 @@ afmongodb_dd_init(LogPipe *s)
 	      evt_tag_str("collection", self->coll),
 	      NULL);
 
-  self->queue = log_dest_driver_acquire_queue(&self->super, afmongodb_dd_format_persist_name(self));
-
-  stats_lock();
-  stats_register_counter(0, SCS_MONGODB | SCS_DESTINATION, self->super.super.id,
-			 afmongodb_dd_format_stats_instance(self),
-			 SC_TYPE_STORED, &self->stored_messages);
-  stats_register_counter(0, SCS_MONGODB | SCS_DESTINATION, self->super.super.id,
-			 afmongodb_dd_format_stats_instance(self),
-			 SC_TYPE_DROPPED, &self->dropped_messages);
-  stats_unlock();
-
-  log_queue_set_counters(self->queue, self->stored_messages, self->dropped_messages);
-  afmongodb_dd_start_thread(self);
-
-  return TRUE;
-}
-
-static gboolean
-afmongodb_dd_deinit(LogPipe *s)
-{
-  MongoDBDestDriver *self = (MongoDBDestDriver *)s;
-
-  afmongodb_dd_stop_thread(self);
-
-  log_queue_set_counters(self->queue, NULL, NULL);
-  stats_lock();
-  stats_unregister_counter(SCS_MONGODB | SCS_DESTINATION, self->super.super.id,
-			   afmongodb_dd_format_stats_instance(self),
-			   SC_TYPE_STORED, &self->stored_messages);
-  stats_unregister_counter(SCS_MONGODB | SCS_DESTINATION, self->super.super.id,
-			   afmongodb_dd_format_stats_instance(self),
-			   SC_TYPE_DROPPED, &self->dropped_messages);
-  stats_unlock();
-  if (!log_dest_driver_deinit_method(s))
-    return FALSE;
-
-  return TRUE;
+  return log_threaded_dest_driver_init_method(s);
 }
 
 static void
@@ -537,13 +422,6 @@ afmongodb_dd_free(LogPipe *d)
 {
   MongoDBDestDriver *self = (MongoDBDestDriver *)d;
 
-  g_mutex_free(self->suspend_mutex);
-  g_mutex_free(self->queue_mutex);
-  g_cond_free(self->writer_thread_wakeup_cond);
-
-  if (self->queue)
-    log_queue_unref(self->queue);
-
   g_free(self->db);
   g_free(self->coll);
   g_free(self->user);
@@ -552,44 +430,17 @@ afmongodb_dd_free(LogPipe *d)
   string_list_free(self->servers);
   if (self->vp)
     value_pairs_free(self->vp);
-  log_dest_driver_free(d);
-}
-
-static void
-afmongodb_dd_queue_notify(gpointer user_data)
-{
-  MongoDBDestDriver *self = (MongoDBDestDriver *)user_data;
-
-  g_mutex_lock(self->queue_mutex);
-  g_cond_signal(self->writer_thread_wakeup_cond);
-  log_queue_reset_parallel_push(self->queue);
-  g_mutex_unlock(self->queue_mutex);
+  log_threaded_dest_driver_free(d);
 }
 
 static void
 afmongodb_dd_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
 {
   MongoDBDestDriver *self = (MongoDBDestDriver *)s;
-  LogPathOptions local_options;
-
-  if (!path_options->flow_control_requested)
-    path_options = log_msg_break_ack(msg, path_options, &local_options);
 
   self->last_msg_stamp = cached_g_current_time_sec ();
 
-  g_mutex_lock(self->suspend_mutex);
-  g_mutex_lock(self->queue_mutex);
-
-  log_msg_add_ack(msg, path_options);
-  log_queue_push_tail(self->queue, log_msg_ref(msg), path_options);
-
-  if (!self->writer_thread_suspended)
-    log_queue_set_parallel_push(self->queue, 1, afmongodb_dd_queue_notify,
-                                self, NULL);
-  g_mutex_unlock(self->queue_mutex);
-  g_mutex_unlock(self->suspend_mutex);
-
-  log_dest_driver_queue_method(s, msg, path_options, user_data);
+  log_threaded_dest_driver_queue_method(s, msg, path_options, user_data);
 }
 
 /*
@@ -603,23 +454,26 @@ afmongodb_dd_new(void)
 
   mongo_util_oid_init (0);
 
-  log_dest_driver_init_instance(&self->super);
-  self->super.super.super.init = afmongodb_dd_init;
-  self->super.super.super.deinit = afmongodb_dd_deinit;
-  self->super.super.super.queue = afmongodb_dd_queue;
-  self->super.super.super.free_fn = afmongodb_dd_free;
+  log_threaded_dest_driver_init_instance(&self->super);
+  self->super.super.super.super.init = afmongodb_dd_init;
+  self->super.super.super.super.queue = afmongodb_dd_queue;
+  self->super.super.super.super.free_fn = afmongodb_dd_free;
+
+  self->super.stats_source = SCS_MONGODB;
+  self->super.format_stats_instance = afmongodb_dd_format_stats_instance;
+  self->super.format_persist_name = afmongodb_dd_format_persist_name;
+  self->super.worker_size = sizeof(MongoDBDestWorker);
+  self->super.worker.thread_init = afmongodb_worker_thread_init;
+  self->super.worker.thread_deinit = afmongodb_worker_thread_deinit;
+  self->super.worker.connect = afmongodb_dd_connect;
+  self->super.worker.disconnect = afmongodb_dd_disconnect;
+  self->super.worker.insert = afmongodb_worker_insert;
 
   afmongodb_dd_set_servers((LogDriver *)self, g_list_append (NULL, g_strdup ("127.0.0.1:27017")));
   afmongodb_dd_set_database((LogDriver *)self, "syslog");
   afmongodb_dd_set_collection((LogDriver *)self, "messages");
   afmongodb_dd_set_safe_mode((LogDriver *)self, FALSE);
 
-  init_sequence_number(&self->seq_num);
-
-  self->writer_thread_wakeup_cond = g_cond_new();
-  self->suspend_mutex = g_mutex_new();
-  self->queue_mutex = g_mutex_new();
-
   return (LogDriver *)self;
 }
 
@@ -24,7 +24,7 @@
 #ifndef AFMONGODB_H_INCLUDED
 #define AFMONGODB_H_INCLUDED
 
-#include "driver.h"
+#include "logthrdestdrv.h"
 #include "value-pairs.h"
 
 LogDriver *afmongodb_dd_new(void);
@@ -41,6 +41,11 @@ static CfgLexerKeyword afsmtp_keywords[] = {
   { "sender",			KW_SENDER },
   { "body",			KW_BODY },
   { "header",			KW_HEADER },
+  { "batch_lines",		KW_BATCH_LINES },
+  { "batch_timeout",		KW_BATCH_TIMEOUT },
+  { "workers",			KW_WORKERS },
+  { "worker_partition_key",	KW_WORKER_PARTITION_KEY },
+  { "retries",			KW_RETRIES },
   { NULL }
 };
 
@@ -29,7 +29,6 @@
 #include "messages.h"
 #include "misc.h"
 #include "stats.h"
-#include "logqueue.h"
 
 #include <libesmtp.h>
 
@@ -49,7 +48,7 @@ typedef struct
 
 typedef struct
 {
-  LogDestDriver super;
+  LogThrDestDriver super;
 
   /* Shared between main/writer; only read by the writer, never
      written */
@@ -62,30 +61,24 @@ typedef struct
   GList *headers;
   gchar *body;
 
-  time_t time_reopen;
-
-  StatsCounterItem *dropped_messages;
-  StatsCounterItem *stored_messages;
-
   LogTemplate *subject_tmpl;
   LogTemplate *body_tmpl;
+} AFSMTPDriver;
 
-  /* Thread related stuff; shared */
-  GThread *writer_thread;
-  GMutex *queue_mutex;
-  GMutex *suspend_mutex;
-  GCond *writer_thread_wakeup_cond;
-
-  gboolean writer_thread_terminate;
-  gboolean writer_thread_suspended;
-  GTimeVal writer_thread_suspend_target;
-
-  LogQueue *queue;
+/*
+ * A batch of messages is sent in a single SMTP session, libesmtp
+ * doesn't copy the message bodies, so each message of the batch has its
+ * own buffer.
+ */
+typedef struct
+{
+  LogThrDestWorker super;
 
   /* Writer-only stuff */
-  gint32 seq_num;
   GString *str;
-} AFSMTPDriver;
+  GString **bodies;
+  smtp_message_t *messages;
+} AFSMTPWorker;
 
 static gchar *
 afsmtp_wash_string (gchar *str)
@@ -203,9 +196,10 @@ ignore_sigpipe (void)
   sigaction(SIGPIPE, &sa, NULL);
 }
 
-static gchar *
-afsmtp_dd_format_stats_instance(AFSMTPDriver *self)
+static const gchar *
+afsmtp_dd_format_stats_instance(LogThrDestDriver *d)
 {
+  AFSMTPDriver *self = (AFSMTPDriver *)d;
   static gchar persist_name[1024];
 
   g_snprintf(persist_name, sizeof(persist_name),
@@ -213,13 +207,21 @@ afsmtp_dd_format_stats_instance(AFSMTPDriver *self)
   return persist_name;
 }
 
-static void
-afsmtp_dd_suspend(AFSMTPDriver *self)
+static const gchar *
+afsmtp_dd_format_persist_name(LogThrDestDriver *d, gint worker_index)
 {
-  self->writer_thread_suspended = TRUE;
-  g_get_current_time(&self->writer_thread_suspend_target);
-  g_time_val_add(&self->writer_thread_suspend_target,
-                 self->time_reopen * 1000000);
+  AFSMTPDriver *self = (AFSMTPDriver *)d;
+  static gchar persist_name[1024];
+
+  /* the first worker keeps the name used before workers() existed, so
+   * that its queue is kept when upgrading */
+  if (worker_index == 0)
+    g_snprintf(persist_name, sizeof(persist_name),
+               "smtp,%s,%u", self->host, self->port);
+  else
+    g_snprintf(persist_name, sizeof(persist_name),
+               "smtp,%s,%u,%d", self->host, self->port, worker_index);
+  return persist_name;
 }
 
 /*
@@ -253,11 +255,12 @@ afsmtp_dd_msg_add_recipient(AFSMTPRecipient *rcpt, smtp_message_t message)
 static void
 afsmtp_dd_msg_add_header(AFSMTPHeader *hdr, gpointer user_data)
 {
-  AFSMTPDriver *self = ((gpointer *)user_data)[0];
+  AFSMTPWorker *self = ((gpointer *)user_data)[0];
   LogMessage *msg = ((gpointer *)user_data)[1];
   smtp_message_t message = ((gpointer *)user_data)[2];
+  gint32 seq_num = *(gint32 *)((gpointer *)user_data)[3];
 
-  log_template_format(hdr->value, msg, NULL, LTZ_SEND, self->seq_num, NULL, self->str);
+  log_template_format(hdr->value, msg, NULL, LTZ_SEND, seq_num, NULL, self->str);
 
   smtp_set_header(message, hdr->name, afsmtp_wash_string (self->str->str), NULL);
   smtp_set_header_option(message, hdr->name, Hdr_OVERRIDE, 1);
@@ -336,64 +339,77 @@ afsmtp_dd_cb_monitor(const gchar *buf, gint buflen, gint writing,
     }
 }
 
-static gboolean
-afsmtp_worker_insert(AFSMTPDriver *self)
+static smtp_message_t
+afsmtp_worker_add_message(AFSMTPWorker *self, smtp_session_t session,
+                          LogMessage *msg, gint32 seq_num, GString *body)
 {
-  gboolean success;
-  LogMessage *msg;
-  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
-  smtp_session_t session;
+  AFSMTPDriver *owner = (AFSMTPDriver *)self->super.owner;
   smtp_message_t message;
-  gpointer args[] = { self, NULL, NULL };
-
-  g_mutex_lock(self->queue_mutex);
-  log_queue_reset_parallel_push(self->queue);
-  success = log_queue_pop_head(self->queue, &msg, &path_options, FALSE, FALSE);
-  g_mutex_unlock(self->queue_mutex);
-  if (!success)
-    return TRUE;
+  gpointer args[] = { self, msg, NULL, &seq_num };
 
-  msg_set_context(msg);
-
-  session = smtp_create_session();
   message = smtp_add_message(session);
 
-  g_string_printf(self->str, "%s:%d", self->host, self->port);
-  smtp_set_server(session, self->str->str);
-
-  smtp_set_eventcb(session, (smtp_eventcb_t)afsmtp_dd_cb_event, (void *)self);
-  smtp_set_monitorcb(session, (smtp_monitorcb_t)afsmtp_dd_cb_monitor,
-                     (void *)self, 1);
-
-  smtp_set_reverse_path(message, self->mail_from->address);
+  smtp_set_reverse_path(message, owner->mail_from->address);
 
   /* Defaults */
   smtp_set_header(message, "To", NULL, NULL);
   smtp_set_header(message, "From", NULL, NULL);
 
-  log_template_format(self->subject_tmpl, msg, NULL, LTZ_SEND,
-                      self->seq_num, NULL, self->str);
+  log_template_format(owner->subject_tmpl, msg, NULL, LTZ_SEND,
+                      seq_num, NULL, self->str);
   smtp_set_header(message, "Subject", afsmtp_wash_string(self->str->str));
   smtp_set_header_option(message, "Subject", Hdr_OVERRIDE, 1);
 
   /* Add recipients */
-  g_list_foreach(self->rcpt_tos, (GFunc)afsmtp_dd_msg_add_recipient, message);
+  g_list_foreach(owner->rcpt_tos, (GFunc)afsmtp_dd_msg_add_recipient, message);
 
   /* Add custom header (overrides anything set before, or in the
      body). */
-  args[1] = msg;
   args[2] = message;
-  g_list_foreach(self->headers, (GFunc)afsmtp_dd_msg_add_header, args);
+  g_list_foreach(owner->headers, (GFunc)afsmtp_dd_msg_add_header, args);
 
   /* Set the body.
    *
    * We add a header to the body, otherwise libesmtp will not
    * recognise headers, and will append them to the end of the body.
    */
-  g_string_assign(self->str, "X-Mailer: syslog-ng " VERSION "\r\n\r\n");
-  log_template_append_format(self->body_tmpl, msg, NULL, LTZ_SEND,
-                             self->seq_num, NULL, self->str);
-  smtp_set_message_str(message, self->str->str);
+  g_string_assign(body, "X-Mailer: syslog-ng " VERSION "\r\n\r\n");
+  log_template_append_format(owner->body_tmpl, msg, NULL, LTZ_SEND,
+                             seq_num, NULL, body);
+  smtp_set_message_str(message, body->str);
+
+  return message;
+}
+
+static LogThrDestResult
+afsmtp_worker_insert(LogThrDestWorker *s, LogMessage **msgs, gint msgs_len,
+                     gint *delivered)
+{
+  AFSMTPWorker *self = (AFSMTPWorker *)s;
+  AFSMTPDriver *owner = (AFSMTPDriver *)s->owner;
+  LogThrDestResult result = LTD_SUCCESS;
+  smtp_session_t session;
+  gint32 seq_num = s->seq_num;
+  gint i;
+
+  session = smtp_create_session();
+
+  g_string_printf(self->str, "%s:%d", owner->host, owner->port);
+  smtp_set_server(session, self->str->str);
+
+  smtp_set_eventcb(session, (smtp_eventcb_t)afsmtp_dd_cb_event, (void *)owner);
+  smtp_set_monitorcb(session, (smtp_monitorcb_t)afsmtp_dd_cb_monitor,
+                     (void *)owner, 1);
+
+  /* the whole batch is sent in a single session */
+  for (i = 0; i < msgs_len; i++)
+    {
+      msg_set_context(msgs[i]);
+      self->messages[i] = afsmtp_worker_add_message(self, session, msgs[i],
+                                                    seq_num, self->bodies[i]);
+      msg_set_context(NULL);
+      step_sequence_number(&seq_num);
+    }
 
   if (!smtp_start_session(session))
     {
@@ -402,114 +418,73 @@ afsmtp_worker_insert(AFSMTPDriver *self)
 
       msg_error("SMTP server error, suspending",
                 evt_tag_str("error", error),
-                evt_tag_int("time_reopen", self->time_reopen),
-                NULL);
-      success = FALSE;
-    }
-  else
-    {
-      const smtp_status_t *status = smtp_message_transfer_status(message);
-      msg_debug("SMTP result",
-                evt_tag_int("code", status->code),
-                evt_tag_str("text", status->text),
+                evt_tag_int("time_reopen", owner->super.time_reopen),
                 NULL);
-      smtp_enumerate_recipients(message, afsmtp_dd_log_rcpt_status, NULL);
-    }
-  smtp_destroy_session(session);
 
-  msg_set_context(NULL);
+      /* messages transferred before the error are not sent again */
+      for (i = 0; i < msgs_len; i++)
+        {
+          const smtp_status_t *status = smtp_message_transfer_status(self->messages[i]);
 
-  if (success)
-    {
-      stats_counter_inc(self->stored_messages);
-      step_sequence_number(&self->seq_num);
-      log_msg_ack(msg, &path_options);
-      log_msg_unref(msg);
+          if (status->code / 100 != 2)
+            break;
+        }
+      *delivered = i;
+      result = LTD_NOT_CONNECTED;
     }
   else
     {
-      g_mutex_lock(self->queue_mutex);
-      log_queue_push_head(self->queue, msg, &path_options);
-      g_mutex_unlock(self->queue_mutex);
+      for (i = 0; i < msgs_len; i++)
+        {
+          const smtp_status_t *status = smtp_message_transfer_status(self->messages[i]);
+          msg_debug("SMTP result",
+                    evt_tag_int("code", status->code),
+                    evt_tag_str("text", status->text),
+                    NULL);
+          smtp_enumerate_recipients(self->messages[i], afsmtp_dd_log_rcpt_status, NULL);
+        }
     }
+  smtp_destroy_session(session);
 
-  return success;
+  return result;
 }
 
-static gpointer
-afsmtp_worker_thread(gpointer arg)
+static void
+afsmtp_worker_thread_init(LogThrDestWorker *s)
 {
-  AFSMTPDriver *self = (AFSMTPDriver *)arg;
-
-  msg_debug("Worker thread started",
-            evt_tag_str("driver", self->super.super.id),
-            NULL);
+  AFSMTPWorker *self = (AFSMTPWorker *)s;
+  gint batch_lines = s->owner->batch_lines;
+  gint i;
 
   self->str = g_string_sized_new(1024);
+  self->bodies = g_new(GString *, batch_lines);
+  for (i = 0; i < batch_lines; i++)
+    self->bodies[i] = g_string_sized_new(1024);
+  self->messages = g_new0(smtp_message_t, batch_lines);
 
   ignore_sigpipe();
+}
 
-  while (!self->writer_thread_terminate)
-    {
-      g_mutex_lock(self->suspend_mutex);
-      if (self->writer_thread_suspended)
-        {
-          g_cond_timed_wait(self->writer_thread_wakeup_cond,
-                            self->suspend_mutex,
-                            &self->writer_thread_suspend_target);
-          self->writer_thread_suspended = FALSE;
-          g_mutex_unlock(self->suspend_mutex);
-        }
-      else
-        {
-          g_mutex_unlock(self->suspend_mutex);
-
-          g_mutex_lock(self->queue_mutex);
-          if (log_queue_get_length(self->queue) == 0)
-            {
-              g_cond_wait(self->writer_thread_wakeup_cond, self->queue_mutex);
-            }
-          g_mutex_unlock(self->queue_mutex);
-        }
-
-      if (self->writer_thread_terminate)
-        break;
-
-      if (!afsmtp_worker_insert (self))
-        {
-          afsmtp_dd_suspend(self);
-        }
-    }
+static void
+afsmtp_worker_thread_deinit(LogThrDestWorker *s)
+{
+  AFSMTPWorker *self = (AFSMTPWorker *)s;
+  gint i;
 
+  for (i = 0; i < s->owner->batch_lines; i++)
+    g_string_free(self->bodies[i], TRUE);
+  g_free(self->bodies);
+  g_free(self->messages);
   g_string_free(self->str, TRUE);
-
-  msg_debug("Worker thread finished",
-            evt_tag_str("driver", self->super.super.id),
-            NULL);
-
-  return NULL;
+  self->bodies = NULL;
+  self->messages = NULL;
+  self->str = NULL;
 }
 
 /*
  * Main thread
  */
 
-static void
-afsmtp_dd_start_thread(AFSMTPDriver *self)
-{
-  self->writer_thread = create_worker_thread(afsmtp_worker_thread, self, TRUE, NULL);
-}
-
-static void
-afsmtp_dd_stop_thread(AFSMTPDriver *self)
-{
-  self->writer_thread_terminate = TRUE;
-  g_mutex_lock(self->queue_mutex);
-  g_cond_signal(self->writer_thread_wakeup_cond);
-  g_mutex_unlock(self->queue_mutex);
-  g_thread_join(self->writer_thread);
-}
-
 static void
 afsmtp_dd_init_header(AFSMTPHeader *hdr, GlobalConfig *cfg)
 {
@@ -526,16 +501,11 @@ afsmtp_dd_init(LogPipe *s)
   AFSMTPDriver *self = (AFSMTPDriver *)s;
   GlobalConfig *cfg = log_pipe_get_config(s);
 
-  if (cfg)
-    self->time_reopen = cfg->time_reopen;
-
   msg_verbose("Initializing SMTP destination",
               evt_tag_str("host", self->host),
               evt_tag_int("port", self->port),
               NULL);
 
-  self->queue = log_dest_driver_acquire_queue(&self->super, afsmtp_dd_format_stats_instance(self));
-
   g_list_foreach(self->headers, (GFunc)afsmtp_dd_init_header, cfg);
   if (!self->subject_tmpl)
     {
@@ -548,37 +518,7 @@ afsmtp_dd_init(LogPipe *s)
       log_template_compile(self->body_tmpl, self->body, NULL);
     }
 
-  stats_lock();
-  stats_register_counter(0, SCS_SMTP | SCS_DESTINATION, self->super.super.id,
-                         afsmtp_dd_format_stats_instance(self),
-                         SC_TYPE_STORED, &self->stored_messages);
-  stats_register_counter(0, SCS_SMTP | SCS_DESTINATION, self->super.super.id,
-                         afsmtp_dd_format_stats_instance(self),
-                         SC_TYPE_DROPPED, &self->dropped_messages);
-  stats_unlock();
-
-  afsmtp_dd_start_thread(self);
-
-  return TRUE;
-}
-
-static gboolean
-afsmtp_dd_deinit(LogPipe *s)
-{
-  AFSMTPDriver *self = (AFSMTPDriver *)s;
-
-  afsmtp_dd_stop_thread(self);
-
-  stats_lock();
-  stats_unregister_counter(SCS_SMTP | SCS_DESTINATION, self->super.super.id,
-                           afsmtp_dd_format_stats_instance(self),
-                           SC_TYPE_STORED, &self->stored_messages);
-  stats_unregister_counter(SCS_SMTP | SCS_DESTINATION, self->super.super.id,
-                           afsmtp_dd_format_stats_instance(self),
-                           SC_TYPE_DROPPED, &self->dropped_messages);
-  stats_unlock();
-
-  return TRUE;
+  return log_threaded_dest_driver_init_method(s);
 }
 
 static void
@@ -587,13 +527,6 @@ afsmtp_dd_free(LogPipe *d)
   AFSMTPDriver *self = (AFSMTPDriver *)d;
   GList *l;
 
-  g_mutex_free(self->suspend_mutex);
-  g_mutex_free(self->queue_mutex);
-  g_cond_free(self->writer_thread_wakeup_cond);
-
-  if (self->queue)
-    log_queue_unref(self->queue);
-
   g_free(self->host);
   g_free(self->mail_from->phrase);
   g_free(self->mail_from->address);
@@ -602,7 +535,6 @@ afsmtp_dd_free(LogPipe *d)
   log_template_unref(self->body_tmpl);
   g_free(self->body);
   g_free(self->subject);
-  g_string_free(self->str, TRUE);
 
   l = self->rcpt_tos;
   while (l)
@@ -625,47 +557,7 @@ afsmtp_dd_free(LogPipe *d)
       l = g_list_delete_link(l, l);
     }
 
-  log_dest_driver_free(d);
-}
-
-static void
-afsmtp_dd_queue_notify(gpointer s)
-{
-  AFSMTPDriver *self = (AFSMTPDriver *)s;
-
-  g_mutex_lock(self->queue_mutex);
-  g_cond_signal(self->writer_thread_wakeup_cond);
-  log_queue_reset_parallel_push(self->queue);
-  g_mutex_unlock(self->queue_mutex);
-}
-
-static void
-afsmtp_dd_queue(LogPipe *s, LogMessage *msg,
-                const LogPathOptions *path_options, gpointer user_data)
-{
-  AFSMTPDriver *self = (AFSMTPDriver *)s;
-  gboolean queue_was_empty;
-  LogPathOptions local_options;
-
-  if (!path_options->flow_control_requested)
-    path_options = log_msg_break_ack(msg, path_options, &local_options);
-
-  g_mutex_lock(self->queue_mutex);
-  queue_was_empty = log_queue_get_length(self->queue) == 0;
-  g_mutex_unlock(self->queue_mutex);
-
-  log_msg_add_ack(msg, path_options);
-  log_queue_push_tail(self->queue, log_msg_ref(msg), path_options);
-
-  g_mutex_lock(self->suspend_mutex);
-  if (queue_was_empty && !self->writer_thread_suspended)
-    {
-      g_mutex_lock(self->queue_mutex);
-      log_queue_set_parallel_push(self->queue, 1, afsmtp_dd_queue_notify, self, NULL);
-      g_mutex_unlock(self->queue_mutex);
-    }
-  g_mutex_unlock(self->suspend_mutex);
-  log_dest_driver_queue_method(s, msg, path_options, user_data);
+  log_threaded_dest_driver_free(d);
 }
 
 /*
@@ -677,23 +569,23 @@ afsmtp_dd_new(void)
 {
   AFSMTPDriver *self = g_new0(AFSMTPDriver, 1);
 
-  log_dest_driver_init_instance(&self->super);
-  self->super.super.super.init = afsmtp_dd_init;
-  self->super.super.super.deinit = afsmtp_dd_deinit;
-  self->super.super.super.queue = afsmtp_dd_queue;
-  self->super.super.super.free_fn = afsmtp_dd_free;
+  log_threaded_dest_driver_init_instance(&self->super);
+  self->super.super.super.super.init = afsmtp_dd_init;
+  self->super.super.super.super.free_fn = afsmtp_dd_free;
+
+  self->super.stats_source = SCS_SMTP;
+  self->super.format_stats_instance = afsmtp_dd_format_stats_instance;
+  self->super.format_persist_name = afsmtp_dd_format_persist_name;
+  self->super.worker_size = sizeof(AFSMTPWorker);
+  self->super.worker.thread_init = afsmtp_worker_thread_init;
+  self->super.worker.thread_deinit = afsmtp_worker_thread_deinit;
+  self->super.worker.insert = afsmtp_worker_insert;
 
   afsmtp_dd_set_host((LogDriver *)self, "127.0.0.1");
   afsmtp_dd_set_port((LogDriver *)self, 25);
 
   self->mail_from = g_new0(AFSMTPRecipient, 1);
 
-  init_sequence_number(&self->seq_num);
-
-  self->writer_thread_wakeup_cond = g_cond_new();
-  self->suspend_mutex = g_mutex_new();
-  self->queue_mutex = g_mutex_new();
-
   return (LogDriver *)self;
 }
 
@@ -24,7 +24,7 @@
 #ifndef AFSMTP_H_INCLUDED
 #define AFSMTP_H_INCLUDED
 
-#include "driver.h"
+#include "logthrdestdrv.h"
 
 typedef enum
   {
@@ -25,6 +25,7 @@
 #include "messages.h"
 #include "misc.h"
 #include "gprocess.h"
+#include "spoofpacket.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -32,6 +33,7 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <string.h>
 
 #ifndef SOL_IP
@@ -526,217 +528,201 @@ afinet_dd_apply_transport(AFSocketDestDriver *s)
 }
 
 static gboolean
-afinet_dd_setup_socket(AFSocketDestDriver *s, gint fd)
+afinet_dd_setup_socket(AFSocketDestDriver *s, AFSocketDestConnection *conn, gint fd)
 {
-  AFInetDestDriver *self = (AFInetDestDriver *) s;
-
-  if (!resolve_hostname(&self->super.dest_addr, self->super.hostname))
+  if (!resolve_hostname(&conn->dest_addr, conn->hostname))
     return FALSE;
 
-  return afinet_setup_socket(fd, self->super.dest_addr, (InetSocketOptions *) s->sock_options_ptr, AFSOCKET_DIR_SEND);
+  return afinet_setup_socket(fd, conn->dest_addr, (InetSocketOptions *) s->sock_options_ptr, AFSOCKET_DIR_SEND);
 }
 
-static gboolean
-afinet_dd_init(LogPipe *s)
-{
-  AFInetDestDriver *self G_GNUC_UNUSED = (AFInetDestDriver *) s;
-  gboolean success;
-
-  success = afsocket_dd_init(s);
 #if ENABLE_SPOOF_SOURCE
-  if (success)
+/*
+ * AFInetSpoofClient
+ *
+ * LogProto sending each message as an UDP datagram with the address of
+ * the original sender as its source. The packets, including their IP
+ * header, are built by spoof_packet_new() and are passed to a datagram
+ * client working on the (connected) raw socket, so they are sent in
+ * batches and acked once they were sent, just like normal UDP datagrams.
+ * libnet is only used to open the raw socket. Messages without an usable
+ * source address are sent with the address of our own UDP socket.
+ *
+ * Each connection has its own instance, which is only used by the thread
+ * of its LogWriter, so no locking is needed.
+ */
+typedef struct _AFInetSpoofClient
+{
+  LogProto super;
+  LogProto *raw_proto;
+  libnet_t *lnet_ctx;
+  GSockAddr *local_addr;
+  GSockAddr *dest_addr;
+  gint dropped;
+} AFInetSpoofClient;
+
+static LogProtoStatus
+afinet_spoof_client_post_from(LogProto *s, GSockAddr *saddr, guchar *msg, gsize msg_len, gboolean *consumed)
+{
+  AFInetSpoofClient *self = (AFInetSpoofClient *) s;
+  LogProtoStatus status;
+  guchar *packet = NULL;
+  gsize packet_len;
+  gint fd;
+  GIOCondition cond;
+
+  *consumed = FALSE;
+  if (saddr)
+    packet = spoof_packet_new(saddr, self->dest_addr, msg, msg_len, &packet_len);
+  if (!packet)
+    packet = spoof_packet_new(self->local_addr, self->dest_addr, msg, msg_len, &packet_len);
+  if (!packet)
     {
-      if (self->spoof_source && !self->lnet_ctx)
-        {
-          gchar error[LIBNET_ERRBUF_SIZE];
-          cap_t saved_caps;
-
-          saved_caps = g_process_cap_save();
-          g_process_cap_modify(CAP_NET_RAW, TRUE);
-          self->lnet_ctx = libnet_init(self->super.bind_addr->sa.sa_family == AF_INET ? LIBNET_RAW4 : LIBNET_RAW6, NULL, error);
-          g_process_cap_restore(saved_caps);
-          if (!self->lnet_ctx)
-            {
-              msg_error("Error initializing raw socket, spoof-source support disabled",
-                        evt_tag_str("error", NULL),
-                        NULL);
-            }
-        }
+      /* the message can't be sent at all (e.g. it is too large for a
+       * datagram), drop it, but only once the messages before it were
+       * sent, as LogWriter acks messages in order */
+      status = log_proto_flush(self->raw_proto);
+      if (status != LPS_SUCCESS || log_proto_prepare(self->raw_proto, &fd, &cond))
+        return status;
+
+      msg_error("Message does not fit into a datagram, dropping",
+                evt_tag_int("length", msg_len),
+                NULL);
+      g_free(msg);
+      self->dropped++;
+      *consumed = TRUE;
+      return LPS_SUCCESS;
     }
-#endif
 
-  return success;
+  status = log_proto_post(self->raw_proto, packet, packet_len, consumed);
+  if (*consumed)
+    g_free(msg);
+  else
+    g_free(packet);
+  return status;
 }
 
-#if ENABLE_SPOOF_SOURCE
-static gboolean
-afinet_dd_construct_ipv4_packet(AFInetDestDriver *self, LogMessage *msg, GString *msg_line)
+static LogProtoStatus
+afinet_spoof_client_post(LogProto *s, guchar *msg, gsize msg_len, gboolean *consumed)
 {
-  libnet_ptag_t ip, udp;
-  struct sockaddr_in *src, *dst;
-
-  if (msg->saddr->sa.sa_family != AF_INET)
-    return FALSE;
-
-  src = (struct sockaddr_in *) &msg->saddr->sa;
-  dst = (struct sockaddr_in *) &self->super.dest_addr->sa;
+  return afinet_spoof_client_post_from(s, NULL, msg, msg_len, consumed);
+}
 
-  libnet_clear_packet(self->lnet_ctx);
+static LogProtoStatus
+afinet_spoof_client_flush(LogProto *s)
+{
+  AFInetSpoofClient *self = (AFInetSpoofClient *) s;
 
-  udp = libnet_build_udp(ntohs(src->sin_port),
-                         ntohs(dst->sin_port),
-                         LIBNET_UDP_H + msg_line->len,
-                         0,
-                         (guchar *) msg_line->str,
-                         msg_line->len,
-                         self->lnet_ctx,
-                         0);
-  if (udp == -1)
-    return FALSE;
+  return log_proto_flush(self->raw_proto);
+}
 
-  ip = libnet_build_ipv4(LIBNET_IPV4_H + msg_line->len + LIBNET_UDP_H,
-                         IPTOS_LOWDELAY,         /* IP tos */
-                         0,                      /* IP ID */
-                         0,                      /* frag stuff */
-                         64,                     /* TTL */
-                         IPPROTO_UDP,            /* transport protocol */
-                         0,
-                         src->sin_addr.s_addr,   /* source IP */
-                         dst->sin_addr.s_addr,   /* destination IP */
-                         NULL,                   /* payload (none) */
-                         0,                      /* payload length */
-                         self->lnet_ctx,
-                         0);
-  if (ip == -1)
-    return FALSE;
+static gint
+afinet_spoof_client_take_sent(LogProto *s)
+{
+  AFInetSpoofClient *self = (AFInetSpoofClient *) s;
+  gint sent;
 
-  return TRUE;
+  sent = log_proto_take_sent(self->raw_proto) + self->dropped;
+  self->dropped = 0;
+  return sent;
 }
 
-#if ENABLE_IPV6
 static gboolean
-afinet_dd_construct_ipv6_packet(AFInetDestDriver *self, LogMessage *msg, GString *msg_line)
+afinet_spoof_client_prepare(LogProto *s, gint *fd, GIOCondition *cond)
 {
-  libnet_ptag_t ip, udp;
-  struct sockaddr_in *src4;
-  struct sockaddr_in6 src, *dst;
-  struct libnet_in6_addr ln_src, ln_dst;
-
-  switch (msg->saddr->sa.sa_family)
-    {
-    case AF_INET:
-      src4 = (struct sockaddr_in *) &msg->saddr->sa;
-      memset(&src, 0, sizeof(src));
-      src.sin6_family = AF_INET6;
-      src.sin6_port = src4->sin_port;
-      ((guint32 *) &src.sin6_addr)[0] = 0;
-      ((guint32 *) &src.sin6_addr)[1] = 0;
-      ((guint32 *) &src.sin6_addr)[2] = htonl(0xffff);
-      ((guint32 *) &src.sin6_addr)[3] = src4->sin_addr.s_addr;
-      break;
-    case AF_INET6:
-      src = *((struct sockaddr_in6 *) &msg->saddr->sa);
-      break;
-    default:
-      g_assert_not_reached();
-      break;
-    }
-
-  dst = (struct sockaddr_in6 *) &self->super.dest_addr->sa;
+  AFInetSpoofClient *self = (AFInetSpoofClient *) s;
 
-  libnet_clear_packet(self->lnet_ctx);
+  /* we are writing the raw socket, the UDP socket is only used for its address */
+  return log_proto_prepare(self->raw_proto, fd, cond);
+}
 
-  udp = libnet_build_udp(ntohs(src.sin6_port),
-                         ntohs(dst->sin6_port),
-                         LIBNET_UDP_H + msg_line->len,
-                         0,
-                         (guchar *) msg_line->str,
-                         msg_line->len,
-                         self->lnet_ctx,
-                         0);
-  if (udp == -1)
-    return FALSE;
+static void
+afinet_spoof_client_free(LogProto *s)
+{
+  AFInetSpoofClient *self = (AFInetSpoofClient *) s;
 
-  /* There seems to be a bug in libnet 1.1.2 that is triggered when
-   * checksumming UDP6 packets. This is a workaround below. */
+  log_proto_free(self->raw_proto);
+  libnet_destroy(self->lnet_ctx);
+  g_sockaddr_unref(self->local_addr);
+  g_sockaddr_unref(self->dest_addr);
+}
 
-  libnet_toggle_checksum(self->lnet_ctx, udp, LIBNET_OFF);
+static LogProto *
+afinet_spoof_client_new(LogTransport *transport, GSockAddr *dest_addr, gint max_batch)
+{
+  AFInetSpoofClient *self;
+  gchar error[LIBNET_ERRBUF_SIZE];
+  struct sockaddr_storage local_sa;
+  socklen_t local_salen = sizeof(local_sa);
+  libnet_t *lnet_ctx;
+  cap_t saved_caps;
+
+  if (getsockname(transport->fd, (struct sockaddr *) &local_sa, &local_salen) < 0)
+    {
+      msg_error("Error querying local address, spoof-source support disabled",
+                evt_tag_errno(EVT_TAG_OSERROR, errno),
+                NULL);
+      return NULL;
+    }
 
-  memcpy(&ln_src, &src.sin6_addr, sizeof(ln_src));
-  memcpy(&ln_dst, &dst->sin6_addr, sizeof(ln_dst));
-  ip = libnet_build_ipv6(0, 0,
-                         LIBNET_UDP_H + msg_line->len,
-                         IPPROTO_UDP,            /* IPv6 next header */
-                         64,                     /* hop limit */
-                         ln_src, ln_dst,
-                         NULL, 0,                /* payload and its length */
-                         self->lnet_ctx,
-                         0);
+  saved_caps = g_process_cap_save();
+  g_process_cap_modify(CAP_NET_RAW, TRUE);
+  /* the raw socket includes the IP header of the packets we build */
+  lnet_ctx = libnet_init(dest_addr->sa.sa_family == AF_INET ? LIBNET_RAW4 : LIBNET_RAW6, NULL, error);
+  g_process_cap_restore(saved_caps);
+  if (!lnet_ctx)
+    {
+      msg_error("Error initializing raw socket, spoof-source support disabled",
+                evt_tag_str("error", error),
+                NULL);
+      return NULL;
+    }
 
-  if (ip == -1)
-    return FALSE;
+  /* the raw socket is connected, so the datagram client can send to it
+   * the same way as to the UDP socket */
+  if (connect(libnet_getfd(lnet_ctx), &dest_addr->sa, dest_addr->salen) < 0)
+    {
+      msg_error("Error connecting raw socket, spoof-source support disabled",
+                evt_tag_errno(EVT_TAG_OSERROR, errno),
+                NULL);
+      libnet_destroy(lnet_ctx);
+      return NULL;
+    }
 
-  return TRUE;
+  self = g_new0(AFInetSpoofClient, 1);
+  self->lnet_ctx = lnet_ctx;
+  self->raw_proto = log_proto_dgram_client_new(log_transport_plain_new(libnet_getfd(lnet_ctx), LTF_DONTCLOSE), max_batch);
+  self->local_addr = g_sockaddr_new((struct sockaddr *) &local_sa, local_salen);
+  self->dest_addr = g_sockaddr_ref(dest_addr);
+  self->super.prepare = afinet_spoof_client_prepare;
+  self->super.post = afinet_spoof_client_post;
+  self->super.post_from = afinet_spoof_client_post_from;
+  self->super.flush = afinet_spoof_client_flush;
+  self->super.take_sent = afinet_spoof_client_take_sent;
+  self->super.free_fn = afinet_spoof_client_free;
+  self->super.transport = transport;
+  self->super.convert = (GIConv) -1;
+  return &self->super;
 }
 #endif
 
-#endif
-
-static void
-afinet_dd_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
+static LogProto *
+afinet_dd_construct_proto(AFSocketDestDriver *s, AFSocketDestConnection *conn, LogTransport *transport)
 {
 #if ENABLE_SPOOF_SOURCE
   AFInetDestDriver *self = (AFInetDestDriver *) s;
+  LogProto *proto;
 
-  /* NOTE: this code should probably become a LogTransport instance so that
-   * spoofed packets are also going through the LogWriter queue */
-
-  if (self->spoof_source && self->lnet_ctx && msg->saddr && (msg->saddr->sa.sa_family == AF_INET || msg->saddr->sa.sa_family == AF_INET6) && log_writer_opened((LogWriter *) self->super.writer))
+  if (self->spoof_source)
     {
-      gboolean success = FALSE;
-
       g_assert((self->super.flags & AFSOCKET_DGRAM) != 0);
 
-      g_static_mutex_lock(&self->lnet_lock);
-      if (!self->lnet_buffer)
-        self->lnet_buffer = g_string_sized_new(256);
-      log_writer_format_log((LogWriter *) self->super.writer, msg, self->lnet_buffer);
-
-      switch (self->super.dest_addr->sa.sa_family)
-        {
-        case AF_INET:
-          success = afinet_dd_construct_ipv4_packet(self, msg, self->lnet_buffer);
-          break;
-#if ENABLE_IPV6
-        case AF_INET6:
-          success = afinet_dd_construct_ipv6_packet(self, msg, self->lnet_buffer);
-          break;
-#endif
-        default:
-          g_assert_not_reached();
-        }
-      if (success)
-        {
-          if (libnet_write(self->lnet_ctx) >= 0)
-            {
-              /* we have finished processing msg */
-              log_msg_ack(msg, path_options);
-              log_msg_unref(msg);
-
-              g_static_mutex_unlock(&self->lnet_lock);
-              return;
-            }
-          else
-            {
-              msg_error("Error sending raw frame",
-                        evt_tag_str("error", libnet_geterror(self->lnet_ctx)),
-                        NULL);
-            }
-        }
-      g_static_mutex_unlock(&self->lnet_lock);
+      proto = afinet_spoof_client_new(transport, conn->dest_addr, self->super.writer_options.flush_lines);
+      if (proto)
+        return proto;
     }
 #endif
-  log_dest_driver_queue_method(s, msg, path_options, user_data);
+  return afsocket_dd_construct_proto_method(s, conn, transport);
 }
 
 void
@@ -747,11 +733,6 @@ afinet_dd_free(LogPipe *s)
   g_free(self->bind_ip);
   g_free(self->bind_port);
   g_free(self->dest_port);
-#if ENABLE_SPOOF_SOURCE
-  if (self->lnet_buffer)
-    g_string_free(self->lnet_buffer, TRUE);
-  g_static_mutex_free(&self->lnet_lock);
-#endif
   afsocket_dd_free(s);
 }
 
@@ -767,14 +748,9 @@ afinet_dd_new(gint af, gchar *host, gint port, guint flags)
     self->super.transport = g_strdup("udp");
   else if (self->super.flags & AFSOCKET_STREAM)
     self->super.transport = g_strdup("tcp");
-  self->super.super.super.super.init = afinet_dd_init;
-  self->super.super.super.super.queue = afinet_dd_queue;
   self->super.super.super.super.free_fn = afinet_dd_free;
   self->super.setup_socket = afinet_dd_setup_socket;
+  self->super.construct_proto = afinet_dd_construct_proto;
   self->super.apply_transport = afinet_dd_apply_transport;
-
-#if ENABLE_SPOOF_SOURCE
-  g_static_mutex_init(&self->lnet_lock);
-#endif
   return &self->super.super.super;
 }
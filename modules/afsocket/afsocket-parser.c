@@ -50,6 +50,9 @@ static CfgLexerKeyword afsocket_keywords[] = {
   { "trusted_keys",       KW_TRUSTED_KEYS },
   { "trusted_dn",         KW_TRUSTED_DN },
   { "cipher_suite",       KW_CIPHER_SUITE },
+  { "handshake_threads",  KW_HANDSHAKE_THREADS },
+  { "session_cache_size", KW_SESSION_CACHE_SIZE },
+  { "session_timeout",    KW_SESSION_TIMEOUT },
 #endif
 
   { "localip",            KW_LOCALIP },
@@ -67,7 +70,16 @@ static CfgLexerKeyword afsocket_keywords[] = {
   { "spoof_source",       KW_SPOOF_SOURCE },
   { "transport",          KW_TRANSPORT },
   { "max_connections",    KW_MAX_CONNECTIONS },
+  { "accept_batch_size",  KW_ACCEPT_BATCH_SIZE },
   { "keep_alive",         KW_KEEP_ALIVE },
+  { "connections",        KW_CONNECTIONS },
+  { "servers",            KW_SERVERS },
+  { "partition_key",      KW_PARTITION_KEY },
+  { "compression",        KW_COMPRESSION },
+  { "compression_level",  KW_COMPRESSION_LEVEL },
+  { "compression_batch_size", KW_COMPRESSION_BATCH_SIZE },
+  { "relay_protocol",     KW_RELAY_PROTOCOL },
+  { "relay_window",       KW_RELAY_WINDOW },
   { NULL }
 };
 
@@ -33,6 +33,7 @@
 #include "gsocket.h"
 #include "stats.h"
 #include "mainloop.h"
+#include "scratch-buffers.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -59,6 +60,12 @@ typedef struct _AFSocketSourceConnection
   LogPipe *reader;
   int sock;
   GSockAddr *peer_addr;
+  /* our element in owner->connections, so that closing is O(1) */
+  GList *link;
+#if BUILD_WITH_SSL
+  /* the session is already established if the handshake was done by the handshake pool */
+  TLSSession *tls_session;
+#endif
 } AFSocketSourceConnection;
 
 static void afsocket_sd_close_connection(AFSocketSourceDriver *self, AFSocketSourceConnection *sc);
@@ -128,23 +135,23 @@ afsocket_open_socket(GSockAddr *bind_addr, int stream_or_dgram, int *fd)
 }
 
 static gint
-afsocket_sc_stats_source(AFSocketSourceConnection *self)
+afsocket_sd_stats_source(AFSocketSourceDriver *self)
 {
   gint source;
 
-  if ((self->owner->flags & AFSOCKET_SYSLOG_PROTOCOL) == 0)
+  if ((self->flags & AFSOCKET_SYSLOG_PROTOCOL) == 0)
     {
-      switch (self->owner->bind_addr->sa.sa_family)
+      switch (self->bind_addr->sa.sa_family)
         {
         case AF_UNIX:
-          source = !!(self->owner->flags & AFSOCKET_STREAM) ? SCS_UNIX_STREAM : SCS_UNIX_DGRAM;
+          source = !!(self->flags & AFSOCKET_STREAM) ? SCS_UNIX_STREAM : SCS_UNIX_DGRAM;
           break;
         case AF_INET:
-          source = !!(self->owner->flags & AFSOCKET_STREAM) ? SCS_TCP : SCS_UDP;
+          source = !!(self->flags & AFSOCKET_STREAM) ? SCS_TCP : SCS_UDP;
           break;
 #if ENABLE_IPV6
         case AF_INET6:
-          source = !!(self->owner->flags & AFSOCKET_STREAM) ? SCS_TCP6 : SCS_UDP6;
+          source = !!(self->flags & AFSOCKET_STREAM) ? SCS_TCP6 : SCS_UDP6;
           break;
 #endif
         default:
@@ -194,7 +201,12 @@ afsocket_sc_init(LogPipe *s)
   if (!self->reader)
     {
 #if BUILD_WITH_SSL
-      if (self->owner->tls_context)
+      if (self->tls_session)
+        {
+          transport = log_transport_tls_new(self->tls_session, self->sock, read_flags);
+          self->tls_session = NULL;
+        }
+      else if (self->owner->tls_context)
         {
           TLSSession *tls_session = tls_context_setup_session(self->owner->tls_context);
           if (!tls_session)
@@ -205,7 +217,18 @@ afsocket_sc_init(LogPipe *s)
 #endif
         transport = log_transport_plain_new(self->sock, read_flags);
 
-      if ((self->owner->flags & AFSOCKET_SYSLOG_PROTOCOL) == 0)
+#if ENABLE_COMPRESSION
+      /* compression is layered over TLS: the peer compresses first, then encrypts */
+      if (self->owner->compression)
+        transport = log_transport_compress_new(transport, 0, 0, self->owner->compress_stats);
+#endif
+
+      if (self->owner->flags & AFSOCKET_RELAY_PROTOCOL)
+        {
+          /* messages serialized by another syslog-ng, see LR_SERIALIZED */
+          proto = log_proto_relay_server_new(transport);
+        }
+      else if ((self->owner->flags & AFSOCKET_SYSLOG_PROTOCOL) == 0)
         {
           /* plain protocol */
 
@@ -214,7 +237,7 @@ afsocket_sc_init(LogPipe *s)
           else if (self->owner->reader_options.padding)
             proto = log_proto_record_server_new(transport, self->owner->reader_options.padding, 0);
           else
-            proto = log_proto_text_server_new(transport, self->owner->reader_options.msg_size, 0);
+            proto = log_proto_text_server_new(transport, self->owner->reader_options.msg_size, LPBS_RELEASE_IDLE_BUFFER);
         }
       else
         {
@@ -229,10 +252,11 @@ afsocket_sc_init(LogPipe *s)
               proto = log_proto_framed_server_new(transport, self->owner->reader_options.msg_size);
             }
         }
+      log_proto_set_buffer_stats(proto, self->owner->buffer_stats);
 
       self->reader = log_reader_new(proto);
     }
-  log_reader_set_options(self->reader, s, &self->owner->reader_options, 1, afsocket_sc_stats_source(self), self->owner->super.super.id, afsocket_sc_stats_instance(self));
+  log_reader_set_options(self->reader, s, &self->owner->reader_options, 1, afsocket_sd_stats_source(self->owner), self->owner->super.super.id, afsocket_sc_stats_instance(self));
   log_reader_set_peer_addr(self->reader, self->peer_addr);
   log_pipe_append(self->reader, s);
   if (log_pipe_init(self->reader, NULL))
@@ -298,6 +322,10 @@ static void
 afsocket_sc_free(LogPipe *s)
 {
   AFSocketSourceConnection *self = (AFSocketSourceConnection *) s;
+#if BUILD_WITH_SSL
+  if (self->tls_session)
+    tls_session_free(self->tls_session);
+#endif
   g_sockaddr_unref(self->peer_addr);
   log_pipe_free_method(s);
 }
@@ -335,6 +363,14 @@ void
 afsocket_sd_add_connection(AFSocketSourceDriver *self, AFSocketSourceConnection *connection)
 {
   self->connections = g_list_prepend(self->connections,connection);
+  connection->link = self->connections;
+}
+
+static void
+afsocket_sd_remove_connection(AFSocketSourceDriver *self, AFSocketSourceConnection *connection)
+{
+  self->connections = g_list_delete_link(self->connections, connection->link);
+  connection->link = NULL;
 }
 
 static void
@@ -369,7 +405,7 @@ afsocket_sd_kill_connection_list(GList *list)
       next = l->next;
 
       if (connection->owner)
-        connection->owner->connections = g_list_remove(connection->owner->connections, connection);
+        afsocket_sd_remove_connection(connection->owner, connection);
       afsocket_sd_kill_connection(connection);
     }
 }
@@ -393,6 +429,33 @@ afsocket_sd_set_max_connections(LogDriver *s, gint max_connections)
   self->max_connections = max_connections;
 }
 
+void
+afsocket_sd_set_accept_batch_size(LogDriver *s, gint accept_batch_size)
+{
+  AFSocketSourceDriver *self = (AFSocketSourceDriver *) s;
+
+  self->accept_batch_size = accept_batch_size;
+}
+
+void
+afsocket_sd_set_compression(LogDriver *s, gboolean compression)
+{
+  AFSocketSourceDriver *self = (AFSocketSourceDriver *) s;
+
+  self->compression = compression;
+}
+
+void
+afsocket_sd_set_relay_protocol(LogDriver *s, gboolean enable)
+{
+  AFSocketSourceDriver *self = (AFSocketSourceDriver *) s;
+
+  if (enable)
+    self->flags |= AFSOCKET_RELAY_PROTOCOL;
+  else
+    self->flags &= ~AFSOCKET_RELAY_PROTOCOL;
+}
+
 #if BUILD_WITH_SSL
 void
 afsocket_sd_set_tls_context(LogDriver *s, TLSContext *tls_context)
@@ -416,6 +479,283 @@ afsocket_sd_format_persist_name(AFSocketSourceDriver *self, gboolean listener_na
   return persist_name;
 }
 
+/* consumes the reference of @conn */
+static gboolean
+afsocket_sd_add_new_connection(AFSocketSourceDriver *self, AFSocketSourceConnection *conn)
+{
+  if (!log_pipe_init(&conn->super, NULL))
+    {
+      log_pipe_unref(&conn->super);
+      return FALSE;
+    }
+  afsocket_sd_add_connection(self,conn);
+  self->num_connections++;
+  log_pipe_append(&conn->super, &self->super.super.super);
+  return TRUE;
+}
+
+#if BUILD_WITH_SSL
+
+#define AFSOCKET_HANDSHAKE_TIMEOUT 30
+
+/*
+ * A pending TLS handshake alternates between waiting for the peer in the
+ * main thread (fd_watch) and being advanced by a thread of the handshake
+ * pool (work_item), so peers that are slow or send nothing at all don't
+ * occupy a thread, only the actual SSL work does.
+ */
+typedef struct _AFSocketHandshake
+{
+  AFSocketSourceDriver *owner;
+  GSockAddr *peer_addr;
+  gint fd;
+  TLSSession *tls_session;
+  GTimeVal start;
+  TLSHandshakeStatus status;
+  gboolean in_pool;
+  gboolean timed_out;
+  struct iv_fd fd_watch;
+  struct iv_timer timeout_timer;
+  struct iv_work_item work_item;
+} AFSocketHandshake;
+
+/* runs in a thread of the handshake pool */
+static void
+afsocket_sd_handshake_work(AFSocketHandshake *hs)
+{
+  hs->status = tls_session_handshake(hs->tls_session, hs->fd);
+}
+
+/* runs in the main thread, once the handshake succeeded or failed */
+static void
+afsocket_sd_handshake_finish(AFSocketHandshake *hs)
+{
+  AFSocketSourceDriver *self = hs->owner;
+  gboolean success = (hs->status == TLS_HANDSHAKE_DONE);
+  gchar buf[MAX_SOCKADDR_STRING];
+  GTimeVal now;
+  glong elapsed_ms;
+
+  main_loop_assert_main_thread();
+
+  if (iv_fd_registered(&hs->fd_watch))
+    iv_fd_unregister(&hs->fd_watch);
+  if (iv_timer_registered(&hs->timeout_timer))
+    iv_timer_unregister(&hs->timeout_timer);
+  self->handshakes = g_list_remove(self->handshakes, hs);
+
+  self->num_handshakes--;
+  stats_counter_dec(self->pending_handshakes);
+  if (success)
+    {
+      /* exponentially weighted moving average, the same way as TCP smoothes RTT */
+      g_get_current_time(&now);
+      elapsed_ms = g_time_val_diff(&now, &hs->start) / 1000;
+      stats_counter_set(self->handshake_latency, (stats_counter_get(self->handshake_latency) * 7 + elapsed_ms) / 8);
+      stats_counter_inc(self->completed_handshakes);
+    }
+  else
+    {
+      stats_counter_inc(self->failed_handshakes);
+    }
+
+  /* the driver may have been deinitialized (e.g. reload) while the handshake was running */
+  if (success && (self->super.super.super.flags & PIF_INITIALIZED))
+    {
+      AFSocketSourceConnection *conn;
+
+      conn = afsocket_sc_new(self, hs->peer_addr, hs->fd);
+      conn->tls_session = hs->tls_session;
+      if (!afsocket_sd_add_new_connection(self, conn))
+        close(hs->fd);
+    }
+  else
+    {
+      msg_verbose("Closing connection, TLS handshake did not complete",
+                  evt_tag_int("fd", hs->fd),
+                  evt_tag_str("client", g_sockaddr_format(hs->peer_addr, buf, sizeof(buf), GSA_FULL)),
+                  NULL);
+      if (hs->tls_session)
+        tls_session_free(hs->tls_session);
+      close(hs->fd);
+    }
+
+  g_sockaddr_unref(hs->peer_addr);
+  log_pipe_unref(&self->super.super.super);
+  g_free(hs);
+}
+
+/* the peer is ready, continue the handshake in the pool */
+static void
+afsocket_sd_handshake_ready(void *cookie)
+{
+  AFSocketHandshake *hs = (AFSocketHandshake *) cookie;
+
+  iv_fd_set_handler_in(&hs->fd_watch, NULL);
+  iv_fd_set_handler_out(&hs->fd_watch, NULL);
+  hs->in_pool = TRUE;
+  iv_work_pool_submit_work(&hs->owner->handshake_pool, &hs->work_item);
+}
+
+static void
+afsocket_sd_handshake_wait(AFSocketHandshake *hs)
+{
+  if (hs->status == TLS_HANDSHAKE_WANT_READ)
+    iv_fd_set_handler_in(&hs->fd_watch, afsocket_sd_handshake_ready);
+  else
+    iv_fd_set_handler_out(&hs->fd_watch, afsocket_sd_handshake_ready);
+}
+
+/* runs in the main thread, after each step performed by the pool */
+static void
+afsocket_sd_handshake_step_done(AFSocketHandshake *hs)
+{
+  hs->in_pool = FALSE;
+  if (hs->status == TLS_HANDSHAKE_WANT_READ || hs->status == TLS_HANDSHAKE_WANT_WRITE)
+    {
+      if (!hs->timed_out && hs->owner->handshake_pool_running)
+        {
+          afsocket_sd_handshake_wait(hs);
+          return;
+        }
+      hs->status = TLS_HANDSHAKE_ERROR;
+    }
+  afsocket_sd_handshake_finish(hs);
+}
+
+static void
+afsocket_sd_handshake_timeout(void *cookie)
+{
+  AFSocketHandshake *hs = (AFSocketHandshake *) cookie;
+
+  msg_error("Timeout during TLS handshake",
+            evt_tag_int("fd", hs->fd),
+            evt_tag_int("timeout", hs->owner->handshake_timeout),
+            NULL);
+
+  /* a step running in the pool can't be interrupted, it is closed once it returns */
+  if (hs->in_pool)
+    {
+      hs->timed_out = TRUE;
+      return;
+    }
+  hs->status = TLS_HANDSHAKE_ERROR;
+  afsocket_sd_handshake_finish(hs);
+}
+
+static void
+afsocket_sd_start_handshake(AFSocketSourceDriver *self, GSockAddr *peer_addr, gint fd)
+{
+  AFSocketHandshake *hs = g_new0(AFSocketHandshake, 1);
+
+  hs->owner = self;
+  log_pipe_ref(&self->super.super.super);
+  hs->peer_addr = g_sockaddr_ref(peer_addr);
+  hs->fd = fd;
+  hs->tls_session = tls_context_setup_session(self->tls_context);
+  g_get_current_time(&hs->start);
+
+  IV_FD_INIT(&hs->fd_watch);
+  hs->fd_watch.fd = fd;
+  hs->fd_watch.cookie = hs;
+
+  IV_TIMER_INIT(&hs->timeout_timer);
+  hs->timeout_timer.cookie = hs;
+  hs->timeout_timer.handler = afsocket_sd_handshake_timeout;
+
+  IV_WORK_ITEM_INIT(&hs->work_item);
+  hs->work_item.cookie = hs;
+  hs->work_item.work = (void (*)(void *)) afsocket_sd_handshake_work;
+  hs->work_item.completion = (void (*)(void *)) afsocket_sd_handshake_step_done;
+
+  self->num_handshakes++;
+  stats_counter_inc(self->pending_handshakes);
+  if (!hs->tls_session)
+    {
+      /* the error has already been logged, complete it as failed */
+      hs->status = TLS_HANDSHAKE_ERROR;
+      afsocket_sd_handshake_finish(hs);
+      return;
+    }
+
+  self->handshakes = g_list_prepend(self->handshakes, hs);
+  iv_fd_register(&hs->fd_watch);
+  iv_validate_now();
+  hs->timeout_timer.expires = iv_now;
+  hs->timeout_timer.expires.tv_sec += self->handshake_timeout;
+  iv_timer_register(&hs->timeout_timer);
+
+  /* the server side starts with waiting for the ClientHello */
+  hs->status = TLS_HANDSHAKE_WANT_READ;
+  afsocket_sd_handshake_wait(hs);
+}
+
+static void
+afsocket_sd_start_handshake_pool(AFSocketSourceDriver *self)
+{
+  if (!self->tls_context || (self->flags & AFSOCKET_STREAM) == 0 || self->tls_context->handshake_threads <= 0)
+    return;
+
+  self->handshake_pool.max_threads = self->tls_context->handshake_threads;
+  self->handshake_pool.cookie = self;
+  iv_work_pool_create(&self->handshake_pool);
+  self->handshake_pool_running = TRUE;
+
+  stats_lock();
+  stats_register_counter(0, afsocket_sd_stats_source(self) | SCS_SOURCE, self->super.super.id, "tls_handshake", SC_TYPE_STORED, &self->pending_handshakes);
+  stats_register_counter(0, afsocket_sd_stats_source(self) | SCS_SOURCE, self->super.super.id, "tls_handshake", SC_TYPE_PROCESSED, &self->completed_handshakes);
+  stats_register_counter(0, afsocket_sd_stats_source(self) | SCS_SOURCE, self->super.super.id, "tls_handshake", SC_TYPE_DROPPED, &self->failed_handshakes);
+  stats_register_counter(0, afsocket_sd_stats_source(self) | SCS_SOURCE, self->super.super.id, "tls_handshake", SC_TYPE_LATENCY, &self->handshake_latency);
+  stats_unlock();
+}
+
+/* handshakes waiting for the peer are closed here, the ones being run by
+ * the pool are closed by afsocket_sd_handshake_step_done() */
+static void
+afsocket_sd_stop_handshake_pool(AFSocketSourceDriver *self)
+{
+  GList *l, *next;
+
+  if (!self->handshake_pool_running)
+    return;
+
+  iv_work_pool_put(&self->handshake_pool);
+  self->handshake_pool_running = FALSE;
+
+  for (l = self->handshakes; l; l = next)
+    {
+      AFSocketHandshake *hs = (AFSocketHandshake *) l->data;
+
+      next = l->next;
+      if (!hs->in_pool)
+        {
+          hs->status = TLS_HANDSHAKE_ERROR;
+          afsocket_sd_handshake_finish(hs);
+        }
+    }
+
+  stats_lock();
+  stats_unregister_counter(afsocket_sd_stats_source(self) | SCS_SOURCE, self->super.super.id, "tls_handshake", SC_TYPE_STORED, &self->pending_handshakes);
+  stats_unregister_counter(afsocket_sd_stats_source(self) | SCS_SOURCE, self->super.super.id, "tls_handshake", SC_TYPE_PROCESSED, &self->completed_handshakes);
+  stats_unregister_counter(afsocket_sd_stats_source(self) | SCS_SOURCE, self->super.super.id, "tls_handshake", SC_TYPE_DROPPED, &self->failed_handshakes);
+  stats_unregister_counter(afsocket_sd_stats_source(self) | SCS_SOURCE, self->super.super.id, "tls_handshake", SC_TYPE_LATENCY, &self->handshake_latency);
+  stats_unlock();
+}
+
+static inline gint
+afsocket_sd_num_handshakes(AFSocketSourceDriver *self)
+{
+  return self->num_handshakes;
+}
+
+#else
+
+#define afsocket_sd_start_handshake_pool(self)
+#define afsocket_sd_stop_handshake_pool(self)
+#define afsocket_sd_num_handshakes(self) 0
+
+#endif
+
 gboolean
 afsocket_sd_process_connection(AFSocketSourceDriver *self, GSockAddr *client_addr, GSockAddr *local_addr, gint fd)
 {
@@ -444,7 +784,7 @@ afsocket_sd_process_connection(AFSocketSourceDriver *self, GSockAddr *client_add
 
 #endif
 
-  if (self->num_connections >= self->max_connections)
+  if (self->num_connections + afsocket_sd_num_handshakes(self) >= self->max_connections)
     {
       msg_error("Number of allowed concurrent connections reached, rejecting connection",
                 evt_tag_str("client", g_sockaddr_format(client_addr, buf, sizeof(buf), GSA_FULL)),
@@ -453,27 +793,66 @@ afsocket_sd_process_connection(AFSocketSourceDriver *self, GSockAddr *client_add
                 NULL);
       return FALSE;
     }
-  else
+#if BUILD_WITH_SSL
+  if (self->handshake_pool_running)
     {
-      AFSocketSourceConnection *conn;
-
-      conn = afsocket_sc_new(self, client_addr, fd);
-      if (log_pipe_init(&conn->super, NULL))
-        {
-          afsocket_sd_add_connection(self,conn);
-          self->num_connections++;
-          log_pipe_append(&conn->super, &self->super.super.super);
-        }
-      else
-        {
-          log_pipe_unref(&conn->super);
-          return FALSE;
-        }
+      afsocket_sd_start_handshake(self, client_addr, fd);
+      return TRUE;
     }
-  return TRUE;
+#endif
+  return afsocket_sd_add_new_connection(self, afsocket_sc_new(self, client_addr, fd));
 }
 
-#define MAX_ACCEPTS_AT_A_TIME 30
+/* the number of "connection accepted/closed" notices emitted per second,
+ * the rest is summarised */
+#define AFSOCKET_CONNECTION_NOTICES_PER_SEC 10
+
+static void
+afsocket_sd_summarise_notices(gpointer s)
+{
+  AFSocketSourceDriver *self = (AFSocketSourceDriver *) s;
+  gchar buf[MAX_SOCKADDR_STRING];
+
+  msg_notice("Syslog connection notices were suppressed because of their rate",
+             evt_tag_int("accepted", self->suppressed_accept_notices),
+             evt_tag_int("closed", self->suppressed_close_notices),
+             evt_tag_int("connections", self->num_connections),
+             evt_tag_str("local", g_sockaddr_format(self->bind_addr, buf, sizeof(buf), GSA_FULL)),
+             NULL);
+  self->suppressed_accept_notices = 0;
+  self->suppressed_close_notices = 0;
+}
+
+/* returns TRUE if the notice of an accepted/closed connection should be emitted */
+static gboolean
+afsocket_sd_connection_notice_allowed(AFSocketSourceDriver *self, gboolean accepted)
+{
+  time_t now = cached_g_current_time_sec();
+
+  if (now != self->notice_period)
+    {
+      self->notice_period = now;
+      self->notices_in_period = 0;
+    }
+  if (self->notices_in_period < AFSOCKET_CONNECTION_NOTICES_PER_SEC)
+    {
+      self->notices_in_period++;
+      return TRUE;
+    }
+
+  if (accepted)
+    self->suppressed_accept_notices++;
+  else
+    self->suppressed_close_notices++;
+  if (!iv_timer_registered(&self->notice_timer))
+    {
+      iv_validate_now();
+      self->notice_timer.expires = iv_now;
+      timespec_add_msec(&self->notice_timer.expires, 1000);
+      iv_timer_register(&self->notice_timer);
+    }
+  return FALSE;
+}
 
 static void
 afsocket_sd_accept(gpointer s)
@@ -485,11 +864,11 @@ afsocket_sd_accept(gpointer s)
   gboolean res;
   int accepts = 0;
 
-  while (accepts < MAX_ACCEPTS_AT_A_TIME)
+  while (accepts < self->accept_batch_size)
     {
       GIOStatus status;
 
-      status = g_accept(self->fd, &new_fd, &peer_addr);
+      status = g_accept_nonblock(self->fd, &new_fd, &peer_addr);
       if (status == G_IO_STATUS_AGAIN)
         {
           /* no more connections to accept */
@@ -508,19 +887,19 @@ afsocket_sd_accept(gpointer s)
           return;
         }
 
-      g_fd_set_nonblock(new_fd, TRUE);
-      g_fd_set_cloexec(new_fd, TRUE);
-
       res = afsocket_sd_process_connection(self, peer_addr, self->bind_addr, new_fd);
 
       if (res)
         {
           if (peer_addr->sa.sa_family != AF_UNIX)
-            msg_notice("Syslog connection accepted",
-                        evt_tag_int("fd", new_fd),
-                        evt_tag_str("client", g_sockaddr_format(peer_addr, buf1, sizeof(buf1), GSA_FULL)),
-                        evt_tag_str("local", g_sockaddr_format(self->bind_addr, buf2, sizeof(buf2), GSA_FULL)),
-                        NULL);
+            {
+              if (afsocket_sd_connection_notice_allowed(self, TRUE))
+                msg_notice("Syslog connection accepted",
+                           evt_tag_int("fd", new_fd),
+                           evt_tag_str("client", g_sockaddr_format(peer_addr, buf1, sizeof(buf1), GSA_FULL)),
+                           evt_tag_str("local", g_sockaddr_format(self->bind_addr, buf2, sizeof(buf2), GSA_FULL)),
+                           NULL);
+            }
           else
             msg_verbose("Syslog connection accepted",
                         evt_tag_int("fd", new_fd),
@@ -545,11 +924,14 @@ afsocket_sd_close_connection(AFSocketSourceDriver *self, AFSocketSourceConnectio
   gchar buf1[MAX_SOCKADDR_STRING], buf2[MAX_SOCKADDR_STRING];
 
   if (sc->peer_addr->sa.sa_family != AF_UNIX)
-    msg_notice("Syslog connection closed",
-               evt_tag_int("fd", sc->sock),
-               evt_tag_str("client", g_sockaddr_format(sc->peer_addr, buf1, sizeof(buf1), GSA_FULL)),
-               evt_tag_str("local", g_sockaddr_format(self->bind_addr, buf2, sizeof(buf2), GSA_FULL)),
-               NULL);
+    {
+      if (afsocket_sd_connection_notice_allowed(self, FALSE))
+        msg_notice("Syslog connection closed",
+                   evt_tag_int("fd", sc->sock),
+                   evt_tag_str("client", g_sockaddr_format(sc->peer_addr, buf1, sizeof(buf1), GSA_FULL)),
+                   evt_tag_str("local", g_sockaddr_format(self->bind_addr, buf2, sizeof(buf2), GSA_FULL)),
+                   NULL);
+    }
   else
     msg_verbose("Syslog connection closed",
                evt_tag_int("fd", sc->sock),
@@ -557,7 +939,7 @@ afsocket_sd_close_connection(AFSocketSourceDriver *self, AFSocketSourceConnectio
                evt_tag_str("local", g_sockaddr_format(self->bind_addr, buf2, sizeof(buf2), GSA_FULL)),
                NULL);
   log_pipe_deinit(&sc->super);
-  self->connections = g_list_remove(self->connections, sc);
+  afsocket_sd_remove_connection(self, sc);
   afsocket_sd_kill_connection(sc);
   self->num_connections--;
 }
@@ -577,6 +959,11 @@ afsocket_sd_stop_watches(AFSocketSourceDriver *self)
 {
   if (iv_fd_registered (&self->listen_fd))
     iv_fd_unregister(&self->listen_fd);
+  if (iv_timer_registered(&self->notice_timer))
+    {
+      iv_timer_unregister(&self->notice_timer);
+      afsocket_sd_summarise_notices(self);
+    }
 }
 
 gboolean
@@ -617,6 +1004,45 @@ afsocket_sd_init(LogPipe *s)
     }
   log_reader_options_init(&self->reader_options, cfg, self->super.super.group);
 
+  if (self->flags & AFSOCKET_RELAY_PROTOCOL)
+    {
+      if (self->flags & AFSOCKET_DGRAM)
+        {
+          msg_error("The relay protocol is only supported by stream sources",
+                    evt_tag_str("id", self->super.super.id),
+                    NULL);
+          return FALSE;
+        }
+      self->reader_options.flags |= LR_SERIALIZED;
+    }
+
+  if (self->compression)
+    {
+#if ENABLE_COMPRESSION
+      if (self->flags & AFSOCKET_DGRAM)
+        {
+          msg_error("Compression is only supported by stream sources",
+                    evt_tag_str("id", self->super.super.id),
+                    NULL);
+          return FALSE;
+        }
+      self->compress_stats = compress_stats_new();
+      compress_stats_register(self->compress_stats, 0, afsocket_sd_stats_source(self) | SCS_SOURCE, self->super.super.id);
+#else
+      msg_error("Compression was requested, but syslog-ng was compiled without compression support",
+                evt_tag_str("id", self->super.super.id),
+                NULL);
+      return FALSE;
+#endif
+    }
+
+  if (self->flags & AFSOCKET_STREAM)
+    {
+      /* the receive buffer memory of this source, see LPBS_RELEASE_IDLE_BUFFER */
+      self->buffer_stats = log_proto_buffer_stats_new();
+      log_proto_buffer_stats_register(self->buffer_stats, 0, afsocket_sd_stats_source(self) | SCS_SOURCE, self->super.super.id);
+    }
+
   /* fetch persistent connections first */
   if ((self->flags & AFSOCKET_KEEP_ALIVE))
     {
@@ -667,6 +1093,7 @@ afsocket_sd_init(LogPipe *s)
         }
 
       self->fd = sock;
+      afsocket_sd_start_handshake_pool(self);
       afsocket_sd_start_watches(self);
       res = TRUE;
     }
@@ -687,6 +1114,16 @@ afsocket_sd_init(LogPipe *s)
           return FALSE;
         }
 
+#ifdef SO_TIMESTAMPNS
+      if (sock != -1)
+        {
+          gint on = 1;
+
+          /* LM_TS_RECVD is taken from the kernel, see LTF_RECV */
+          setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+        }
+#endif
+
       /* we either have self->connections != NULL, or sock contains a new fd */
       if (self->connections || afsocket_sd_process_connection(self, NULL, self->bind_addr, sock))
         res = TRUE;
@@ -729,6 +1166,7 @@ afsocket_sd_deinit(LogPipe *s)
   if (self->flags & AFSOCKET_STREAM)
     {
       afsocket_sd_stop_watches(self);
+      afsocket_sd_stop_handshake_pool(self);
       if ((self->flags & AFSOCKET_KEEP_ALIVE) == 0)
         {
           msg_verbose("Closing listener fd",
@@ -752,6 +1190,22 @@ afsocket_sd_deinit(LogPipe *s)
       ;
     }
 
+  if (self->compress_stats)
+    {
+      /* connections kept alive still reference it, but stop reporting */
+      compress_stats_unregister(self->compress_stats, afsocket_sd_stats_source(self) | SCS_SOURCE, self->super.super.id);
+      compress_stats_unref(self->compress_stats);
+      self->compress_stats = NULL;
+    }
+
+  if (self->buffer_stats)
+    {
+      /* connections kept alive still reference it, but stop reporting */
+      log_proto_buffer_stats_unregister(self->buffer_stats, afsocket_sd_stats_source(self) | SCS_SOURCE, self->super.super.id);
+      log_proto_buffer_stats_unref(self->buffer_stats);
+      self->buffer_stats = NULL;
+    }
+
   if (!log_src_driver_deinit_method(s))
     return FALSE;
 
@@ -812,10 +1266,21 @@ afsocket_sd_init_instance(AFSocketSourceDriver *self, SocketOptions *sock_option
   self->address_family = family;
   self->max_connections = 10;
   self->listen_backlog = 255;
+  self->accept_batch_size = 30;
+#if BUILD_WITH_SSL
+  self->handshake_timeout = AFSOCKET_HANDSHAKE_TIMEOUT;
+#endif
   self->flags = flags | AFSOCKET_KEEP_ALIVE;
+  IV_TIMER_INIT(&self->notice_timer);
+  self->notice_timer.cookie = self;
+  self->notice_timer.handler = afsocket_sd_summarise_notices;
   log_reader_options_defaults(&self->reader_options);
   if (self->flags & AFSOCKET_STREAM)
-    self->reader_options.super.init_window_size = 1000;
+    {
+      self->reader_options.super.init_window_size = 1000;
+      /* connections that never send anything shouldn't touch the stats registry */
+      self->reader_options.super.defer_stats = TRUE;
+    }
 
   if (self->flags & AFSOCKET_LOCAL)
     {
@@ -877,16 +1342,98 @@ afsocket_dd_set_keep_alive(LogDriver *s, gint enable)
     self->flags &= ~AFSOCKET_KEEP_ALIVE;
 }
 
+void
+afsocket_dd_set_servers(LogDriver *s, GList *servers)
+{
+  AFSocketDestDriver *self = (AFSocketDestDriver *) s;
 
-static gchar *
-afsocket_dd_format_persist_name(AFSocketDestDriver *self, gboolean qfile)
+  string_list_free(self->servers);
+  self->servers = servers;
+}
+
+void
+afsocket_dd_set_connections(LogDriver *s, gint connections)
+{
+  AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+
+  self->num_connections = connections;
+}
+
+void
+afsocket_dd_set_compression(LogDriver *s, gboolean compression)
+{
+  AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+
+  self->compression = compression;
+}
+
+void
+afsocket_dd_set_compression_level(LogDriver *s, gint level)
+{
+  AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+
+  self->compression_level = level;
+}
+
+void
+afsocket_dd_set_compression_batch_size(LogDriver *s, gint batch_size)
+{
+  AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+
+  self->compression_batch_size = batch_size;
+}
+
+void
+afsocket_dd_set_relay_protocol(LogDriver *s, gboolean enable)
+{
+  AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+
+  if (enable)
+    self->flags |= AFSOCKET_RELAY_PROTOCOL;
+  else
+    self->flags &= ~AFSOCKET_RELAY_PROTOCOL;
+}
+
+void
+afsocket_dd_set_relay_window(LogDriver *s, gint relay_window)
+{
+  AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+
+  self->relay_window = relay_window;
+}
+
+void
+afsocket_dd_set_partition_key(LogDriver *s, const gchar *key)
+{
+  AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+
+  log_template_unref(self->partition_key);
+  self->partition_key = log_template_new(configuration, NULL);
+  log_template_compile(self->partition_key, key, NULL);
+}
+
+/*
+ * The writer and the queue of a connection are looked up by the host it
+ * connects to, so that a reload that changes servers() or connections()
+ * never hands them to a connection to another host. The first connection
+ * to each host keeps the names used before connections() existed, so
+ * that its writer and queue are kept when upgrading.
+ */
+gchar *
+afsocket_dc_format_persist_name(AFSocketDestConnection *self, gboolean qfile)
 {
   static gchar persist_name[128];
 
-  g_snprintf(persist_name, sizeof(persist_name),
-             qfile ? "afsocket_dd_qfile(%s,%s)" : "afsocket_dd_connection(%s,%s)",
-             !!(self->flags & AFSOCKET_STREAM) ? "stream" : "dgram",
-             self->dest_name);
+  if (self->index == 0)
+    g_snprintf(persist_name, sizeof(persist_name),
+               qfile ? "afsocket_dd_qfile(%s,%s)" : "afsocket_dd_connection(%s,%s)",
+               !!(self->owner->flags & AFSOCKET_STREAM) ? "stream" : "dgram",
+               self->dest_name);
+  else
+    g_snprintf(persist_name, sizeof(persist_name),
+               qfile ? "afsocket_dd_qfile(%s,%s,%d)" : "afsocket_dd_connection(%s,%s,%d)",
+               !!(self->owner->flags & AFSOCKET_STREAM) ? "stream" : "dgram",
+               self->dest_name, self->index);
   return persist_name;
 }
 
@@ -923,29 +1470,34 @@ afsocket_dd_stats_source(AFSocketDestDriver *self)
   return source;
 }
 
-static gchar *
-afsocket_dd_stats_instance(AFSocketDestDriver *self)
+gchar *
+afsocket_dc_stats_instance(AFSocketDestConnection *self)
 {
-  if ((self->flags & AFSOCKET_SYSLOG_PROTOCOL) == 0)
+  static gchar buf[256];
+
+  if ((self->owner->flags & AFSOCKET_SYSLOG_PROTOCOL) == 0)
     {
-      return self->dest_name;
+      if (self->index == 0)
+        return self->dest_name;
+      g_snprintf(buf, sizeof(buf), "%s,%d", self->dest_name, self->index);
     }
   else
     {
-      static gchar buf[256];
-
-      g_snprintf(buf, sizeof(buf), "%s,%s", self->transport, self->dest_name);
-      return buf;
+      if (self->index == 0)
+        g_snprintf(buf, sizeof(buf), "%s,%s", self->owner->transport, self->dest_name);
+      else
+        g_snprintf(buf, sizeof(buf), "%s,%s,%d", self->owner->transport, self->dest_name, self->index);
     }
+  return buf;
 }
 
 #if BUILD_WITH_SSL
 static gint
-afsocket_dd_tls_verify_callback(gint ok, X509_STORE_CTX *ctx, gpointer user_data)
+afsocket_dc_tls_verify_callback(gint ok, X509_STORE_CTX *ctx, gpointer user_data)
 {
-  AFSocketDestDriver *self = (AFSocketDestDriver *) user_data;
+  AFSocketDestConnection *self = (AFSocketDestConnection *) user_data;
 
-  if (ok && ctx->current_cert == ctx->cert && self->hostname && (self->tls_context->verify_mode & TVM_TRUSTED))
+  if (ok && ctx->current_cert == ctx->cert && self->hostname && (self->owner->tls_context->verify_mode & TVM_TRUSTED))
     {
       ok = tls_verify_certificate_name(ctx->cert, self->hostname);
     }
@@ -954,23 +1506,23 @@ afsocket_dd_tls_verify_callback(gint ok, X509_STORE_CTX *ctx, gpointer user_data
 }
 #endif
 
-static gboolean afsocket_dd_connected(AFSocketDestDriver *self);
-static void afsocket_dd_reconnect(AFSocketDestDriver *self);
+static gboolean afsocket_dc_connected(AFSocketDestConnection *self);
+static void afsocket_dc_reconnect(AFSocketDestConnection *self);
 
 static void
-afsocket_dd_init_watches(AFSocketDestDriver *self)
+afsocket_dc_init_watches(AFSocketDestConnection *self)
 {
   IV_FD_INIT(&self->connect_fd);
   self->connect_fd.cookie = self;
-  self->connect_fd.handler_out = (void (*)(void *)) afsocket_dd_connected;
+  self->connect_fd.handler_out = (void (*)(void *)) afsocket_dc_connected;
 
   IV_TIMER_INIT(&self->reconnect_timer);
   self->reconnect_timer.cookie = self;
-  self->reconnect_timer.handler = (void (*)(void *)) afsocket_dd_reconnect;
+  self->reconnect_timer.handler = (void (*)(void *)) afsocket_dc_reconnect;
 }
 
 static void
-afsocket_dd_start_watches(AFSocketDestDriver *self)
+afsocket_dc_start_watches(AFSocketDestConnection *self)
 {
   main_loop_assert_main_thread();
 
@@ -979,7 +1531,7 @@ afsocket_dd_start_watches(AFSocketDestDriver *self)
 }
 
 static void
-afsocket_dd_stop_watches(AFSocketDestDriver *self)
+afsocket_dc_stop_watches(AFSocketDestConnection *self)
 {
   main_loop_assert_main_thread();
 
@@ -998,7 +1550,7 @@ afsocket_dd_stop_watches(AFSocketDestDriver *self)
 }
 
 static void
-afsocket_dd_start_reconnect_timer(AFSocketDestDriver *self)
+afsocket_dc_start_reconnect_timer(AFSocketDestConnection *self)
 {
   main_loop_assert_main_thread();
 
@@ -1007,13 +1559,14 @@ afsocket_dd_start_reconnect_timer(AFSocketDestDriver *self)
   iv_validate_now();
 
   self->reconnect_timer.expires = iv_now;
-  timespec_add_msec(&self->reconnect_timer.expires, self->time_reopen * 1000);
+  timespec_add_msec(&self->reconnect_timer.expires, self->owner->time_reopen * 1000);
   iv_timer_register(&self->reconnect_timer);
 }
 
 static gboolean
-afsocket_dd_connected(AFSocketDestDriver *self)
+afsocket_dc_connected(AFSocketDestConnection *self)
 {
+  AFSocketDestDriver *owner = self->owner;
   gchar buf1[256], buf2[256];
   int error = 0;
   socklen_t errorlen = sizeof(error);
@@ -1026,7 +1579,7 @@ afsocket_dd_connected(AFSocketDestDriver *self)
   if (iv_fd_registered(&self->connect_fd))
     iv_fd_unregister(&self->connect_fd);
 
-  if (self->flags & AFSOCKET_STREAM)
+  if (owner->flags & AFSOCKET_STREAM)
     {
       transport_flags |= LTF_SHUTDOWN;
       if (getsockopt(self->fd, SOL_SOCKET, SO_ERROR, &error, &errorlen) == -1)
@@ -1035,7 +1588,7 @@ afsocket_dd_connected(AFSocketDestDriver *self)
                     evt_tag_int("fd", self->fd),
                     evt_tag_str("server", g_sockaddr_format(self->dest_addr, buf2, sizeof(buf2), GSA_FULL)),
                     evt_tag_errno(EVT_TAG_OSERROR, errno),
-                    evt_tag_int("time_reopen", self->time_reopen),
+                    evt_tag_int("time_reopen", owner->time_reopen),
                     NULL);
           goto error_reconnect;
         }
@@ -1045,7 +1598,7 @@ afsocket_dd_connected(AFSocketDestDriver *self)
                     evt_tag_int("fd", self->fd),
                     evt_tag_str("server", g_sockaddr_format(self->dest_addr, buf2, sizeof(buf2), GSA_FULL)),
                     evt_tag_errno(EVT_TAG_OSERROR, error),
-                    evt_tag_int("time_reopen", self->time_reopen),
+                    evt_tag_int("time_reopen", owner->time_reopen),
                     NULL);
           goto error_reconnect;
         }
@@ -1053,62 +1606,60 @@ afsocket_dd_connected(AFSocketDestDriver *self)
   msg_notice("Syslog connection established",
               evt_tag_int("fd", self->fd),
               evt_tag_str("server", g_sockaddr_format(self->dest_addr, buf2, sizeof(buf2), GSA_FULL)),
-              evt_tag_str("local", g_sockaddr_format(self->bind_addr, buf1, sizeof(buf1), GSA_FULL)),
+              evt_tag_str("local", g_sockaddr_format(owner->bind_addr, buf1, sizeof(buf1), GSA_FULL)),
               NULL);
 
 
 #if BUILD_WITH_SSL
-  if (self->tls_context)
+  if (owner->tls_context)
     {
       TLSSession *tls_session;
 
-      tls_session = tls_context_setup_session(self->tls_context);
+      tls_session = tls_context_setup_session(owner->tls_context);
       if (!tls_session)
         {
           goto error_reconnect;
         }
 
-      tls_session_set_verify(tls_session, afsocket_dd_tls_verify_callback, self, NULL);
+      tls_session_set_verify(tls_session, afsocket_dc_tls_verify_callback, self, NULL);
+      /* resume the last session with this server when reconnecting */
+      tls_session_set_resumption_key(tls_session, g_sockaddr_format(self->dest_addr, buf2, sizeof(buf2), GSA_FULL));
       transport = log_transport_tls_new(tls_session, self->fd, transport_flags);
     }
   else
 #endif
     transport = log_transport_plain_new(self->fd, transport_flags);
 
-  if (self->flags & AFSOCKET_SYSLOG_PROTOCOL)
-    {
-      if (self->flags & AFSOCKET_STREAM)
-        proto = log_proto_framed_client_new(transport);
-      else
-        proto = log_proto_text_client_new(transport);
-    }
-  else
-    {
-      proto = log_proto_text_client_new(transport);
-    }
+#if ENABLE_COMPRESSION
+  /* compress first, then encrypt: the TLS transport can't wrap another transport */
+  if (owner->compression)
+    transport = log_transport_compress_new(transport, owner->compression_level, owner->compression_batch_size, owner->compress_stats);
+#endif
 
+  proto = owner->construct_proto(owner, self, transport);
   log_writer_reopen(self->writer, proto);
   return TRUE;
  error_reconnect:
   close(self->fd);
   self->fd = -1;
-  afsocket_dd_start_reconnect_timer(self);
+  afsocket_dc_start_reconnect_timer(self);
   return FALSE;
 }
 
 static gboolean
-afsocket_dd_start_connect(AFSocketDestDriver *self)
+afsocket_dc_start_connect(AFSocketDestConnection *self)
 {
+  AFSocketDestDriver *owner = self->owner;
   int sock, rc;
   gchar buf1[MAX_SOCKADDR_STRING], buf2[MAX_SOCKADDR_STRING];
 
   main_loop_assert_main_thread();
-  if (!afsocket_open_socket(self->bind_addr, !!(self->flags & AFSOCKET_STREAM), &sock))
+  if (!afsocket_open_socket(owner->bind_addr, !!(owner->flags & AFSOCKET_STREAM), &sock))
     {
       return FALSE;
     }
 
-  if (self->setup_socket && !self->setup_socket(self, sock))
+  if (owner->setup_socket && !owner->setup_socket(owner, self, sock))
     {
       close(sock);
       return FALSE;
@@ -1120,14 +1671,14 @@ afsocket_dd_start_connect(AFSocketDestDriver *self)
   if (rc == G_IO_STATUS_NORMAL)
     {
       self->fd = sock;
-      afsocket_dd_connected(self);
+      afsocket_dc_connected(self);
     }
   else if (rc == G_IO_STATUS_ERROR && errno == EINPROGRESS)
     {
       /* we must wait until connect succeeds */
 
       self->fd = sock;
-      afsocket_dd_start_watches(self);
+      afsocket_dc_start_watches(self);
     }
   else
     {
@@ -1135,7 +1686,7 @@ afsocket_dd_start_connect(AFSocketDestDriver *self)
       msg_error("Connection failed",
                 evt_tag_int("fd", sock),
                 evt_tag_str("server", g_sockaddr_format(self->dest_addr, buf2, sizeof(buf2), GSA_FULL)),
-                evt_tag_str("local", g_sockaddr_format(self->bind_addr, buf1, sizeof(buf1), GSA_FULL)),
+                evt_tag_str("local", g_sockaddr_format(owner->bind_addr, buf1, sizeof(buf1), GSA_FULL)),
                 evt_tag_errno(EVT_TAG_OSERROR, errno),
                 NULL);
       close(sock);
@@ -1146,42 +1697,25 @@ afsocket_dd_start_connect(AFSocketDestDriver *self)
 }
 
 static void
-afsocket_dd_reconnect(AFSocketDestDriver *self)
+afsocket_dc_reconnect(AFSocketDestConnection *self)
 {
-  if (!afsocket_dd_start_connect(self))
+  if (!afsocket_dc_start_connect(self))
     {
       msg_error("Initiating connection failed, reconnecting",
-                evt_tag_int("time_reopen", self->time_reopen),
+                evt_tag_int("time_reopen", self->owner->time_reopen),
                 NULL);
-      afsocket_dd_start_reconnect_timer(self);
+      afsocket_dc_start_reconnect_timer(self);
     }
 }
 
-gboolean
-afsocket_dd_init(LogPipe *s)
+static gboolean
+afsocket_dc_init(LogPipe *s)
 {
-  AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+  AFSocketDestConnection *self = (AFSocketDestConnection *) s;
+  AFSocketDestDriver *owner = self->owner;
   GlobalConfig *cfg = log_pipe_get_config(s);
 
-  if (!log_dest_driver_init_method(s))
-    return FALSE;
-
-  if (!afsocket_dd_apply_transport(self))
-    return FALSE;
-
-  /* these fields must be set up by apply_transport, so let's check if it indeed did */
-  g_assert(self->transport);
-  g_assert(self->bind_addr);
-  g_assert(self->hostname);
-  g_assert(self->dest_name);
-
-  if (cfg)
-    {
-      self->time_reopen = cfg->time_reopen;
-    }
-
-  log_writer_options_init(&self->writer_options, cfg, 0);
-  self->writer = cfg_persist_config_fetch(cfg, afsocket_dd_format_persist_name(self, FALSE));
+  self->writer = cfg_persist_config_fetch(cfg, afsocket_dc_format_persist_name(self, FALSE));
   if (!self->writer)
     {
       /* NOTE: we open our writer with no fd, so we can send messages down there
@@ -1189,51 +1723,48 @@ afsocket_dd_init(LogPipe *s)
 
       self->writer = log_writer_new(LW_FORMAT_PROTO |
 #if BUILD_WITH_SSL
-                                    (((self->flags & AFSOCKET_STREAM) && !self->tls_context) ? LW_DETECT_EOF : 0) |
+                                    (((owner->flags & AFSOCKET_STREAM) && !owner->tls_context) ? LW_DETECT_EOF : 0) |
 #else
-                                    ((self->flags & AFSOCKET_STREAM) ? LW_DETECT_EOF : 0) |
+                                    ((owner->flags & AFSOCKET_STREAM) ? LW_DETECT_EOF : 0) |
 #endif
-                                    (self->flags & AFSOCKET_SYSLOG_PROTOCOL ? LW_SYSLOG_PROTOCOL : 0));
+                                    (owner->flags & AFSOCKET_SYSLOG_PROTOCOL ? LW_SYSLOG_PROTOCOL : 0) |
+                                    (owner->flags & AFSOCKET_RELAY_PROTOCOL ? LW_SERIALIZED : 0));
 
     }
-  log_writer_set_options((LogWriter *) self->writer, &self->super.super.super, &self->writer_options, 0, afsocket_dd_stats_source(self), self->super.super.id, afsocket_dd_stats_instance(self));
-  log_writer_set_queue(self->writer, log_dest_driver_acquire_queue(&self->super, afsocket_dd_format_persist_name(self, TRUE)));
+  log_writer_set_options((LogWriter *) self->writer, s, &owner->writer_options, 0, afsocket_dd_stats_source(owner), owner->super.super.id, afsocket_dc_stats_instance(self));
+  log_writer_set_queue(self->writer, log_dest_driver_acquire_queue(&owner->super, afsocket_dc_format_persist_name(self, TRUE)));
 
   log_pipe_init(self->writer, NULL);
-  log_pipe_append(&self->super.super.super, self->writer);
 
   if (!log_writer_opened((LogWriter *) self->writer))
-    afsocket_dd_reconnect(self);
+    afsocket_dc_reconnect(self);
   return TRUE;
 }
 
-gboolean
-afsocket_dd_deinit(LogPipe *s)
+static gboolean
+afsocket_dc_deinit(LogPipe *s)
 {
-  AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+  AFSocketDestConnection *self = (AFSocketDestConnection *) s;
+  AFSocketDestDriver *owner = self->owner;
   GlobalConfig *cfg = log_pipe_get_config(s);
 
-  afsocket_dd_stop_watches(self);
+  afsocket_dc_stop_watches(self);
 
   if (self->writer)
     log_pipe_deinit(self->writer);
 
-  if (self->flags & AFSOCKET_KEEP_ALIVE)
+  if (owner->flags & AFSOCKET_KEEP_ALIVE)
     {
-      cfg_persist_config_add(cfg, afsocket_dd_format_persist_name(self, FALSE), self->writer, (GDestroyNotify) log_pipe_unref, FALSE);
+      cfg_persist_config_add(cfg, afsocket_dc_format_persist_name(self, FALSE), self->writer, (GDestroyNotify) log_pipe_unref, FALSE);
       self->writer = NULL;
     }
-
-  if (!log_dest_driver_deinit_method(s))
-    return FALSE;
-
   return TRUE;
 }
 
 static void
-afsocket_dd_notify(LogPipe *s, LogPipe *sender, gint notify_code, gpointer user_data)
+afsocket_dc_notify(LogPipe *s, LogPipe *sender, gint notify_code, gpointer user_data)
 {
-  AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+  AFSocketDestConnection *self = (AFSocketDestConnection *) s;
   gchar buf[MAX_SOCKADDR_STRING];
 
   switch (notify_code)
@@ -1245,29 +1776,294 @@ afsocket_dd_notify(LogPipe *s, LogPipe *sender, gint notify_code, gpointer user_
       msg_notice("Syslog connection broken",
                  evt_tag_int("fd", self->fd),
                  evt_tag_str("server", g_sockaddr_format(self->dest_addr, buf, sizeof(buf), GSA_FULL)),
-                 evt_tag_int("time_reopen", self->time_reopen),
+                 evt_tag_int("time_reopen", self->owner->time_reopen),
                  NULL);
-      afsocket_dd_start_reconnect_timer(self);
+      afsocket_dc_start_reconnect_timer(self);
       break;
     }
 }
 
+static void
+afsocket_dc_free(LogPipe *s)
+{
+  AFSocketDestConnection *self = (AFSocketDestConnection *) s;
+
+  g_sockaddr_unref(self->dest_addr);
+  g_free(self->dest_name);
+  log_pipe_unref(self->writer);
+  log_pipe_free_method(s);
+}
+
+static AFSocketDestConnection *
+afsocket_dc_new(AFSocketDestDriver *owner, gint index, gchar *hostname)
+{
+  AFSocketDestConnection *self = g_new0(AFSocketDestConnection, 1);
+
+  log_pipe_init_instance(&self->super);
+  self->super.init = afsocket_dc_init;
+  self->super.deinit = afsocket_dc_deinit;
+  self->super.notify = afsocket_dc_notify;
+  self->super.free_fn = afsocket_dc_free;
+
+  /* the connection is owned by the driver, no need to reference it */
+  self->owner = owner;
+  self->index = index;
+  self->hostname = hostname;
+  self->fd = -1;
+  /* the port is shared, the address of hostname is resolved by setup_socket() */
+  self->dest_addr = g_sockaddr_new(&owner->dest_addr->sa, owner->dest_addr->salen);
+  /* servers() is only accepted by inet destinations, which use the same
+   * host:port format for the driver itself */
+  if (hostname == owner->hostname)
+    self->dest_name = g_strdup(owner->dest_name);
+  else
+    self->dest_name = g_strdup_printf("%s:%d", hostname,
+                                      g_sockaddr_inet_check(owner->dest_addr) ? g_sockaddr_inet_get_port(owner->dest_addr)
+#if ENABLE_IPV6
+                                      : g_sockaddr_inet6_get_port(owner->dest_addr)
+#else
+                                      : 0
+#endif
+                                      );
+  afsocket_dc_init_watches(self);
+  return self;
+}
+
+/*
+ * Create connections() connections to the host of the driver and to each
+ * of servers(), interleaved, so that the first connections() messages
+ * already go to different servers.
+ */
+void
+afsocket_dd_init_connections(AFSocketDestDriver *self)
+{
+  GPtrArray *hostnames;
+  GList *l;
+  gint i;
+
+  if (self->connections)
+    return;
+
+  hostnames = g_ptr_array_new();
+  g_ptr_array_add(hostnames, self->hostname);
+  for (l = self->servers; l; l = l->next)
+    g_ptr_array_add(hostnames, l->data);
+
+  self->connections_len = self->num_connections * hostnames->len;
+  self->connections = g_new0(AFSocketDestConnection *, self->connections_len);
+  for (i = 0; i < self->connections_len; i++)
+    self->connections[i] = afsocket_dc_new(self, i / hostnames->len, g_ptr_array_index(hostnames, i % hostnames->len));
+  g_ptr_array_free(hostnames, TRUE);
+}
+
+/*
+ * Messages with the same partition_key() always go to the same
+ * connection, otherwise they are distributed round-robin. Connections
+ * that are down are skipped, their share goes to the next one that is
+ * up, until they reconnect.
+ */
+static AFSocketDestConnection *
+afsocket_dd_choose_connection(AFSocketDestDriver *self, LogMessage *msg)
+{
+  guint index;
+  gint i;
+
+  if (self->connections_len == 1)
+    return self->connections[0];
+
+  if (self->partition_key)
+    {
+      ScratchBuffer *sb = scratch_buffer_acquire();
+
+      log_template_format(self->partition_key, msg, &self->writer_options.template_options, LTZ_LOCAL, 0, NULL, sb_string(sb));
+      index = g_str_hash(sb_string(sb)->str);
+      scratch_buffer_release(sb);
+    }
+  else
+    {
+      index = (guint) g_atomic_counter_exchange_and_add(&self->next_connection, 1);
+    }
+
+  for (i = 0; i < self->connections_len; i++)
+    {
+      AFSocketDestConnection *conn = self->connections[(index + i) % self->connections_len];
+
+      if (log_writer_opened((LogWriter *) conn->writer))
+        return conn;
+    }
+  /* none of them is up, queue the message where it belongs */
+  return self->connections[index % self->connections_len];
+}
+
+static void
+afsocket_dd_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
+{
+  AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+  AFSocketDestConnection *conn;
+
+  stats_counter_inc(self->super.super.processed_group_messages);
+  stats_counter_inc(self->super.queued_global_messages);
+
+  conn = afsocket_dd_choose_connection(self, msg);
+  log_pipe_queue(conn->writer, msg, path_options);
+}
+
+gboolean
+afsocket_dd_init(LogPipe *s)
+{
+  AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+  GlobalConfig *cfg = log_pipe_get_config(s);
+  gint i;
+
+  if (!log_dest_driver_init_method(s))
+    return FALSE;
+
+  if (!afsocket_dd_apply_transport(self))
+    return FALSE;
+
+  /* these fields must be set up by apply_transport, so let's check if it indeed did */
+  g_assert(self->transport);
+  g_assert(self->bind_addr);
+  g_assert(self->hostname);
+  g_assert(self->dest_name);
+
+  if (self->num_connections < 1)
+    {
+      msg_error("The number of connections must be at least 1",
+                evt_tag_int("connections", self->num_connections),
+                evt_tag_str("id", self->super.super.id),
+                NULL);
+      return FALSE;
+    }
+
+  if (self->flags & AFSOCKET_RELAY_PROTOCOL)
+    {
+      if (self->flags & AFSOCKET_DGRAM)
+        {
+          msg_error("The relay protocol is only supported by stream destinations",
+                    evt_tag_str("id", self->super.super.id),
+                    NULL);
+          return FALSE;
+        }
+      if (self->relay_window < 1)
+        {
+          msg_error("The relay window must be at least 1",
+                    evt_tag_int("relay_window", self->relay_window),
+                    evt_tag_str("id", self->super.super.id),
+                    NULL);
+          return FALSE;
+        }
+    }
+
+  if (self->compression)
+    {
+#if ENABLE_COMPRESSION
+      if (self->flags & AFSOCKET_DGRAM)
+        {
+          msg_error("Compression is only supported by stream destinations",
+                    evt_tag_str("id", self->super.super.id),
+                    NULL);
+          return FALSE;
+        }
+      if (self->compression_level < 0 || self->compression_level > 9)
+        {
+          msg_error("The compression level must be between 0 and 9",
+                    evt_tag_int("compression_level", self->compression_level),
+                    evt_tag_str("id", self->super.super.id),
+                    NULL);
+          return FALSE;
+        }
+      self->compress_stats = compress_stats_new();
+      compress_stats_register(self->compress_stats, 0, afsocket_dd_stats_source(self) | SCS_DESTINATION, self->super.super.id);
+#else
+      msg_error("Compression was requested, but syslog-ng was compiled without compression support",
+                evt_tag_str("id", self->super.super.id),
+                NULL);
+      return FALSE;
+#endif
+    }
+
+  if (cfg)
+    {
+      self->time_reopen = cfg->time_reopen;
+    }
+
+  log_writer_options_init(&self->writer_options, cfg, 0);
+
+  afsocket_dd_init_connections(self);
+  for (i = 0; i < self->connections_len; i++)
+    log_pipe_init(&self->connections[i]->super, cfg);
+  return TRUE;
+}
+
+gboolean
+afsocket_dd_deinit(LogPipe *s)
+{
+  AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+  gint i;
+
+  for (i = 0; i < self->connections_len; i++)
+    log_pipe_deinit(&self->connections[i]->super);
+
+  if (self->compress_stats)
+    {
+      compress_stats_unregister(self->compress_stats, afsocket_dd_stats_source(self) | SCS_DESTINATION, self->super.super.id);
+      compress_stats_unref(self->compress_stats);
+      self->compress_stats = NULL;
+    }
+
+  if (!log_dest_driver_deinit_method(s))
+    return FALSE;
+
+  return TRUE;
+}
+
 static gboolean
-afsocket_dd_setup_socket(AFSocketDestDriver *self, gint fd)
+afsocket_dd_setup_socket(AFSocketDestDriver *self, AFSocketDestConnection *conn, gint fd)
 {
   return afsocket_setup_socket(fd, self->sock_options_ptr, AFSOCKET_DIR_SEND);
 }
 
+LogProto *
+afsocket_dd_construct_proto_method(AFSocketDestDriver *self, AFSocketDestConnection *conn, LogTransport *transport)
+{
+  if (self->flags & AFSOCKET_DGRAM)
+    {
+      /* send the available messages in batches of flush_lines() datagrams,
+       * flush_timeout() bounds the latency of a partial batch */
+      return log_proto_dgram_client_new(transport, self->writer_options.flush_lines);
+    }
+  else if (self->flags & AFSOCKET_RELAY_PROTOCOL)
+    {
+      /* a batch is closed after flush_lines() messages or when the
+       * writer flushes, at most relay_window() batches are unacknowledged */
+      return log_proto_relay_client_new(transport, self->writer_options.flush_lines > 0 ? self->writer_options.flush_lines : 100, self->relay_window);
+    }
+  else if (self->flags & AFSOCKET_SYSLOG_PROTOCOL)
+    {
+      return log_proto_framed_client_new(transport);
+    }
+  else
+    {
+      return log_proto_text_client_new(transport);
+    }
+}
+
 void
 afsocket_dd_free(LogPipe *s)
 {
   AFSocketDestDriver *self = (AFSocketDestDriver *) s;
+  gint i;
 
+  for (i = 0; i < self->connections_len; i++)
+    log_pipe_unref(&self->connections[i]->super);
+  g_free(self->connections);
   log_writer_options_destroy(&self->writer_options);
   g_sockaddr_unref(self->bind_addr);
   g_sockaddr_unref(self->dest_addr);
-  log_pipe_unref(self->writer);
   g_free(self->hostname);
+  string_list_free(self->servers);
+  log_template_unref(self->partition_key);
   g_free(self->dest_name);
   g_free(self->transport);
 #if BUILD_WITH_SSL
@@ -1287,17 +2083,19 @@ afsocket_dd_init_instance(AFSocketDestDriver *self, SocketOptions *sock_options,
   log_writer_options_defaults(&self->writer_options);
   self->super.super.super.init = afsocket_dd_init;
   self->super.super.super.deinit = afsocket_dd_deinit;
-  /* NULL behaves as if log_msg_forward_msg was specified */
-  self->super.super.super.queue = NULL;
+  self->super.super.super.queue = afsocket_dd_queue;
   self->super.super.super.free_fn = afsocket_dd_free;
-  self->super.super.super.notify = afsocket_dd_notify;
   self->setup_socket = afsocket_dd_setup_socket;
+  self->construct_proto = afsocket_dd_construct_proto_method;
   self->sock_options_ptr = sock_options;
   self->address_family = family;
   self->flags = flags  | AFSOCKET_KEEP_ALIVE;
+  self->num_connections = 1;
+  self->compression_level = 6;
+  self->compression_batch_size = 65536;
+  self->relay_window = 16;
 
   self->hostname = g_strdup(hostname);
 
   self->writer_options.mark_mode = MM_GLOBAL;
-  afsocket_dd_init_watches(self);
 }
@@ -27,11 +27,14 @@
 #include "driver.h"
 #include "logreader.h"
 #include "logwriter.h"
+#include "atomic.h"
+#include "compresstransport.h"
 #if BUILD_WITH_SSL
 #include "tlscontext.h"
 #endif
 
 #include <iv.h>
+#include <iv_work.h>
 
 #define AFSOCKET_DGRAM               0x0001
 #define AFSOCKET_STREAM              0x0002
@@ -40,6 +43,7 @@
 #define AFSOCKET_SYSLOG_PROTOCOL     0x0008
 #define AFSOCKET_KEEP_ALIVE          0x0100
 #define AFSOCKET_REQUIRE_TLS         0x0200
+#define AFSOCKET_RELAY_PROTOCOL      0x0400
 
 #define AFSOCKET_WNDSIZE_INITED      0x10000
 
@@ -51,6 +55,7 @@ typedef enum
 
 typedef struct _AFSocketSourceDriver AFSocketSourceDriver;
 typedef struct _AFSocketDestDriver AFSocketDestDriver;
+typedef struct _AFSocketDestConnection AFSocketDestConnection;
 
 typedef struct _SocketOptions
 {
@@ -71,6 +76,19 @@ struct _AFSocketSourceDriver
   LogReaderOptions reader_options;
 #if BUILD_WITH_SSL
   TLSContext *tls_context;
+  /* TLS handshakes of new connections are performed by this pool, so
+   * that a reconnect storm doesn't starve the I/O workers */
+  struct iv_work_pool handshake_pool;
+  gboolean handshake_pool_running;
+  /* seconds a peer has to complete the TLS handshake in */
+  gint handshake_timeout;
+  gint num_handshakes;
+  /* AFSocketHandshake instances, see afsocket.c */
+  GList *handshakes;
+  StatsCounterItem *pending_handshakes;
+  StatsCounterItem *completed_handshakes;
+  StatsCounterItem *failed_handshakes;
+  StatsCounterItem *handshake_latency;
 #endif
   gint address_family;
   GSockAddr *bind_addr;
@@ -78,7 +96,18 @@ struct _AFSocketSourceDriver
   gint max_connections;
   gint num_connections;
   gint listen_backlog;
+  gint accept_batch_size;
+  gboolean compression;
+  CompressStats *compress_stats;
+  LogProtoBufferStats *buffer_stats;
   GList *connections;
+  /* per-connection notices are rate limited during reconnect storms,
+   * the suppressed ones are summarised when notice_timer expires */
+  time_t notice_period;
+  gint notices_in_period;
+  gint suppressed_accept_notices;
+  gint suppressed_close_notices;
+  struct iv_timer notice_timer;
   SocketOptions *sock_options_ptr;
 
 
@@ -106,6 +135,9 @@ struct _AFSocketSourceDriver
 void afsocket_sd_set_transport(LogDriver *s, const gchar *transport);
 void afsocket_sd_set_keep_alive(LogDriver *self, gint enable);
 void afsocket_sd_set_max_connections(LogDriver *self, gint max_connections);
+void afsocket_sd_set_accept_batch_size(LogDriver *s, gint accept_batch_size);
+void afsocket_sd_set_compression(LogDriver *s, gboolean compression);
+void afsocket_sd_set_relay_protocol(LogDriver *s, gboolean enable);
 #if BUILD_WITH_SSL
 void afsocket_sd_set_tls_context(LogDriver *s, TLSContext *tls_context);
 #else
@@ -133,25 +165,55 @@ gboolean afsocket_sd_deinit(LogPipe *s);
 void afsocket_sd_init_instance(AFSocketSourceDriver *self, SocketOptions *sock_options, gint family, guint32 flags);
 void afsocket_sd_free(LogPipe *self);
 
+/*
+ * A single connection of a socket destination with its own LogWriter,
+ * queue and reconnect timer. The driver opens connections() connections
+ * to each of its servers and balances messages among them.
+ */
+struct _AFSocketDestConnection
+{
+  /* receives the notifications of the writer */
+  LogPipe super;
+  AFSocketDestDriver *owner;
+  /* tells the connections() connections to the same host apart */
+  gint index;
+  gchar *hostname;
+  /* host:port of this connection, its persist and stats names are based on it */
+  gchar *dest_name;
+  GSockAddr *dest_addr;
+  gint fd;
+  LogPipe *writer;
+  struct iv_fd connect_fd;
+  struct iv_timer reconnect_timer;
+};
+
 struct _AFSocketDestDriver
 {
   LogDestDriver super;
   guint32 flags;
-  gint fd;
-  LogPipe *writer;
   LogWriterOptions writer_options;
 #if BUILD_WITH_SSL
   TLSContext *tls_context;
 #endif
   gint address_family;
   gchar *hostname;
+  /* further hosts to balance messages among, in addition to hostname */
+  GList *servers;
   gchar *transport;
   GSockAddr *bind_addr;
   GSockAddr *dest_addr;
   gchar *dest_name;
   gint time_reopen;
-  struct iv_fd connect_fd;
-  struct iv_timer reconnect_timer;
+  gint num_connections;
+  LogTemplate *partition_key;
+  AFSocketDestConnection **connections;
+  gint connections_len;
+  GAtomicCounter next_connection;
+  gboolean compression;
+  gint compression_level;
+  gint compression_batch_size;
+  CompressStats *compress_stats;
+  gint relay_window;
   SocketOptions *sock_options_ptr;
 
   /*
@@ -169,7 +231,11 @@ struct _AFSocketDestDriver
   /* once the socket is opened, set up socket related options (IP_TTL,
      IP_TOS, SO_RCVBUF etc) */
 
-  gboolean (*setup_socket)(AFSocketDestDriver *s, gint fd);
+  gboolean (*setup_socket)(AFSocketDestDriver *s, AFSocketDestConnection *conn, gint fd);
+
+  /* construct the LogProto instance used by the writer of @conn once the
+     connection is established */
+  LogProto *(*construct_proto)(AFSocketDestDriver *s, AFSocketDestConnection *conn, LogTransport *transport);
 };
 
 
@@ -187,6 +253,18 @@ afsocket_dd_apply_transport(AFSocketDestDriver *s)
 
 void afsocket_dd_set_transport(LogDriver *s, const gchar *transport);
 void afsocket_dd_set_keep_alive(LogDriver *self, gint enable);
+void afsocket_dd_set_servers(LogDriver *s, GList *servers);
+void afsocket_dd_set_connections(LogDriver *s, gint connections);
+void afsocket_dd_set_partition_key(LogDriver *s, const gchar *key);
+void afsocket_dd_init_connections(AFSocketDestDriver *self);
+gchar *afsocket_dc_format_persist_name(AFSocketDestConnection *self, gboolean qfile);
+gchar *afsocket_dc_stats_instance(AFSocketDestConnection *self);
+void afsocket_dd_set_compression(LogDriver *s, gboolean compression);
+void afsocket_dd_set_compression_level(LogDriver *s, gint level);
+void afsocket_dd_set_compression_batch_size(LogDriver *s, gint batch_size);
+void afsocket_dd_set_relay_protocol(LogDriver *s, gboolean enable);
+void afsocket_dd_set_relay_window(LogDriver *s, gint relay_window);
+LogProto *afsocket_dd_construct_proto_method(AFSocketDestDriver *self, AFSocketDestConnection *conn, LogTransport *transport);
 void afsocket_dd_init_instance(AFSocketDestDriver *self, SocketOptions *sock_options, gint family, const gchar *hostname, guint32 flags);
 gboolean afsocket_dd_init(LogPipe *s);
 void afsocket_dd_free(LogPipe *s);
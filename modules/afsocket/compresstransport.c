@@ -0,0 +1,477 @@
+/*
+ * Copyright (c) 2002-2013 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2013 Balázs Scheidler
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#include "compresstransport.h"
+#include "messages.h"
+
+#include <errno.h>
+#include <time.h>
+
+CompressStats *
+compress_stats_new(void)
+{
+  CompressStats *self = g_new0(CompressStats, 1);
+
+  g_atomic_counter_set(&self->ref_cnt, 1);
+  g_static_mutex_init(&self->lock);
+  return self;
+}
+
+CompressStats *
+compress_stats_ref(CompressStats *self)
+{
+  if (self)
+    g_atomic_counter_inc(&self->ref_cnt);
+  return self;
+}
+
+void
+compress_stats_unref(CompressStats *self)
+{
+  if (self && g_atomic_counter_dec_and_test(&self->ref_cnt))
+    {
+      g_static_mutex_free(&self->lock);
+      g_free(self);
+    }
+}
+
+void
+compress_stats_register(CompressStats *self, gint level, gint source, const gchar *id)
+{
+  stats_lock();
+  stats_register_counter(level, source, id, "compression_raw_kbytes", SC_TYPE_PROCESSED, &self->raw_kbytes);
+  stats_register_counter(level, source, id, "compression_wire_kbytes", SC_TYPE_PROCESSED, &self->wire_kbytes);
+  stats_register_counter(level, source, id, "compression", SC_TYPE_RATIO, &self->ratio);
+  stats_register_counter(level, source, id, "compression", SC_TYPE_LATENCY, &self->cpu_per_mbyte);
+  stats_unlock();
+}
+
+void
+compress_stats_unregister(CompressStats *self, gint source, const gchar *id)
+{
+  stats_lock();
+  stats_unregister_counter(source, id, "compression_raw_kbytes", SC_TYPE_PROCESSED, &self->raw_kbytes);
+  stats_unregister_counter(source, id, "compression_wire_kbytes", SC_TYPE_PROCESSED, &self->wire_kbytes);
+  stats_unregister_counter(source, id, "compression", SC_TYPE_RATIO, &self->ratio);
+  stats_unregister_counter(source, id, "compression", SC_TYPE_LATENCY, &self->cpu_per_mbyte);
+  stats_unlock();
+}
+
+static void
+compress_stats_update(CompressStats *self, gsize raw_bytes, gsize wire_bytes, guint64 cpu_nsec)
+{
+  g_static_mutex_lock(&self->lock);
+  self->raw_bytes += raw_bytes;
+  self->wire_bytes += wire_bytes;
+  self->cpu_nsec += cpu_nsec;
+
+  stats_counter_set(self->raw_kbytes, self->raw_bytes >> 10);
+  stats_counter_set(self->wire_kbytes, self->wire_bytes >> 10);
+  if (self->wire_bytes)
+    stats_counter_set(self->ratio, self->raw_bytes * 100 / self->wire_bytes);
+  if (self->raw_bytes >> 20)
+    stats_counter_set(self->cpu_per_mbyte, self->cpu_nsec / 1000000 / (self->raw_bytes >> 20));
+  g_static_mutex_unlock(&self->lock);
+}
+
+#if ENABLE_COMPRESSION
+
+#include <zlib.h>
+
+#define COMPRESS_BUFFER_SIZE 16384
+
+/* statistics are published after this amount of uncompressed data */
+#define COMPRESS_STATS_UPDATE_BYTES 65536
+
+/* the CPU time of one in this many zlib calls is measured */
+#define COMPRESS_CPU_SAMPLE_RATE 16
+
+/*
+ * LogTransport wrapping another one, compressing data written and
+ * decompressing data read using a zlib stream. The compressed stream is
+ * Z_SYNC_FLUSH-ed after every batch_size bytes of input and whenever the
+ * transport is flushed explicitly (which LogProtoTextClient does after
+ * each batch of messages), so that the receiving side can decompress all
+ * data sent so far without waiting for more.
+ *
+ * Decompressed data that doesn't fit the buffer of a read() remains in
+ * the zlib stream and is reported by the pending() method, as the fd
+ * won't become readable for it.
+ *
+ * Both directions are handled by the same object, but a connection only
+ * uses one of them in practice, so the zlib state and the buffers are
+ * allocated when the first read or write is performed.
+ */
+typedef struct _LogTransportCompress
+{
+  LogTransport super;
+  LogTransport *inner;
+  gint level;
+  gsize batch_size;
+  CompressStats *stats;
+
+  z_stream deflater;
+  gboolean deflater_initialized;
+  /* compressed data not yet written to the inner transport */
+  guchar *out_buf;
+  gsize out_pos, out_len;
+  /* number of input bytes since the last sync flush */
+  gsize unflushed;
+  /* a sync flush was started but its output was not produced completely */
+  gboolean sync_pending;
+
+  z_stream inflater;
+  gboolean inflater_initialized;
+  guchar *in_buf;
+  /* the output buffer filled up during the last inflate(), there may be
+   * more output available without reading the inner transport */
+  gboolean inflate_more;
+
+  /* not yet published to stats */
+  gsize raw_bytes, wire_bytes;
+  guint64 cpu_nsec;
+  guint zlib_calls;
+} LogTransportCompress;
+
+static inline guint64
+log_transport_compress_cpu_time(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_THREAD_CPUTIME_ID)
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+    return (guint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+  return 0;
+}
+
+/*
+ * Returns the CPU time before a zlib call, or 0 if the call is not to be
+ * measured. Reading the thread CPU clock costs a system call, more than
+ * compressing a short message does, so it is only read if the CPU usage
+ * is reported at all, and then only for a sample of the calls.
+ */
+static inline guint64
+log_transport_compress_cpu_sample(LogTransportCompress *self)
+{
+  if (!self->stats || !self->stats->cpu_per_mbyte)
+    return 0;
+  if ((self->zlib_calls++ % COMPRESS_CPU_SAMPLE_RATE) != 0)
+    return 0;
+  return log_transport_compress_cpu_time();
+}
+
+static void
+log_transport_compress_account(LogTransportCompress *self, gsize raw_bytes, gsize wire_bytes, guint64 cpu_start, gboolean force)
+{
+  self->raw_bytes += raw_bytes;
+  self->wire_bytes += wire_bytes;
+  if (cpu_start)
+    self->cpu_nsec += (log_transport_compress_cpu_time() - cpu_start) * COMPRESS_CPU_SAMPLE_RATE;
+
+  if (self->stats && (force || self->raw_bytes >= COMPRESS_STATS_UPDATE_BYTES))
+    {
+      compress_stats_update(self->stats, self->raw_bytes, self->wire_bytes, self->cpu_nsec);
+      self->raw_bytes = 0;
+      self->wire_bytes = 0;
+      self->cpu_nsec = 0;
+    }
+}
+
+/* write out the pending compressed data, returns FALSE with errno set if
+ * it could not be written completely */
+static gboolean
+log_transport_compress_drain(LogTransportCompress *self)
+{
+  gssize rc;
+
+  while (self->out_pos < self->out_len)
+    {
+      rc = log_transport_write(self->inner, self->out_buf + self->out_pos, self->out_len - self->out_pos);
+      self->super.cond = self->inner->cond;
+      if (rc < 0)
+        return FALSE;
+      self->out_pos += rc;
+      log_transport_compress_account(self, 0, rc, 0, FALSE);
+    }
+  self->out_pos = self->out_len = 0;
+  return TRUE;
+}
+
+static gboolean
+log_transport_compress_init_deflater(LogTransportCompress *self)
+{
+  if (self->deflater_initialized)
+    return TRUE;
+
+  if (deflateInit(&self->deflater, self->level) != Z_OK)
+    {
+      msg_error("Error initializing compression",
+                evt_tag_int("fd", self->super.fd),
+                evt_tag_int("level", self->level),
+                NULL);
+      errno = ENOMEM;
+      return FALSE;
+    }
+  self->out_buf = g_malloc(COMPRESS_BUFFER_SIZE);
+  self->deflater_initialized = TRUE;
+  return TRUE;
+}
+
+static gboolean
+log_transport_compress_init_inflater(LogTransportCompress *self)
+{
+  if (self->inflater_initialized)
+    return TRUE;
+
+  if (inflateInit(&self->inflater) != Z_OK)
+    {
+      msg_error("Error initializing decompression",
+                evt_tag_int("fd", self->super.fd),
+                NULL);
+      errno = ENOMEM;
+      return FALSE;
+    }
+  self->in_buf = g_malloc(COMPRESS_BUFFER_SIZE);
+  self->inflater_initialized = TRUE;
+  return TRUE;
+}
+
+static gboolean
+log_transport_compress_deflate(LogTransportCompress *self, gint flush)
+{
+  gint rc;
+
+  self->deflater.next_out = self->out_buf;
+  self->deflater.avail_out = COMPRESS_BUFFER_SIZE;
+  rc = deflate(&self->deflater, flush);
+  self->out_len = COMPRESS_BUFFER_SIZE - self->deflater.avail_out;
+  self->out_pos = 0;
+
+  /* Z_BUF_ERROR only means that no progress was possible, e.g. a sync
+   * flush was repeated without new input */
+  if (rc != Z_OK && rc != Z_BUF_ERROR)
+    {
+      msg_error("Error compressing stream",
+                evt_tag_int("fd", self->super.fd),
+                evt_tag_str("error", self->deflater.msg ? self->deflater.msg : "unknown"),
+                NULL);
+      errno = EPIPE;
+      return FALSE;
+    }
+  return TRUE;
+}
+
+static gboolean
+log_transport_compress_sync_flush(LogTransportCompress *self)
+{
+  guint64 cpu_start;
+  gboolean more;
+
+  self->sync_pending = TRUE;
+  do
+    {
+      cpu_start = log_transport_compress_cpu_sample(self);
+      self->deflater.next_in = NULL;
+      self->deflater.avail_in = 0;
+      if (!log_transport_compress_deflate(self, Z_SYNC_FLUSH))
+        return FALSE;
+      more = self->deflater.avail_out == 0;
+      log_transport_compress_account(self, 0, 0, cpu_start, FALSE);
+      if (!log_transport_compress_drain(self))
+        return FALSE;
+    }
+  while (more);
+  self->sync_pending = FALSE;
+  self->unflushed = 0;
+  return TRUE;
+}
+
+static gssize
+log_transport_compress_write_method(LogTransport *s, const gpointer buf, gsize buflen)
+{
+  LogTransportCompress *self = (LogTransportCompress *) s;
+  guint64 cpu_start;
+  gsize consumed;
+
+  if (!log_transport_compress_init_deflater(self))
+    return -1;
+  if (!log_transport_compress_drain(self))
+    return -1;
+  if (self->sync_pending && !log_transport_compress_sync_flush(self))
+    return -1;
+
+  self->deflater.next_in = buf;
+  self->deflater.avail_in = buflen;
+  while (self->deflater.avail_in > 0)
+    {
+      cpu_start = log_transport_compress_cpu_sample(self);
+      if (!log_transport_compress_deflate(self, Z_NO_FLUSH))
+        return -1;
+      consumed = buflen - self->deflater.avail_in;
+      log_transport_compress_account(self, 0, 0, cpu_start, FALSE);
+
+      if (!log_transport_compress_drain(self))
+        {
+          /* whatever deflate() consumed is ours now, the rest of the
+           * compressed output is written by the next call */
+          if (errno == EAGAIN && consumed > 0)
+            break;
+          return -1;
+        }
+    }
+
+  consumed = buflen - self->deflater.avail_in;
+  self->deflater.next_in = NULL;
+  self->deflater.avail_in = 0;
+  log_transport_compress_account(self, consumed, 0, 0, FALSE);
+
+  self->unflushed += consumed;
+  if (self->unflushed >= self->batch_size && self->out_len == 0)
+    {
+      /* the data is consumed even if the flush can't be completed now,
+       * sync_pending makes sure it is finished first next time */
+      if (!log_transport_compress_sync_flush(self) && errno != EAGAIN)
+        return -1;
+    }
+  return consumed;
+}
+
+static gssize
+log_transport_compress_flush_method(LogTransport *s)
+{
+  LogTransportCompress *self = (LogTransportCompress *) s;
+
+  if (!self->deflater_initialized)
+    return 0;
+  if (!log_transport_compress_drain(self))
+    return -1;
+  if ((self->unflushed > 0 || self->sync_pending) && !log_transport_compress_sync_flush(self))
+    return -1;
+  return 0;
+}
+
+static gssize
+log_transport_compress_read_method(LogTransport *s, gpointer buf, gsize buflen, GSockAddr **sa)
+{
+  LogTransportCompress *self = (LogTransportCompress *) s;
+  guint64 cpu_start;
+  gssize rc;
+  gint zrc;
+
+  if (sa)
+    *sa = NULL;
+
+  if (!log_transport_compress_init_inflater(self))
+    return -1;
+
+  self->inflater.next_out = buf;
+  self->inflater.avail_out = buflen;
+  while (self->inflater.avail_out == buflen)
+    {
+      if (!self->inflate_more && self->inflater.avail_in == 0)
+        {
+          rc = log_transport_read(self->inner, self->in_buf, COMPRESS_BUFFER_SIZE, sa);
+          self->super.cond = self->inner->cond;
+          if (rc <= 0)
+            return rc;
+          self->inflater.next_in = self->in_buf;
+          self->inflater.avail_in = rc;
+          log_transport_compress_account(self, 0, rc, 0, FALSE);
+        }
+
+      cpu_start = log_transport_compress_cpu_sample(self);
+      zrc = inflate(&self->inflater, Z_SYNC_FLUSH);
+      log_transport_compress_account(self, 0, 0, cpu_start, FALSE);
+      if (zrc == Z_STREAM_END)
+        {
+          /* the peer finished a stream, a new one may follow */
+          inflateReset(&self->inflater);
+        }
+      else if (zrc == Z_BUF_ERROR && self->inflater.avail_in == 0)
+        {
+          /* needs more input */
+        }
+      else if (zrc != Z_OK)
+        {
+          msg_error("Error decompressing stream",
+                    evt_tag_int("fd", self->super.fd),
+                    evt_tag_str("error", self->inflater.msg ? self->inflater.msg : "unknown"),
+                    NULL);
+          errno = ECONNRESET;
+          return -1;
+        }
+      self->inflate_more = (self->inflater.avail_out == 0);
+    }
+
+  rc = buflen - self->inflater.avail_out;
+  log_transport_compress_account(self, rc, 0, 0, FALSE);
+  return rc;
+}
+
+static gboolean
+log_transport_compress_pending_method(LogTransport *s)
+{
+  LogTransportCompress *self = (LogTransportCompress *) s;
+
+  return self->inflate_more || self->inflater.avail_in > 0;
+}
+
+static void
+log_transport_compress_free_method(LogTransport *s)
+{
+  LogTransportCompress *self = (LogTransportCompress *) s;
+
+  log_transport_compress_account(self, 0, 0, 0, TRUE);
+  if (self->deflater_initialized)
+    deflateEnd(&self->deflater);
+  if (self->inflater_initialized)
+    inflateEnd(&self->inflater);
+  g_free(self->out_buf);
+  g_free(self->in_buf);
+  compress_stats_unref(self->stats);
+  log_transport_free(self->inner);
+}
+
+LogTransport *
+log_transport_compress_new(LogTransport *inner, gint level, gsize batch_size, CompressStats *stats)
+{
+  LogTransportCompress *self = g_new0(LogTransportCompress, 1);
+
+  self->super.fd = inner->fd;
+  self->super.cond = inner->cond;
+  self->super.flags = inner->flags;
+  self->super.timeout = inner->timeout;
+  self->super.read = log_transport_compress_read_method;
+  self->super.write = log_transport_compress_write_method;
+  self->super.flush = log_transport_compress_flush_method;
+  self->super.pending = log_transport_compress_pending_method;
+  self->super.free_fn = log_transport_compress_free_method;
+  self->inner = inner;
+  self->level = level;
+  self->batch_size = batch_size;
+  self->stats = compress_stats_ref(stats);
+  return &self->super;
+}
+
+#endif
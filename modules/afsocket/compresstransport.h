@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2002-2013 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2013 Balázs Scheidler
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+#ifndef COMPRESSTRANSPORT_H_INCLUDED
+#define COMPRESSTRANSPORT_H_INCLUDED
+
+#include "logtransport.h"
+#include "stats.h"
+#include "atomic.h"
+
+/*
+ * Compression statistics, shared by all connections of a driver:
+ * uncompressed and compressed kilobytes, the ratio between the two (x100)
+ * and the CPU time spent compressing/decompressing a megabyte of data, in
+ * milliseconds, estimated from a sample of the zlib calls.
+ */
+typedef struct _CompressStats
+{
+  GAtomicCounter ref_cnt;
+  GStaticMutex lock;
+  guint64 raw_bytes, wire_bytes, cpu_nsec;
+  StatsCounterItem *raw_kbytes;
+  StatsCounterItem *wire_kbytes;
+  StatsCounterItem *ratio;
+  StatsCounterItem *cpu_per_mbyte;
+} CompressStats;
+
+CompressStats *compress_stats_new(void);
+CompressStats *compress_stats_ref(CompressStats *self);
+void compress_stats_unref(CompressStats *self);
+void compress_stats_register(CompressStats *self, gint level, gint source, const gchar *id);
+void compress_stats_unregister(CompressStats *self, gint source, const gchar *id);
+
+#if ENABLE_COMPRESSION
+
+LogTransport *log_transport_compress_new(LogTransport *inner, gint level, gsize batch_size, CompressStats *stats);
+
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2002-2013 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2013 Balázs Scheidler
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+
+#include "spoofpacket.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <string.h>
+
+#define SPOOF_IPV4_HEADER_LEN 20
+#define SPOOF_IPV6_HEADER_LEN 40
+#define SPOOF_UDP_HEADER_LEN  8
+#define SPOOF_TTL             64
+#define SPOOF_TOS_LOWDELAY    0x10
+
+static void
+spoof_put_uint16(guchar *p, guint16 value)
+{
+  p[0] = value >> 8;
+  p[1] = value & 0xff;
+}
+
+/* the 32 bit one's complement sum of @data as 16 bit big-endian words */
+static guint32
+spoof_checksum_add(guint32 sum, const guchar *data, gsize len)
+{
+  gsize i;
+
+  for (i = 0; i + 1 < len; i += 2)
+    sum += (data[i] << 8) + data[i + 1];
+  if (len & 1)
+    sum += data[len - 1] << 8;
+  return sum;
+}
+
+static guint16
+spoof_checksum_fold(guint32 sum)
+{
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum & 0xffff;
+}
+
+/* @pseudo_header: the source and destination addresses, they are followed
+ * by the protocol and the UDP length in the pseudo header of both IPv4 and
+ * IPv6 */
+static void
+spoof_build_udp(guchar *udp, const guchar *pseudo_header, gsize pseudo_header_len,
+                guint16 src_port, guint16 dest_port, const guchar *payload, gsize payload_len)
+{
+  guint16 udp_len = SPOOF_UDP_HEADER_LEN + payload_len;
+  guint32 sum;
+  guint16 checksum;
+
+  spoof_put_uint16(udp, ntohs(src_port));
+  spoof_put_uint16(udp + 2, ntohs(dest_port));
+  spoof_put_uint16(udp + 4, udp_len);
+  spoof_put_uint16(udp + 6, 0);
+  memcpy(udp + SPOOF_UDP_HEADER_LEN, payload, payload_len);
+
+  sum = spoof_checksum_add(0, pseudo_header, pseudo_header_len);
+  sum += IPPROTO_UDP + udp_len;
+  sum = spoof_checksum_add(sum, udp, udp_len);
+  checksum = spoof_checksum_fold(sum);
+  /* zero means "no checksum", it is sent as all ones instead */
+  spoof_put_uint16(udp + 6, checksum ? checksum : 0xffff);
+}
+
+static guchar *
+spoof_packet_new_ipv4(struct sockaddr_in *src, struct sockaddr_in *dst, const guchar *payload, gsize payload_len, gsize *packet_len)
+{
+  guchar *packet, *ip;
+
+  if (payload_len > G_MAXUINT16 - SPOOF_IPV4_HEADER_LEN - SPOOF_UDP_HEADER_LEN)
+    return NULL;
+
+  *packet_len = SPOOF_IPV4_HEADER_LEN + SPOOF_UDP_HEADER_LEN + payload_len;
+  packet = ip = g_malloc0(*packet_len);
+  ip[0] = 0x45;                                 /* version 4, 5 words of header */
+  ip[1] = SPOOF_TOS_LOWDELAY;
+  spoof_put_uint16(ip + 2, *packet_len);
+  /* IP ID and fragmentation fields are left zero, the kernel fills in the ID */
+  ip[8] = SPOOF_TTL;
+  ip[9] = IPPROTO_UDP;
+  memcpy(ip + 12, &src->sin_addr, 4);
+  memcpy(ip + 16, &dst->sin_addr, 4);
+  spoof_put_uint16(ip + 10, spoof_checksum_fold(spoof_checksum_add(0, ip, SPOOF_IPV4_HEADER_LEN)));
+
+  spoof_build_udp(packet + SPOOF_IPV4_HEADER_LEN, ip + 12, 8,
+                  src->sin_port, dst->sin_port, payload, payload_len);
+  return packet;
+}
+
+#if ENABLE_IPV6
+static guchar *
+spoof_packet_new_ipv6(struct sockaddr_in6 *src, struct sockaddr_in6 *dst, const guchar *payload, gsize payload_len, gsize *packet_len)
+{
+  guchar *packet, *ip;
+
+  if (payload_len > G_MAXUINT16 - SPOOF_UDP_HEADER_LEN)
+    return NULL;
+
+  *packet_len = SPOOF_IPV6_HEADER_LEN + SPOOF_UDP_HEADER_LEN + payload_len;
+  packet = ip = g_malloc0(*packet_len);
+  ip[0] = 0x60;                                 /* version 6, no traffic class or flow label */
+  spoof_put_uint16(ip + 4, SPOOF_UDP_HEADER_LEN + payload_len);
+  ip[6] = IPPROTO_UDP;
+  ip[7] = SPOOF_TTL;
+  memcpy(ip + 8, &src->sin6_addr, 16);
+  memcpy(ip + 24, &dst->sin6_addr, 16);
+
+  spoof_build_udp(packet + SPOOF_IPV6_HEADER_LEN, ip + 8, 32,
+                  src->sin6_port, dst->sin6_port, payload, payload_len);
+  return packet;
+}
+#endif
+
+guchar *
+spoof_packet_new(GSockAddr *src_addr, GSockAddr *dest_addr, const guchar *payload, gsize payload_len, gsize *packet_len)
+{
+#if ENABLE_IPV6
+  struct sockaddr_in *src4;
+  struct sockaddr_in6 src6;
+#endif
+
+  switch (dest_addr->sa.sa_family)
+    {
+    case AF_INET:
+      if (src_addr->sa.sa_family != AF_INET)
+        return NULL;
+      return spoof_packet_new_ipv4((struct sockaddr_in *) &src_addr->sa, (struct sockaddr_in *) &dest_addr->sa,
+                                   payload, payload_len, packet_len);
+#if ENABLE_IPV6
+    case AF_INET6:
+      switch (src_addr->sa.sa_family)
+        {
+        case AF_INET:
+          src4 = (struct sockaddr_in *) &src_addr->sa;
+          memset(&src6, 0, sizeof(src6));
+          src6.sin6_family = AF_INET6;
+          src6.sin6_port = src4->sin_port;
+          ((guint32 *) &src6.sin6_addr)[2] = htonl(0xffff);
+          ((guint32 *) &src6.sin6_addr)[3] = src4->sin_addr.s_addr;
+          break;
+        case AF_INET6:
+          src6 = *((struct sockaddr_in6 *) &src_addr->sa);
+          break;
+        default:
+          return NULL;
+        }
+      return spoof_packet_new_ipv6(&src6, (struct sockaddr_in6 *) &dest_addr->sa,
+                                   payload, payload_len, packet_len);
+#endif
+    default:
+      return NULL;
+    }
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2002-2013 BalaBit IT Ltd, Budapest, Hungary
+ * Copyright (c) 1998-2013 Balázs Scheidler
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ *
+ */
+
+
+#ifndef SPOOFPACKET_H_INCLUDED
+#define SPOOFPACKET_H_INCLUDED
+
+#include "gsockaddr.h"
+
+/*
+ * Builds an UDP datagram from @src_addr to @dest_addr, including the
+ * IPv4 or IPv6 header (depending on the family of @dest_addr), as it has
+ * to be written to a raw socket with header inclusion (IPPROTO_RAW). IPv4
+ * senders are mapped into IPv6 for IPv6 destinations.
+ *
+ * Returns a newly allocated packet or NULL if the addresses can't be used
+ * or the payload does not fit into a datagram.
+ */
+guchar *spoof_packet_new(GSockAddr *src_addr, GSockAddr *dest_addr, const guchar *payload, gsize payload_len, gsize *packet_len);
+
+#endif
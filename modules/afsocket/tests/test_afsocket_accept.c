@@ -0,0 +1,198 @@
+#include "testutils.h"
+#include "afinet.h"
+#include "apphook.h"
+#include "cfg.h"
+#include "mainloop.h"
+#include "timeutils.h"
+
+#include <iv.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* upper limit for waiting on the main loop, in seconds */
+#define MAX_WAIT 10
+
+#define NUM_CLIENTS 25
+#define ACCEPT_BATCH_SIZE 4
+
+/* defined by libtest, filled while grabbing messages */
+extern GList *internal_messages;
+
+typedef gboolean (*DriverCondition)(AFSocketSourceDriver *driver);
+
+static void (*afsocket_sd_accept_fn)(void *cookie);
+static gint accept_calls;
+
+/* wraps the accept callback of the listener to check the batches */
+static void
+counting_accept(void *cookie)
+{
+  AFSocketSourceDriver *driver = (AFSocketSourceDriver *) cookie;
+  gint num_connections = driver->num_connections;
+
+  accept_calls++;
+  afsocket_sd_accept_fn(cookie);
+  assert_true(driver->num_connections - num_connections <= ACCEPT_BATCH_SIZE,
+              "more connections accepted than accept-batch-size() at once, accepted=%d",
+              driver->num_connections - num_connections);
+}
+
+static AFSocketSourceDriver *
+create_driver(void)
+{
+  AFSocketSourceDriver *self = (AFSocketSourceDriver *) afinet_sd_new(AF_INET, AFSOCKET_STREAM);
+
+  afinet_sd_set_localip(&self->super.super, "127.0.0.1");
+  afinet_sd_set_localport(&self->super.super, "0");
+  afsocket_sd_set_max_connections(&self->super.super, 100);
+  afsocket_sd_set_accept_batch_size(&self->super.super, ACCEPT_BATCH_SIZE);
+  self->flags &= ~AFSOCKET_KEEP_ALIVE;
+
+  self->super.super.group = g_strdup("s_test");
+  self->super.group_len = strlen(self->super.super.group);
+  self->super.super.id = g_strdup("s_test#0");
+
+  assert_true(log_pipe_init(&self->super.super.super, configuration), "initializing the source failed");
+
+  afsocket_sd_accept_fn = self->listen_fd.handler_in;
+  iv_fd_set_handler_in(&self->listen_fd, counting_accept);
+  return self;
+}
+
+static gint
+connect_client(AFSocketSourceDriver *driver)
+{
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof(addr);
+  gint fd;
+
+  assert_gint(getsockname(driver->fd, (struct sockaddr *) &addr, &addrlen), 0, "getsockname() failed");
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  assert_gint(connect(fd, (struct sockaddr *) &addr, addrlen), 0, "connect() failed");
+  return fd;
+}
+
+static gint
+count_grabbed_messages(const gchar *pattern)
+{
+  GList *l;
+  gint count = 0;
+
+  for (l = internal_messages; l; l = l->next)
+    {
+      if (strstr(log_msg_get_value((LogMessage *) l->data, LM_V_MESSAGE, NULL), pattern))
+        count++;
+    }
+  return count;
+}
+
+typedef struct
+{
+  struct iv_timer timer;
+  struct timespec deadline;
+  DriverCondition condition;
+  AFSocketSourceDriver *driver;
+} MainLoopPoll;
+
+static void
+main_loop_poll(void *cookie)
+{
+  MainLoopPoll *self = (MainLoopPoll *) cookie;
+
+  iv_validate_now();
+  if (self->condition(self->driver) || timespec_diff_msec(&iv_now, &self->deadline) >= 0)
+    {
+      iv_quit();
+      return;
+    }
+  self->timer.expires = iv_now;
+  timespec_add_msec(&self->timer.expires, 10);
+  iv_timer_register(&self->timer);
+}
+
+static void
+run_main_loop_until(DriverCondition condition, AFSocketSourceDriver *driver)
+{
+  MainLoopPoll waiter;
+
+  IV_TIMER_INIT(&waiter.timer);
+  waiter.timer.cookie = &waiter;
+  waiter.timer.handler = main_loop_poll;
+  waiter.condition = condition;
+  waiter.driver = driver;
+  iv_validate_now();
+  waiter.deadline = iv_now;
+  waiter.deadline.tv_sec += MAX_WAIT;
+  waiter.timer.expires = iv_now;
+  iv_timer_register(&waiter.timer);
+  iv_main();
+  if (iv_timer_registered(&waiter.timer))
+    iv_timer_unregister(&waiter.timer);
+}
+
+static gboolean
+all_clients_accepted(AFSocketSourceDriver *driver)
+{
+  return driver->num_connections == NUM_CLIENTS;
+}
+
+static gboolean
+notices_summarised(AFSocketSourceDriver *driver)
+{
+  return count_grabbed_messages("Syslog connection notices were suppressed") > 0;
+}
+
+static void
+test_batched_accept_and_rate_limited_notices(void)
+{
+  AFSocketSourceDriver *driver;
+  gint clients[NUM_CLIENTS];
+  gint i, notices;
+  gchar summary[64];
+
+  testcase_begin("Testing that connections are accepted in batches and their notices are rate limited");
+  driver = create_driver();
+  start_grabbing_messages();
+
+  /* the connections wait in the backlog of the listener until the main loop runs */
+  for (i = 0; i < NUM_CLIENTS; i++)
+    clients[i] = connect_client(driver);
+
+  run_main_loop_until(all_clients_accepted, driver);
+  assert_gint(driver->num_connections, NUM_CLIENTS, "not all connections were accepted");
+  assert_true(accept_calls >= (NUM_CLIENTS + ACCEPT_BATCH_SIZE - 1) / ACCEPT_BATCH_SIZE,
+              "connections were not accepted in batches, accept_calls=%d", accept_calls);
+
+  notices = count_grabbed_messages("Syslog connection accepted");
+  assert_true(notices < NUM_CLIENTS, "connection notices were not rate limited, notices=%d", notices);
+
+  /* the suppressed ones are summarised once the period is over */
+  run_main_loop_until(notices_summarised, driver);
+  g_snprintf(summary, sizeof(summary), "accepted='%d'", NUM_CLIENTS - notices);
+  assert_grabbed_messages_contain(summary, "summary of the suppressed notices mismatch");
+
+  stop_grabbing_messages();
+  testcase_end();
+
+  log_pipe_deinit(&driver->super.super.super);
+  log_pipe_unref(&driver->super.super.super);
+  for (i = 0; i < NUM_CLIENTS; i++)
+    close(clients[i]);
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+  main_thread_handle = g_thread_self();
+  configuration = cfg_new(0x0303);
+
+  test_batched_accept_and_rate_limited_notices();
+
+  cfg_free(configuration);
+  app_shutdown();
+  return 0;
+}
@@ -0,0 +1,131 @@
+#include "testutils.h"
+#include "afinet.h"
+#include "apphook.h"
+#include "cfg.h"
+#include "misc.h"
+
+#include <string.h>
+
+static AFSocketDestDriver *
+create_driver(const gchar *servers, gint connections)
+{
+  AFSocketDestDriver *self = (AFSocketDestDriver *) afinet_dd_new(AF_INET, "host-a", 514, AFSOCKET_STREAM);
+  gchar **hosts = g_strsplit(servers, " ", -1);
+  GList *l = NULL;
+  gint i;
+
+  for (i = 0; hosts[i]; i++)
+    l = g_list_append(l, g_strdup(hosts[i]));
+  g_strfreev(hosts);
+
+  afsocket_dd_set_servers(&self->super.super, l);
+  afsocket_dd_set_connections(&self->super.super, connections);
+  self->super.super.super.cfg = configuration;
+  assert_true(afsocket_dd_apply_transport(self), "applying the transport failed");
+  afsocket_dd_init_connections(self);
+  return self;
+}
+
+/*
+ * Emulate what the connections of a keep-alive destination do on reload:
+ * the old ones store their writer and queue under their persist names,
+ * the new ones fetch them by theirs. Each of them has to end up with a
+ * writer and queue of its own host, if any.
+ */
+static void
+assert_reload_keeps_hosts(AFSocketDestDriver *old_driver, AFSocketDestDriver *new_driver, gint expected_reused)
+{
+  GHashTable *persist = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  const gchar *stored;
+  gint i, reused = 0;
+
+  for (i = 0; i < old_driver->connections_len; i++)
+    {
+      AFSocketDestConnection *conn = old_driver->connections[i];
+
+      g_hash_table_insert(persist, g_strdup(afsocket_dc_format_persist_name(conn, FALSE)), conn->hostname);
+      g_hash_table_insert(persist, g_strdup(afsocket_dc_format_persist_name(conn, TRUE)), conn->hostname);
+      g_hash_table_insert(persist, g_strdup(afsocket_dc_stats_instance(conn)), conn->hostname);
+    }
+  assert_gint(g_hash_table_size(persist), old_driver->connections_len * 3, "persist names of connections collide");
+
+  for (i = 0; i < new_driver->connections_len; i++)
+    {
+      AFSocketDestConnection *conn = new_driver->connections[i];
+
+      stored = g_hash_table_lookup(persist, afsocket_dc_format_persist_name(conn, FALSE));
+      if (stored)
+        {
+          assert_string(stored, conn->hostname, "writer of another host reused, connection=%d", i);
+          reused++;
+        }
+      stored = g_hash_table_lookup(persist, afsocket_dc_format_persist_name(conn, TRUE));
+      if (stored)
+        assert_string(stored, conn->hostname, "queue of another host reused, connection=%d", i);
+      stored = g_hash_table_lookup(persist, afsocket_dc_stats_instance(conn));
+      if (stored)
+        assert_string(stored, conn->hostname, "stats of another host reused, connection=%d", i);
+    }
+  assert_gint(reused, expected_reused, "number of reused writers mismatch");
+  g_hash_table_destroy(persist);
+}
+
+static void
+test_first_connection_keeps_its_name(void)
+{
+  AFSocketDestDriver *driver;
+
+  testcase_begin("Testing that the first connection keeps the names of a single connection destination");
+  driver = create_driver("host-b", 2);
+  assert_gint(driver->connections_len, 4, "number of connections mismatch");
+  assert_string(afsocket_dc_format_persist_name(driver->connections[0], FALSE), "afsocket_dd_connection(stream,host-a:514)", "persist name mismatch");
+  assert_string(afsocket_dc_format_persist_name(driver->connections[0], TRUE), "afsocket_dd_qfile(stream,host-a:514)", "qfile name mismatch");
+  assert_string(afsocket_dc_stats_instance(driver->connections[0]), "host-a:514", "stats instance mismatch");
+
+  /* connections are interleaved among the hosts */
+  assert_string(afsocket_dc_format_persist_name(driver->connections[1], FALSE), "afsocket_dd_connection(stream,host-b:514)", "persist name mismatch");
+  assert_string(afsocket_dc_format_persist_name(driver->connections[2], FALSE), "afsocket_dd_connection(stream,host-a:514,1)", "persist name mismatch");
+  assert_string(afsocket_dc_stats_instance(driver->connections[3]), "host-b:514,1", "stats instance mismatch");
+  testcase_end();
+
+  log_pipe_unref(&driver->super.super.super);
+}
+
+static void
+test_reload_with_changed_servers(void)
+{
+  AFSocketDestDriver *old_driver, *new_driver;
+
+  testcase_begin("Testing that a reload with changed servers() keeps every connection on its own host");
+  old_driver = create_driver("host-b host-c", 2);
+  new_driver = create_driver("host-c host-d", 2);
+  /* host-a and host-c are kept */
+  assert_reload_keeps_hosts(old_driver, new_driver, 4);
+  log_pipe_unref(&new_driver->super.super.super);
+
+  new_driver = create_driver("host-d", 1);
+  assert_reload_keeps_hosts(old_driver, new_driver, 1);
+  log_pipe_unref(&new_driver->super.super.super);
+
+  /* more connections to the same hosts keep the existing ones */
+  new_driver = create_driver("host-b host-c", 3);
+  assert_reload_keeps_hosts(old_driver, new_driver, 6);
+  log_pipe_unref(&new_driver->super.super.super);
+  testcase_end();
+
+  log_pipe_unref(&old_driver->super.super.super);
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+  configuration = cfg_new(0x0303);
+
+  test_first_connection_keeps_its_name();
+  test_reload_with_changed_servers();
+
+  cfg_free(configuration);
+  app_shutdown();
+  return 0;
+}
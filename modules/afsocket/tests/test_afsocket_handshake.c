@@ -0,0 +1,211 @@
+#include "testutils.h"
+#include "afinet.h"
+#include "apphook.h"
+#include "cfg.h"
+#include "mainloop.h"
+#include "timeutils.h"
+
+#include <iv.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* upper limit for waiting on the main loop, in seconds */
+#define MAX_WAIT 10
+
+typedef gboolean (*DriverCondition)(AFSocketSourceDriver *driver);
+
+static void (*afsocket_sd_free_fn)(LogPipe *s);
+static gboolean driver_freed;
+
+static void
+driver_free_hook(LogPipe *s)
+{
+  driver_freed = TRUE;
+  afsocket_sd_free_fn(s);
+}
+
+static AFSocketSourceDriver *
+create_driver(void)
+{
+  AFSocketSourceDriver *self = (AFSocketSourceDriver *) afinet_sd_new(AF_INET, AFSOCKET_STREAM);
+  TLSContext *tls_context = tls_context_new(TM_SERVER);
+
+  afinet_sd_set_localip(&self->super.super, "127.0.0.1");
+  afinet_sd_set_localport(&self->super.super, "0");
+  tls_context->handshake_threads = 1;
+  afsocket_sd_set_tls_context(&self->super.super, tls_context);
+  self->flags &= ~AFSOCKET_KEEP_ALIVE;
+  self->handshake_timeout = 1;
+
+  self->super.super.group = g_strdup("s_test");
+  self->super.group_len = strlen(self->super.super.group);
+  self->super.super.id = g_strdup("s_test#0");
+
+  afsocket_sd_free_fn = self->super.super.super.free_fn;
+  self->super.super.super.free_fn = driver_free_hook;
+  driver_freed = FALSE;
+
+  assert_true(log_pipe_init(&self->super.super.super, configuration), "initializing the source failed");
+  return self;
+}
+
+static gint
+connect_client(AFSocketSourceDriver *driver)
+{
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof(addr);
+  gint fd;
+
+  assert_gint(getsockname(driver->fd, (struct sockaddr *) &addr, &addrlen), 0, "getsockname() failed");
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  assert_gint(connect(fd, (struct sockaddr *) &addr, addrlen), 0, "connect() failed");
+  return fd;
+}
+
+/* the server has closed the connection without completing the handshake */
+static void
+assert_client_closed(gint fd)
+{
+  gchar buf[1024];
+  gssize rc;
+
+  while ((rc = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+    ;
+  assert_true(rc == 0 || (rc < 0 && errno == ECONNRESET), "client connection is still open, rc=%d, errno=%d", (gint) rc, errno);
+}
+
+typedef struct
+{
+  struct iv_timer timer;
+  struct timespec deadline;
+  DriverCondition condition;
+  AFSocketSourceDriver *driver;
+} MainLoopPoll;
+
+static void
+main_loop_poll(void *cookie)
+{
+  MainLoopPoll *self = (MainLoopPoll *) cookie;
+
+  iv_validate_now();
+  if (self->condition(self->driver) || timespec_diff_msec(&iv_now, &self->deadline) >= 0)
+    {
+      iv_quit();
+      return;
+    }
+  self->timer.expires = iv_now;
+  timespec_add_msec(&self->timer.expires, 10);
+  iv_timer_register(&self->timer);
+}
+
+static void
+run_main_loop_until(DriverCondition condition, AFSocketSourceDriver *driver)
+{
+  MainLoopPoll waiter;
+
+  IV_TIMER_INIT(&waiter.timer);
+  waiter.timer.cookie = &waiter;
+  waiter.timer.handler = main_loop_poll;
+  waiter.condition = condition;
+  waiter.driver = driver;
+  iv_validate_now();
+  waiter.deadline = iv_now;
+  waiter.deadline.tv_sec += MAX_WAIT;
+  waiter.timer.expires = iv_now;
+  iv_timer_register(&waiter.timer);
+  iv_main();
+  if (iv_timer_registered(&waiter.timer))
+    iv_timer_unregister(&waiter.timer);
+}
+
+static gboolean
+handshake_started(AFSocketSourceDriver *driver)
+{
+  return driver->num_handshakes > 0;
+}
+
+static gboolean
+handshake_finished(AFSocketSourceDriver *driver)
+{
+  return driver->num_handshakes == 0 && stats_counter_get(driver->failed_handshakes) > 0;
+}
+
+static gboolean
+is_driver_freed(AFSocketSourceDriver *driver)
+{
+  return driver_freed;
+}
+
+static void
+test_handshake_timeout(void)
+{
+  AFSocketSourceDriver *driver;
+  gint client;
+
+  testcase_begin("Testing that a peer that never completes the handshake is closed after the timeout");
+  driver = create_driver();
+  client = connect_client(driver);
+
+  run_main_loop_until(handshake_started, driver);
+  assert_gint(driver->num_handshakes, 1, "handshake was not started");
+
+  run_main_loop_until(handshake_finished, driver);
+  assert_gint(driver->num_handshakes, 0, "handshake is still pending after the timeout");
+  assert_gint(stats_counter_get(driver->pending_handshakes), 0, "pending handshakes counter mismatch");
+  assert_gint(stats_counter_get(driver->failed_handshakes), 1, "failed handshakes counter mismatch");
+  assert_gint(stats_counter_get(driver->completed_handshakes), 0, "completed handshakes counter mismatch");
+  assert_gint(driver->num_connections, 0, "connection was added without a handshake");
+  assert_client_closed(client);
+  testcase_end();
+
+  close(client);
+  log_pipe_deinit(&driver->super.super.super);
+  log_pipe_unref(&driver->super.super.super);
+  assert_true(driver_freed, "driver was not freed");
+}
+
+static void
+test_owner_freed_during_handshake(void)
+{
+  AFSocketSourceDriver *driver;
+  gint client;
+
+  testcase_begin("Testing that the source can be deinitialized and released during a handshake");
+  driver = create_driver();
+  client = connect_client(driver);
+  /* the beginning of a TLS record, the handshake goes to the pool and
+   * then waits for the rest */
+  assert_gint(send(client, "\x16\x03\x01", 3, 0), 3, "send() failed");
+
+  run_main_loop_until(handshake_started, driver);
+  assert_gint(driver->num_handshakes, 1, "handshake was not started");
+
+  /* the pending handshake keeps the driver alive until it finishes */
+  log_pipe_deinit(&driver->super.super.super);
+  log_pipe_unref(&driver->super.super.super);
+  run_main_loop_until(is_driver_freed, driver);
+  assert_true(driver_freed, "driver was not freed once the handshake finished");
+  assert_client_closed(client);
+  testcase_end();
+
+  close(client);
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+  main_thread_handle = g_thread_self();
+  configuration = cfg_new(0x0303);
+
+  test_handshake_timeout();
+  test_owner_freed_during_handshake();
+
+  cfg_free(configuration);
+  app_shutdown();
+  return 0;
+}
@@ -0,0 +1,269 @@
+#include "testutils.h"
+#include "compresstransport.h"
+#include "apphook.h"
+
+#include <errno.h>
+#include <string.h>
+
+#if ENABLE_COMPRESSION
+
+/* give up on loops that don't make progress after this many attempts */
+#define MAX_ATTEMPTS 1000000
+
+/*
+ * In-memory transport: writes append to a shared "wire" buffer, at most
+ * write_chunk bytes at a time, failing with EAGAIN on every second call
+ * if inject_eagain is set. Reads return at most read_chunk bytes and
+ * EAGAIN once the wire is exhausted.
+ */
+typedef struct _MockTransport
+{
+  LogTransport super;
+  GString *wire;
+  gsize read_pos;
+  gsize read_chunk;
+  gsize write_chunk;
+  gboolean inject_eagain;
+  gboolean eagain_next;
+} MockTransport;
+
+static gssize
+mock_transport_write(LogTransport *s, const gpointer buf, gsize count)
+{
+  MockTransport *self = (MockTransport *) s;
+  gsize len = MIN(count, self->write_chunk);
+
+  if (self->eagain_next)
+    {
+      self->eagain_next = FALSE;
+      errno = EAGAIN;
+      return -1;
+    }
+  self->eagain_next = self->inject_eagain;
+  g_string_append_len(self->wire, buf, len);
+  return len;
+}
+
+static gssize
+mock_transport_read(LogTransport *s, gpointer buf, gsize count, GSockAddr **sa)
+{
+  MockTransport *self = (MockTransport *) s;
+  gsize len = MIN(MIN(count, self->read_chunk), self->wire->len - self->read_pos);
+
+  if (len == 0)
+    {
+      errno = EAGAIN;
+      return -1;
+    }
+  memcpy(buf, self->wire->str + self->read_pos, len);
+  self->read_pos += len;
+  return len;
+}
+
+static void
+mock_transport_free(LogTransport *s)
+{
+}
+
+static MockTransport *
+mock_transport_new(GString *wire, gsize read_chunk, gsize write_chunk, gboolean inject_eagain)
+{
+  MockTransport *self = g_new0(MockTransport, 1);
+
+  self->super.fd = -1;
+  self->super.read = mock_transport_read;
+  self->super.write = mock_transport_write;
+  self->super.free_fn = mock_transport_free;
+  self->wire = wire;
+  self->read_chunk = read_chunk;
+  self->write_chunk = write_chunk;
+  self->inject_eagain = inject_eagain;
+  return self;
+}
+
+static void
+write_data(LogTransport *transport, const gchar *data, gsize len)
+{
+  gsize pos = 0;
+  gint attempts = 0;
+  gssize rc;
+
+  while (pos < len && attempts++ < MAX_ATTEMPTS)
+    {
+      rc = log_transport_write(transport, (gpointer) (data + pos), len - pos);
+      if (rc < 0)
+        assert_gint(errno, EAGAIN, "unexpected write error");
+      else
+        pos += rc;
+    }
+  assert_guint32(pos, len, "write did not complete");
+}
+
+static void
+flush_data(LogTransport *transport)
+{
+  gint attempts = 0;
+
+  while (log_transport_flush(transport) < 0 && attempts++ < MAX_ATTEMPTS)
+    assert_gint(errno, EAGAIN, "unexpected flush error");
+  assert_true(attempts < MAX_ATTEMPTS, "flush did not complete");
+}
+
+/* read everything that can be read without new data on the wire */
+static void
+read_data(LogTransport *transport, GString *result, gsize buflen)
+{
+  gchar *buf = g_malloc(buflen);
+  gssize rc;
+
+  while ((rc = log_transport_read(transport, buf, buflen, NULL)) > 0)
+    g_string_append_len(result, buf, rc);
+  assert_gint(rc, -1, "unexpected end of stream");
+  assert_gint(errno, EAGAIN, "unexpected read error");
+  g_free(buf);
+}
+
+static GString *
+generate_data(gint lines)
+{
+  GString *data = g_string_new("");
+  gint i;
+
+  for (i = 0; i < lines; i++)
+    g_string_append_printf(data, "message %d: %08x\n", i, i * 2654435761U);
+  return data;
+}
+
+static void
+test_round_trip_with_partial_writes(void)
+{
+  GString *wire = g_string_new("");
+  GString *data = generate_data(10000);
+  GString *result = g_string_new("");
+  LogTransport *writer, *reader;
+  gsize pos;
+
+  testcase_begin("Testing compression round trip with partial writes and EAGAIN");
+  writer = log_transport_compress_new(&mock_transport_new(wire, 0, 7, TRUE)->super, 6, 1024, NULL);
+  for (pos = 0; pos < data->len; pos += 1000)
+    write_data(writer, data->str + pos, MIN(1000, data->len - pos));
+  flush_data(writer);
+
+  reader = log_transport_compress_new(&mock_transport_new(wire, 100, 0, FALSE)->super, 0, 0, NULL);
+  read_data(reader, result, 4096);
+  assert_nstring(result->str, result->len, data->str, data->len, "decompressed data mismatch");
+  assert_true(wire->len < data->len, "data was not compressed");
+  testcase_end();
+
+  log_transport_free(writer);
+  log_transport_free(reader);
+  g_string_free(wire, TRUE);
+  g_string_free(data, TRUE);
+  g_string_free(result, TRUE);
+}
+
+static void
+test_sync_flush(void)
+{
+  GString *wire = g_string_new("");
+  GString *result = g_string_new("");
+  LogTransport *writer, *reader;
+
+  testcase_begin("Testing that flushed data can be decompressed without further input");
+  writer = log_transport_compress_new(&mock_transport_new(wire, 0, 1, TRUE)->super, 6, G_MAXSIZE, NULL);
+  reader = log_transport_compress_new(&mock_transport_new(wire, 1, 0, FALSE)->super, 0, 0, NULL);
+
+  write_data(writer, "first message\n", 14);
+  flush_data(writer);
+  read_data(reader, result, 4096);
+  assert_string(result->str, "first message\n", "explicitly flushed data mismatch");
+
+  write_data(writer, "second message\n", 15);
+  flush_data(writer);
+  read_data(reader, result, 4096);
+  assert_string(result->str, "first message\nsecond message\n", "explicitly flushed data mismatch");
+  log_transport_free(writer);
+
+  /* batch_size triggers the flush without an explicit one, as long as
+   * the inner transport accepts all the output */
+  writer = log_transport_compress_new(&mock_transport_new(wire, 0, 65536, FALSE)->super, 6, 10, NULL);
+  g_string_truncate(wire, 0);
+  log_transport_free(reader);
+  reader = log_transport_compress_new(&mock_transport_new(wire, 1, 0, FALSE)->super, 0, 0, NULL);
+  g_string_truncate(result, 0);
+
+  write_data(writer, "a message longer than the batch\n", 32);
+  read_data(reader, result, 4096);
+  assert_string(result->str, "a message longer than the batch\n", "data flushed by batch_size mismatch");
+  testcase_end();
+
+  log_transport_free(writer);
+  log_transport_free(reader);
+  g_string_free(wire, TRUE);
+  g_string_free(result, TRUE);
+}
+
+static void
+test_pending_decompressed_data(void)
+{
+  GString *wire = g_string_new("");
+  GString *data = g_string_new("");
+  GString *result = g_string_new("");
+  MockTransport *inner;
+  LogTransport *writer, *reader;
+  gchar buf[1024];
+  gint attempts = 0;
+  gssize rc;
+
+  testcase_begin("Testing that data remaining in the decompressor is reported as pending");
+  g_string_set_size(data, 65536);
+  memset(data->str, 'a', data->len);
+  writer = log_transport_compress_new(&mock_transport_new(wire, 0, 65536, FALSE)->super, 6, G_MAXSIZE, NULL);
+  write_data(writer, data->str, data->len);
+  flush_data(writer);
+
+  inner = mock_transport_new(wire, 65536, 0, FALSE);
+  reader = log_transport_compress_new(&inner->super, 0, 0, NULL);
+  assert_false(log_transport_pending(reader), "pending data reported before the first read");
+
+  rc = log_transport_read(reader, buf, sizeof(buf), NULL);
+  assert_gint(rc, sizeof(buf), "first read mismatch");
+  g_string_append_len(result, buf, rc);
+
+  /* the fd would not become readable again, all compressed data has been consumed */
+  assert_guint32(inner->read_pos, wire->len, "compressed data was not consumed at once");
+  assert_true(log_transport_pending(reader), "decompressed data is not reported as pending");
+
+  while (log_transport_pending(reader) && attempts++ < MAX_ATTEMPTS)
+    {
+      rc = log_transport_read(reader, buf, sizeof(buf), NULL);
+      if (rc > 0)
+        g_string_append_len(result, buf, rc);
+    }
+  assert_false(log_transport_pending(reader), "pending data reported after draining");
+  assert_nstring(result->str, result->len, data->str, data->len, "decompressed data mismatch");
+  testcase_end();
+
+  log_transport_free(writer);
+  log_transport_free(reader);
+  g_string_free(wire, TRUE);
+  g_string_free(data, TRUE);
+  g_string_free(result, TRUE);
+}
+
+#endif
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+
+#if ENABLE_COMPRESSION
+  test_round_trip_with_partial_writes();
+  test_sync_flush();
+  test_pending_decompressed_data();
+#endif
+
+  app_shutdown();
+  return 0;
+}
@@ -0,0 +1,106 @@
+#include "testutils.h"
+#include "spoofpacket.h"
+#include "apphook.h"
+
+#include <string.h>
+
+static guint16
+get_uint16(const guchar *p)
+{
+  return (p[0] << 8) + p[1];
+}
+
+static void
+assert_packet(guchar *packet, gsize packet_len, const guchar *expected, gsize expected_len, const gchar *payload)
+{
+  gsize header_len = expected_len;
+
+  assert_not_null(packet, "packet construction failed");
+  assert_guint32(packet_len, header_len + strlen(payload), "packet length mismatch");
+  assert_true(memcmp(packet, expected, header_len) == 0, "packet header mismatch");
+  assert_nstring((gchar *) packet + header_len, packet_len - header_len, payload, -1, "payload mismatch");
+}
+
+static void
+test_ipv4_packet(void)
+{
+  GSockAddr *src = g_sockaddr_inet_new("10.1.2.3", 514);
+  GSockAddr *dst = g_sockaddr_inet_new("192.168.0.1", 514);
+  const gchar *payload = "<13>test";
+  const guchar expected[] =
+  {
+    /* IPv4: version/IHL, TOS, length, ID, fragment, TTL, UDP, checksum */
+    0x45, 0x10, 0x00, 0x24, 0x00, 0x00, 0x00, 0x00, 0x40, 0x11, 0xae, 0x0c,
+    10, 1, 2, 3,
+    192, 168, 0, 1,
+    /* UDP: ports, length, checksum */
+    0x02, 0x02, 0x02, 0x02, 0x00, 0x10, 0xd7, 0xd3,
+  };
+  guchar *packet;
+  gsize packet_len;
+
+  testcase_begin("Testing IPv4 spoofed packet");
+  packet = spoof_packet_new(src, dst, (const guchar *) payload, strlen(payload), &packet_len);
+  assert_packet(packet, packet_len, expected, sizeof(expected), payload);
+  g_free(packet);
+
+  /* too large for a datagram */
+  assert_null(spoof_packet_new(src, dst, (const guchar *) payload, 65535 - 28 + 1, &packet_len),
+              "oversized datagram was constructed");
+  testcase_end();
+
+  g_sockaddr_unref(src);
+  g_sockaddr_unref(dst);
+}
+
+#if ENABLE_IPV6
+static void
+test_ipv6_packet(void)
+{
+  GSockAddr *src = g_sockaddr_inet_new("10.1.2.3", 514);
+  GSockAddr *dst = g_sockaddr_inet6_new("2001:db8::1", 514);
+  GSockAddr *dst4 = g_sockaddr_inet_new("192.168.0.1", 514);
+  /* odd length, to check the padding of the checksum */
+  const gchar *payload = "<13>testx";
+  const guchar expected[] =
+  {
+    /* IPv6: version, flow label, payload length, UDP, hop limit */
+    0x60, 0x00, 0x00, 0x00, 0x00, 0x11, 0x11, 0x40,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 10, 1, 2, 3,
+    0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
+    /* UDP: ports, length, checksum */
+    0x02, 0x02, 0x02, 0x02, 0x00, 0x11, 0xf2, 0xc0,
+  };
+  guchar *packet;
+  gsize packet_len;
+
+  testcase_begin("Testing IPv6 spoofed packet with an IPv4 sender");
+  packet = spoof_packet_new(src, dst, (const guchar *) payload, strlen(payload), &packet_len);
+  assert_packet(packet, packet_len, expected, sizeof(expected), payload);
+  assert_guint16(get_uint16(packet + 4), 8 + strlen(payload), "IPv6 payload length mismatch");
+  g_free(packet);
+
+  /* IPv6 senders can't be sent to IPv4 destinations */
+  assert_null(spoof_packet_new(dst, dst4, (const guchar *) payload, strlen(payload), &packet_len),
+              "IPv6 sender accepted for an IPv4 destination");
+  testcase_end();
+
+  g_sockaddr_unref(src);
+  g_sockaddr_unref(dst);
+  g_sockaddr_unref(dst4);
+}
+#endif
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+
+  test_ipv4_packet();
+#if ENABLE_IPV6
+  test_ipv6_packet();
+#endif
+
+  app_shutdown();
+  return 0;
+}
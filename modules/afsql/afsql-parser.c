@@ -54,6 +54,10 @@ static CfgLexerKeyword afsql_keywords[] = {
   { "retries",            KW_RETRIES, 0x0303 },
   { "flush_lines",        KW_FLUSH_LINES },
   { "flush_timeout",      KW_FLUSH_TIMEOUT },
+  { "batch_lines",        KW_BATCH_LINES },
+  { "batch_timeout",      KW_BATCH_TIMEOUT },
+  { "workers",            KW_WORKERS },
+  { "worker_partition_key", KW_WORKER_PARTITION_KEY },
   { "flags",              KW_FLAGS },
 
   { "dbd_option",         KW_DBD_OPTION },
@@ -25,7 +25,6 @@
 
 #if ENABLE_SQL
 
-#include "logqueue.h"
 #include "templates.h"
 #include "messages.h"
 #include "misc.h"
@@ -61,20 +60,36 @@ typedef struct _AFSqlField
   LogTemplate *value;
 } AFSqlField;
 
+/**
+ * AFSqlDestWorker:
+ *
+ * A database connection of an SQL destination. The threads driving the
+ * connections and the distribution of the messages among them are
+ * implemented by LogThrDestDriver.
+ **/
+typedef struct _AFSqlDestWorker
+{
+  LogThrDestWorker super;
+
+  /* used exclusively by the db thread */
+  dbi_conn dbi_ctx;
+  GHashTable *validated_tables;
+} AFSqlDestWorker;
+
 /**
  * AFSqlDestDriver:
  *
  * This structure encapsulates an SQL destination driver. SQL insert
- * statements are generated from a separate thread because of the blocking
- * nature of the DBI API. It is ensured that while the thread is running,
+ * statements are generated from separate threads because of the blocking
+ * nature of the DBI API. It is ensured that while the threads are running,
  * the reference count to the driver structure is increased, thus the db
- * thread can read any of the fields in this structure. To do anything more
+ * threads can read any of the fields in this structure. To do anything more
  * than simple reading out a value, some kind of locking mechanism shall be
  * used.
  **/
 typedef struct _AFSqlDestDriver
 {
-  LogDestDriver super;
+  LogThrDestDriver super;
   /* read by the db thread */
   gchar *type;
   gchar *host;
@@ -90,42 +105,22 @@ typedef struct _AFSqlDestDriver
   gint fields_len;
   AFSqlField *fields;
   gchar *null_value;
-  gint time_reopen;
-  gint num_retries;
   gint flush_lines;
   gint flush_timeout;
-  gint flush_lines_queued;
   gint flags;
   GList *session_statements;
 
   LogTemplateOptions template_options;
 
-  StatsCounterItem *dropped_messages;
-  StatsCounterItem *stored_messages;
-
   GHashTable *dbd_options;
   GHashTable *dbd_options_numeric;
-
-  /* shared by the main/db thread */
-  GThread *db_thread;
-  GMutex *db_thread_mutex;
-  GCond *db_thread_wakeup_cond;
-  gboolean db_thread_terminate;
-  gboolean db_thread_suspended;
-  GTimeVal db_thread_suspend_target;
-  LogQueue *queue;
-  /* used exclusively by the db thread */
-  gint32 seq_num;
-  dbi_conn dbi_ctx;
-  GHashTable *validated_tables;
-  guint32 failed_message_counter;
 } AFSqlDestDriver;
 
 static gboolean dbi_initialized = FALSE;
 static const char *s_oracle = "oracle";
 static const char *s_freetds = "freetds";
 
-#define MAX_FAILED_ATTEMPTS 3
+#define AFSQL_FREETDS_MAX_ROWS 1000
 
 void
 afsql_dd_add_dbd_option(LogDriver *s, const gchar *name, const gchar *value)
@@ -254,21 +249,6 @@ afsql_dd_set_null_value(LogDriver *s, const gchar *null)
   self->null_value = g_strdup(null);
 }
 
-void
-afsql_dd_set_retries(LogDriver *s, gint num_retries)
-{
-  AFSqlDestDriver *self = (AFSqlDestDriver *) s;
-
-  if (num_retries < 1)
-    {
-      self->num_retries = 1;
-    }
-  else
-    {
-      self->num_retries = num_retries;
-    }
-}
-
 void
 afsql_dd_set_frac_digits(LogDriver *s, gint frac_digits)
 {
@@ -333,7 +313,7 @@ afsql_dd_set_flags(LogDriver *s, gint flags)
  * NOTE: This function can only be called from the database thread.
  **/
 static gboolean
-afsql_dd_run_query(AFSqlDestDriver *self, const gchar *query, gboolean silent, dbi_result *result)
+afsql_dd_run_query(AFSqlDestDriver *self, AFSqlDestWorker *worker, const gchar *query, gboolean silent, dbi_result *result)
 {
   dbi_result db_res;
 
@@ -341,14 +321,14 @@ afsql_dd_run_query(AFSqlDestDriver *self, const gchar *query, gboolean silent, d
             evt_tag_str("query", query),
             NULL);
 
-  db_res = dbi_conn_query(self->dbi_ctx, query);
+  db_res = dbi_conn_query(worker->dbi_ctx, query);
   if (!db_res)
     {
       const gchar *dbi_error;
 
       if (!silent)
         {
-          dbi_conn_error(self->dbi_ctx, &dbi_error);
+          dbi_conn_error(worker->dbi_ctx, &dbi_error);
           msg_error("Error running SQL query",
                     evt_tag_str("type", self->type),
                     evt_tag_str("host", self->host),
@@ -395,7 +375,7 @@ afsql_dd_check_sql_identifier(gchar *token, gboolean sanitize)
  * NOTE: This function can only be called from the database thread.
  **/
 static gboolean
-afsql_dd_create_index(AFSqlDestDriver *self, gchar *table, gchar *column)
+afsql_dd_create_index(AFSqlDestDriver *self, AFSqlDestWorker *worker, gchar *table, gchar *column)
 {
   GString *query_string;
   gboolean success = TRUE;
@@ -435,7 +415,7 @@ afsql_dd_create_index(AFSqlDestDriver *self, gchar *table, gchar *column)
   else
     g_string_printf(query_string, "CREATE INDEX %s_%s_idx ON %s (%s)",
                     table, column, table, column);
-  if (!afsql_dd_run_query(self, query_string->str, FALSE, NULL))
+  if (!afsql_dd_run_query(self, worker, query_string->str, FALSE, NULL))
     {
       msg_error("Error adding missing index",
                 evt_tag_str("table", table),
@@ -457,7 +437,7 @@ afsql_dd_create_index(AFSqlDestDriver *self, gchar *table, gchar *column)
  * NOTE: This function can only be called from the database thread.
  **/
 static GString *
-afsql_dd_validate_table(AFSqlDestDriver *self, LogMessage *msg)
+afsql_dd_validate_table(AFSqlDestDriver *self, AFSqlDestWorker *worker, LogMessage *msg)
 {
   GString *query_string, *table;
   dbi_result db_res;
@@ -472,12 +452,12 @@ afsql_dd_validate_table(AFSqlDestDriver *self, LogMessage *msg)
 
   afsql_dd_check_sql_identifier(table->str, TRUE);
 
-  if (g_hash_table_lookup(self->validated_tables, table->str))
+  if (g_hash_table_lookup(worker->validated_tables, table->str))
     return table;
 
   query_string = g_string_sized_new(32);
   g_string_printf(query_string, "SELECT * FROM %s WHERE 0=1", table->str);
-  if (afsql_dd_run_query(self, query_string->str, TRUE, &db_res))
+  if (afsql_dd_run_query(self, worker, query_string->str, TRUE, &db_res))
     {
 
       /* table exists, check structure */
@@ -489,7 +469,7 @@ afsql_dd_validate_table(AFSqlDestDriver *self, LogMessage *msg)
               GList *l;
               /* field does not exist, add this column */
               g_string_printf(query_string, "ALTER TABLE %s ADD %s %s", table->str, self->fields[i].name, self->fields[i].type);
-              if (!afsql_dd_run_query(self, query_string->str, FALSE, NULL))
+              if (!afsql_dd_run_query(self, worker, query_string->str, FALSE, NULL))
                 {
                   msg_error("Error adding missing column, giving up",
                             evt_tag_str("table", table->str),
@@ -503,7 +483,7 @@ afsql_dd_validate_table(AFSqlDestDriver *self, LogMessage *msg)
                   if (strcmp((gchar *) l->data, self->fields[i].name) == 0)
                     {
                       /* this is an indexed column, create index */
-                      afsql_dd_create_index(self, table->str, self->fields[i].name);
+                      afsql_dd_create_index(self, worker, table->str, self->fields[i].name);
                     }
                 }
             }
@@ -522,14 +502,14 @@ afsql_dd_validate_table(AFSqlDestDriver *self, LogMessage *msg)
             g_string_append(query_string, ", ");
         }
       g_string_append(query_string, ")");
-      if (afsql_dd_run_query(self, query_string->str, FALSE, NULL))
+      if (afsql_dd_run_query(self, worker, query_string->str, FALSE, NULL))
         {
           GList *l;
 
           success = TRUE;
           for (l = self->indexes; l; l = l->next)
             {
-              afsql_dd_create_index(self, table->str, (gchar *) l->data);
+              afsql_dd_create_index(self, worker, table->str, (gchar *) l->data);
             }
         }
       else
@@ -542,7 +522,7 @@ afsql_dd_validate_table(AFSqlDestDriver *self, LogMessage *msg)
   if (success)
     {
       /* we have successfully created/altered the destination table, record this information */
-      g_hash_table_insert(self->validated_tables, g_strdup(table->str), GUINT_TO_POINTER(TRUE));
+      g_hash_table_insert(worker->validated_tables, g_strdup(table->str), GUINT_TO_POINTER(TRUE));
     }
   else
     {
@@ -562,7 +542,7 @@ afsql_dd_validate_table(AFSqlDestDriver *self, LogMessage *msg)
  * NOTE: This function can only be called from the database thread.
  **/
 static gboolean
-afsql_dd_begin_txn(AFSqlDestDriver *self)
+afsql_dd_begin_txn(AFSqlDestDriver *self, AFSqlDestWorker *worker)
 {
   gboolean success = TRUE;
   const char *s_begin = "BEGIN";
@@ -575,74 +555,51 @@ afsql_dd_begin_txn(AFSqlDestDriver *self)
   if (strcmp(self->type, s_oracle) != 0)
     {
       /* oracle db has no BEGIN TRANSACTION command, it implicitly starts one, after every commit. */
-      success = afsql_dd_run_query(self, s_begin, FALSE, NULL);
+      success = afsql_dd_run_query(self, worker, s_begin, FALSE, NULL);
     }
   return success;
 }
 
 /**
- * afsql_dd_begin_txn:
+ * afsql_dd_commit_txn:
  *
  * Commit SQL transaction.
  *
  * NOTE: This function can only be called from the database thread.
  **/
 static gboolean
-afsql_dd_commit_txn(AFSqlDestDriver *self, gboolean lock)
+afsql_dd_commit_txn(AFSqlDestDriver *self, AFSqlDestWorker *worker)
 {
-  gboolean success;
-
-  success = afsql_dd_run_query(self, "COMMIT", FALSE, NULL);
-  if (lock)
-    g_mutex_lock(self->db_thread_mutex);
-
-  /* FIXME: this is a workaround because of the non-proper locking semantics
-   * of the LogQueue.  It might happen that the _queue() method sees 0
-   * elements in the queue, while the thread is still busy processing the
-   * previous message.  In that case arming the parallel push callback is
-   * not needed and will cause assertions to fail.  This is ugly and should
-   * be fixed by properly defining the "blocking" semantics of the LogQueue
-   * object w/o having to rely on user-code messing with parallel push
-   * callbacks. */
-
-  log_queue_reset_parallel_push(self->queue);
-  if (success)
-    {
-      log_queue_ack_backlog(self->queue, self->flush_lines_queued);
-    }
-  else
+  if (!afsql_dd_run_query(self, worker, "COMMIT", FALSE, NULL))
     {
       msg_notice("SQL transaction commit failed, rewinding backlog and starting again",
                  NULL);
-      log_queue_rewind_backlog(self->queue);
+      return FALSE;
     }
-  if (lock)
-    g_mutex_unlock(self->db_thread_mutex);
-  self->flush_lines_queued = 0;
-  return success;
+  return TRUE;
 }
 
 /**
- * afsql_dd_suspend:
- * timeout: in milliseconds
+ * afsql_dd_rollback_txn:
  *
- * This function is assumed to be called from the database thread
- * only!
+ * Roll back the SQL transaction of a failed batch, its messages are
+ * rewound to the queue and inserted again.
+ *
+ * NOTE: This function can only be called from the database thread.
  **/
 static void
-afsql_dd_suspend(AFSqlDestDriver *self)
+afsql_dd_rollback_txn(AFSqlDestDriver *self, AFSqlDestWorker *worker)
 {
-  self->db_thread_suspended = TRUE;
-  g_get_current_time(&self->db_thread_suspend_target);
-  g_time_val_add(&self->db_thread_suspend_target, self->time_reopen * 1000 * 1000); /* the timeout expects microseconds */
+  afsql_dd_run_query(self, worker, "ROLLBACK", TRUE, NULL);
 }
 
 static void
-afsql_dd_disconnect(AFSqlDestDriver *self)
+afsql_dd_disconnect(AFSqlDestDriver *self, AFSqlDestWorker *worker)
 {
-  dbi_conn_close(self->dbi_ctx);
-  self->dbi_ctx = NULL;
-  g_hash_table_remove_all(self->validated_tables);
+  if (worker->dbi_ctx)
+    dbi_conn_close(worker->dbi_ctx);
+  worker->dbi_ctx = NULL;
+  g_hash_table_remove_all(worker->validated_tables);
 }
 
 static void
@@ -659,13 +616,13 @@ afsql_dd_set_dbd_opt_numeric(gpointer key, gpointer value, gpointer user_data)
 }
 
 static gboolean
-afsql_dd_connect(AFSqlDestDriver *self)
+afsql_dd_connect(AFSqlDestDriver *self, AFSqlDestWorker *worker)
 {
-  if (self->dbi_ctx)
+  if (worker->dbi_ctx)
     return TRUE;
 
-  self->dbi_ctx = dbi_conn_new(self->type);
-  if (!self->dbi_ctx)
+  worker->dbi_ctx = dbi_conn_new(self->type);
+  if (!worker->dbi_ctx)
     {
       msg_error("No such DBI driver",
                 evt_tag_str("type", self->type),
@@ -673,30 +630,30 @@ afsql_dd_connect(AFSqlDestDriver *self)
       return FALSE;
     }
 
-  dbi_conn_set_option(self->dbi_ctx, "host", self->host);
+  dbi_conn_set_option(worker->dbi_ctx, "host", self->host);
   if (strcmp(self->type, "mysql"))
-    dbi_conn_set_option(self->dbi_ctx, "port", self->port);
+    dbi_conn_set_option(worker->dbi_ctx, "port", self->port);
   else
-    dbi_conn_set_option_numeric(self->dbi_ctx, "port", atoi(self->port));
-  dbi_conn_set_option(self->dbi_ctx, "username", self->user);
-  dbi_conn_set_option(self->dbi_ctx, "password", self->password);
-  dbi_conn_set_option(self->dbi_ctx, "dbname", self->database);
-  dbi_conn_set_option(self->dbi_ctx, "encoding", self->encoding);
-  dbi_conn_set_option(self->dbi_ctx, "auto-commit", self->flags & AFSQL_DDF_EXPLICIT_COMMITS ? "false" : "true");
+    dbi_conn_set_option_numeric(worker->dbi_ctx, "port", atoi(self->port));
+  dbi_conn_set_option(worker->dbi_ctx, "username", self->user);
+  dbi_conn_set_option(worker->dbi_ctx, "password", self->password);
+  dbi_conn_set_option(worker->dbi_ctx, "dbname", self->database);
+  dbi_conn_set_option(worker->dbi_ctx, "encoding", self->encoding);
+  dbi_conn_set_option(worker->dbi_ctx, "auto-commit", self->flags & AFSQL_DDF_EXPLICIT_COMMITS ? "false" : "true");
 
   /* database specific hacks */
-  dbi_conn_set_option(self->dbi_ctx, "sqlite_dbdir", "");
-  dbi_conn_set_option(self->dbi_ctx, "sqlite3_dbdir", "");
+  dbi_conn_set_option(worker->dbi_ctx, "sqlite_dbdir", "");
+  dbi_conn_set_option(worker->dbi_ctx, "sqlite3_dbdir", "");
 
   /* Set user-specified options */
-  g_hash_table_foreach(self->dbd_options, afsql_dd_set_dbd_opt, self->dbi_ctx);
-  g_hash_table_foreach(self->dbd_options_numeric, afsql_dd_set_dbd_opt_numeric, self->dbi_ctx);
+  g_hash_table_foreach(self->dbd_options, afsql_dd_set_dbd_opt, worker->dbi_ctx);
+  g_hash_table_foreach(self->dbd_options_numeric, afsql_dd_set_dbd_opt_numeric, worker->dbi_ctx);
 
-  if (dbi_conn_connect(self->dbi_ctx) < 0)
+  if (dbi_conn_connect(worker->dbi_ctx) < 0)
     {
       const gchar *dbi_error;
 
-      dbi_conn_error(self->dbi_ctx, &dbi_error);
+      dbi_conn_error(worker->dbi_ctx, &dbi_error);
 
       msg_error("Error establishing SQL connection",
                 evt_tag_str("type", self->type),
@@ -715,7 +672,7 @@ afsql_dd_connect(AFSqlDestDriver *self)
 
       for (l = self->session_statements; l; l = l->next)
         {
-          if (!afsql_dd_run_query(self, (gchar *) l->data, FALSE, NULL))
+          if (!afsql_dd_run_query(self, worker, (gchar *) l->data, FALSE, NULL))
             {
               msg_error("Error executing SQL connection statement",
                         evt_tag_str("statement", (gchar *) l->data),
@@ -728,64 +685,39 @@ afsql_dd_connect(AFSqlDestDriver *self)
   return TRUE;
 }
 
+/**
+ * afsql_dd_check_connection:
+ *
+ * Database connection status sanity check after a failed query.
+ **/
 static gboolean
-afsql_dd_insert_fail_handler(AFSqlDestDriver *self, LogMessage *msg,
-                             LogPathOptions *path_options)
+afsql_dd_check_connection(AFSqlDestDriver *self, AFSqlDestWorker *worker)
 {
-  if (self->failed_message_counter < self->num_retries - 1)
-    {
-      log_queue_push_head(self->queue, msg, &path_options);
+  const gchar *dbi_error;
 
-      /* database connection status sanity check after failed query */
-      if (dbi_conn_ping(self->dbi_ctx) != 1)
-        {
-          const gchar *dbi_error;
-
-          dbi_conn_error(self->dbi_ctx, &dbi_error);
-          msg_error("Error, no SQL connection after failed query attempt",
-                    evt_tag_str("type", self->type),
-                    evt_tag_str("host", self->host),
-                    evt_tag_str("port", self->port),
-                    evt_tag_str("username", self->user),
-                    evt_tag_str("database", self->database),
-                    evt_tag_str("error", dbi_error),
-                    NULL);
-          return FALSE;
-        }
-
-      self->failed_message_counter++;
-      return FALSE;
-    }
+  if (dbi_conn_ping(worker->dbi_ctx) == 1)
+    return TRUE;
 
-  msg_error("Multiple failures while inserting this record into the database, message dropped",
-            evt_tag_int("attempts", self->num_retries),
+  dbi_conn_error(worker->dbi_ctx, &dbi_error);
+  msg_error("Error, no SQL connection after failed query attempt",
+            evt_tag_str("type", self->type),
+            evt_tag_str("host", self->host),
+            evt_tag_str("port", self->port),
+            evt_tag_str("username", self->user),
+            evt_tag_str("database", self->database),
+            evt_tag_str("error", dbi_error),
             NULL);
-  stats_counter_inc(self->dropped_messages);
-  log_msg_drop(msg, path_options);
-  self->failed_message_counter = 0;
-  return TRUE;
+  return FALSE;
 }
 
-static GString *
-afsql_dd_construct_query(AFSqlDestDriver *self, GString *table,
-                         LogMessage *msg)
+static void
+afsql_dd_append_row(AFSqlDestDriver *self, AFSqlDestWorker *worker,
+                    GString *query_string, LogMessage *msg, gint32 seq_num,
+                    GString *value)
 {
-  GString *value;
-  GString *query_string;
   gint i;
 
-  value = g_string_sized_new(256);
-  query_string = g_string_sized_new(512);
-
-  g_string_printf(query_string, "INSERT INTO %s (", table->str);
-  for (i = 0; i < self->fields_len; i++)
-    {
-      g_string_append(query_string, self->fields[i].name);
-      if (i != self->fields_len - 1)
-        g_string_append(query_string, ", ");
-    }
-  g_string_append(query_string, ") VALUES (");
-
+  g_string_append_c(query_string, '(');
   for (i = 0; i < self->fields_len; i++)
     {
       gchar *quoted;
@@ -797,7 +729,7 @@ afsql_dd_construct_query(AFSqlDestDriver *self, GString *table,
         }
       else
         {
-          log_template_format(self->fields[i].value, msg, &self->template_options, LTZ_SEND, self->seq_num, NULL, value);
+          log_template_format(self->fields[i].value, msg, &self->template_options, LTZ_SEND, seq_num, NULL, value);
 
           if (self->null_value && strcmp(self->null_value, value->str) == 0)
             {
@@ -805,7 +737,7 @@ afsql_dd_construct_query(AFSqlDestDriver *self, GString *table,
             }
           else
             {
-              dbi_conn_quote_string_copy(self->dbi_ctx, value->str, &quoted);
+              dbi_conn_quote_string_copy(worker->dbi_ctx, value->str, &quoted);
               if (quoted)
                 {
                   g_string_append(query_string, quoted);
@@ -821,204 +753,214 @@ afsql_dd_construct_query(AFSqlDestDriver *self, GString *table,
       if (i != self->fields_len - 1)
         g_string_append(query_string, ", ");
     }
-  g_string_append(query_string, ")");
-
-  g_string_free(value, TRUE);
-
-  return query_string;
+  g_string_append_c(query_string, ')');
 }
 
 /**
- * afsql_dd_insert_db:
- *
- * This function is running in the database thread
+ * afsql_dd_construct_query:
  *
- * Returns: FALSE to indicate that the connection should be closed and
- * this destination suspended for time_reopen() time.
+ * Construct a single INSERT statement for @msgs_len messages, all of
+ * them going into @table. More than one message is inserted using the
+ * multi-row VALUES syntax, which saves a round trip and a statement
+ * parse on the server for every row.
  **/
-static gboolean
-afsql_dd_insert_db(AFSqlDestDriver *self)
+static GString *
+afsql_dd_construct_query(AFSqlDestDriver *self, AFSqlDestWorker *worker,
+                         GString *table, LogMessage **msgs, gint msgs_len,
+                         gint32 seq_num)
 {
-  GString *table, *query_string;
-  LogMessage *msg;
-  gboolean success;
-  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
-
-  afsql_dd_connect(self);
-
-  g_mutex_lock(self->db_thread_mutex);
-
-  /* FIXME: this is a workaround because of the non-proper locking semantics
-   * of the LogQueue.  It might happen that the _queue() method sees 0
-   * elements in the queue, while the thread is still busy processing the
-   * previous message.  In that case arming the parallel push callback is
-   * not needed and will cause assertions to fail.  This is ugly and should
-   * be fixed by properly defining the "blocking" semantics of the LogQueue
-   * object w/o having to rely on user-code messing with parallel push
-   * callbacks. */
-  log_queue_reset_parallel_push(self->queue);
-  success = log_queue_pop_head(self->queue, &msg, &path_options, (self->flags & AFSQL_DDF_EXPLICIT_COMMITS), FALSE);
-  g_mutex_unlock(self->db_thread_mutex);
-  if (!success)
-    return TRUE;
+  GString *value;
+  GString *query_string;
+  gint i;
 
-  msg_set_context(msg);
+  value = g_string_sized_new(256);
+  query_string = g_string_sized_new(512 * msgs_len);
 
-  table = afsql_dd_validate_table(self, msg);
-  if (!table)
+  g_string_printf(query_string, "INSERT INTO %s (", table->str);
+  for (i = 0; i < self->fields_len; i++)
     {
-      /* If validate table is FALSE then close the connection and wait time_reopen time (next call) */
-      msg_error("Error checking table, disconnecting from database, trying again shortly",
-                evt_tag_int("time_reopen", self->time_reopen),
-                NULL);
-      msg_set_context(NULL);
-      g_string_free(table, TRUE);
-      return afsql_dd_insert_fail_handler(self, msg, &path_options);
+      g_string_append(query_string, self->fields[i].name);
+      if (i != self->fields_len - 1)
+        g_string_append(query_string, ", ");
     }
+  g_string_append(query_string, ") VALUES ");
 
-  query_string = afsql_dd_construct_query(self, table, msg);
-
-  if (self->flush_lines_queued == 0 && !afsql_dd_begin_txn(self))
-    return FALSE;
-
-  success = afsql_dd_run_query(self, query_string->str, FALSE, NULL);
-  if (success && self->flush_lines_queued != -1)
+  for (i = 0; i < msgs_len; i++)
     {
-      self->flush_lines_queued++;
-
-      if (self->flush_lines && self->flush_lines_queued == self->flush_lines && !afsql_dd_commit_txn(self, TRUE))
-        return FALSE;
+      if (i != 0)
+        g_string_append(query_string, ", ");
+      afsql_dd_append_row(self, worker, query_string, msgs[i], seq_num, value);
+      step_sequence_number(&seq_num);
     }
 
-  g_string_free(table, TRUE);
-  g_string_free(query_string, TRUE);
+  g_string_free(value, TRUE);
 
-  msg_set_context(NULL);
+  return query_string;
+}
+
+/**
+ * afsql_dd_count_rows:
+ *
+ * Count the messages at the start of @msgs that go into @table, these are
+ * inserted using a single multi-row INSERT statement.
+ *
+ * NOTE: This function can only be called from the database thread.
+ **/
+static gint
+afsql_dd_count_rows(AFSqlDestDriver *self, GString *table, LogMessage **msgs, gint msgs_len)
+{
+  GString *next_table;
+  gint max_rows = msgs_len;
+  gint n;
 
-  if (!success)
-    return afsql_dd_insert_fail_handler(self, msg, &path_options);
+  if (strcmp(self->type, s_oracle) == 0)
+    {
+      /* Oracle does not support the multi-row VALUES syntax */
+      max_rows = 1;
+    }
+  else if (strcmp(self->type, s_freetds) == 0)
+    {
+      /* MSSQL accepts at most 1000 rows in a single INSERT statement */
+      max_rows = MIN(max_rows, AFSQL_FREETDS_MAX_ROWS);
+    }
 
-  /* we only ACK if each INSERT is a separate transaction */
-  if ((self->flags & AFSQL_DDF_EXPLICIT_COMMITS) == 0)
-    log_msg_ack(msg, &path_options);
-  log_msg_unref(msg);
-  step_sequence_number(&self->seq_num);
-  self->failed_message_counter = 0;
+  next_table = g_string_sized_new(32);
+  for (n = 1; n < max_rows; n++)
+    {
+      g_string_truncate(next_table, 0);
+      log_template_format(self->table, msgs[n], &self->template_options, LTZ_LOCAL, 0, NULL, next_table);
+      if ((self->flags & AFSQL_DDF_DONT_CREATE_TABLES) == 0)
+        afsql_dd_check_sql_identifier(next_table->str, TRUE);
 
-  return TRUE;
+      if (strcmp(next_table->str, table->str) != 0)
+        break;
+    }
+  g_string_free(next_table, TRUE);
+  return n;
 }
 
 /**
- * afsql_dd_database_thread:
+ * afsql_worker_insert:
+ *
+ * Insert a batch of messages, using one INSERT statement for each run of
+ * messages going into the same table. With explicit-commits the batch is
+ * a single transaction, otherwise every statement is committed on its own.
  *
- * This is the thread inserting records into the database.
+ * This function is running in the database thread
  **/
-static gpointer
-afsql_dd_database_thread(gpointer arg)
+static LogThrDestResult
+afsql_worker_insert(LogThrDestWorker *s, LogMessage **msgs, gint msgs_len, gint *delivered)
 {
-  AFSqlDestDriver *self = (AFSqlDestDriver *) arg;
+  AFSqlDestWorker *worker = (AFSqlDestWorker *) s;
+  AFSqlDestDriver *self = (AFSqlDestDriver *) s->owner;
+  gboolean explicit_commits = !!(self->flags & AFSQL_DDF_EXPLICIT_COMMITS);
+  gint32 seq_num = s->seq_num;
+  gboolean table_error = FALSE;
+  gint i = 0, j;
+
+  if (explicit_commits && !afsql_dd_begin_txn(self, worker))
+    goto error;
 
-  msg_verbose("Database thread started",
-              evt_tag_str("driver", self->super.super.id),
-              NULL);
-  while (!self->db_thread_terminate)
+  while (i < msgs_len)
     {
-      g_mutex_lock(self->db_thread_mutex);
-      if (self->db_thread_suspended)
+      GString *table, *query_string;
+      gboolean success;
+      gint rows;
+
+      msg_set_context(msgs[i]);
+
+      table = afsql_dd_validate_table(self, worker, msgs[i]);
+      if (!table)
         {
-          /* we got suspended, probably because of a connection error,
-           * during this time we only get wakeups if we need to be
-           * terminated. */
-          if (!self->db_thread_terminate)
-            g_cond_timed_wait(self->db_thread_wakeup_cond, self->db_thread_mutex, &self->db_thread_suspend_target);
-          self->db_thread_suspended = FALSE;
-          g_mutex_unlock(self->db_thread_mutex);
-
-          /* we loop back to check if the thread was requested to terminate */
+          msg_error("Error checking table, trying again shortly",
+                    evt_tag_int("time_reopen", self->super.time_reopen),
+                    NULL);
+          msg_set_context(NULL);
+          table_error = TRUE;
+          goto error;
         }
-      else if (log_queue_get_length(self->queue) == 0)
-        {
-          /* we have nothing to INSERT into the database, let's wait we get some new stuff */
 
-          if (self->flush_lines_queued > 0 && self->flush_timeout > 0)
-            {
-              GTimeVal flush_target;
+      rows = afsql_dd_count_rows(self, table, &msgs[i], msgs_len - i);
+      query_string = afsql_dd_construct_query(self, worker, table, &msgs[i], rows, seq_num);
+      g_string_free(table, TRUE);
 
-              g_get_current_time(&flush_target);
-              g_time_val_add(&flush_target, self->flush_timeout * 1000);
-              if (!self->db_thread_terminate && !g_cond_timed_wait(self->db_thread_wakeup_cond, self->db_thread_mutex, &flush_target))
-                {
-                  /* timeout elapsed */
-                  if (!afsql_dd_commit_txn(self, FALSE))
-                    {
-                      afsql_dd_disconnect(self);
-                      afsql_dd_suspend(self);
-                      g_mutex_unlock(self->db_thread_mutex);
-                      continue;
-                    }
-                }
-            }
-          else if (!self->db_thread_terminate)
-            {
-              g_cond_wait(self->db_thread_wakeup_cond, self->db_thread_mutex);
-            }
-          g_mutex_unlock(self->db_thread_mutex);
+      success = afsql_dd_run_query(self, worker, query_string->str, FALSE, NULL);
+      g_string_free(query_string, TRUE);
+      msg_set_context(NULL);
 
-          /* we loop back to check if the thread was requested to terminate */
-        }
-      else
-        g_mutex_unlock(self->db_thread_mutex);
+      if (!success)
+        goto error;
 
-      if (self->db_thread_terminate)
-        break;
+      for (j = 0; j < rows; j++)
+        step_sequence_number(&seq_num);
+      i += rows;
 
-      if (!afsql_dd_insert_db(self))
-        {
-          afsql_dd_disconnect(self);
-          afsql_dd_suspend(self);
-        }
+      /* we only ACK if each INSERT is a separate transaction */
+      if (!explicit_commits)
+        *delivered = i;
     }
-  if (self->flush_lines_queued > 0)
-    {
-      /* we can't do anything with the return value here. if commit isn't
-       * successful, we get our backlog back, but we have no chance
-       * submitting that back to the SQL engine.
-       */
 
-      afsql_dd_commit_txn(self, TRUE);
+  if (explicit_commits && !afsql_dd_commit_txn(self, worker))
+    goto error;
+
+  return LTD_SUCCESS;
+
+ error:
+  if (explicit_commits)
+    {
+      afsql_dd_rollback_txn(self, worker);
+      *delivered = 0;
     }
+  /* a table that can't be created or altered is not the fault of the
+   * messages, retry them after time_reopen() instead of counting the
+   * failure against retries() */
+  if (table_error)
+    return LTD_NOT_CONNECTED;
+  return afsql_dd_check_connection(self, worker) ? LTD_ERROR : LTD_NOT_CONNECTED;
+}
+
+static gboolean
+afsql_worker_connect(LogThrDestWorker *s)
+{
+  AFSqlDestWorker *worker = (AFSqlDestWorker *) s;
+  AFSqlDestDriver *self = (AFSqlDestDriver *) s->owner;
 
-  afsql_dd_disconnect(self);
+  if (!afsql_dd_connect(self, worker))
+    {
+      /* start over with a new connection after time_reopen() */
+      afsql_dd_disconnect(self, worker);
+      return FALSE;
+    }
+  return TRUE;
+}
 
-  msg_verbose("Database thread finished",
-              evt_tag_str("driver", self->super.super.id),
-              NULL);
-  return NULL;
+static void
+afsql_worker_disconnect(LogThrDestWorker *s)
+{
+  afsql_dd_disconnect((AFSqlDestDriver *) s->owner, (AFSqlDestWorker *) s);
 }
 
 static void
-afsql_dd_start_thread(AFSqlDestDriver *self)
+afsql_worker_thread_init(LogThrDestWorker *s)
 {
-  self->db_thread_wakeup_cond = g_cond_new();
-  self->db_thread_mutex = g_mutex_new();
-  self->db_thread = create_worker_thread(afsql_dd_database_thread, self, TRUE, NULL);
+  AFSqlDestWorker *worker = (AFSqlDestWorker *) s;
+
+  worker->validated_tables = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
 }
 
 static void
-afsql_dd_stop_thread(AFSqlDestDriver *self)
+afsql_worker_thread_deinit(LogThrDestWorker *s)
 {
-  g_mutex_lock(self->db_thread_mutex);
-  self->db_thread_terminate = TRUE;
-  g_cond_signal(self->db_thread_wakeup_cond);
-  g_mutex_unlock(self->db_thread_mutex);
-  g_thread_join(self->db_thread);
-  g_mutex_free(self->db_thread_mutex);
-  g_cond_free(self->db_thread_wakeup_cond);
+  AFSqlDestWorker *worker = (AFSqlDestWorker *) s;
+
+  g_hash_table_destroy(worker->validated_tables);
+  worker->validated_tables = NULL;
 }
 
-static gchar *
-afsql_dd_format_stats_instance(AFSqlDestDriver *self)
+static const gchar *
+afsql_dd_format_stats_instance(LogThrDestDriver *s)
 {
+  AFSqlDestDriver *self = (AFSqlDestDriver *) s;
   static gchar persist_name[64];
 
   g_snprintf(persist_name, sizeof(persist_name),
@@ -1027,18 +969,25 @@ afsql_dd_format_stats_instance(AFSqlDestDriver *self)
   return persist_name;
 }
 
-static inline gchar *
-afsql_dd_format_persist_name(AFSqlDestDriver *self)
+static const gchar *
+afsql_dd_format_persist_name(LogThrDestDriver *s, gint worker_index)
 {
+  AFSqlDestDriver *self = (AFSqlDestDriver *) s;
   static gchar persist_name[256];
 
-  g_snprintf(persist_name, sizeof(persist_name),
-             "afsql_dd(%s,%s,%s,%s,%s)",
-             self->type, self->host, self->port, self->database, self->table->template);
+  /* the first worker keeps the name used before workers() existed, so
+   * that its queue is kept when upgrading */
+  if (worker_index == 0)
+    g_snprintf(persist_name, sizeof(persist_name),
+               "afsql_dd(%s,%s,%s,%s,%s)",
+               self->type, self->host, self->port, self->database, self->table->template);
+  else
+    g_snprintf(persist_name, sizeof(persist_name),
+               "afsql_dd(%s,%s,%s,%s,%s,%d)",
+               self->type, self->host, self->port, self->database, self->table->template, worker_index);
   return persist_name;
 }
 
-
 static gboolean
 afsql_dd_init(LogPipe *s)
 {
@@ -1046,9 +995,6 @@ afsql_dd_init(LogPipe *s)
   GlobalConfig *cfg = log_pipe_get_config(s);
   gint len_cols, len_values;
 
-  if (!log_dest_driver_init_method(s))
-    return FALSE;
-
   if (!self->columns || !self->values)
     {
       msg_error("Default columns and values must be specified for database destinations",
@@ -1057,13 +1003,6 @@ afsql_dd_init(LogPipe *s)
       return FALSE;
     }
 
-  stats_lock();
-  stats_register_counter(0, SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_STORED, &self->stored_messages);
-  stats_register_counter(0, SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_DROPPED, &self->dropped_messages);
-  stats_unlock();
-
-  self->queue = log_dest_driver_acquire_queue(&self->super, afsql_dd_format_persist_name(self));
-  log_queue_set_counters(self->queue, self->stored_messages, self->dropped_messages);
   if (!self->fields)
     {
       GList *col, *value;
@@ -1077,7 +1016,7 @@ afsql_dd_init(LogPipe *s)
                     evt_tag_int("len_columns", len_cols),
                     evt_tag_int("len_values", len_values),
                     NULL);
-          goto error;
+          return FALSE;
         }
       self->fields_len = len_cols;
       self->fields = g_new0(AFSqlField, len_cols);
@@ -1130,8 +1069,6 @@ afsql_dd_init(LogPipe *s)
         }
     }
 
-  self->time_reopen = cfg->time_reopen;
-
   log_template_options_init(&self->template_options, cfg);
 
   if (self->flush_lines == -1)
@@ -1139,8 +1076,17 @@ afsql_dd_init(LogPipe *s)
   if (self->flush_timeout == -1)
     self->flush_timeout = cfg->flush_timeout;
 
-  if ((self->flags & AFSQL_DDF_EXPLICIT_COMMITS) && (self->flush_lines > 0 || self->flush_timeout > 0))
-    self->flush_lines_queued = 0;
+  /* with explicit-commits a batch is committed as a single transaction,
+   * so flush_lines() and flush_timeout() determine the batch size */
+  if (self->super.batch_lines == -1)
+    {
+      if ((self->flags & AFSQL_DDF_EXPLICIT_COMMITS) && self->flush_lines > 0)
+        self->super.batch_lines = self->flush_lines;
+      else
+        self->super.batch_lines = 1;
+    }
+  if (self->super.batch_timeout == -1)
+    self->super.batch_timeout = (self->flags & AFSQL_DDF_EXPLICIT_COMMITS) ? self->flush_timeout : 0;
 
   if (!dbi_initialized)
     {
@@ -1153,13 +1099,13 @@ afsql_dd_init(LogPipe *s)
                     evt_tag_int("rc", rc),
                     evt_tag_errno("error", errno),
                     NULL);
-          goto error;
+          return FALSE;
         }
       else if (rc == 0)
         {
           msg_error("The database access library (DBI) reports no usable SQL drivers, perhaps DBI drivers are not installed properly",
                     NULL);
-          goto error;
+          return FALSE;
         }
       else
         {
@@ -1167,69 +1113,7 @@ afsql_dd_init(LogPipe *s)
         }
     }
 
-  afsql_dd_start_thread(self);
-  return TRUE;
-
- error:
-
-  stats_lock();
-  stats_unregister_counter(SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_STORED, &self->stored_messages);
-  stats_unregister_counter(SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_DROPPED, &self->dropped_messages);
-  stats_unlock();
-
-  return FALSE;
-}
-
-static gboolean
-afsql_dd_deinit(LogPipe *s)
-{
-  AFSqlDestDriver *self = (AFSqlDestDriver *) s;
-
-  afsql_dd_stop_thread(self);
-
-  log_queue_set_counters(self->queue, NULL, NULL);
-
-  stats_lock();
-  stats_unregister_counter(SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_STORED, &self->stored_messages);
-  stats_unregister_counter(SCS_SQL | SCS_DESTINATION, self->super.super.id, afsql_dd_format_stats_instance(self), SC_TYPE_DROPPED, &self->dropped_messages);
-  stats_unlock();
-
-  if (!log_dest_driver_deinit_method(s))
-    return FALSE;
-
-  return TRUE;
-}
-
-static void
-afsql_dd_queue_notify(gpointer user_data)
-{
-  AFSqlDestDriver *self = (AFSqlDestDriver *) user_data;
-  g_mutex_lock(self->db_thread_mutex);
-  g_cond_signal(self->db_thread_wakeup_cond);
-  log_queue_reset_parallel_push(self->queue);
-  g_mutex_unlock(self->db_thread_mutex);
-}
-
-static void
-afsql_dd_queue(LogPipe *s, LogMessage *msg, const LogPathOptions *path_options, gpointer user_data)
-{
-  AFSqlDestDriver *self = (AFSqlDestDriver *) s;
-  gboolean queue_was_empty;
-  LogPathOptions local_options;
-
-  if (!path_options->flow_control_requested)
-    path_options = log_msg_break_ack(msg, path_options, &local_options);
-
-  g_mutex_lock(self->db_thread_mutex);
-  queue_was_empty = log_queue_get_length(self->queue) == 0;
-  if (queue_was_empty && !self->db_thread_suspended)
-    {
-      log_queue_set_parallel_push(self->queue, 1, afsql_dd_queue_notify, self, NULL);
-    }
-  g_mutex_unlock(self->db_thread_mutex);
-  log_msg_add_ack(msg, path_options);
-  log_queue_push_tail(self->queue, log_msg_ref(msg), path_options);
-  log_dest_driver_queue_method(s, msg, path_options, user_data);
+  return log_threaded_dest_driver_init_method(s);
 }
 
 static void
@@ -1239,8 +1123,6 @@ afsql_dd_free(LogPipe *s)
   gint i;
 
   log_template_options_destroy(&self->template_options);
-  if (self->queue)
-    log_queue_unref(self->queue);
   for (i = 0; i < self->fields_len; i++)
     {
       g_free(self->fields[i].name);
@@ -1262,12 +1144,11 @@ afsql_dd_free(LogPipe *s)
   string_list_free(self->indexes);
   string_list_free(self->values);
   log_template_unref(self->table);
-  g_hash_table_destroy(self->validated_tables);
   g_hash_table_destroy(self->dbd_options);
   g_hash_table_destroy(self->dbd_options_numeric);
   if(self->session_statements)
     string_list_free(self->session_statements);
-  log_dest_driver_free(s);
+  log_threaded_dest_driver_free(s);
 }
 
 LogDriver *
@@ -1275,11 +1156,19 @@ afsql_dd_new(void)
 {
   AFSqlDestDriver *self = g_new0(AFSqlDestDriver, 1);
 
-  log_dest_driver_init_instance(&self->super);
-  self->super.super.super.init = afsql_dd_init;
-  self->super.super.super.deinit = afsql_dd_deinit;
-  self->super.super.super.queue = afsql_dd_queue;
-  self->super.super.super.free_fn = afsql_dd_free;
+  log_threaded_dest_driver_init_instance(&self->super);
+  self->super.super.super.super.init = afsql_dd_init;
+  self->super.super.super.super.free_fn = afsql_dd_free;
+
+  self->super.stats_source = SCS_SQL;
+  self->super.worker_size = sizeof(AFSqlDestWorker);
+  self->super.worker.thread_init = afsql_worker_thread_init;
+  self->super.worker.thread_deinit = afsql_worker_thread_deinit;
+  self->super.worker.connect = afsql_worker_connect;
+  self->super.worker.disconnect = afsql_worker_disconnect;
+  self->super.worker.insert = afsql_worker_insert;
+  self->super.format_stats_instance = afsql_dd_format_stats_instance;
+  self->super.format_persist_name = afsql_dd_format_persist_name;
 
   self->type = g_strdup("mysql");
   self->host = g_strdup("");
@@ -1291,21 +1180,16 @@ afsql_dd_new(void)
 
   self->table = log_template_new(configuration, NULL);
   log_template_compile(self->table, "messages", NULL);
-  self->failed_message_counter = 0;
 
   self->flush_lines = -1;
   self->flush_timeout = -1;
-  self->flush_lines_queued = -1;
   self->session_statements = NULL;
-  self->num_retries = MAX_FAILED_ATTEMPTS;
 
-  self->validated_tables = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
   self->dbd_options = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
   self->dbd_options_numeric = g_hash_table_new_full(g_str_hash, g_int_equal, g_free, NULL);
 
   log_template_options_defaults(&self->template_options);
-  init_sequence_number(&self->seq_num);
-  return &self->super.super;
+  return &self->super.super.super;
 }
 
 gint
@@ -25,6 +25,7 @@
 #define AFSQL_H_INCLUDED
 
 #include "driver.h"
+#include "logthrdestdrv.h"
 
 enum
 {
@@ -45,7 +46,6 @@ void afsql_dd_set_columns(LogDriver *s, GList *columns);
 void afsql_dd_set_values(LogDriver *s, GList *values);
 void afsql_dd_set_null_value(LogDriver *s, const gchar *null);
 void afsql_dd_set_indexes(LogDriver *s, GList *indexes);
-void afsql_dd_set_retries(LogDriver *s, gint num_retries);
 void afsql_dd_set_frac_digits(LogDriver *s, gint frac_digits);
 void afsql_dd_set_local_time_zone(LogDriver *s, const gchar *local_time_zone);
 void afsql_dd_set_send_time_zone(LogDriver *s, const gchar *send_time_zone);
@@ -55,7 +55,6 @@ void afsql_dd_set_session_statements(LogDriver *s, GList *session_statements);
 void afsql_dd_set_flags(LogDriver *s, gint flags);
 LogDriver *afsql_dd_new();
 gint afsql_dd_lookup_flag(const gchar *flag);
-void afsql_dd_set_retries(LogDriver *s, gint num_retries);
 void afsql_dd_add_dbd_option(LogDriver *s, const gchar *name, const gchar *value);
 void afsql_dd_add_dbd_option_numeric(LogDriver *s, const gchar *name, gint value);
 
@@ -1,27 +1,76 @@
+typedef struct _TFNumState
+{
+  TFSimpleFuncState super;
+  /* handles of arguments that are single value references, these are
+   * looked up in their binary form first, see tf_num_get_arg() */
+  NVHandle handles[2];
+} TFNumState;
+
 static gboolean
-tf_num_parse(gint argc, GString *argv[],
-	     const gchar *func_name, glong *n, glong *m)
+tf_num_prepare(LogTemplateFunction *self, gpointer s, LogTemplate *parent, gint argc, gchar *argv[], GError **error)
 {
-  if (argc != 2)
+  TFNumState *state = (TFNumState *) s;
+  gint i;
+
+  g_return_val_if_fail(error == NULL || *error == NULL, FALSE);
+
+  if (!tf_simple_func_prepare(self, s, parent, argc, argv, error))
+    return FALSE;
+
+  for (i = 0; i < state->super.argc && i < G_N_ELEMENTS(state->handles); i++)
     {
-      msg_debug("Template function requires two arguments.",
-		evt_tag_str("function", func_name), NULL);
+      if (!log_template_is_trivial_value(state->super.argv[i], &state->handles[i]))
+        state->handles[i] = 0;
+    }
+  return TRUE;
+}
+
+static gboolean
+tf_num_get_arg(TFNumState *state, const LogTemplateInvokeArgs *args, gint ndx, glong *n)
+{
+  LogMessage *msg = args->messages[args->num_messages - 1];
+  gint64 value;
+  GString *arg;
+
+  if (state->handles[ndx] && log_msg_get_value_numeric(msg, state->handles[ndx], &value))
+    {
+      *n = value;
+      return TRUE;
+    }
+
+  while (args->bufs->len <= ndx)
+    g_ptr_array_add(args->bufs, g_string_sized_new(256));
+
+  arg = (GString *) g_ptr_array_index(args->bufs, ndx);
+  g_string_truncate(arg, 0);
+  log_template_append_format_recursive(state->super.argv[ndx], args, arg);
+
+  if (!tf_parse_int(arg->str, n))
+    {
+      msg_debug("Parsing failed, template function's argument is not a number",
+		evt_tag_int("argument", ndx + 1),
+		evt_tag_str("value", arg->str), NULL);
       return FALSE;
     }
+  return TRUE;
+}
 
-  if (!tf_parse_int(argv[0]->str, n))
+static gboolean
+tf_num_parse(TFNumState *state, const LogTemplateInvokeArgs *args,
+	     const gchar *func_name, glong *n, glong *m)
+{
+  if (state->super.argc != 2)
     {
-      msg_debug("Parsing failed, template function's first argument is not a number",
-		evt_tag_str("function", func_name),
-		evt_tag_str("arg1", argv[0]->str), NULL);
+      msg_debug("Template function requires two arguments.",
+		evt_tag_str("function", func_name), NULL);
       return FALSE;
     }
 
-  if (!tf_parse_int(argv[1]->str, m))
+  if (!tf_num_get_arg(state, args, 0, n) ||
+      !tf_num_get_arg(state, args, 1, m))
     {
-      msg_debug("Parsing failed, template function's first argument is not a number",
-		evt_tag_str("function", func_name),
-		evt_tag_str("arg1", argv[1]->str), NULL);
+      msg_debug("Template function failed to parse its arguments",
+		evt_tag_str("function", func_name), NULL);
       return FALSE;
     }
 
@@ -29,11 +78,11 @@ tf_num_parse(gint argc, GString *argv[],
 }
 
 static void
-tf_num_plus(LogMessage *msg, gint argc, GString *argv[], GString *result)
+tf_num_plus_call(LogTemplateFunction *self, gpointer s, const LogTemplateInvokeArgs *args, GString *result)
 {
   glong n, m;
 
-  if (!tf_num_parse(argc, argv, "+", &n, &m))
+  if (!tf_num_parse((TFNumState *) s, args, "+", &n, &m))
     {
       g_string_append_len(result, "NaN", 3);
       return;
@@ -42,14 +91,14 @@ tf_num_plus(LogMessage *msg, gint argc, GString *argv[], GString *result)
   format_int32_padded(result, 0, ' ', 10, n + m);
 }
 
-TEMPLATE_FUNCTION_SIMPLE(tf_num_plus);
+TEMPLATE_FUNCTION(TFNumState, tf_num_plus, tf_num_prepare, NULL, tf_num_plus_call, tf_simple_func_free_state, NULL);
 
 static void
-tf_num_minus(LogMessage *msg, gint argc, GString *argv[], GString *result)
+tf_num_minus_call(LogTemplateFunction *self, gpointer s, const LogTemplateInvokeArgs *args, GString *result)
 {
   glong n, m;
 
-  if (!tf_num_parse(argc, argv, "-", &n, &m))
+  if (!tf_num_parse((TFNumState *) s, args, "-", &n, &m))
     {
       g_string_append_len(result, "NaN", 3);
       return;
@@ -58,14 +107,14 @@ tf_num_minus(LogMessage *msg, gint argc, GString *argv[], GString *result)
   format_int32_padded(result, 0, ' ', 10, n - m);
 }
 
-TEMPLATE_FUNCTION_SIMPLE(tf_num_minus);
+TEMPLATE_FUNCTION(TFNumState, tf_num_minus, tf_num_prepare, NULL, tf_num_minus_call, tf_simple_func_free_state, NULL);
 
 static void
-tf_num_multi(LogMessage *msg, gint argc, GString *argv[], GString *result)
+tf_num_multi_call(LogTemplateFunction *self, gpointer s, const LogTemplateInvokeArgs *args, GString *result)
 {
   glong n, m;
 
-  if (!tf_num_parse(argc, argv, "*", &n, &m))
+  if (!tf_num_parse((TFNumState *) s, args, "*", &n, &m))
     {
       g_string_append_len(result, "NaN", 3);
       return;
@@ -74,14 +123,14 @@ tf_num_multi(LogMessage *msg, gint argc, GString *argv[], GString *result)
   format_int32_padded(result, 0, ' ', 10, n * m);
 }
 
-TEMPLATE_FUNCTION_SIMPLE(tf_num_multi);
+TEMPLATE_FUNCTION(TFNumState, tf_num_multi, tf_num_prepare, NULL, tf_num_multi_call, tf_simple_func_free_state, NULL);
 
 static void
-tf_num_div(LogMessage *msg, gint argc, GString *argv[], GString *result)
+tf_num_div_call(LogTemplateFunction *self, gpointer s, const LogTemplateInvokeArgs *args, GString *result)
 {
   glong n, m;
 
-  if (!tf_num_parse(argc, argv, "/", &n, &m) || !m)
+  if (!tf_num_parse((TFNumState *) s, args, "/", &n, &m) || !m)
     {
       g_string_append_len(result, "NaN", 3);
       return;
@@ -90,14 +139,14 @@ tf_num_div(LogMessage *msg, gint argc, GString *argv[], GString *result)
   format_int32_padded(result, 0, ' ', 10, n / m);
 }
 
-TEMPLATE_FUNCTION_SIMPLE(tf_num_div);
+TEMPLATE_FUNCTION(TFNumState, tf_num_div, tf_num_prepare, NULL, tf_num_div_call, tf_simple_func_free_state, NULL);
 
 static void
-tf_num_mod(LogMessage *msg, gint argc, GString *argv[], GString *result)
+tf_num_mod_call(LogTemplateFunction *self, gpointer s, const LogTemplateInvokeArgs *args, GString *result)
 {
   glong n, m;
 
-  if (!tf_num_parse(argc, argv, "%", &n, &m) || !m)
+  if (!tf_num_parse((TFNumState *) s, args, "%", &n, &m) || !m)
     {
       g_string_append_len(result, "NaN", 3);
       return;
@@ -106,4 +155,4 @@ tf_num_mod(LogMessage *msg, gint argc, GString *argv[], GString *result)
   format_uint32_padded(result, 0, ' ', 10, n % m);
 }
 
-TEMPLATE_FUNCTION_SIMPLE(tf_num_mod);
+TEMPLATE_FUNCTION(TFNumState, tf_num_mod, tf_num_prepare, NULL, tf_num_mod_call, tf_simple_func_free_state, NULL);
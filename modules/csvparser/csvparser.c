@@ -34,10 +34,34 @@ typedef struct _LogCSVParser
   gchar *quotes_end;
   gchar *null_value;
   guint32 flags;
+  /* non-zero for delimiter characters, the terminating NUL included */
+  guint8 delimiter_map[256];
+  /* the closing quote for opening quote characters, zero otherwise */
+  gchar quote_map[256];
 } LogCSVParser;
 
 #define LOG_CSV_PARSER_SINGLE_CHAR_DELIM 0x0100
 
+static void
+log_csv_parser_update_maps(LogCSVParser *self)
+{
+  gint i;
+
+  memset(self->delimiter_map, 0, sizeof(self->delimiter_map));
+  memset(self->quote_map, 0, sizeof(self->quote_map));
+
+  self->delimiter_map[0] = 1;
+  for (i = 0; self->delimiters && self->delimiters[i]; i++)
+    self->delimiter_map[(guchar) self->delimiters[i]] = 1;
+
+  /* walk backwards, so that the first occurrence of an opening quote wins */
+  if (self->quotes_start && self->quotes_end)
+    {
+      for (i = strlen(self->quotes_start) - 1; i >= 0; i--)
+        self->quote_map[(guchar) self->quotes_start[i]] = self->quotes_end[i];
+    }
+}
+
 void
 log_csv_parser_set_flags(LogColumnParser *s, guint32 flags)
 {
@@ -58,6 +82,7 @@ log_csv_parser_set_delimiters(LogColumnParser *s, const gchar *delimiters)
     self->flags |= LOG_CSV_PARSER_SINGLE_CHAR_DELIM;
   else
     self->flags &= ~LOG_CSV_PARSER_SINGLE_CHAR_DELIM;
+  log_csv_parser_update_maps(self);
 }
 
 void
@@ -71,6 +96,7 @@ log_csv_parser_set_quotes(LogColumnParser *s, const gchar *quotes)
     g_free(self->quotes_end);
   self->quotes_start = g_strdup(quotes);
   self->quotes_end = g_strdup(quotes);
+  log_csv_parser_update_maps(self);
 }
 
 void
@@ -94,6 +120,7 @@ log_csv_parser_set_quote_pairs(LogColumnParser *s, const gchar *quote_pairs)
     }
   self->quotes_start[i / 2] = 0;
   self->quotes_end[i / 2] = 0;
+  log_csv_parser_update_maps(self);
 }
 
 void
@@ -106,17 +133,55 @@ log_csv_parser_set_null_value(LogColumnParser *s, const gchar *null_value)
   self->null_value = g_strdup(null_value);
 }
 
+/*
+ * Store a column by copying @value. Every column that changes MESSAGE
+ * has to be stored this way: once MESSAGE itself is overwritten, offsets
+ * into the original input are no longer valid references, so the rest
+ * of the columns are copied too.
+ */
+static inline void
+log_csv_parser_set_value(LogMessage *msg, NVHandle handle, const gchar *value, gssize len, gboolean *indirect)
+{
+  log_msg_set_value(msg, handle, value, len);
+  if (handle == LM_V_MESSAGE)
+    *indirect = FALSE;
+}
+
+/*
+ * Store a column that is a substring of @input. If @input is the MESSAGE
+ * value of @msg (*indirect is TRUE), the column is stored as a reference
+ * into MESSAGE instead of copying it. Builtin values cannot be
+ * references.
+ */
+static inline void
+log_csv_parser_set_column(LogMessage *msg, NVHandle handle, const gchar *input, const gchar *value, gssize len, gboolean *indirect)
+{
+  if (*indirect && handle >= LM_V_MAX && len > 0)
+    log_msg_set_value_indirect(msg, handle, LM_V_MESSAGE, 0, value - input, len);
+  else
+    log_csv_parser_set_value(msg, handle, value, len, indirect);
+}
+
 static gboolean
 log_csv_parser_process(LogParser *s, LogMessage **pmsg, const LogPathOptions *path_options, const gchar *input)
 {
   LogCSVParser *self = (LogCSVParser *) s;
   const gchar *src;
   GList *cur_column = self->super.columns;
+  NVHandle *cur_handle = self->super.column_handles;
   gint len;
   LogMessage *msg;
+  const gchar *msg_value;
+  gssize msg_len;
+  gboolean indirect;
 
   src = input;
   msg = log_msg_make_writable(pmsg, path_options);
+
+  /* the columns can reference the input if we are parsing MESSAGE */
+  msg_value = log_msg_get_value(msg, LM_V_MESSAGE, &msg_len);
+  indirect = (input == msg_value && msg_len <= G_MAXUINT16);
+
   if ((self->flags & LOG_CSV_PARSER_ESCAPE_NONE) || ((self->flags & LOG_CSV_PARSER_ESCAPE_MASK) == 0))
     {
       /* no escaping, no need to keep state, we split input and trim if necessary */
@@ -124,21 +189,14 @@ log_csv_parser_process(LogParser *s, LogMessage **pmsg, const LogPathOptions *pa
       while (cur_column && *src)
         {
           const guchar *delim;
-          guchar *quote;
           guchar current_quote;
 
-          quote = (guchar *) strchr(self->quotes_start, *src);
-          if (quote != NULL)
+          current_quote = self->quote_map[(guchar) *src];
+          if (current_quote)
             {
               /* ok, quote character found */
-              current_quote = self->quotes_end[quote - (guchar *) self->quotes_start];
               src++;
             }
-          else
-            {
-              /* we didn't start with a quote character, no need for escaping, delimiter terminates */
-              current_quote = 0;
-            }
 
           if (self->flags & LOG_CSV_PARSER_STRIP_WHITESPACE)
             {
@@ -151,11 +209,10 @@ log_csv_parser_process(LogParser *s, LogMessage **pmsg, const LogPathOptions *pa
               /* search for end of quote */
               delim = (guchar *) strchr(src, current_quote);
 
-              if (delim &&
-                  (((self->flags & LOG_CSV_PARSER_SINGLE_CHAR_DELIM) && *(delim + 1) == self->delimiters[0]) ||
-                     strchr(self->delimiters, *(delim + 1)) != NULL))
+              if (delim && self->delimiter_map[*(delim + 1)])
                 {
-                  /* closing quote, and then a delimiter, everything is nice */
+                  /* closing quote, and then a delimiter (or the end of
+                   * the string), everything is nice */
                   delim++;
                 }
               else if (!delim)
@@ -174,7 +231,9 @@ log_csv_parser_process(LogParser *s, LogMessage **pmsg, const LogPathOptions *pa
                 }
               else
                 {
-                  delim = (guchar *) src + strcspn(src, self->delimiters);
+                  delim = (guchar *) src;
+                  while (!self->delimiter_map[*delim])
+                    delim++;
                 }
             }
 
@@ -189,19 +248,20 @@ log_csv_parser_process(LogParser *s, LogMessage **pmsg, const LogPathOptions *pa
                 len--;
             }
           if (self->null_value && strncmp(src, self->null_value, len) == 0)
-            log_msg_set_value(msg, log_msg_get_value_handle((gchar *) cur_column->data), "", 0);
+            log_csv_parser_set_value(msg, *cur_handle, "", 0, &indirect);
           else
-            log_msg_set_value(msg, log_msg_get_value_handle((gchar *) cur_column->data), src, len);
+            log_csv_parser_set_column(msg, *cur_handle, input, src, len, &indirect);
 
           src = (gchar *) delim;
           if (*src)
             src++;
           cur_column = cur_column->next;
+          cur_handle++;
 
           if (cur_column && cur_column->next == NULL && self->flags & LOG_CSV_PARSER_GREEDY)
             {
               /* greedy mode, the last column gets it all, without taking escaping, quotes or anything into account */
-              log_msg_set_value(msg, log_msg_get_value_handle((gchar *) cur_column->data), src, -1);
+              log_csv_parser_set_column(msg, *cur_handle, input, src, strlen(src), &indirect);
               cur_column = NULL;
               src = NULL;
               break;
@@ -223,7 +283,6 @@ log_csv_parser_process(LogParser *s, LogMessage **pmsg, const LogPathOptions *pa
       gchar current_quote = 0;
       GString *current_value;
       gboolean store_value = FALSE;
-      gchar *quote;
 
       current_value = g_string_sized_new(128);
 
@@ -235,16 +294,10 @@ log_csv_parser_process(LogParser *s, LogMessage **pmsg, const LogPathOptions *pa
             case PS_COLUMN_START:
               /* check for quote character */
               state = PS_WHITESPACE;
-              quote = strchr(self->quotes_start, *src);
-              if (quote != NULL)
-                {
-                  /* ok, quote character found */
-                  current_quote = self->quotes_end[quote - self->quotes_start];
-                }
-              else
+              current_quote = self->quote_map[(guchar) *src];
+              if (!current_quote)
                 {
                   /* we didn't start with a quote character, no need for escaping, delimiter terminates */
-                  current_quote = 0;
                   /* don't skip to the next character */
                   continue;
                 }
@@ -284,7 +337,7 @@ log_csv_parser_process(LogParser *s, LogMessage **pmsg, const LogPathOptions *pa
               else
                 {
                   /* unquoted value */
-                  if (strchr(self->delimiters, *src))
+                  if (self->delimiter_map[(guchar) *src])
                     {
                       state = PS_DELIMITER;
                       continue;
@@ -306,18 +359,19 @@ log_csv_parser_process(LogParser *s, LogMessage **pmsg, const LogPathOptions *pa
                     len--;
                 }
               if (self->null_value && strcmp(current_value->str, self->null_value) == 0)
-                log_msg_set_value(msg, log_msg_get_value_handle((gchar *) cur_column->data), "", 0);
+                log_csv_parser_set_value(msg, *cur_handle, "", 0, &indirect);
               else
-                log_msg_set_value(msg, log_msg_get_value_handle((gchar *) cur_column->data), current_value->str, len);
+                log_csv_parser_set_value(msg, *cur_handle, current_value->str, len, &indirect);
               g_string_truncate(current_value, 0);
               cur_column = cur_column->next;
+              cur_handle++;
               state = PS_COLUMN_START;
               store_value = FALSE;
 
               if (cur_column && cur_column->next == NULL && self->flags & LOG_CSV_PARSER_GREEDY)
                 {
                   /* greedy mode, the last column gets it all, without taking escaping, quotes or anything into account */
-                  log_msg_set_value(msg, log_msg_get_value_handle((gchar *) cur_column->data), src, -1);
+                  log_csv_parser_set_column(msg, *cur_handle, input, src, strlen(src), &indirect);
                   cur_column = NULL;
                   src = NULL;
                   break;
@@ -340,7 +394,7 @@ log_csv_parser_clone(LogPipe *s)
 {
   LogCSVParser *self = (LogCSVParser *) s;
   LogCSVParser *cloned;
-  GList *l;
+  GList *l, *columns = NULL;
 
   cloned = (LogCSVParser *) log_csv_parser_new();
   g_free(cloned->delimiters);
@@ -352,12 +406,15 @@ log_csv_parser_clone(LogPipe *s)
   cloned->quotes_end = g_strdup(self->quotes_end);
   cloned->null_value = self->null_value ? g_strdup(self->null_value) : NULL;
   cloned->flags = self->flags;
+  memcpy(cloned->delimiter_map, self->delimiter_map, sizeof(self->delimiter_map));
+  memcpy(cloned->quote_map, self->quote_map, sizeof(self->quote_map));
 
   cloned->super.super.template = log_template_ref(self->super.super.template);
   for (l = self->super.columns; l; l = l->next)
     {
-      cloned->super.columns = g_list_append(cloned->super.columns, g_strdup(l->data));
+      columns = g_list_append(columns, g_strdup(l->data));
     }
+  log_column_parser_set_columns(&cloned->super, columns);
   return &cloned->super.super.super;
 }
 
@@ -137,6 +137,77 @@ testcase(gchar *msg, guint parse_flags, gint max_columns, guint32 flags, gchar *
   return 1;
 }
 
+/* columns parsed from MESSAGE reference it, they must remain intact when MESSAGE changes */
+void
+testcase_message_changed(void)
+{
+  gchar *msg = "PTHREAD support initialized";
+  const gchar *column_array[] = { "C1", "C2", "C3", NULL };
+  LogMessage *logmsg;
+  LogColumnParser *p;
+  NVTable *nvtable;
+  const gchar *value;
+  const gchar *expected_value;
+
+  parse_options.flags = LP_NOPARSE;
+  logmsg = log_msg_new(msg, strlen(msg), NULL, &parse_options);
+
+  p = log_csv_parser_new();
+  log_csv_parser_set_flags(p, LOG_CSV_PARSER_ESCAPE_NONE);
+  log_column_parser_set_columns(p, string_array_to_list(column_array));
+
+  nvtable = nv_table_ref(logmsg->payload);
+  log_parser_process(&p->super, &logmsg, NULL, log_msg_get_value(logmsg, LM_V_MESSAGE, NULL));
+  nv_table_unref(nvtable);
+  log_pipe_unref(&p->super.super);
+
+  log_msg_set_value(logmsg, LM_V_MESSAGE, "something else entirely", -1);
+  value = log_msg_get_value(logmsg, log_msg_get_value_handle("C1"), NULL);
+  expected_value = "PTHREAD";
+  TEST_ASSERT(strcmp(value, expected_value) == 0, "column changed together with MESSAGE");
+  value = log_msg_get_value(logmsg, log_msg_get_value_handle("C3"), NULL);
+  expected_value = "initialized";
+  TEST_ASSERT(strcmp(value, expected_value) == 0, "column changed together with MESSAGE");
+
+  log_msg_unref(logmsg);
+}
+
+/* the columns following a MESSAGE column can't reference the original MESSAGE */
+void
+testcase_message_column(guint32 flags)
+{
+  gchar *msg = "first \"quoted value\" rest of the line";
+  const gchar *column_array[] = { "C1", "MESSAGE", "C3", NULL };
+  const gchar *expected_array[] = { "first", "quoted value", "rest of the line", NULL };
+  LogMessage *logmsg;
+  LogColumnParser *p;
+  NVTable *nvtable;
+  const gchar *value;
+  const gchar *expected_value;
+  gint i;
+
+  parse_options.flags = LP_NOPARSE;
+  logmsg = log_msg_new(msg, strlen(msg), NULL, &parse_options);
+
+  p = log_csv_parser_new();
+  log_csv_parser_set_flags(p, flags | LOG_CSV_PARSER_GREEDY);
+  log_column_parser_set_columns(p, string_array_to_list(column_array));
+
+  nvtable = nv_table_ref(logmsg->payload);
+  log_parser_process(&p->super, &logmsg, NULL, log_msg_get_value(logmsg, LM_V_MESSAGE, NULL));
+  nv_table_unref(nvtable);
+  log_pipe_unref(&p->super.super);
+
+  for (i = 0; column_array[i]; i++)
+    {
+      value = log_msg_get_value(logmsg, log_msg_get_value_handle(column_array[i]), NULL);
+      expected_value = expected_array[i];
+      TEST_ASSERT(strcmp(value, expected_value) == 0, "column mismatch after overwriting MESSAGE");
+    }
+
+  log_msg_unref(logmsg);
+}
+
 int
 main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
 {
@@ -282,6 +353,9 @@ main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
   testcase("random.vhost\t10.0.0.1\t-\t\"GET /index.html HTTP/1.1\"\t\t200", LP_NOPARSE, 7, LOG_CSV_PARSER_ESCAPE_BACKSLASH, "\t", "\"\"", "-",
            "random.vhost", "10.0.0.1", "", "GET /index.html HTTP/1.1", "", "200", "", NULL);
 
+  testcase_message_changed();
+  testcase_message_column(LOG_CSV_PARSER_ESCAPE_NONE);
+  testcase_message_column(LOG_CSV_PARSER_ESCAPE_BACKSLASH);
 
   app_shutdown();
   return 0;
@@ -0,0 +1,90 @@
+#include "csvparser.h"
+
+#include "syslog-ng.h"
+#include "logmsg.h"
+#include "apphook.h"
+#include "misc.h"
+#include "cfg.h"
+#include "plugin.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+MsgFormatOptions parse_options;
+
+#define BENCHMARK_COUNT 100000
+#define NUM_COLUMNS 56
+
+/* a firewall traffic log in the usual wide CSV layout */
+#define FIREWALL_LOG \
+  "1,2013/01/15 10:00:00,001801000123,TRAFFIC,end,1,2013/01/15 10:00:00,10.0.0.10,192.168.1.20,0.0.0.0,0.0.0.0," \
+  "allow-web,,,web-browsing,vsys1,trust,untrust,ethernet1/2,ethernet1/1,forward-all,2013/01/15 10:00:00,123456,1," \
+  "51234,80,0,0,0x19,tcp,allow,1543,632,911,12,2013/01/15 09:59:58,2,computer-and-internet-info,0,98765432,0x0," \
+  "10.0.0.0-10.255.255.255,United States,0,7,5,tcp-fin,0,0,0,0,,fw-01,from-policy,,,0,,0,,N/A,0"
+
+static void
+testcase(const gchar *title, const gchar *msg_str, guint32 flags, const gchar *delimiters, gboolean parse_message)
+{
+  LogColumnParser *p;
+  const gchar *columns[NUM_COLUMNS + 1];
+  gchar *names[NUM_COLUMNS];
+  GTimeVal start, end;
+  gint i;
+
+  for (i = 0; i < NUM_COLUMNS; i++)
+    {
+      names[i] = g_strdup_printf("FW.C%d", i);
+      columns[i] = names[i];
+    }
+  columns[NUM_COLUMNS] = NULL;
+
+  p = log_csv_parser_new();
+  log_csv_parser_set_flags(p, flags);
+  log_csv_parser_set_delimiters(p, delimiters);
+  log_column_parser_set_columns(p, string_array_to_list(columns));
+
+  parse_options.flags = LP_NOPARSE;
+  g_get_current_time(&start);
+  for (i = 0; i < BENCHMARK_COUNT; i++)
+    {
+      LogMessage *msg;
+      NVTable *payload;
+      gchar *input;
+
+      msg = log_msg_new(msg_str, strlen(msg_str), NULL, &parse_options);
+      payload = nv_table_ref(msg->payload);
+      /* a copy of the message behaves as the output of a template(), whose columns are copied */
+      input = parse_message ? (gchar *) log_msg_get_value(msg, LM_V_MESSAGE, NULL) : g_strdup(msg_str);
+      log_parser_process(&p->super, &msg, NULL, input);
+      if (!parse_message)
+        g_free(input);
+      nv_table_unref(payload);
+      log_msg_unref(msg);
+    }
+  g_get_current_time(&end);
+  printf("%-50s speed: %12.3f msg/sec\n", title, i * 1e6 / g_time_val_diff(&end, &start));
+
+  log_pipe_unref(&p->super.super);
+  for (i = 0; i < NUM_COLUMNS; i++)
+    g_free(names[i]);
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+
+  configuration = cfg_new(0x0302);
+  plugin_load_module("syslogformat", configuration, NULL);
+  msg_format_options_defaults(&parse_options);
+  msg_format_options_init(&parse_options, configuration);
+
+  testcase("escape-none, MESSAGE", FIREWALL_LOG, LOG_CSV_PARSER_ESCAPE_NONE, ",", TRUE);
+  testcase("escape-none, copied input", FIREWALL_LOG, LOG_CSV_PARSER_ESCAPE_NONE, ",", FALSE);
+  testcase("escape-none, multiple delimiters, MESSAGE", FIREWALL_LOG, LOG_CSV_PARSER_ESCAPE_NONE, ",;", TRUE);
+  testcase("escape-backslash, MESSAGE", FIREWALL_LOG, LOG_CSV_PARSER_ESCAPE_BACKSLASH, ",", TRUE);
+
+  app_shutdown();
+  return 0;
+}
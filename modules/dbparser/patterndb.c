@@ -1242,6 +1242,28 @@ pdb_rule_set_load(PDBRuleSet *self, GlobalConfig *cfg, const gchar *config, GLis
   return success;
 }
 
+/* @NUMBER@ matches are stored along with their binary value, so that
+ * numeric comparisons and template functions don't have to reparse them */
+static gboolean
+log_db_parse_number_match(LogMessage *msg, NVHandle ref_handle, RParserMatch *match, gint64 *number)
+{
+  const gchar *value;
+  gssize value_len;
+  gchar buf[32];
+  gchar *end;
+
+  value = log_msg_get_value(msg, ref_handle, &value_len);
+  if (match->len >= sizeof(buf) || match->ofs + match->len > value_len)
+    return FALSE;
+
+  memcpy(buf, value + match->ofs, match->len);
+  buf[match->len] = 0;
+  /* base 10, the same way the string form is parsed by the consumers,
+   * other values (e.g. hexadecimal ones) are stored as strings only */
+  *number = g_ascii_strtoll(buf, &end, 10);
+  return *end == 0;
+}
+
 /**
  * log_db_add_matches:
  *
@@ -1267,7 +1289,12 @@ log_db_add_matches(LogMessage *msg, GArray *matches, NVHandle ref_handle)
         }
       else
         {
-          log_msg_set_value_indirect(msg, match->handle, ref_handle, match->type, match->ofs, match->len);
+          gint64 number;
+
+          if (match->type == RPT_NUMBER && log_db_parse_number_match(msg, ref_handle, match, &number))
+            log_msg_set_value_indirect_with_numeric(msg, match->handle, ref_handle, match->type, match->ofs, match->len, number);
+          else
+            log_msg_set_value_indirect(msg, match->handle, ref_handle, match->type, match->ofs, match->len);
         }
     }
 }
@@ -23,12 +23,12 @@
 #include "jsonparser.h"
 #include "logparser.h"
 #include "scratch-buffers.h"
+#include "nvhandle-cache.h"
 
 #include <string.h>
 #include <ctype.h>
 
-#include <json.h>
-#include <json_object_private.h>
+#define LOG_JSON_PARSER_MAX_DEPTH 32
 
 struct _LogJSONParser
 {
@@ -36,8 +36,27 @@ struct _LogJSONParser
   gchar *prefix;
   gchar *marker;
   gint marker_len;
+  /* key path -> NVHandle */
+  NVHandleCache *handles;
 };
 
+typedef struct
+{
+  LogJSONParser *self;
+  LogMessage *msg;
+  /* the start of the MESSAGE value if we are parsing that, NULL otherwise */
+  const gchar *ref_base;
+  const gchar *pos;
+  /* the key path of the current value, including the prefix */
+  GString *key;
+  /* string values that had to be unescaped */
+  GString *value;
+  /* the value of MESSAGE, if the input sets it, stored once the input is no longer needed */
+  GString *message;
+  gboolean message_set;
+  gint depth;
+} LogJSONParserState;
+
 void
 log_json_parser_set_prefix (LogParser *p, const gchar *prefix)
 {
@@ -57,107 +76,351 @@ log_json_parser_set_marker (LogParser *p, const gchar *marker)
   self->marker_len = strlen(marker);
 }
 
+/*
+ * Stores the value at the current key path. Values that are a verbatim
+ * substring of the MESSAGE value being parsed (@from_input) are stored
+ * as references to MESSAGE.
+ */
 static void
-log_json_parser_process_object (struct json_object *jso,
-                                const gchar *prefix,
-                                LogMessage *msg);
+log_json_parser_store_value (LogJSONParserState *state, const gchar *value, gsize value_len, gboolean from_input)
+{
+  NVHandle handle;
 
-static void
-log_json_parser_process_single (struct json_object *jso,
-                                const gchar *prefix,
-                                const gchar *obj_key,
-                                LogMessage *msg)
+  handle = nv_handle_cache_lookup (state->self->handles, state->key->str, state->key->len);
+  if (handle == LM_V_MESSAGE && state->ref_base)
+    {
+      /* we are still reading MESSAGE, postpone overwriting it */
+      g_string_assign_len (state->message, value, value_len);
+      state->message_set = TRUE;
+    }
+  else if (from_input && state->ref_base && handle >= LM_V_MAX && value_len > 0)
+    {
+      log_msg_set_value_indirect (state->msg, handle, LM_V_MESSAGE, 0, value - state->ref_base, value_len);
+    }
+  else
+    {
+      log_msg_set_value (state->msg, handle, value, value_len);
+    }
+}
+
+static inline void
+log_json_parser_skip_whitespace (LogJSONParserState *state)
 {
-  ScratchBuffer *key, *value;
-  gboolean parsed = FALSE;
+  while (*state->pos == ' ' || *state->pos == '\t' || *state->pos == '\n' || *state->pos == '\r')
+    state->pos++;
+}
 
-  key = scratch_buffer_acquire ();
-  value = scratch_buffer_acquire ();
+static gint
+log_json_parser_hex_digit (gchar c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  else if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  else if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+static gboolean
+log_json_parser_parse_unicode_escape (LogJSONParserState *state, gunichar *ch)
+{
+  gint i, digit;
 
-  switch (json_object_get_type (jso))
+  *ch = 0;
+  for (i = 0; i < 4; i++)
     {
-    case json_type_boolean:
-      parsed = TRUE;
-      if (json_object_get_boolean (jso))
-        g_string_assign (sb_string (value), "true");
-      else
-        g_string_assign (sb_string (value), "false");
-      break;
-    case json_type_double:
-      parsed = TRUE;
-      g_string_printf (sb_string (value), "%f",
-                       json_object_get_double (jso));
-      break;
-    case json_type_int:
-      parsed = TRUE;
-      g_string_printf (sb_string (value), "%i",
-                       json_object_get_int (jso));
-      break;
-    case json_type_string:
-      parsed = TRUE;
-      g_string_assign (sb_string (value),
-                       json_object_get_string (jso));
-      break;
-    case json_type_object:
-      g_string_assign (sb_string (key), prefix);
-      g_string_append (sb_string (key), obj_key);
-      g_string_append_c (sb_string (key), '.');
-      log_json_parser_process_object (jso, sb_string (key)->str, msg);
-      break;
-    case json_type_array:
-      {
-        gint i, plen;
+      digit = log_json_parser_hex_digit (state->pos[i]);
+      if (digit < 0)
+        return FALSE;
+      *ch = (*ch << 4) + digit;
+    }
+  state->pos += 4;
+  return TRUE;
+}
+
+/*
+ * Parses a string literal, state->pos points right after the opening
+ * quote. If the string contains no escapes, *value points into the
+ * input, otherwise the unescaped string is stored in @buf and *value
+ * points there.
+ */
+static gboolean
+log_json_parser_parse_string (LogJSONParserState *state, GString *buf, const gchar **value, gsize *value_len)
+{
+  const gchar *start = state->pos;
+  gboolean escaped = FALSE;
+
+  while (*state->pos != '"')
+    {
+      const gchar *run = state->pos;
+
+      while (*state->pos && *state->pos != '"' && *state->pos != '\\')
+        state->pos++;
 
-        g_string_assign (sb_string (key), obj_key);
+      if (escaped)
+        g_string_append_len (buf, run, state->pos - run);
 
-        plen = sb_string (key)->len;
+      if (*state->pos == 0)
+        return FALSE;
+      if (*state->pos != '\\')
+        continue;
+
+      if (!escaped)
+        {
+          g_string_truncate (buf, 0);
+          g_string_append_len (buf, start, state->pos - start);
+          escaped = TRUE;
+        }
 
-        for (i = 0; i < json_object_array_length (jso); i++)
+      state->pos++;
+      switch (*state->pos)
+        {
+        case '"':
+        case '\\':
+        case '/':
+          g_string_append_c (buf, *state->pos);
+          break;
+        case 'b':
+          g_string_append_c (buf, '\b');
+          break;
+        case 'f':
+          g_string_append_c (buf, '\f');
+          break;
+        case 'n':
+          g_string_append_c (buf, '\n');
+          break;
+        case 'r':
+          g_string_append_c (buf, '\r');
+          break;
+        case 't':
+          g_string_append_c (buf, '\t');
+          break;
+        case 'u':
           {
-            g_string_truncate (sb_string (key), plen);
-            g_string_append_printf (sb_string (key), "[%d]", i);
-            log_json_parser_process_single (json_object_array_get_idx (jso, i),
-                                            prefix,
-                                            sb_string (key)->str, msg);
+            gunichar ch, low;
+            gchar utf8[6];
+
+            state->pos++;
+            if (!log_json_parser_parse_unicode_escape (state, &ch))
+              return FALSE;
+
+            /* combine surrogate pairs */
+            if (ch >= 0xd800 && ch < 0xdc00 && state->pos[0] == '\\' && state->pos[1] == 'u')
+              {
+                const gchar *save = state->pos;
+
+                state->pos += 2;
+                if (log_json_parser_parse_unicode_escape (state, &low) && low >= 0xdc00 && low < 0xe000)
+                  ch = 0x10000 + ((ch - 0xd800) << 10) + (low - 0xdc00);
+                else
+                  state->pos = save;
+              }
+            g_string_append_len (buf, utf8, g_unichar_to_utf8 (ch, utf8));
+            /* pos already points after the escape */
+            continue;
           }
+        default:
+          return FALSE;
+        }
+      state->pos++;
+    }
+
+  if (escaped)
+    {
+      *value = buf->str;
+      *value_len = buf->len;
+    }
+  else
+    {
+      *value = start;
+      *value_len = state->pos - start;
+    }
+  /* skip closing quote */
+  state->pos++;
+  return TRUE;
+}
+
+static gboolean
+log_json_parser_parse_number (LogJSONParserState *state)
+{
+  const gchar *start = state->pos;
+
+  if (*state->pos == '-')
+    state->pos++;
+  if (!g_ascii_isdigit (*state->pos))
+    return FALSE;
+  while (g_ascii_isdigit (*state->pos))
+    state->pos++;
+  if (*state->pos == '.')
+    {
+      state->pos++;
+      if (!g_ascii_isdigit (*state->pos))
+        return FALSE;
+      while (g_ascii_isdigit (*state->pos))
+        state->pos++;
+    }
+  if (*state->pos == 'e' || *state->pos == 'E')
+    {
+      state->pos++;
+      if (*state->pos == '+' || *state->pos == '-')
+        state->pos++;
+      if (!g_ascii_isdigit (*state->pos))
+        return FALSE;
+      while (g_ascii_isdigit (*state->pos))
+        state->pos++;
+    }
+  log_json_parser_store_value (state, start, state->pos - start, TRUE);
+  return TRUE;
+}
+
+static gboolean
+log_json_parser_parse_literal (LogJSONParserState *state, const gchar *literal, gboolean store)
+{
+  gsize len = strlen (literal);
+
+  if (strncmp (state->pos, literal, len) != 0)
+    return FALSE;
+  if (store)
+    log_json_parser_store_value (state, state->pos, len, TRUE);
+  state->pos += len;
+  return TRUE;
+}
+
+static gboolean log_json_parser_parse_value (LogJSONParserState *state);
+
+/* parses the members of an object, their names are appended to the current key path */
+static gboolean
+log_json_parser_parse_object (LogJSONParserState *state)
+{
+  gsize base_len = state->key->len;
+
+  /* skip the opening brace */
+  state->pos++;
+  log_json_parser_skip_whitespace (state);
+  if (*state->pos == '}')
+    {
+      state->pos++;
+      return TRUE;
+    }
+
+  while (1)
+    {
+      const gchar *name;
+      gsize name_len;
+
+      if (*state->pos != '"')
+        return FALSE;
+      state->pos++;
+      if (!log_json_parser_parse_string (state, state->value, &name, &name_len))
+        return FALSE;
+      g_string_truncate (state->key, base_len);
+      g_string_append_len (state->key, name, name_len);
+
+      log_json_parser_skip_whitespace (state);
+      if (*state->pos != ':')
+        return FALSE;
+      state->pos++;
+      log_json_parser_skip_whitespace (state);
+
+      if (!log_json_parser_parse_value (state))
+        return FALSE;
+
+      log_json_parser_skip_whitespace (state);
+      if (*state->pos == '}')
         break;
-      }
-    default:
-      msg_error ("JSON parser encountered an unknown type, skipping",
-                 evt_tag_str ("key", obj_key), NULL);
-      break;
+      if (*state->pos != ',')
+        return FALSE;
+      state->pos++;
+      log_json_parser_skip_whitespace (state);
     }
+  g_string_truncate (state->key, base_len);
+  state->pos++;
+  return TRUE;
+}
+
+/* array elements are stored as key[0], key[1] and so on */
+static gboolean
+log_json_parser_parse_array (LogJSONParserState *state)
+{
+  gsize base_len = state->key->len;
+  gint i;
 
-  if (parsed)
+  /* skip the opening bracket */
+  state->pos++;
+  log_json_parser_skip_whitespace (state);
+  if (*state->pos == ']')
     {
-      if (prefix)
-        {
-          g_string_assign (sb_string (key), prefix);
-          g_string_append (sb_string (key), obj_key);
-          log_msg_set_value (msg,
-                             log_msg_get_value_handle (sb_string (key)->str),
-                             sb_string (value)->str, sb_string (value)->len);
-        }
-      else
-        log_msg_set_value (msg,
-                           log_msg_get_value_handle (obj_key),
-                           sb_string (value)->str, sb_string (value)->len);
+      state->pos++;
+      return TRUE;
     }
 
-  scratch_buffer_release (key);
-  scratch_buffer_release (value);
+  for (i = 0; ; i++)
+    {
+      g_string_truncate (state->key, base_len);
+      g_string_append_printf (state->key, "[%d]", i);
+
+      if (!log_json_parser_parse_value (state))
+        return FALSE;
+
+      log_json_parser_skip_whitespace (state);
+      if (*state->pos == ']')
+        break;
+      if (*state->pos != ',')
+        return FALSE;
+      state->pos++;
+      log_json_parser_skip_whitespace (state);
+    }
+  g_string_truncate (state->key, base_len);
+  state->pos++;
+  return TRUE;
 }
 
-static void
-log_json_parser_process_object (struct json_object *jso,
-                                const gchar *prefix,
-                                LogMessage *msg)
+/* parses a value and stores it (or its members) under the current key path */
+static gboolean
+log_json_parser_parse_value (LogJSONParserState *state)
 {
-  struct json_object_iter itr;
+  gboolean success;
 
-  json_object_object_foreachC (jso, itr)
+  switch (*state->pos)
     {
-      log_json_parser_process_single (itr.val, prefix, itr.key, msg);
+    case '{':
+    case '[':
+      if (state->depth >= LOG_JSON_PARSER_MAX_DEPTH)
+        return FALSE;
+      state->depth++;
+      if (*state->pos == '{')
+        {
+          g_string_append_c (state->key, '.');
+          success = log_json_parser_parse_object (state);
+          g_string_truncate (state->key, state->key->len - 1);
+        }
+      else
+        {
+          success = log_json_parser_parse_array (state);
+        }
+      state->depth--;
+      return success;
+    case '"':
+      {
+        const gchar *value;
+        gsize value_len;
+
+        state->pos++;
+        if (!log_json_parser_parse_string (state, state->value, &value, &value_len))
+          return FALSE;
+        log_json_parser_store_value (state, value, value_len, value != state->value->str);
+        return TRUE;
+      }
+    case 't':
+      return log_json_parser_parse_literal (state, "true", TRUE);
+    case 'f':
+      return log_json_parser_parse_literal (state, "false", TRUE);
+    case 'n':
+      /* null values are not stored */
+      return log_json_parser_parse_literal (state, "null", FALSE);
+    default:
+      return log_json_parser_parse_number (state);
     }
 }
 
@@ -165,7 +428,11 @@ static gboolean
 log_json_parser_process (LogParser *s, LogMessage **pmsg, const LogPathOptions *path_options, const gchar *input)
 {
   LogJSONParser *self = (LogJSONParser *) s;
-  struct json_object *jso;
+  LogJSONParserState state;
+  ScratchBuffer *key, *value, *message;
+  const gchar *msg_value;
+  gssize msg_len;
+  gboolean success;
 
   if (self->marker)
     {
@@ -177,20 +444,47 @@ log_json_parser_process (LogParser *s, LogMessage **pmsg, const LogPathOptions *
         input++;
     }
 
-  jso = json_tokener_parse (input);
+  /* NOTE: values are stored as they are parsed, on error the
+   * half-parsed message is dropped by our caller */
+  state.self = self;
+  state.msg = log_msg_make_writable(pmsg, path_options);
+  state.pos = input;
+  state.depth = 0;
+  state.message_set = FALSE;
+
+  /* values can reference the input if we are parsing MESSAGE */
+  msg_value = log_msg_get_value (state.msg, LM_V_MESSAGE, &msg_len);
+  if (input >= msg_value && input <= msg_value + msg_len && msg_len <= G_MAXUINT16)
+    state.ref_base = msg_value;
+  else
+    state.ref_base = NULL;
 
-  if (!jso)
-    {
-      msg_error ("Unparsable JSON stream encountered", NULL);
-      return FALSE;
-    }
+  key = scratch_buffer_acquire ();
+  value = scratch_buffer_acquire ();
+  message = scratch_buffer_acquire ();
+  state.key = sb_string (key);
+  state.value = sb_string (value);
+  state.message = sb_string (message);
+  g_string_assign (state.key, self->prefix ? self->prefix : "");
 
-  log_msg_make_writable(pmsg, path_options);
-  log_json_parser_process_object (jso, self->prefix, *pmsg);
+  log_json_parser_skip_whitespace (&state);
+  success = (*state.pos == '{') && log_json_parser_parse_object (&state);
 
-  json_object_put (jso);
+  if (!success)
+    {
+      msg_error ("Unparsable JSON stream encountered",
+                 evt_tag_int ("position", state.pos - input),
+                 NULL);
+    }
+  else if (state.message_set)
+    {
+      log_msg_set_value (state.msg, LM_V_MESSAGE, state.message->str, state.message->len);
+    }
 
-  return TRUE;
+  scratch_buffer_release (key);
+  scratch_buffer_release (value);
+  scratch_buffer_release (message);
+  return success;
 }
 
 static LogPipe *
@@ -210,6 +504,7 @@ log_json_parser_free (LogPipe *s)
 {
   LogJSONParser *self = (LogJSONParser *)s;
 
+  nv_handle_cache_free (self->handles);
   g_free (self->prefix);
   g_free (self->marker);
   log_parser_free_method (s);
@@ -224,6 +519,7 @@ log_json_parser_new (void)
   self->super.super.free_fn = log_json_parser_free;
   self->super.super.clone = log_json_parser_clone;
   self->super.process = log_json_parser_process;
+  self->handles = nv_handle_cache_new (NULL);
 
   return self;
 }
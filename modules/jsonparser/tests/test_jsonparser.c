@@ -0,0 +1,157 @@
+#include "testutils.h"
+#include "jsonparser.h"
+
+#include "syslog-ng.h"
+#include "logmsg.h"
+#include "apphook.h"
+#include "cfg.h"
+#include "plugin.h"
+
+#include <string.h>
+
+MsgFormatOptions parse_options;
+
+static LogMessage *
+parse_json(const gchar *json, const gchar *prefix, const gchar *marker, gboolean from_message, gboolean expected_success)
+{
+  LogJSONParser *p;
+  LogMessage *msg;
+  NVTable *payload;
+  gboolean success;
+
+  parse_options.flags = LP_NOPARSE;
+  msg = log_msg_new(json, strlen(json), NULL, &parse_options);
+
+  p = log_json_parser_new();
+  if (prefix)
+    log_json_parser_set_prefix(&p->super, prefix);
+  if (marker)
+    log_json_parser_set_marker(&p->super, marker);
+
+  payload = nv_table_ref(msg->payload);
+  success = log_parser_process(&p->super, &msg, NULL, from_message ? log_msg_get_value(msg, LM_V_MESSAGE, NULL) : json);
+  nv_table_unref(payload);
+  log_pipe_unref(&p->super.super);
+
+  assert_gboolean(success, expected_success, "unexpected json-parser result, json=%s", json);
+  return msg;
+}
+
+static void
+assert_msg_value(LogMessage *msg, const gchar *name, const gchar *expected)
+{
+  const gchar *value;
+  gssize value_len;
+
+  value = log_msg_get_value(msg, log_msg_get_value_handle(name), &value_len);
+  assert_nstring(value, value_len, expected, -1, "value mismatch, name=%s", name);
+}
+
+static void
+test_scalars(gboolean from_message)
+{
+  LogMessage *msg;
+
+  msg = parse_json("{\"str\": \"value\", \"int\": 123, \"neg\": -5, \"dbl\": 3.14e2, \"t\": true, \"f\": false, \"n\": null}",
+                   NULL, NULL, from_message, TRUE);
+  assert_msg_value(msg, "str", "value");
+  assert_msg_value(msg, "int", "123");
+  assert_msg_value(msg, "neg", "-5");
+  assert_msg_value(msg, "dbl", "3.14e2");
+  assert_msg_value(msg, "t", "true");
+  assert_msg_value(msg, "f", "false");
+  assert_msg_value(msg, "n", "");
+  log_msg_unref(msg);
+}
+
+static void
+test_nesting(gboolean from_message)
+{
+  LogMessage *msg;
+
+  msg = parse_json("{\"a\": {\"b\": {\"c\": \"d\"}, \"e\": [1, \"x\", {\"k\": \"v\"}, [true]]}, \"f\": {}}",
+                   NULL, NULL, from_message, TRUE);
+  assert_msg_value(msg, "a.b.c", "d");
+  assert_msg_value(msg, "a.e[0]", "1");
+  assert_msg_value(msg, "a.e[1]", "x");
+  assert_msg_value(msg, "a.e[2].k", "v");
+  assert_msg_value(msg, "a.e[3][0]", "true");
+  log_msg_unref(msg);
+
+  msg = parse_json("{\"a\": {\"b\": \"c\"}}", ".json.", NULL, from_message, TRUE);
+  assert_msg_value(msg, ".json.a.b", "c");
+  log_msg_unref(msg);
+}
+
+static void
+test_escapes(gboolean from_message)
+{
+  LogMessage *msg;
+
+  msg = parse_json("{\"esc\": \"a\\\"b\\\\c\\/d\\te\\u00e1\\ud83d\\ude00\", \"k\\u0065y\": \"plain\"}",
+                   NULL, NULL, from_message, TRUE);
+  assert_msg_value(msg, "esc", "a\"b\\c/d\te\xc3\xa1\xf0\x9f\x98\x80");
+  assert_msg_value(msg, "key", "plain");
+  log_msg_unref(msg);
+}
+
+static void
+test_marker(void)
+{
+  LogMessage *msg;
+
+  msg = parse_json("@cee: {\"a\": \"b\"}", NULL, "@cee:", TRUE, TRUE);
+  assert_msg_value(msg, "a", "b");
+  log_msg_unref(msg);
+
+  msg = parse_json("{\"a\": \"b\"}", NULL, "@cee:", TRUE, FALSE);
+  log_msg_unref(msg);
+}
+
+static void
+test_invalid(void)
+{
+  log_msg_unref(parse_json("{\"a\": ", NULL, NULL, TRUE, FALSE));
+  log_msg_unref(parse_json("{\"a\": \"b\" \"c\": 1}", NULL, NULL, TRUE, FALSE));
+  log_msg_unref(parse_json("{\"a\": \"\\x\"}", NULL, NULL, TRUE, FALSE));
+  log_msg_unref(parse_json("{\"a\": 1.}", NULL, NULL, TRUE, FALSE));
+  log_msg_unref(parse_json("[1, 2]", NULL, NULL, TRUE, FALSE));
+  log_msg_unref(parse_json("{\"a\": [[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[1]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]}", NULL, NULL, TRUE, FALSE));
+}
+
+/* values referencing MESSAGE must survive when the input overwrites MESSAGE */
+static void
+test_message_overwritten(void)
+{
+  LogMessage *msg;
+
+  msg = parse_json("{\"first\": \"one\", \"MESSAGE\": \"new message\", \"last\": \"two\"}", NULL, NULL, TRUE, TRUE);
+  assert_msg_value(msg, "first", "one");
+  assert_msg_value(msg, "MESSAGE", "new message");
+  assert_msg_value(msg, "last", "two");
+  log_msg_unref(msg);
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+
+  configuration = cfg_new(0x0302);
+  plugin_load_module("syslogformat", configuration, NULL);
+  msg_format_options_defaults(&parse_options);
+  msg_format_options_init(&parse_options, configuration);
+
+  test_scalars(TRUE);
+  test_scalars(FALSE);
+  test_nesting(TRUE);
+  test_nesting(FALSE);
+  test_escapes(TRUE);
+  test_escapes(FALSE);
+  test_marker();
+  test_invalid();
+  test_message_overwritten();
+
+  app_shutdown();
+  return 0;
+}
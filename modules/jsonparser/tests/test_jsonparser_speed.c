@@ -0,0 +1,160 @@
+#include "jsonparser.h"
+
+#include "syslog-ng.h"
+#include "logmsg.h"
+#include "apphook.h"
+#include "cfg.h"
+#include "plugin.h"
+
+#include <string.h>
+#include <stdio.h>
+
+#include <json.h>
+
+MsgFormatOptions parse_options;
+
+#define BENCHMARK_COUNT 20000
+
+/* a typical application log of about 1.5KB */
+#define APP_LOG \
+  "{\"timestamp\": \"2013-01-15T10:00:00.123+01:00\", \"level\": \"INFO\", \"logger\": \"com.example.shop.checkout.OrderService\", " \
+  "\"thread\": \"http-nio-8080-exec-17\", \"message\": \"Order placed successfully for customer, payment authorized and items reserved\", " \
+  "\"context\": {\"request_id\": \"4f1c2a9e-7b3d-4e51-9a0c-2d8e6f4b1a77\", \"session_id\": \"a81f0c3e9d2b4c6a8e1f7d5b3c9a2e4f\", " \
+  "\"user\": {\"id\": 1234567, \"name\": \"jdoe\", \"email\": \"john.doe@example.com\", \"roles\": [\"customer\", \"newsletter\"]}, " \
+  "\"client\": {\"ip\": \"192.168.10.24\", \"user_agent\": \"Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/24.0 Safari/537.36\"}}, " \
+  "\"order\": {\"id\": \"ORD-2013-000987654\", \"total\": 149.97, \"currency\": \"EUR\", \"items\": [" \
+  "{\"sku\": \"SKU-10001\", \"name\": \"Wireless Mouse\", \"quantity\": 1, \"price\": 29.99}, " \
+  "{\"sku\": \"SKU-20002\", \"name\": \"Mechanical Keyboard\", \"quantity\": 1, \"price\": 89.99}, " \
+  "{\"sku\": \"SKU-30003\", \"name\": \"USB-C Cable \\\"2m\\\"\", \"quantity\": 3, \"price\": 9.99}], " \
+  "\"shipping\": {\"method\": \"express\", \"address\": {\"street\": \"Main Street 12\", \"city\": \"Budapest\", \"zip\": \"1111\", \"country\": \"HU\"}}, " \
+  "\"payment\": {\"provider\": \"card\", \"authorized\": true, \"captured\": false, \"transaction\": \"TX-88c1d0e2f3\"}}, " \
+  "\"metrics\": {\"duration_ms\": 182, \"db_queries\": 14, \"cache_hits\": 37, \"cache_misses\": 2}, \"tags\": [\"checkout\", \"payment\", \"inventory\"], " \
+  "\"host\": \"app-server-03.prod.example.com\", \"service\": \"shop-checkout\", \"version\": \"2.14.1\", \"environment\": \"production\"}"
+
+/* the DOM based approach the parser used to implement */
+static void json_c_process_object(struct json_object *jso, const gchar *prefix, LogMessage *msg);
+
+static void
+json_c_process_single(struct json_object *jso, const gchar *prefix, const gchar *obj_key, LogMessage *msg)
+{
+  GString *key = g_string_sized_new(64);
+  GString *value = g_string_sized_new(64);
+  gboolean parsed = FALSE;
+  gint i;
+
+  switch (json_object_get_type(jso))
+    {
+    case json_type_boolean:
+      parsed = TRUE;
+      g_string_assign(value, json_object_get_boolean(jso) ? "true" : "false");
+      break;
+    case json_type_double:
+      parsed = TRUE;
+      g_string_printf(value, "%f", json_object_get_double(jso));
+      break;
+    case json_type_int:
+      parsed = TRUE;
+      g_string_printf(value, "%i", json_object_get_int(jso));
+      break;
+    case json_type_string:
+      parsed = TRUE;
+      g_string_assign(value, json_object_get_string(jso));
+      break;
+    case json_type_object:
+      g_string_printf(key, "%s%s.", prefix, obj_key);
+      json_c_process_object(jso, key->str, msg);
+      break;
+    case json_type_array:
+      for (i = 0; i < json_object_array_length(jso); i++)
+        {
+          g_string_printf(key, "%s[%d]", obj_key, i);
+          json_c_process_single(json_object_array_get_idx(jso, i), prefix, key->str, msg);
+        }
+      break;
+    default:
+      break;
+    }
+
+  if (parsed)
+    {
+      g_string_printf(key, "%s%s", prefix, obj_key);
+      log_msg_set_value(msg, log_msg_get_value_handle(key->str), value->str, value->len);
+    }
+  g_string_free(key, TRUE);
+  g_string_free(value, TRUE);
+}
+
+static void
+json_c_process_object(struct json_object *jso, const gchar *prefix, LogMessage *msg)
+{
+  struct json_object_iter itr;
+
+  json_object_object_foreachC(jso, itr)
+    {
+      json_c_process_single(itr.val, prefix, itr.key, msg);
+    }
+}
+
+static void
+benchmark_json_c(const gchar *json)
+{
+  GTimeVal start, end;
+  gint i;
+
+  parse_options.flags = LP_NOPARSE;
+  g_get_current_time(&start);
+  for (i = 0; i < BENCHMARK_COUNT; i++)
+    {
+      LogMessage *msg = log_msg_new(json, strlen(json), NULL, &parse_options);
+      struct json_object *jso;
+
+      jso = json_tokener_parse(log_msg_get_value(msg, LM_V_MESSAGE, NULL));
+      json_c_process_object(jso, "", msg);
+      json_object_put(jso);
+      log_msg_unref(msg);
+    }
+  g_get_current_time(&end);
+  printf("%-40s speed: %12.3f msg/sec\n", "json-c DOM", i * 1e6 / g_time_val_diff(&end, &start));
+}
+
+static void
+benchmark_json_parser(const gchar *title, const gchar *json, gboolean from_message)
+{
+  LogJSONParser *p;
+  GTimeVal start, end;
+  gint i;
+
+  p = log_json_parser_new();
+  parse_options.flags = LP_NOPARSE;
+  g_get_current_time(&start);
+  for (i = 0; i < BENCHMARK_COUNT; i++)
+    {
+      LogMessage *msg = log_msg_new(json, strlen(json), NULL, &parse_options);
+      NVTable *payload = nv_table_ref(msg->payload);
+
+      log_parser_process(&p->super, &msg, NULL, from_message ? log_msg_get_value(msg, LM_V_MESSAGE, NULL) : json);
+      nv_table_unref(payload);
+      log_msg_unref(msg);
+    }
+  g_get_current_time(&end);
+  printf("%-40s speed: %12.3f msg/sec\n", title, i * 1e6 / g_time_val_diff(&end, &start));
+  log_pipe_unref(&p->super.super);
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+
+  configuration = cfg_new(0x0302);
+  plugin_load_module("syslogformat", configuration, NULL);
+  msg_format_options_defaults(&parse_options);
+  msg_format_options_init(&parse_options, configuration);
+
+  benchmark_json_c(APP_LOG);
+  benchmark_json_parser("json-parser, MESSAGE", APP_LOG, TRUE);
+  benchmark_json_parser("json-parser, copied input", APP_LOG, FALSE);
+
+  app_shutdown();
+  return 0;
+}
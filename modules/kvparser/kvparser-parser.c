@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2012 BalaBit IT Ltd, Budapest, Hungary
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ */
+
+#include "kvparser.h"
+#include "cfg-parser.h"
+#include "kvparser-grammar.h"
+
+extern int kvparser_debug;
+
+int kvparser_parse(CfgLexer *lexer, LogParser **instance, gpointer arg);
+
+static CfgLexerKeyword kvparser_keywords[] =
+{
+  { "kv_parser",          KW_KV_PARSER,  },
+  { "prefix",             KW_PREFIX,  },
+  { "value_separator",    KW_VALUE_SEPARATOR,  },
+  { NULL }
+};
+
+CfgParser kvparser_parser =
+{
+#if ENABLE_DEBUG
+  .debug_flag = &kvparser_debug,
+#endif
+  .name = "kvparser",
+  .keywords = kvparser_keywords,
+  .parse = (gint (*)(CfgLexer *, gpointer *, gpointer)) kvparser_parse,
+  .cleanup = (void (*)(gpointer)) log_pipe_unref,
+};
+
+CFG_PARSER_IMPLEMENT_LEXER_BINDING(kvparser_, LogParser **)
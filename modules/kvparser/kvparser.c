@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2012 BalaBit IT Ltd, Budapest, Hungary
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * As an additional exemption you are allowed to compile & link against the
+ * OpenSSL libraries as published by the OpenSSL project. See the file
+ * COPYING for details.
+ */
+
+#include "kvparser.h"
+#include "logparser.h"
+#include "nvhandle-cache.h"
+#include "scratch-buffers.h"
+
+#include <string.h>
+
+/* character classes */
+#define KV_KEY_END   0x01
+#define KV_VALUE_END 0x02
+
+typedef struct _LogKVParser
+{
+  LogParser super;
+  gchar *prefix;
+  gchar value_separator;
+  /* key -> NVHandle, the prefix included */
+  NVHandleCache *handles;
+  /* KV_* flags for each character */
+  guint8 char_class[256];
+} LogKVParser;
+
+typedef struct
+{
+  LogKVParser *self;
+  LogMessage *msg;
+  /* the start of the MESSAGE value if we are parsing that, NULL otherwise */
+  const gchar *ref_base;
+  /* the value of MESSAGE, if the input sets it, stored once the input is no longer needed */
+  GString *message;
+  gboolean message_set;
+} LogKVParserState;
+
+static void
+log_kv_parser_update_char_class(LogKVParser *self)
+{
+  memset(self->char_class, 0, sizeof(self->char_class));
+  self->char_class[0] = KV_KEY_END | KV_VALUE_END;
+  self->char_class[' '] = KV_KEY_END | KV_VALUE_END;
+  self->char_class['\t'] = KV_KEY_END | KV_VALUE_END;
+  self->char_class[(guchar) self->value_separator] |= KV_KEY_END;
+}
+
+void
+log_kv_parser_set_prefix(LogParser *p, const gchar *prefix)
+{
+  LogKVParser *self = (LogKVParser *) p;
+
+  g_free(self->prefix);
+  self->prefix = g_strdup(prefix);
+  nv_handle_cache_free(self->handles);
+  self->handles = nv_handle_cache_new(prefix);
+}
+
+void
+log_kv_parser_set_value_separator(LogParser *p, gchar value_separator)
+{
+  LogKVParser *self = (LogKVParser *) p;
+
+  self->value_separator = value_separator;
+  log_kv_parser_update_char_class(self);
+}
+
+static void
+log_kv_parser_store_value(LogKVParserState *state, const gchar *key, gsize key_len, const gchar *value, gsize value_len, gboolean from_input)
+{
+  NVHandle handle;
+
+  handle = nv_handle_cache_lookup(state->self->handles, key, key_len);
+  if (handle == LM_V_MESSAGE && state->ref_base)
+    {
+      /* we are still reading MESSAGE, postpone overwriting it */
+      g_string_assign_len(state->message, value, value_len);
+      state->message_set = TRUE;
+    }
+  else if (from_input && state->ref_base && handle >= LM_V_MAX && value_len > 0)
+    {
+      log_msg_set_value_indirect(state->msg, handle, LM_V_MESSAGE, 0, value - state->ref_base, value_len);
+    }
+  else
+    {
+      log_msg_set_value(state->msg, handle, value, value_len);
+    }
+}
+
+/*
+ * Parses whitespace separated key=value pairs. Values can be quoted
+ * with single or double quotes, a backslash escapes the next character
+ * within quotes. Words that are not key=value pairs are skipped.
+ */
+static gboolean
+log_kv_parser_process(LogParser *s, LogMessage **pmsg, const LogPathOptions *path_options, const gchar *input)
+{
+  LogKVParser *self = (LogKVParser *) s;
+  LogKVParserState state;
+  ScratchBuffer *value_buf, *message_buf;
+  const guchar *src = (const guchar *) input;
+  const gchar *msg_value;
+  gssize msg_len;
+
+  state.self = self;
+  state.msg = log_msg_make_writable(pmsg, path_options);
+  state.message_set = FALSE;
+
+  /* values can reference the input if we are parsing MESSAGE */
+  msg_value = log_msg_get_value(state.msg, LM_V_MESSAGE, &msg_len);
+  if (input == msg_value && msg_len <= G_MAXUINT16)
+    state.ref_base = msg_value;
+  else
+    state.ref_base = NULL;
+
+  value_buf = scratch_buffer_acquire();
+  message_buf = scratch_buffer_acquire();
+  state.message = sb_string(message_buf);
+
+  while (*src)
+    {
+      const guchar *key, *value;
+      gsize key_len, value_len;
+      gboolean escaped = FALSE;
+
+      while (*src == ' ' || *src == '\t')
+        src++;
+
+      key = src;
+      while (!(self->char_class[*src] & KV_KEY_END))
+        src++;
+      key_len = src - key;
+
+      if (*src != (guchar) self->value_separator || !*src)
+        {
+          /* not a key=value pair, skip the word */
+          while (!(self->char_class[*src] & KV_VALUE_END))
+            src++;
+          continue;
+        }
+      src++;
+
+      if (*src == '"' || *src == '\'')
+        {
+          guchar quote = *src;
+
+          src++;
+          value = src;
+          while (*src && *src != quote)
+            {
+              if (*src == '\\' && *(src + 1))
+                {
+                  escaped = TRUE;
+                  src++;
+                }
+              src++;
+            }
+          value_len = src - value;
+          /* skip the closing quote */
+          if (*src)
+            src++;
+        }
+      else
+        {
+          value = src;
+          while (!(self->char_class[*src] & KV_VALUE_END))
+            src++;
+          value_len = src - value;
+        }
+
+      if (key_len == 0)
+        continue;
+
+      if (escaped)
+        {
+          GString *unescaped = sb_string(value_buf);
+          gsize i;
+
+          g_string_truncate(unescaped, 0);
+          for (i = 0; i < value_len; i++)
+            {
+              if (value[i] == '\\' && i + 1 < value_len)
+                i++;
+              g_string_append_c(unescaped, value[i]);
+            }
+          log_kv_parser_store_value(&state, (const gchar *) key, key_len, unescaped->str, unescaped->len, FALSE);
+        }
+      else
+        {
+          log_kv_parser_store_value(&state, (const gchar *) key, key_len, (const gchar *) value, value_len, TRUE);
+        }
+    }
+
+  if (state.message_set)
+    log_msg_set_value(state.msg, LM_V_MESSAGE, state.message->str, state.message->len);
+
+  scratch_buffer_release(value_buf);
+  scratch_buffer_release(message_buf);
+  return TRUE;
+}
+
+static LogPipe *
+log_kv_parser_clone(LogPipe *s)
+{
+  LogKVParser *self = (LogKVParser *) s;
+  LogParser *cloned;
+
+  cloned = log_kv_parser_new();
+  log_kv_parser_set_prefix(cloned, self->prefix);
+  log_kv_parser_set_value_separator(cloned, self->value_separator);
+  log_parser_set_template(cloned, log_template_ref(self->super.template));
+
+  return &cloned->super;
+}
+
+static void
+log_kv_parser_free(LogPipe *s)
+{
+  LogKVParser *self = (LogKVParser *) s;
+
+  nv_handle_cache_free(self->handles);
+  g_free(self->prefix);
+  log_parser_free_method(s);
+}
+
+/*
+ * Parse key=value pairs from a log message.
+ */
+LogParser *
+log_kv_parser_new(void)
+{
+  LogKVParser *self = g_new0(LogKVParser, 1);
+
+  log_parser_init_instance(&self->super);
+  self->super.super.free_fn = log_kv_parser_free;
+  self->super.super.clone = log_kv_parser_clone;
+  self->super.process = log_kv_parser_process;
+  self->handles = nv_handle_cache_new(NULL);
+  log_kv_parser_set_value_separator(&self->super, '=');
+  return &self->super;
+}
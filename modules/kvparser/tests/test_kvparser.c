@@ -0,0 +1,101 @@
+#include "testutils.h"
+#include "kvparser.h"
+
+#include "syslog-ng.h"
+#include "logmsg.h"
+#include "apphook.h"
+#include "cfg.h"
+#include "plugin.h"
+
+#include <string.h>
+
+MsgFormatOptions parse_options;
+
+static LogMessage *
+parse_kv(const gchar *input, const gchar *prefix, gboolean from_message)
+{
+  LogParser *p;
+  LogMessage *msg;
+  NVTable *payload;
+
+  parse_options.flags = LP_NOPARSE;
+  msg = log_msg_new(input, strlen(input), NULL, &parse_options);
+
+  p = log_kv_parser_new();
+  if (prefix)
+    log_kv_parser_set_prefix(p, prefix);
+
+  payload = nv_table_ref(msg->payload);
+  assert_true(log_parser_process(p, &msg, NULL, from_message ? log_msg_get_value(msg, LM_V_MESSAGE, NULL) : input),
+              "kv-parser failed, input=%s", input);
+  nv_table_unref(payload);
+  log_pipe_unref(&p->super);
+  return msg;
+}
+
+static void
+assert_msg_value(LogMessage *msg, const gchar *name, const gchar *expected)
+{
+  const gchar *value;
+  gssize value_len;
+
+  value = log_msg_get_value(msg, log_msg_get_value_handle(name), &value_len);
+  assert_nstring(value, value_len, expected, -1, "value mismatch, name=%s", name);
+}
+
+static void
+test_pairs(gboolean from_message)
+{
+  LogMessage *msg;
+
+  msg = parse_kv("type=USER_LOGIN msg='op=login acct=\"root\" res=success' pid=1234 uid=0 a=b=c empty= bare word q=\"x \\\"y\\\" z\"",
+                 NULL, from_message);
+  assert_msg_value(msg, "type", "USER_LOGIN");
+  assert_msg_value(msg, "msg", "op=login acct=\"root\" res=success");
+  assert_msg_value(msg, "pid", "1234");
+  assert_msg_value(msg, "uid", "0");
+  assert_msg_value(msg, "a", "b=c");
+  assert_msg_value(msg, "empty", "");
+  assert_msg_value(msg, "bare", "");
+  assert_msg_value(msg, "q", "x \"y\" z");
+  log_msg_unref(msg);
+
+  msg = parse_kv("  src=10.0.0.1\tdst=10.0.0.2 proto=tcp unterminated=\"abc", ".kv.", from_message);
+  assert_msg_value(msg, ".kv.src", "10.0.0.1");
+  assert_msg_value(msg, ".kv.dst", "10.0.0.2");
+  assert_msg_value(msg, ".kv.proto", "tcp");
+  assert_msg_value(msg, ".kv.unterminated", "abc");
+  assert_msg_value(msg, "src", "");
+  log_msg_unref(msg);
+}
+
+/* values referencing MESSAGE must survive when the input overwrites MESSAGE */
+static void
+test_message_overwritten(void)
+{
+  LogMessage *msg;
+
+  msg = parse_kv("first=one MESSAGE=\"new message\" last=two", NULL, TRUE);
+  assert_msg_value(msg, "first", "one");
+  assert_msg_value(msg, "MESSAGE", "new message");
+  assert_msg_value(msg, "last", "two");
+  log_msg_unref(msg);
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+
+  configuration = cfg_new(0x0302);
+  plugin_load_module("syslogformat", configuration, NULL);
+  msg_format_options_defaults(&parse_options);
+  msg_format_options_init(&parse_options, configuration);
+
+  test_pairs(TRUE);
+  test_pairs(FALSE);
+  test_message_overwritten();
+
+  app_shutdown();
+  return 0;
+}
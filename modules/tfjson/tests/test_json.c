@@ -0,0 +1,75 @@
+#include "testutils.h"
+
+#include "syslog-ng.h"
+#include "logmsg.h"
+#include "templates.h"
+#include "apphook.h"
+#include "cfg.h"
+#include "plugin.h"
+
+#include <string.h>
+
+MsgFormatOptions parse_options;
+
+static LogMessage *
+create_message(void)
+{
+  const gchar *text = "<15>Oct 15 16:17:01 host prog[2499]: message";
+  LogMessage *msg;
+
+  msg = log_msg_new(text, strlen(text), NULL, &parse_options);
+  log_msg_set_value(msg, log_msg_get_value_handle("APP.ESCAPE"), "a\"b\\c/d\te\001f\xc3\xa1", -1);
+  return msg;
+}
+
+static void
+testcase(const gchar *template, const gchar *expected)
+{
+  LogTemplate *templ;
+  LogMessage *msg;
+  GString *res = g_string_sized_new(128);
+  GError *error = NULL;
+
+  msg = create_message();
+  templ = log_template_new(configuration, NULL);
+  assert_true(log_template_compile(templ, template, &error), "error compiling template, template=%s", template);
+
+  log_template_format(templ, msg, NULL, LTZ_LOCAL, 0, NULL, res);
+  assert_string(res->str, expected, "format-json output mismatch, template=%s", template);
+
+  log_template_unref(templ);
+  log_msg_unref(msg);
+  g_string_free(res, TRUE);
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+  putenv("TZ=MET-1METDST");
+  tzset();
+
+  configuration = cfg_new(0x0302);
+  plugin_load_module("syslogformat", configuration, NULL);
+  plugin_load_module("tfjson", configuration, NULL);
+  msg_format_options_defaults(&parse_options);
+  msg_format_options_init(&parse_options, configuration);
+
+  testcase("$(format-json b=2 a=1 c=3)", "{\"a\":\"1\",\"b\":\"2\",\"c\":\"3\"}");
+  testcase("$(format-json --scope rfc3164 --exclude DATE)",
+           "{\"FACILITY\":\"user\",\"HOST\":\"host\",\"MESSAGE\":\"message\",\"PID\":\"2499\",\"PRIORITY\":\"debug\",\"PROGRAM\":\"prog\"}");
+
+  /* the same key added twice, the explicit pair wins */
+  testcase("$(format-json --scope rfc3164 --exclude DATE HOST=other)",
+           "{\"FACILITY\":\"user\",\"HOST\":\"other\",\"MESSAGE\":\"message\",\"PID\":\"2499\",\"PRIORITY\":\"debug\",\"PROGRAM\":\"prog\"}");
+
+  /* escaping of values and keys */
+  testcase("$(format-json key=${APP.ESCAPE})", "{\"key\":\"a\\\"b\\\\c\\/d\\te\\u0001f\xc3\xa1\"}");
+  testcase("$(format-json \xc3\xa1rv=1)", "{\"\\303\\241rv\":\"1\"}");
+
+  /* empty values are left out */
+  testcase("$(format-json key=${APP.NONEXISTENT} key2=value)", "{\"key2\":\"value\"}");
+
+  app_shutdown();
+  return 0;
+}
@@ -27,15 +27,7 @@
 
 #include "config.h"
 
-#ifdef HAVE_JSON_C
-#include <printbuf.h>
-#include <json.h>
-#include <json_object_private.h>
-#endif
-
-#ifdef HAVE_JSON_GLIB
-#include <json-glib/json-glib.h>
-#endif
+#include <string.h>
 
 typedef struct _TFJsonState
 {
@@ -57,71 +49,103 @@ tf_json_prepare(LogTemplateFunction *self, gpointer s, LogTemplate *parent,
   return TRUE;
 }
 
-#if HAVE_JSON_C
-static int
-tf_json_object_to_string (struct json_object *jso,
-			  struct printbuf *pb)
+/*
+ * The JSON document is written straight into the result buffer. The
+ * output matches what the json-c based implementation produced: values
+ * are escaped the way json-c does, keys the way g_strescape() does.
+ *
+ * The escape tables contain 0 for characters that can be copied
+ * verbatim, the character to put after the backslash for the short
+ * escapes and 'u' (or 'o' for keys) for characters that need a numeric
+ * escape. Runs of verbatim characters are copied at once.
+ */
+static guchar json_value_escapes[256];
+static guchar json_key_escapes[256];
+
+static void
+tf_json_init_escapes(void)
 {
-  int i = 0;
-  struct json_object_iter iter;
-  sprintbuf (pb, "{");
+  gint c;
 
-  json_object_object_foreachC (jso, iter)
+  for (c = 0; c < 0x20; c++)
     {
-      gchar *esc;
-      
-      if (i)
-	sprintbuf (pb, ",");
-      sprintbuf (pb, "\"");
-      esc = g_strescape (iter.key, NULL);
-      sprintbuf (pb, esc);
-      g_free (esc);
-      sprintbuf (pb, "\":");
-      if (iter.val == NULL)
-	sprintbuf (pb, "null");
-      else
-	iter.val->_to_json_string (iter.val, pb);
-      i++;
+      json_value_escapes[c] = 'u';
+      json_key_escapes[c] = 'o';
     }
-
-  return sprintbuf(pb, "}");
-}
-
-static gboolean
-tf_json_foreach (const gchar *name, const gchar *value, gpointer user_data)
-{
-  struct json_object *root = (struct json_object *)user_data;
-  struct json_object *this;
-
-  this = json_object_new_string ((gchar *) value);
-  json_object_object_add (root, (gchar *) name, this);
-
-  return FALSE;
+  for (c = 0x7f; c < 256; c++)
+    json_key_escapes[c] = 'o';
+
+  json_value_escapes['\b'] = 'b';
+  json_value_escapes['\n'] = 'n';
+  json_value_escapes['\r'] = 'r';
+  json_value_escapes['\t'] = 't';
+  json_value_escapes['"'] = '"';
+  json_value_escapes['\\'] = '\\';
+  json_value_escapes['/'] = '/';
+
+  json_key_escapes['\b'] = 'b';
+  json_key_escapes['\f'] = 'f';
+  json_key_escapes['\n'] = 'n';
+  json_key_escapes['\r'] = 'r';
+  json_key_escapes['\t'] = 't';
+  json_key_escapes['\v'] = 'v';
+  json_key_escapes['"'] = '"';
+  json_key_escapes['\\'] = '\\';
 }
 
 static void
-tf_json_append(GString *result, ValuePairs *vp, LogMessage *msg)
+tf_json_append_escaped(GString *result, const guchar *escapes, const gchar *str)
 {
-  struct json_object *json;
-
-  json = json_object_new_object();
-  json->_to_json_string = tf_json_object_to_string;
-
-  value_pairs_foreach(vp, tf_json_foreach, msg, 0, json);
+  static const gchar hex_digits[] = "0123456789abcdef";
+  const guchar *p = (const guchar *) str;
+  const guchar *start;
 
-  g_string_append(result, json_object_to_json_string (json));
-  json_object_put(json);
+  while (*p)
+    {
+      start = p;
+      while (*p && !escapes[*p])
+        p++;
+      if (p != start)
+        g_string_append_len(result, (const gchar *) start, p - start);
+      if (!*p)
+        break;
+
+      g_string_append_c(result, '\\');
+      switch (escapes[*p])
+        {
+        case 'u':
+          g_string_append_len(result, "u00", 3);
+          g_string_append_c(result, hex_digits[*p >> 4]);
+          g_string_append_c(result, hex_digits[*p & 0xf]);
+          break;
+        case 'o':
+          g_string_append_c(result, '0' + ((*p >> 6) & 07));
+          g_string_append_c(result, '0' + ((*p >> 3) & 07));
+          g_string_append_c(result, '0' + (*p & 07));
+          break;
+        default:
+          g_string_append_c(result, escapes[*p]);
+          break;
+        }
+      p++;
+    }
 }
-#endif
 
-#if HAVE_JSON_GLIB
 static gboolean
 tf_json_foreach (const gchar *name, const gchar *value, gpointer user_data)
 {
-  JsonBuilder *builder = (JsonBuilder *)user_data;
+  GString *result = (GString *) ((gpointer *) user_data)[0];
+  gboolean *first = (gboolean *) ((gpointer *) user_data)[1];
+
+  if (!*first)
+    g_string_append_c(result, ',');
+  *first = FALSE;
 
-  json_builder_set_member_name(builder, name);
-  json_builder_add_string_value(builder, value);
+  g_string_append_c(result, '"');
+  tf_json_append_escaped(result, json_key_escapes, name);
+  g_string_append_len(result, "\":\"", 3);
+  tf_json_append_escaped(result, json_value_escapes, value);
+  g_string_append_c(result, '"');
 
   return FALSE;
 }
@@ -129,28 +153,13 @@ tf_json_foreach (const gchar *name, const gchar *value, gpointer user_data)
 static void
 tf_json_append(GString *result, ValuePairs *vp, LogMessage *msg)
 {
-  JsonBuilder *builder;
-  JsonGenerator *gen;
-  gchar *str;
+  gboolean first = TRUE;
+  gpointer args[] = { result, &first };
 
-  builder = json_builder_new();
-  json_builder_begin_object(builder);
-
-  value_pairs_foreach(vp, tf_json_foreach, msg, 0, builder);
-
-  json_builder_end_object(builder);
-
-  gen = json_generator_new();
-  json_generator_set_root(gen, json_builder_get_root(builder));
-  str = json_generator_to_data(gen, NULL);
-
-  g_object_unref(gen);
-  g_object_unref(builder);
-
-  g_string_append(result, str);
-  g_free(str);
+  g_string_append_c(result, '{');
+  value_pairs_foreach(vp, tf_json_foreach, msg, 0, args);
+  g_string_append_c(result, '}');
 }
-#endif
 
 static void
 tf_json_call(LogTemplateFunction *self, gpointer s,
@@ -184,10 +193,7 @@ static Plugin builtin_tmpl_func_plugins[] =
 gboolean
 tfjson_module_init(GlobalConfig *cfg, CfgArgs *args)
 {
-#ifdef HAVE_JSON_GLIB
-  g_type_init ();
-#endif
-
+  tf_json_init_escapes();
   plugin_register(cfg, builtin_tmpl_func_plugins, G_N_ELEMENTS(builtin_tmpl_func_plugins));
   return TRUE;
 }
@@ -8,7 +8,13 @@
 #include "logpipe.h"
 #include "cfg.h"
 #include "plugin.h"
+#include "nvtable.h"
+#include "tags.h"
 
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <stddef.h>
 #include <time.h>
 #include <string.h>
 #include <stdlib.h>
@@ -75,6 +81,245 @@ test_cloning_with_log_message(gchar *msg)
   testcase_end();
 }
 
+void
+test_serializing_log_message(gchar *msg)
+{
+  LogMessage *log_message, *read_log_message;
+  GSockAddr *addr = g_sockaddr_inet_new("10.10.10.10", 1010);
+  SerializeArchive *sa;
+  GString *stream = g_string_new("");
+  regex_t bad_hostname;
+
+  testcase_begin("Testing log message serialization; msg='%s'", msg);
+
+  parse_options.flags = LP_SYSLOG_PROTOCOL;
+  parse_options.bad_hostname = &bad_hostname;
+
+  log_message = log_msg_new(msg, strlen(msg), addr, &parse_options);
+  set_new_log_message_attributes(log_message);
+  log_msg_set_tag_by_name(log_message, "newtag");
+
+  sa = serialize_string_archive_new(stream);
+  assert_true(log_msg_write(log_message, sa), "error serializing log message");
+  serialize_archive_free(sa);
+
+  read_log_message = log_msg_new_empty();
+  sa = serialize_buffer_archive_new(stream->str, stream->len);
+  assert_true(log_msg_read(read_log_message, sa, NULL), "error deserializing log message");
+  serialize_archive_free(sa);
+
+  assert_log_messages_equal(read_log_message, log_message);
+  assert_new_log_message_attributes(read_log_message);
+  assert_log_message_has_tag(read_log_message, "newtag");
+
+  /* truncated input must be detected */
+  log_msg_unref(read_log_message);
+  read_log_message = log_msg_new_empty();
+  sa = serialize_buffer_archive_new(stream->str, stream->len - 1);
+  sa->silent = TRUE;
+  assert_false(log_msg_read(read_log_message, sa, NULL), "truncated log message deserialized successfully");
+  serialize_archive_free(sa);
+
+  log_msg_unref(read_log_message);
+  log_msg_unref(log_message);
+  g_sockaddr_unref(addr);
+  g_string_free(stream, TRUE);
+
+  testcase_end();
+}
+
+/* replaces the source address of a serialized message with @addr */
+static GString *
+replace_serialized_address(GString *stream, gconstpointer addr, guint16 salen)
+{
+  /* version, flags, pri and the timestamps precede the address */
+  gsize offset = 1 + 4 + 2 + LM_TS_MAX * (8 + 4 + 4);
+  guint16 orig_salen = (((guchar) stream->str[offset]) << 8) + (guchar) stream->str[offset + 1];
+  GString *result = g_string_new_len(stream->str, offset);
+
+  g_string_append_c(result, salen >> 8);
+  g_string_append_c(result, salen & 0xff);
+  g_string_append_len(result, addr, salen);
+  g_string_append_len(result, stream->str + offset + 2 + orig_salen, stream->len - offset - 2 - orig_salen);
+  return result;
+}
+
+static void
+assert_deserialized_address(GString *stream, gconstpointer addr, guint16 salen, gboolean expected_valid)
+{
+  GString *modified = replace_serialized_address(stream, addr, salen);
+  LogMessage *msg = log_msg_new_empty();
+  SerializeArchive *sa;
+
+  sa = serialize_buffer_archive_new(modified->str, modified->len);
+  assert_true(log_msg_read(msg, sa, NULL), "error deserializing log message, salen=%d", salen);
+  serialize_archive_free(sa);
+  if (expected_valid)
+    assert_true(msg->saddr != NULL && msg->saddr->salen == salen, "valid address was dropped, salen=%d", salen);
+  else
+    assert_true(msg->saddr == NULL, "invalid address was accepted, salen=%d", salen);
+
+  log_msg_unref(msg);
+  g_string_free(modified, TRUE);
+}
+
+void
+test_deserializing_addresses(void)
+{
+  LogMessage *log_message;
+  GSockAddr *addr = g_sockaddr_inet_new("10.10.10.10", 1010);
+  SerializeArchive *sa;
+  GString *stream = g_string_new("");
+  gchar buf[512];
+  struct sockaddr_un *saun = (struct sockaddr_un *) buf;
+  struct sockaddr_in *sin = (struct sockaddr_in *) buf;
+  gsize path_offset = offsetof(struct sockaddr_un, sun_path);
+  gchar *large;
+
+  testcase_begin("Testing deserialization of source addresses");
+
+  log_message = log_msg_new("<7>message", strlen("<7>message"), addr, &parse_options);
+  sa = serialize_string_archive_new(stream);
+  assert_true(log_msg_write(log_message, sa), "error serializing log message");
+  serialize_archive_free(sa);
+
+  memset(buf, 0, sizeof(buf));
+  sin->sin_family = AF_INET;
+  assert_deserialized_address(stream, buf, sizeof(struct sockaddr_in), TRUE);
+  assert_deserialized_address(stream, buf, 4, FALSE);
+  assert_deserialized_address(stream, buf, sizeof(buf), FALSE);
+
+  memset(buf, 0, sizeof(buf));
+  saun->sun_family = AF_UNIX;
+  strcpy(saun->sun_path, "/dev/log");
+  assert_deserialized_address(stream, buf, path_offset + strlen("/dev/log") + 1, TRUE);
+  /* not NUL terminated */
+  assert_deserialized_address(stream, buf, path_offset + strlen("/dev/log"), FALSE);
+  assert_deserialized_address(stream, buf, path_offset, FALSE);
+  assert_deserialized_address(stream, buf, sizeof(struct sockaddr_un) + 1, FALSE);
+
+  memset(buf, 0, sizeof(buf));
+  buf[0] = buf[1] = 0x7f;
+  assert_deserialized_address(stream, buf, 16, FALSE);
+
+  /* the longest address a peer can send is discarded without buffering it */
+  large = g_malloc0(G_MAXUINT16);
+  assert_deserialized_address(stream, large, G_MAXUINT16, FALSE);
+  g_free(large);
+
+  log_msg_unref(log_message);
+  g_sockaddr_unref(addr);
+  g_string_free(stream, TRUE);
+
+  testcase_end();
+}
+
+/* a message as a peer would send it, with @num_names values and tags */
+static GString *
+serialize_peer_message(guint32 flags, const gchar *prefix, gint num_names)
+{
+  GString *stream = g_string_new("");
+  SerializeArchive *sa = serialize_string_archive_new(stream);
+  gchar name[64];
+  gint i;
+
+  serialize_write_uint8(sa, 1);
+  serialize_write_uint32(sa, flags);
+  serialize_write_uint16(sa, 13);
+  for (i = 0; i < LM_TS_MAX; i++)
+    {
+      serialize_write_uint64(sa, 1000000000);
+      serialize_write_uint32(sa, 0);
+      serialize_write_uint32(sa, 0);
+    }
+  serialize_write_uint16(sa, 0);
+  for (i = 0; i < num_names; i++)
+    {
+      g_snprintf(name, sizeof(name), "%s.value%d", prefix, i);
+      serialize_write_cstring(sa, name, -1);
+      serialize_write_cstring(sa, "value", -1);
+    }
+  serialize_write_cstring(sa, "", 0);
+  for (i = 0; i < num_names; i++)
+    {
+      g_snprintf(name, sizeof(name), "%s.tag%d", prefix, i);
+      serialize_write_cstring(sa, name, -1);
+    }
+  serialize_write_cstring(sa, "", 0);
+  serialize_archive_free(sa);
+  return stream;
+}
+
+static LogMessage *
+read_peer_message(GString *stream, gint *new_names_left)
+{
+  LogMessage *msg = log_msg_new_empty();
+  SerializeArchive *sa = serialize_buffer_archive_new(stream->str, stream->len);
+
+  assert_true(log_msg_read(msg, sa, new_names_left), "error deserializing log message");
+  serialize_archive_free(sa);
+  return msg;
+}
+
+void
+test_deserializing_flags(void)
+{
+  GString *stream;
+  LogMessage *msg;
+
+  testcase_begin("Testing that a peer can't set flags that describe the local reception");
+  stream = serialize_peer_message(LF_UTF8 | LF_INTERNAL | LF_LOCAL | 0x80000000, "flags", 0);
+  msg = read_peer_message(stream, NULL);
+  assert_true(msg->flags & LF_UTF8, "serialized flag was dropped");
+  assert_false(msg->flags & (LF_INTERNAL | LF_LOCAL), "local flags were accepted from the peer, flags=%x", msg->flags);
+  assert_false(msg->flags & 0x80000000, "unknown flags were accepted from the peer, flags=%x", msg->flags);
+  assert_gint(msg->pri, 13, "priority mismatch");
+  testcase_end();
+
+  log_msg_unref(msg);
+  g_string_free(stream, TRUE);
+}
+
+void
+test_deserializing_new_names(void)
+{
+  GString *stream;
+  LogMessage *msg;
+  LogTagId id;
+  gint new_names_left = 3;
+
+  testcase_begin("Testing that a peer can only register a limited number of new names");
+  stream = serialize_peer_message(0, "peer", 2);
+  start_grabbing_messages();
+  msg = read_peer_message(stream, &new_names_left);
+  assert_gint(new_names_left, -1, "new names were not counted");
+  assert_grabbed_messages_contain("Too many new names in serialized messages", "exhausting the limit was not logged");
+  stop_grabbing_messages();
+
+  assert_log_message_value(msg, log_msg_get_value_handle("peer.value0"), "value");
+  assert_log_message_value(msg, log_msg_get_value_handle("peer.value1"), "value");
+  assert_true(log_tags_lookup_by_name("peer.tag0", &id) && log_msg_is_tag_by_id(msg, id), "tag within the limit was dropped");
+  assert_false(log_tags_lookup_by_name("peer.tag1", &id), "tag over the limit was registered");
+  log_msg_unref(msg);
+
+  /* names that are already known don't count */
+  msg = read_peer_message(stream, &new_names_left);
+  assert_log_message_value(msg, log_msg_get_value_handle("peer.value1"), "value");
+  assert_true(log_tags_lookup_by_name("peer.tag0", &id) && log_msg_is_tag_by_id(msg, id), "known tag was dropped");
+  assert_false(log_tags_lookup_by_name("peer.tag1", &id), "tag over the limit was registered");
+  log_msg_unref(msg);
+  g_string_free(stream, TRUE);
+
+  stream = serialize_peer_message(0, "other", 1);
+  msg = read_peer_message(stream, &new_names_left);
+  assert_gint(nv_registry_get_handle(logmsg_registry, "other.value0"), 0, "value over the limit was registered");
+  assert_false(log_tags_lookup_by_name("other.tag0", &id), "tag over the limit was registered");
+  testcase_end();
+
+  log_msg_unref(msg);
+  g_string_free(stream, TRUE);
+}
+
 int
 main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
 {
@@ -87,6 +332,12 @@ main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
   test_cloning_with_log_message(
       "<132>1 2006-10-29T01:59:59.156+01:00 mymachine evntslog - - [exampleSDID@0 iut=\"3\"] [eventSource=\"Application\" eventID=\"1011\"][examplePriority@0 class=\"high\"] BOMAn application event log entry...");
 
+  test_deserializing_addresses();
+  test_deserializing_flags();
+  test_deserializing_new_names();
+  test_serializing_log_message(
+      "<7>1 2006-10-29T01:59:59.156+01:00 mymachine.example.com evntslog - ID47 [exampleSDID@0 iut=\"3\" eventSource=\"Application\" eventID=\"1011\"][examplePriority@0 class=\"high\"] BOMAn application event log entry...");
+
   deinit_syslogformat_module();
   app_shutdown();
   return 0;
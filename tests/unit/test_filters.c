@@ -133,6 +133,34 @@ testcase(gchar *msg,
   filter_expr_unref(f);
 }
 
+void
+testcase_with_numeric_value(gchar *msg,
+                            const gchar *name,
+                            const gchar *value,
+                            gint64 numeric,
+                            FilterExprNode *f,
+                            gboolean expected_result)
+{
+  LogMessage *logmsg;
+  gboolean res;
+  static gint testno = 0;
+
+  testno++;
+  logmsg = log_msg_new(msg, strlen(msg), NULL, &parse_options);
+  logmsg->saddr = g_sockaddr_ref(sender_saddr);
+  log_msg_set_value_with_numeric(logmsg, log_msg_get_value_handle(name), value, -1, numeric);
+
+  res = filter_expr_eval(f, logmsg);
+  if (res != expected_result)
+    {
+      fprintf(stderr, "Filter test failed (numeric value); num='%d', msg='%s'\n", testno, msg);
+      exit(1);
+    }
+
+  log_msg_unref(logmsg);
+  filter_expr_unref(f);
+}
+
 void
 testcase_with_backref_chk(gchar *msg,
          FilterExprNode *f,
@@ -345,6 +373,21 @@ main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
   testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", fop_cmp_new(create_template("alma"), create_template("alma"), KW_GE), 1);
   testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", fop_cmp_new(create_template("alma"), create_template("alma"), KW_GT), 0);
 
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", fop_cmp_new(create_template("10"), create_template("9"), KW_NUM_LT), 0);
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", fop_cmp_new(create_template("10"), create_template("9"), KW_NUM_LE), 0);
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", fop_cmp_new(create_template("10"), create_template("9"), KW_NUM_EQ), 0);
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", fop_cmp_new(create_template("10"), create_template("9"), KW_NUM_NE), 1);
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", fop_cmp_new(create_template("10"), create_template("9"), KW_NUM_GE), 1);
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", fop_cmp_new(create_template("10"), create_template("9"), KW_NUM_GT), 1);
+
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", fop_cmp_new(create_template("$PID"), create_template("2499"), KW_NUM_EQ), 1);
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", fop_cmp_new(create_template("$PID"), create_template("300"), KW_NUM_GT), 1);
+  testcase("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", fop_cmp_new(create_template("$PID"), create_template("300"), KW_GT), 0);
+
+  testcase_with_numeric_value("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", "num", "32", 32, fop_cmp_new(create_template("$num"), create_template("31"), KW_NUM_GT), 1);
+  testcase_with_numeric_value("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", "num", "32", 32, fop_cmp_new(create_template("${num}"), create_template("32"), KW_NUM_EQ), 1);
+  testcase_with_numeric_value("<15>Oct 15 16:17:01 host openvpn[2499]: PTHREAD support initialized", "num", "32", 32, fop_cmp_new(create_template("$num"), create_template("33"), KW_NUM_GE), 0);
+
 
   testcase_with_backref_chk("<15>Oct 15 16:17:01 host openvpn[2499]: al fa", create_posix_regexp_filter(LM_V_MESSAGE, "(a)(l) (fa)", LMF_STORE_MATCHES), 1, "1","a");
 
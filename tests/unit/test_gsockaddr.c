@@ -0,0 +1,162 @@
+#include "testutils.h"
+#include "gsockaddr.h"
+#include "dnscache.h"
+#include "misc.h"
+#include "apphook.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string.h>
+
+static void
+fill_sockaddr_in(struct sockaddr_in *sin, const gchar *ip, guint16 port)
+{
+  memset(sin, 0, sizeof(*sin));
+  sin->sin_family = AF_INET;
+  sin->sin_port = htons(port);
+  inet_aton(ip, &sin->sin_addr);
+}
+
+static GSockAddr *
+intern_inet(GSockAddrInternTable *table, const gchar *ip, guint16 port)
+{
+  struct sockaddr_in sin;
+
+  fill_sockaddr_in(&sin, ip, port);
+  return g_sockaddr_intern(table, (struct sockaddr *) &sin, sizeof(sin));
+}
+
+static void
+assert_sockaddr_format(GSockAddr *addr, gint format, const gchar *expected)
+{
+  gchar buf[MAX_SOCKADDR_STRING];
+
+  assert_string(g_sockaddr_format(addr, buf, sizeof(buf), format), expected, "formatted address mismatch");
+}
+
+static void
+assert_resolved_sockaddr(GSockAddr *addr, const gchar *expected)
+{
+  gchar result[256];
+  gsize result_len = sizeof(result);
+
+  resolve_sockaddr(result, &result_len, addr, FALSE, FALSE, TRUE, FALSE);
+  assert_nstring(result, result_len, expected, -1, "address resolved with usedns(no) mismatch");
+}
+
+static void
+test_intern_returns_shared_instances(void)
+{
+  GSockAddrInternTable *table = g_sockaddr_intern_table_new(16);
+  GSockAddr *a, *b, *c;
+
+  testcase_begin("Testing that equal addresses are interned to the same instance");
+  a = intern_inet(table, "10.1.2.3", 514);
+  b = intern_inet(table, "10.1.2.3", 514);
+  c = intern_inet(table, "10.1.2.3", 515);
+  assert_true(a == b, "equal addresses were not interned to the same instance");
+  assert_true(a != c, "addresses with different ports were interned to the same instance");
+  assert_gint(g_sockaddr_inet_get_port(c), 515, "port of the interned address mismatch");
+  assert_sockaddr_format(a, GSA_FULL, "AF_INET(10.1.2.3:514)");
+  assert_sockaddr_format(c, GSA_ADDRESS_ONLY, "10.1.2.3");
+
+  /* the table holds a reference of its own, the returned ones stay valid */
+  g_sockaddr_unref(b);
+  g_sockaddr_intern_table_free(table);
+  assert_sockaddr_format(a, GSA_FULL, "AF_INET(10.1.2.3:514)");
+  testcase_end();
+
+  g_sockaddr_unref(a);
+  g_sockaddr_unref(c);
+}
+
+static void
+test_intern_table_is_emptied_when_full(void)
+{
+  GSockAddrInternTable *table = g_sockaddr_intern_table_new(2);
+  GSockAddr *a, *b, *c, *a2;
+
+  testcase_begin("Testing that a full intern table is emptied and its addresses stay valid");
+  a = intern_inet(table, "10.1.2.3", 1000);
+  b = intern_inet(table, "10.1.2.3", 1001);
+  c = intern_inet(table, "10.1.2.3", 1002);
+  a2 = intern_inet(table, "10.1.2.3", 1000);
+  assert_true(a != a2, "address was kept in the table after it was emptied");
+  assert_sockaddr_format(a, GSA_FULL, "AF_INET(10.1.2.3:1000)");
+  assert_sockaddr_format(a2, GSA_FULL, "AF_INET(10.1.2.3:1000)");
+  testcase_end();
+
+  g_sockaddr_unref(a);
+  g_sockaddr_unref(b);
+  g_sockaddr_unref(c);
+  g_sockaddr_unref(a2);
+  g_sockaddr_intern_table_free(table);
+}
+
+static void
+test_formatted_address_is_reused(void)
+{
+  GSockAddrInternTable *table = g_sockaddr_intern_table_new(16);
+  GSockAddr *interned, *plain;
+
+  testcase_begin("Testing that the format of interned addresses is reused");
+  plain = g_sockaddr_inet_new("10.1.2.3", 514);
+  assert_true(plain->formatted == NULL, "an address that is not interned has a cached format");
+
+  interned = intern_inet(table, "10.1.2.3", 514);
+  assert_not_null(interned->formatted, "the interned address has no cached format");
+  assert_string(interned->formatted, "10.1.2.3", "cached format mismatch");
+
+  /* tamper with the cache to see that it is used instead of formatting again */
+  g_strlcpy(interned->formatted, "cached", MAX_SOCKADDR_STRING);
+  assert_sockaddr_format(interned, GSA_ADDRESS_ONLY, "cached");
+  assert_sockaddr_format(interned, GSA_FULL, "AF_INET(10.1.2.3:514)");
+  assert_resolved_sockaddr(interned, "cached");
+  assert_resolved_sockaddr(plain, "10.1.2.3");
+  testcase_end();
+
+  g_sockaddr_unref(interned);
+  g_sockaddr_unref(plain);
+  g_sockaddr_intern_table_free(table);
+}
+
+static void
+test_resolve_without_dns_skips_the_cache(void)
+{
+  GSockAddrInternTable *table = g_sockaddr_intern_table_new(16);
+  GSockAddr *interned, *plain;
+  const gchar *hostname = NULL;
+  gboolean positive;
+  struct in_addr ia;
+
+  testcase_begin("Testing that usedns(no) resolves to the address without storing it in the DNS cache");
+  interned = intern_inet(table, "10.4.5.6", 514);
+  plain = g_sockaddr_inet_new("10.4.5.7", 514);
+  assert_resolved_sockaddr(interned, "10.4.5.6");
+  assert_resolved_sockaddr(plain, "10.4.5.7");
+
+  inet_aton("10.4.5.6", &ia);
+  assert_false(dns_cache_lookup(AF_INET, &ia, &hostname, &positive), "the address of an interned sender was stored in the DNS cache");
+  inet_aton("10.4.5.7", &ia);
+  assert_false(dns_cache_lookup(AF_INET, &ia, &hostname, &positive), "the address of a sender was stored in the DNS cache");
+  testcase_end();
+
+  g_sockaddr_unref(interned);
+  g_sockaddr_unref(plain);
+  g_sockaddr_intern_table_free(table);
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+
+  test_intern_returns_shared_instances();
+  test_intern_table_is_emptied_when_full();
+  test_formatted_address_is_reused();
+  test_resolve_without_dns_skips_the_cache();
+
+  app_shutdown();
+  return 0;
+}
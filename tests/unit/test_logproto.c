@@ -1,9 +1,17 @@
 #include "mock-transport.h"
 #include "logproto.h"
 #include "msg_parse_lib.h"
+#include "misc.h"
+#include "timeutils.h"
 
 #include "apphook.h"
 
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <unistd.h>
+
 void
 assert_proto_status(LogProto *proto, LogProtoStatus status, LogProtoStatus expected_status)
 {
@@ -501,6 +509,74 @@ test_log_proto_text_server_multi_read(void)
   log_proto_free(proto);
 }
 
+static void
+test_log_proto_text_server_release_idle_buffer(void)
+{
+  LogProto *proto;
+
+  /* the mock transport returns EAGAIN between reads, the buffer is
+   * returned to the pool whenever it is empty, but partial lines must
+   * survive */
+  proto = log_proto_text_server_new(
+            log_transport_mock_new(
+              FALSE,
+              "foobar\n", -1,
+              "foo", -1,
+              "baz\nbar", -1,
+              "qux\n", -1,
+              LTM_EOF),
+            32, LPBS_RELEASE_IDLE_BUFFER);
+  assert_proto_fetch(proto, "foobar", -1);
+  assert_proto_fetch(proto, "foobaz", -1);
+  assert_proto_fetch(proto, "barqux", -1);
+  assert_proto_fetch_failure(proto, LPS_EOF, NULL);
+  log_proto_free(proto);
+
+  /* the buffer is grown during the conversion */
+  proto = log_proto_text_server_new(
+            log_transport_mock_new(
+              FALSE,
+              "\xe1\x72\x76\xed\x7a\x74\xfb\x72\n", -1,
+              "\xf5\x74\xfc\x6b\xf6\x72\n", -1,
+              LTM_EOF),
+            8, LPBS_RELEASE_IDLE_BUFFER);
+  log_proto_set_encoding(proto, "iso-8859-2");
+  assert_proto_fetch(proto, "árvíztűr", -1);
+  assert_proto_fetch(proto, "őtükör", -1);
+  assert_proto_fetch_failure(proto, LPS_EOF, NULL);
+  log_proto_free(proto);
+}
+
+static void
+test_log_proto_text_server_buffer_stats(void)
+{
+  LogProtoBufferStats *buffer_stats = log_proto_buffer_stats_new();
+  LogProto *proto;
+
+  log_proto_buffer_stats_register(buffer_stats, 0, SCS_TCP | SCS_SOURCE, "test_buffer_stats");
+  assert_not_null(buffer_stats->in_use, "receive_buffers counter not registered");
+
+  proto = log_proto_text_server_new(
+            log_transport_mock_new(
+              FALSE,
+              "foo", -1,
+              "bar\n", -1,
+              LTM_EOF),
+            32, LPBS_RELEASE_IDLE_BUFFER);
+  log_proto_set_buffer_stats(proto, buffer_stats);
+
+  /* the buffer is held while a partial line is pending */
+  assert_proto_fetch_single_read(proto, NULL, -1);
+  assert_true(stats_counter_get(buffer_stats->in_use) > 0, "receive buffer holding a partial line is not accounted");
+  assert_proto_fetch(proto, "foobar", -1);
+  assert_proto_fetch_failure(proto, LPS_EOF, NULL);
+  log_proto_free(proto);
+  assert_gint(stats_counter_get(buffer_stats->in_use), 0, "receive buffer is still accounted after free");
+
+  log_proto_buffer_stats_unregister(buffer_stats, SCS_TCP | SCS_SOURCE, "test_buffer_stats");
+  log_proto_buffer_stats_unref(buffer_stats);
+}
+
 static void
 test_log_proto_text_server(void)
 {
@@ -511,6 +587,8 @@ test_log_proto_text_server(void)
   test_log_proto_text_server_ucs4();
   test_log_proto_text_server_iso8859_2();
   test_log_proto_text_server_multi_read();
+  test_log_proto_text_server_release_idle_buffer();
+  test_log_proto_text_server_buffer_stats();
 }
 
 /****************************************************************************************
@@ -656,6 +734,194 @@ test_log_proto_dgram_server(void)
   test_log_proto_dgram_server_eof_handling();
 }
 
+/****************************************************************************************
+ * Receive timestamps
+ ****************************************************************************************/
+
+/* what LogReader does with a fetched message */
+static LogMessage *
+new_received_message(LogProto *proto, const gchar *msg)
+{
+  GTimeVal recvd;
+
+  return log_msg_new_received(msg, strlen(msg), NULL,
+                              log_proto_get_recvd(proto, &recvd) ? &recvd : NULL,
+                              &parse_options);
+}
+
+static void
+assert_msg_received_between(LogMessage *msg, GTimeVal *start, GTimeVal *end)
+{
+  GTimeVal stamp;
+
+  stamp.tv_sec = msg->timestamps[LM_TS_RECVD].tv_sec;
+  stamp.tv_usec = msg->timestamps[LM_TS_RECVD].tv_usec;
+  assert_true(g_time_val_diff(&stamp, start) >= 0 && g_time_val_diff(end, &stamp) >= 0,
+              "receive time is out of range, recvd=%ld.%06ld, start=%ld.%06ld, end=%ld.%06ld",
+              stamp.tv_sec, stamp.tv_usec, start->tv_sec, start->tv_usec, end->tv_sec, end->tv_usec);
+}
+
+static void
+test_log_proto_dgram_server_kernel_timestamp(void)
+{
+#ifdef SO_TIMESTAMPNS
+  LogProto *proto;
+  LogMessage *msg;
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof(addr);
+  GTimeVal sent, fetched;
+  gint server, client, on = 1;
+
+  server = socket(AF_INET, SOCK_DGRAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  assert_gint(bind(server, (struct sockaddr *) &addr, sizeof(addr)), 0, "bind() failed");
+  assert_gint(getsockname(server, (struct sockaddr *) &addr, &addrlen), 0, "getsockname() failed");
+  assert_gint(setsockopt(server, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)), 0, "setsockopt(SO_TIMESTAMPNS) failed");
+  proto = log_proto_dgram_server_new(log_transport_plain_new(server, LTF_RECV), 1024, 0);
+
+  client = socket(AF_INET, SOCK_DGRAM, 0);
+  g_get_current_time(&sent);
+  assert_gint(sendto(client, "foo", 3, 0, (struct sockaddr *) &addr, addrlen), 3, "sendto() failed");
+
+  /* the datagram waits in the socket buffer, its receive time must
+   * precede the fetch by about as much, not be the time of the fetch */
+  g_usleep(200000);
+  g_get_current_time(&fetched);
+  g_time_val_add(&fetched, -100000);
+
+  assert_proto_fetch(proto, "foo", -1);
+  msg = new_received_message(proto, "foo");
+  assert_msg_received_between(msg, &sent, &fetched);
+  log_msg_unref(msg);
+
+  log_proto_free(proto);
+  close(client);
+#endif
+}
+
+static void
+test_log_proto_text_server_current_time(void)
+{
+  LogProto *proto;
+  LogMessage *msg;
+  GTimeVal recvd, start, end;
+  gint pair[2];
+
+  socketpair(PF_UNIX, SOCK_STREAM, 0, pair);
+  assert_gint(write(pair[0], "foo\n", 4), 4, "write() failed");
+  proto = log_proto_text_server_new(log_transport_plain_new(pair[1], 0), 1024, 0);
+
+  assert_proto_fetch(proto, "foo", -1);
+  assert_false(log_proto_get_recvd(proto, &recvd), "stream transport reported a kernel receive time");
+
+  /* the cached time is only refreshed by the main loop */
+  invalidate_cached_time();
+  g_get_current_time(&start);
+  msg = new_received_message(proto, "foo");
+  g_get_current_time(&end);
+  assert_msg_received_between(msg, &start, &end);
+  log_msg_unref(msg);
+
+  log_proto_free(proto);
+  close(pair[0]);
+}
+
+static void
+test_log_proto_recvd(void)
+{
+  test_log_proto_dgram_server_kernel_timestamp();
+  test_log_proto_text_server_current_time();
+}
+
+/****************************************************************************************
+ * LogProtoDGramClient
+ ****************************************************************************************/
+
+static void
+assert_proto_post(LogProto *proto, const gchar *msg)
+{
+  gboolean consumed = FALSE;
+  LogProtoStatus status;
+
+  status = log_proto_post(proto, (guchar *) g_strdup(msg), strlen(msg), &consumed);
+  assert_proto_status(proto, status, LPS_SUCCESS);
+  assert_true(consumed, "LogProtoDGramClient didn't consume a message while it had space");
+}
+
+static void
+assert_dgram_received(gint fd, const gchar *expected_msg)
+{
+  gchar buf[128];
+  gssize len;
+
+  len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+  assert_nstring(buf, len, expected_msg, strlen(expected_msg), "LogProtoDGramClient sent datagram mismatch");
+}
+
+static void
+test_log_proto_dgram_client_batching(void)
+{
+  LogProto *proto;
+  gint pair[2];
+  gchar buf[16];
+
+  socketpair(PF_UNIX, SOCK_DGRAM, 0, pair);
+  proto = log_proto_dgram_client_new(log_transport_plain_new(pair[0], 0), 3);
+
+  assert_true(log_proto_has_delayed_ack(proto), "LogProtoDGramClient should ack messages only after sending them");
+  assert_proto_post(proto, "foo");
+  assert_proto_post(proto, "bar");
+  assert_proto_post(proto, "baz");
+  assert_gint(log_proto_take_sent(proto), 0, "messages were sent before the batch was flushed");
+  assert_true(recv(pair[1], buf, sizeof(buf), MSG_DONTWAIT) < 0, "a datagram was sent before the batch was flushed");
+
+  /* the buffer is full, posting one more sends the batch */
+  assert_proto_post(proto, "quux");
+  assert_gint(log_proto_take_sent(proto), 3, "the full batch was not sent");
+  assert_gint(log_proto_take_sent(proto), 0, "the number of sent messages is not reset");
+
+  assert_proto_status(proto, log_proto_flush(proto), LPS_SUCCESS);
+  assert_gint(log_proto_take_sent(proto), 1, "the partial batch was not sent on flush");
+
+  /* each message is a separate datagram */
+  assert_dgram_received(pair[1], "foo");
+  assert_dgram_received(pair[1], "bar");
+  assert_dgram_received(pair[1], "baz");
+  assert_dgram_received(pair[1], "quux");
+  log_proto_free(proto);
+  close(pair[1]);
+}
+
+static void
+test_log_proto_dgram_client_io_error(void)
+{
+  LogProto *proto;
+  gint pair[2];
+
+  socketpair(PF_UNIX, SOCK_DGRAM, 0, pair);
+  proto = log_proto_dgram_client_new(log_transport_plain_new(pair[0], 0), 2);
+
+  close(pair[1]);
+  assert_proto_post(proto, "foo");
+  start_grabbing_messages();
+  assert_proto_status(proto, log_proto_flush(proto), LPS_ERROR);
+  assert_grabbed_messages_contain("I/O error occurred while writing", "expected error message didn't show up");
+  stop_grabbing_messages();
+
+  /* the message is kept in the buffer, it was not sent */
+  assert_gint(log_proto_take_sent(proto), 0, "a message was reported sent in spite of an error");
+  log_proto_free(proto);
+}
+
+static void
+test_log_proto_dgram_client(void)
+{
+  test_log_proto_dgram_client_batching();
+  test_log_proto_dgram_client_io_error();
+}
+
 /****************************************************************************************
  * LogProtoFramedServer
  ****************************************************************************************/
@@ -835,6 +1101,126 @@ test_log_proto_framed_server(void)
   test_log_proto_framed_server_multi_read();
 }
 
+/****************************************************************************************
+ * LogProtoRelayClient & LogProtoRelayServer
+ ****************************************************************************************/
+
+static void
+relay_socketpair(gint pair[2])
+{
+  socketpair(PF_UNIX, SOCK_STREAM, 0, pair);
+  g_fd_set_nonblock(pair[0], TRUE);
+  g_fd_set_nonblock(pair[1], TRUE);
+}
+
+static void
+test_log_proto_relay_batches_and_acks(void)
+{
+  LogProto *client, *server;
+  gint pair[2];
+
+  relay_socketpair(pair);
+  client = log_proto_relay_client_new(log_transport_plain_new(pair[0], 0), 2, 4);
+  server = log_proto_relay_server_new(log_transport_plain_new(pair[1], 0));
+
+  assert_true(log_proto_has_delayed_ack(client), "LogProtoRelayClient should ack messages only after the server acknowledged them");
+
+  /* the first batch is sent as soon as it is full */
+  assert_proto_post(client, "foo");
+  assert_proto_post(client, "bar");
+  assert_proto_post(client, "");
+  assert_gint(log_proto_take_sent(client), 0, "messages were acked before the server acknowledged them");
+
+  assert_proto_fetch(server, "foo", -1);
+  log_proto_queued(server);
+  assert_proto_fetch(server, "bar", -1);
+  log_proto_queued(server);
+
+  /* flush sends the partial batch and reads the acknowledgement of the first one */
+  assert_proto_status(client, log_proto_flush(client), LPS_SUCCESS);
+  assert_gint(log_proto_take_sent(client), 2, "the acknowledged batch was not reported as sent");
+  assert_gint(log_proto_take_sent(client), 0, "the number of sent messages is not reset");
+
+  assert_proto_fetch(server, "", 0);
+  log_proto_queued(server);
+  assert_proto_status(client, log_proto_flush(client), LPS_SUCCESS);
+  assert_gint(log_proto_take_sent(client), 1, "the partial batch was not acknowledged");
+
+  log_proto_free(client);
+  log_proto_free(server);
+}
+
+static void
+test_log_proto_relay_client_window_full(void)
+{
+  LogProto *client, *server;
+  gboolean consumed = TRUE;
+  gint pair[2];
+
+  relay_socketpair(pair);
+  client = log_proto_relay_client_new(log_transport_plain_new(pair[0], 0), 1, 1);
+  server = log_proto_relay_server_new(log_transport_plain_new(pair[1], 0));
+
+  assert_proto_post(client, "foo");
+  /* "bar" fills the next batch, which can't be closed while "foo" is unacknowledged */
+  assert_proto_post(client, "bar");
+  assert_proto_status(client, log_proto_post(client, (guchar *) "baz", 3, &consumed), LPS_SUCCESS);
+  assert_false(consumed, "LogProtoRelayClient consumed a message while its window was full");
+
+  assert_proto_fetch(server, "foo", -1);
+  log_proto_queued(server);
+  assert_proto_post(client, "baz");
+  assert_gint(log_proto_take_sent(client), 1, "the acknowledged batch was not reported as sent");
+
+  assert_proto_fetch(server, "bar", -1);
+  log_proto_queued(server);
+  assert_proto_status(client, log_proto_flush(client), LPS_SUCCESS);
+  assert_proto_fetch(server, "baz", -1);
+  log_proto_queued(server);
+  assert_proto_status(client, log_proto_flush(client), LPS_SUCCESS);
+  assert_gint(log_proto_take_sent(client), 2, "the acknowledged batches were not reported as sent");
+
+  log_proto_free(client);
+  log_proto_free(server);
+}
+
+static void
+test_log_proto_relay_server_invalid_header(void)
+{
+  LogProto *proto;
+
+  proto = log_proto_relay_server_new(
+            log_transport_mock_new(
+              TRUE,
+              "SNGX\0\0\0\0\0\0\0\1\0\0\0\4\0\0\0\0", 20,
+              LTM_EOF));
+  assert_proto_fetch_failure(proto, LPS_ERROR, "Invalid batch header received from relay peer");
+  log_proto_free(proto);
+}
+
+static void
+test_log_proto_relay_server_invalid_length(void)
+{
+  LogProto *proto;
+
+  proto = log_proto_relay_server_new(
+            log_transport_mock_new(
+              TRUE,
+              "SNGB\0\0\0\0\0\0\0\1\0\0\0\6\0\0\0\3ab", 22,
+              LTM_EOF));
+  assert_proto_fetch_failure(proto, LPS_ERROR, "Invalid message length in relay batch");
+  log_proto_free(proto);
+}
+
+static void
+test_log_proto_relay(void)
+{
+  test_log_proto_relay_batches_and_acks();
+  test_log_proto_relay_client_window_full();
+  test_log_proto_relay_server_invalid_header();
+  test_log_proto_relay_server_invalid_length();
+}
+
 static void
 test_log_proto(void)
 {
@@ -864,7 +1250,10 @@ test_log_proto(void)
   test_log_proto_record_server();
   test_log_proto_text_server();
   test_log_proto_dgram_server();
+  test_log_proto_recvd();
+  test_log_proto_dgram_client();
   test_log_proto_framed_server();
+  test_log_proto_relay();
 }
 
 
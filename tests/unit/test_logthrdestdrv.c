@@ -0,0 +1,248 @@
+#include "testutils.h"
+#include "logthrdestdrv.h"
+#include "logmsg.h"
+#include "apphook.h"
+#include "cfg.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NUM_MESSAGES 10
+
+/*
+ * A destination that records the batches it gets. The worker is held
+ * back in connect() until all messages are queued, so the batches don't
+ * depend on timing.
+ */
+typedef struct _TestThrDestDriver
+{
+  LogThrDestDriver super;
+  const gchar *bad_message;
+  gint not_connected_batches;
+
+  GMutex *lock;
+  GCond *start_cond;
+  gboolean started;
+  gint connects;
+  GString *batches;
+  GString *delivered;
+} TestThrDestDriver;
+
+static gint acked_messages;
+static gint test_dd_instances;
+
+static void
+test_ack(LogMessage *msg, gpointer user_data)
+{
+  g_atomic_int_inc(&acked_messages);
+}
+
+static gboolean
+test_dd_connect(LogThrDestWorker *s)
+{
+  TestThrDestDriver *self = (TestThrDestDriver *) s->owner;
+
+  g_mutex_lock(self->lock);
+  while (!self->started)
+    g_cond_wait(self->start_cond, self->lock);
+  self->connects++;
+  g_mutex_unlock(self->lock);
+  return TRUE;
+}
+
+static LogThrDestResult
+test_dd_insert(LogThrDestWorker *s, LogMessage **msgs, gint msgs_len, gint *delivered)
+{
+  TestThrDestDriver *self = (TestThrDestDriver *) s->owner;
+  LogThrDestResult result = LTD_SUCCESS;
+  gint i;
+
+  g_mutex_lock(self->lock);
+  g_string_append_printf(self->batches, "%d,", msgs_len);
+  if (self->not_connected_batches > 0)
+    {
+      self->not_connected_batches--;
+      *delivered = 0;
+      result = LTD_NOT_CONNECTED;
+      goto exit;
+    }
+
+  for (i = 0; i < msgs_len; i++)
+    {
+      const gchar *value = log_msg_get_value(msgs[i], LM_V_MESSAGE, NULL);
+
+      if (self->bad_message && strcmp(value, self->bad_message) == 0)
+        {
+          *delivered = i;
+          result = LTD_ERROR;
+          goto exit;
+        }
+      g_string_append_printf(self->delivered, "%s,", value);
+    }
+ exit:
+  g_mutex_unlock(self->lock);
+  return result;
+}
+
+static const gchar *
+test_dd_format_stats_instance(LogThrDestDriver *s)
+{
+  return "test";
+}
+
+static const gchar *
+test_dd_format_persist_name(LogThrDestDriver *s, gint worker_index)
+{
+  return NULL;
+}
+
+static void
+test_dd_free(LogPipe *s)
+{
+  TestThrDestDriver *self = (TestThrDestDriver *) s;
+
+  g_mutex_free(self->lock);
+  g_cond_free(self->start_cond);
+  g_string_free(self->batches, TRUE);
+  g_string_free(self->delivered, TRUE);
+  log_threaded_dest_driver_free(s);
+}
+
+static TestThrDestDriver *
+test_dd_new(void)
+{
+  TestThrDestDriver *self = g_new0(TestThrDestDriver, 1);
+
+  log_threaded_dest_driver_init_instance(&self->super);
+  self->super.super.super.super.free_fn = test_dd_free;
+  /* stats counters outlive the driver, so each one gets its own */
+  self->super.super.super.group = g_strdup("d_test");
+  self->super.super.super.id = g_strdup_printf("d_test#%d", test_dd_instances++);
+  self->super.worker.connect = test_dd_connect;
+  self->super.worker.insert = test_dd_insert;
+  self->super.format_stats_instance = test_dd_format_stats_instance;
+  self->super.format_persist_name = test_dd_format_persist_name;
+  self->super.stats_source = SCS_SQL;
+  /* don't wait between retries */
+  self->super.time_reopen = 0;
+
+  self->lock = g_mutex_new();
+  self->start_cond = g_cond_new();
+  self->batches = g_string_new("");
+  self->delivered = g_string_new("");
+  return self;
+}
+
+static void
+queue_messages(TestThrDestDriver *self)
+{
+  LogPathOptions path_options = LOG_PATH_OPTIONS_INIT;
+  gint i;
+
+  path_options.flow_control_requested = TRUE;
+  for (i = 0; i < NUM_MESSAGES; i++)
+    {
+      LogMessage *msg = log_msg_new_empty();
+      gchar value[16];
+
+      g_snprintf(value, sizeof(value), "m%d", i);
+      log_msg_set_value(msg, LM_V_MESSAGE, value, -1);
+      log_msg_add_ack(msg, &path_options);
+      msg->ack_func = test_ack;
+      log_pipe_queue(&self->super.super.super.super, msg, &path_options);
+    }
+
+  g_mutex_lock(self->lock);
+  self->started = TRUE;
+  g_cond_broadcast(self->start_cond);
+  g_mutex_unlock(self->lock);
+}
+
+static void
+wait_for_acks(gint expected)
+{
+  struct timespec ns;
+  gint slept = 0;
+
+  /* sleep 1 msec at a time, for at most 10 seconds */
+  ns.tv_sec = 0;
+  ns.tv_nsec = 1000000;
+  while (g_atomic_int_get(&acked_messages) < expected && slept++ < 10000)
+    nanosleep(&ns, NULL);
+  assert_gint(g_atomic_int_get(&acked_messages), expected, "not all messages were acked");
+}
+
+static void
+run_testcase(TestThrDestDriver *self, const gchar *expected_batches, const gchar *expected_delivered,
+             gint expected_dropped, gint expected_connects)
+{
+  acked_messages = 0;
+  self->super.batch_lines = 5;
+  assert_true(log_pipe_init(&self->super.super.super.super, configuration), "error initializing driver");
+
+  queue_messages(self);
+  wait_for_acks(NUM_MESSAGES);
+
+  /* the counters are unregistered by deinit; dropped is incremented
+   * before the message is acked, unlike processed */
+  assert_gint(stats_counter_get(self->super.dropped_messages), expected_dropped, "dropped counter mismatch");
+  log_pipe_deinit(&self->super.super.super.super);
+
+  assert_string(self->batches->str, expected_batches, "batches mismatch");
+  assert_string(self->delivered->str, expected_delivered, "delivered messages mismatch");
+  assert_gint(self->connects, expected_connects, "number of connects mismatch");
+  log_pipe_unref(&self->super.super.super.super);
+}
+
+static void
+test_batches_are_delivered(void)
+{
+  TestThrDestDriver *self = test_dd_new();
+
+  testcase_begin("Testing delivery in batches");
+  run_testcase(self, "5,5,", "m0,m1,m2,m3,m4,m5,m6,m7,m8,m9,", 0, 1);
+  testcase_end();
+}
+
+static void
+test_bad_message_is_dropped_after_retries(void)
+{
+  TestThrDestDriver *self = test_dd_new();
+
+  testcase_begin("Testing one-by-one retries of a failed batch");
+  self->bad_message = "m2";
+  log_threaded_dest_driver_set_retries(&self->super.super.super, 3);
+
+  /* the delivered part of the batch is acked, the rest is retried one
+   * by one: m2 fails three times and is dropped, then m3 and m4 are
+   * sent alone before batching resumes */
+  run_testcase(self, "5,1,1,1,1,1,5,", "m0,m1,m3,m4,m5,m6,m7,m8,m9,", 1, 1);
+  testcase_end();
+}
+
+static void
+test_batch_is_rewound_on_disconnect(void)
+{
+  TestThrDestDriver *self = test_dd_new();
+
+  testcase_begin("Testing rewinding a batch when the connection is lost");
+  self->not_connected_batches = 1;
+  run_testcase(self, "5,5,5,", "m0,m1,m2,m3,m4,m5,m6,m7,m8,m9,", 0, 2);
+  testcase_end();
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+  configuration = cfg_new(0x0302);
+
+  test_batches_are_delivered();
+  test_bad_message_is_dropped_after_retries();
+  test_batch_is_rewound_on_disconnect();
+
+  cfg_free(configuration);
+  app_shutdown();
+  return 0;
+}
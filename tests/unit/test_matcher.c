@@ -141,6 +141,16 @@ main()
 
   testcase_replace("<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: abcdef", "ABCDEF", "qwerty", "qwerty", LMF_PREFIX | LMF_ICASE, log_matcher_string_new());
   testcase_replace("<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: abcdef", "BCD", "qwerty", "aqwertyef", LMF_SUBSTRING | LMF_ICASE, log_matcher_string_new());
+  testcase_replace("<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: abcabcABCabc", "aBc", "#", "####", LMF_SUBSTRING | LMF_ICASE | LMF_GLOBAL, log_matcher_string_new());
+  testcase_replace("<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: abcabcABCabc", "abc", "#", "##ABC#", LMF_SUBSTRING | LMF_GLOBAL, log_matcher_string_new());
+  testcase_match("<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: Connection refused from peer", "REFUSED FROM", LMF_SUBSTRING | LMF_ICASE, TRUE, log_matcher_string_new());
+  testcase_match("<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: Connection refused from peer", "refused from", LMF_SUBSTRING, TRUE, log_matcher_string_new());
+  testcase_match("<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: Connection refused from peer", "REFUSED FROM", LMF_SUBSTRING, FALSE, log_matcher_string_new());
+  testcase_match("<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: Connection refused from peer", "peer", LMF_SUBSTRING, TRUE, log_matcher_string_new());
+  testcase_match("<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: Connection refused from peer", "Conn", LMF_SUBSTRING, TRUE, log_matcher_string_new());
+  /* the non-zero terminated value is followed by AAAA in the underlying buffer, it must not be matched */
+  testcase_match("<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: Connection refused from peer", "peerA", LMF_SUBSTRING, FALSE, log_matcher_string_new());
+  testcase_match("<155>2006-02-11T10:34:56+01:00 bzorp syslog-ng[23323]: Connection refused from peer", "PEERa", LMF_SUBSTRING | LMF_ICASE, FALSE, log_matcher_string_new());
 
   /* glob match */
 
@@ -0,0 +1,120 @@
+#include "syslog-ng.h"
+#include "logmsg.h"
+#include "logmatcher.h"
+#include "templates.h"
+#include "apphook.h"
+#include "cfg.h"
+#include "plugin.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+MsgFormatOptions parse_options;
+
+#define BENCHMARK_COUNT 100000
+
+static LogMessage *
+create_message(const gchar *msg_str)
+{
+  LogMessage *msg;
+  GSockAddr *sa;
+
+  sa = g_sockaddr_inet_new("10.10.10.10", 1010);
+  msg = log_msg_new(msg_str, strlen(msg_str), sa, &parse_options);
+  g_sockaddr_unref(sa);
+  return msg;
+}
+
+void
+testcase_match(const gchar *type, const gchar *msg_str, const gchar *pattern, gint matcher_flags)
+{
+  LogMatcher *m;
+  LogMessage *msg;
+  const gchar *value;
+  gssize value_len;
+  GTimeVal start, end;
+  gint i;
+
+  msg = create_message(msg_str);
+  m = log_matcher_new(type);
+  log_matcher_set_flags(m, matcher_flags);
+  log_matcher_compile(m, pattern);
+
+  value = log_msg_get_value(msg, LM_V_MESSAGE, &value_len);
+  g_get_current_time(&start);
+  for (i = 0; i < BENCHMARK_COUNT; i++)
+    {
+      log_matcher_match(m, msg, LM_V_MESSAGE, value, value_len);
+    }
+  g_get_current_time(&end);
+  printf("match   %-6s flags=0x%04x %-50s speed: %12.3f msg/sec\n", type, matcher_flags, pattern, i * 1e6 / g_time_val_diff(&end, &start));
+
+  log_matcher_unref(m);
+  log_msg_unref(msg);
+}
+
+void
+testcase_replace(const gchar *type, const gchar *msg_str, const gchar *pattern, const gchar *replacement, gint matcher_flags)
+{
+  LogMatcher *m;
+  LogMessage *msg;
+  LogTemplate *r;
+  const gchar *value;
+  gssize value_len, new_len;
+  GTimeVal start, end;
+  gint i;
+
+  msg = create_message(msg_str);
+  m = log_matcher_new(type);
+  log_matcher_set_flags(m, matcher_flags);
+  log_matcher_compile(m, pattern);
+
+  r = log_template_new(configuration, NULL);
+  log_template_compile(r, replacement, NULL);
+
+  value = log_msg_get_value(msg, LM_V_MESSAGE, &value_len);
+  g_get_current_time(&start);
+  for (i = 0; i < BENCHMARK_COUNT; i++)
+    {
+      g_free(log_matcher_replace(m, msg, LM_V_MESSAGE, value, value_len, r, &new_len));
+    }
+  g_get_current_time(&end);
+  printf("replace %-6s flags=0x%04x %-50s speed: %12.3f msg/sec\n", type, matcher_flags, pattern, i * 1e6 / g_time_val_diff(&end, &start));
+
+  log_template_unref(r);
+  log_matcher_unref(m);
+  log_msg_unref(msg);
+}
+
+#define MSG_STR "<155>2006-02-11T10:34:56+01:00 bzorp sshd[23323]: Accepted publickey for bazsi from 10.20.30.40 port 51234 ssh2"
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+
+  configuration = cfg_new(0x0302);
+  plugin_load_module("syslogformat", configuration, NULL);
+  msg_format_options_defaults(&parse_options);
+  msg_format_options_init(&parse_options, configuration);
+
+  testcase_match("posix", MSG_STR, "publickey for ([a-z]+) from", 0);
+  testcase_match("posix", MSG_STR, "nomatch[0-9]+", 0);
+  testcase_match("string", MSG_STR, "10.20.30.40", LMF_SUBSTRING);
+  testcase_match("string", MSG_STR, "ACCEPTED", LMF_SUBSTRING | LMF_ICASE);
+  testcase_match("string", MSG_STR, "Accepted", LMF_PREFIX);
+#if ENABLE_PCRE
+  testcase_match("pcre", MSG_STR, "publickey for ([a-z]+) from", 0);
+  testcase_match("pcre", MSG_STR, "publickey for ([a-z]+) from", LMF_STORE_MATCHES);
+  testcase_match("pcre", MSG_STR, "(?<user>[a-z]+) from (?<ip>[0-9.]+) port (?<port>[0-9]+)", LMF_STORE_MATCHES);
+  testcase_match("pcre", MSG_STR, "nomatch[0-9]+", 0);
+  testcase_match("pcre", MSG_STR, "ACCEPTED", LMF_ICASE);
+  testcase_replace("pcre", MSG_STR, "([0-9]+)\\.([0-9]+)\\.([0-9]+)\\.([0-9]+)", "$1.$2.x.x", 0);
+  testcase_replace("pcre", MSG_STR, "[0-9]", "#", LMF_GLOBAL);
+#endif
+  testcase_replace("string", MSG_STR, "bazsi", "user", LMF_SUBSTRING | LMF_GLOBAL);
+
+  app_shutdown();
+  return 0;
+}
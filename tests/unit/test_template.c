@@ -6,6 +6,7 @@
 #include "cfg.h"
 #include "timeutils.h"
 #include "plugin.h"
+#include "logwriter.h"
 
 #include <time.h>
 #include <stdlib.h>
@@ -73,6 +74,85 @@ testcase_failure(gchar *template, const gchar *expected_error)
   log_template_unref(templ);
 }
 
+void
+testcase_cached(LogMessage *msg, gchar *template, gchar *expected, gboolean cacheable)
+{
+  LogTemplate *templ;
+  GString *res = g_string_sized_new(128);
+  gint i;
+
+  templ = log_template_new(configuration, "dummy");
+  log_template_compile(templ, template, NULL);
+  if ((templ->cache_id != 0) != cacheable)
+    {
+      fprintf(stderr, "FAIL: template cacheability mismatch, template=%s, expected=%d\n", template, cacheable);
+      success = FALSE;
+    }
+
+  /* two destinations sharing the same template */
+  log_template_add_user(templ);
+  log_template_add_user(templ);
+  for (i = 0; i < 2; i++)
+    {
+      log_template_format_cached(templ, msg, NULL, LTZ_LOCAL, 999, NULL, res);
+      if (strcmp(res->str, expected) != 0)
+        {
+          fprintf(stderr, "FAIL: cached template test failed, template=%s, round=%d, [%s] <=> [%s]\n", template, i, res->str, expected);
+          success = FALSE;
+        }
+      if ((msg->format_cache != NULL) != cacheable)
+        {
+          fprintf(stderr, "FAIL: cached template output was not memoized as expected, template=%s\n", template);
+          success = FALSE;
+        }
+    }
+  log_template_remove_user(templ);
+  log_template_remove_user(templ);
+
+  /* changing the message drops the memoized output */
+  log_msg_set_value(msg, log_msg_get_value_handle("APP.CACHED"), "", -1);
+  if (msg->format_cache)
+    {
+      fprintf(stderr, "FAIL: cached template output was not dropped on change, template=%s\n", template);
+      success = FALSE;
+    }
+  log_template_unref(templ);
+  g_string_free(res, TRUE);
+}
+
+static void
+testcase_writer_options_users(void)
+{
+  LogWriterOptions options;
+  LogTemplate *templ;
+  gint i;
+
+  templ = log_template_new(configuration, "dummy");
+  log_template_compile(templ, "$HOST $MSG", NULL);
+
+  log_writer_options_defaults(&options);
+  options.template = log_template_ref(templ);
+
+  /* a reinitialized destination still counts as a single user */
+  for (i = 0; i < 3; i++)
+    {
+      log_writer_options_init(&options, configuration, 0);
+      if (templ->num_users != 1)
+        {
+          fprintf(stderr, "FAIL: template users mismatch after options init, round=%d, num_users=%d\n", i, templ->num_users);
+          success = FALSE;
+        }
+    }
+
+  log_writer_options_destroy(&options);
+  if (templ->num_users != 0)
+    {
+      fprintf(stderr, "FAIL: template users mismatch after options destroy, num_users=%d\n", templ->num_users);
+      success = FALSE;
+    }
+  log_template_unref(templ);
+}
+
 GCond *thread_ping;
 GMutex *thread_lock;
 gboolean thread_start;
@@ -371,6 +451,13 @@ main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
   testcase(msg, "$(grep 'facility(local3)' $PID)@1", "23323");
   testcase(msg, "$(grep 'facility(local3)' $PID)@2", "");
 
+  /* output memoized on the message */
+  testcase_cached(msg, "alma $HOST bela", "alma bzorp bela", TRUE);
+  testcase_cached(msg, "kukac $DATE ${APP.VALUE} mukac", "kukac Feb 11 10:34:56.000 value mukac", TRUE);
+  testcase_cached(msg, "$SEQNUM", "999", FALSE);
+  testcase_cached(msg, "$(echo $HOST)", "bzorp", FALSE);
+  testcase_writer_options_users();
+
   /* multi-threaded expansion */
 
   /* name-value pair */
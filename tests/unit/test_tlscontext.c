@@ -0,0 +1,191 @@
+#include "testutils.h"
+#include "tlscontext.h"
+#include "apphook.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define MAX_HANDSHAKE_STEPS 100
+
+typedef struct
+{
+  gint client_fd;
+  gint server_fd;
+  TLSSession *client;
+  TLSSession *server;
+} TestConnection;
+
+static TLSContext *
+create_server_context(void)
+{
+  TLSContext *self = tls_context_new(TM_SERVER);
+
+  self->key_file = g_strdup(TLS_TEST_CERT_DIR "/ssl.key");
+  self->cert_file = g_strdup(TLS_TEST_CERT_DIR "/ssl.crt");
+  self->verify_mode = TVM_NONE;
+  return self;
+}
+
+static TLSContext *
+create_client_context(void)
+{
+  TLSContext *self = tls_context_new(TM_CLIENT);
+
+  self->verify_mode = TVM_NONE;
+  return self;
+}
+
+static void
+test_connection_open(TestConnection *conn, TLSContext *client_ctx, TLSContext *server_ctx, const gchar *resumption_key)
+{
+  gint fds[2];
+
+  assert_gint(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0, "socketpair() failed");
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(fds[1], F_SETFL, O_NONBLOCK);
+  conn->client_fd = fds[0];
+  conn->server_fd = fds[1];
+
+  conn->client = tls_context_setup_session(client_ctx);
+  conn->server = tls_context_setup_session(server_ctx);
+  assert_not_null(conn->client, "setting up the client session failed");
+  assert_not_null(conn->server, "setting up the server session failed");
+  tls_session_set_resumption_key(conn->client, resumption_key);
+}
+
+static void
+test_connection_close(TestConnection *conn)
+{
+  tls_session_free(conn->client);
+  if (conn->server)
+    tls_session_free(conn->server);
+  close(conn->client_fd);
+  if (conn->server_fd != -1)
+    close(conn->server_fd);
+}
+
+/* runs both sides of the handshake in turns, the socket pair is non-blocking */
+static gboolean
+test_connection_handshake(TestConnection *conn)
+{
+  TLSHandshakeStatus client_status = TLS_HANDSHAKE_WANT_WRITE;
+  TLSHandshakeStatus server_status = TLS_HANDSHAKE_WANT_READ;
+  gint i;
+
+  for (i = 0; i < MAX_HANDSHAKE_STEPS; i++)
+    {
+      if (client_status != TLS_HANDSHAKE_DONE)
+        client_status = tls_session_handshake(conn->client, conn->client_fd);
+      if (conn->server && server_status != TLS_HANDSHAKE_DONE)
+        server_status = tls_session_handshake(conn->server, conn->server_fd);
+
+      if (client_status == TLS_HANDSHAKE_ERROR || server_status == TLS_HANDSHAKE_ERROR)
+        return FALSE;
+      if (client_status == TLS_HANDSHAKE_DONE && server_status == TLS_HANDSHAKE_DONE)
+        return TRUE;
+    }
+  return FALSE;
+}
+
+static gboolean
+is_session_resumable(TLSContext *client_ctx, const gchar *resumption_key)
+{
+  gboolean result;
+
+  g_static_mutex_lock(&client_ctx->resumable_sessions_lock);
+  result = g_hash_table_lookup(client_ctx->resumable_sessions, resumption_key) != NULL;
+  g_static_mutex_unlock(&client_ctx->resumable_sessions_lock);
+  return result;
+}
+
+/* connects to the server and returns whether the session was resumed */
+static gboolean
+connect_to_server(TLSContext *client_ctx, TLSContext *server_ctx, const gchar *resumption_key)
+{
+  TestConnection conn;
+  gboolean resumed;
+
+  test_connection_open(&conn, client_ctx, server_ctx, resumption_key);
+  assert_true(test_connection_handshake(&conn), "handshake failed, destination=%s", resumption_key);
+  resumed = SSL_session_reused(conn.client->ssl);
+  assert_gboolean(SSL_session_reused(conn.server->ssl), resumed, "client and server disagree on resumption");
+  test_connection_close(&conn);
+  return resumed;
+}
+
+static void
+test_resumed_client_session(void)
+{
+  TLSContext *client_ctx = create_client_context();
+  TLSContext *server_ctx = create_server_context();
+
+  testcase_begin("Testing that a reconnecting client resumes its session");
+  assert_false(connect_to_server(client_ctx, server_ctx, "10.0.0.1:6514"), "the first connection was resumed");
+  assert_true(is_session_resumable(client_ctx, "10.0.0.1:6514"), "the negotiated session was not remembered");
+  assert_true(connect_to_server(client_ctx, server_ctx, "10.0.0.1:6514"), "the session was not resumed");
+  testcase_end();
+
+  tls_context_free(client_ctx);
+  tls_context_free(server_ctx);
+}
+
+static void
+test_sessions_are_keyed_by_destination(void)
+{
+  TLSContext *client_ctx = create_client_context();
+  TLSContext *server_ctx = create_server_context();
+
+  testcase_begin("Testing that sessions are only resumed for the same destination");
+  assert_false(connect_to_server(client_ctx, server_ctx, "10.0.0.1:6514"), "the first connection was resumed");
+  assert_false(connect_to_server(client_ctx, server_ctx, "10.0.0.2:6514"), "the session of another destination was resumed");
+  assert_gint(g_hash_table_size(client_ctx->resumable_sessions), 2, "number of remembered sessions mismatch");
+  assert_true(connect_to_server(client_ctx, server_ctx, "10.0.0.1:6514"), "the session was not resumed");
+  assert_true(connect_to_server(client_ctx, server_ctx, "10.0.0.2:6514"), "the session was not resumed");
+  testcase_end();
+
+  tls_context_free(client_ctx);
+  tls_context_free(server_ctx);
+}
+
+static void
+test_session_evicted_after_failed_handshake(void)
+{
+  TLSContext *client_ctx = create_client_context();
+  TLSContext *server_ctx = create_server_context();
+  TestConnection conn;
+
+  testcase_begin("Testing that a session is not offered again once resuming it failed");
+  connect_to_server(client_ctx, server_ctx, "10.0.0.1:6514");
+  assert_true(is_session_resumable(client_ctx, "10.0.0.1:6514"), "the negotiated session was not remembered");
+
+  /* the server goes away in the middle of the handshake */
+  test_connection_open(&conn, client_ctx, server_ctx, "10.0.0.1:6514");
+  tls_session_free(conn.server);
+  conn.server = NULL;
+  close(conn.server_fd);
+  conn.server_fd = -1;
+  assert_false(test_connection_handshake(&conn), "handshake succeeded without a server");
+  test_connection_close(&conn);
+
+  assert_false(is_session_resumable(client_ctx, "10.0.0.1:6514"), "the session was not evicted");
+  assert_false(connect_to_server(client_ctx, server_ctx, "10.0.0.1:6514"), "an evicted session was resumed");
+  assert_true(is_session_resumable(client_ctx, "10.0.0.1:6514"), "the new session was not remembered");
+  testcase_end();
+
+  tls_context_free(client_ctx);
+  tls_context_free(server_ctx);
+}
+
+int
+main(int argc G_GNUC_UNUSED, char *argv[] G_GNUC_UNUSED)
+{
+  app_startup();
+
+  test_resumed_client_session();
+  test_sessions_are_keyed_by_destination();
+  test_session_evicted_after_failed_handshake();
+
+  app_shutdown();
+  return 0;
+}